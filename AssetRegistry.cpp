@@ -0,0 +1,181 @@
+#include "AssetRegistry.hpp"
+#include "GeometryArena.hpp"
+#include "MappedFile.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+#ifndef _WIN32
+#include <climits>
+#endif
+
+namespace gps {
+
+    static uint64_t HashBytes(const unsigned char* data, size_t size)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < size; i++) {
+            hash ^= data[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    // FNV-1a over the file contents; files that cannot be read are told apart by their path instead
+    static uint64_t HashFileContents(const std::string& path)
+    {
+        MappedFile file;
+        if (!file.Open(path))
+            return HashBytes((const unsigned char*)path.data(), path.size());
+        return HashBytes(file.GetData(), file.GetSize());
+    }
+
+    AssetRegistry& AssetRegistry::Instance()
+    {
+        static AssetRegistry registry;
+        return registry;
+    }
+
+    // Absolute path with separators unified, so "objects/a/../b.png" and "objects/b.png" meet
+    std::string AssetRegistry::CanonicalPath(const std::string& path)
+    {
+        std::string canonical = path;
+#ifdef _WIN32
+        char resolved[_MAX_PATH];
+        if (_fullpath(resolved, path.c_str(), _MAX_PATH) != NULL)
+            canonical = resolved;
+        for (size_t i = 0; i < canonical.size(); i++) {
+            if (canonical[i] == '\\')
+                canonical[i] = '/';
+            else
+                canonical[i] = (char)tolower((unsigned char)canonical[i]);
+        }
+#else
+        char resolved[PATH_MAX];
+        if (realpath(path.c_str(), resolved) != NULL)
+            canonical = resolved;
+#endif
+        return canonical;
+    }
+
+    TextureHandle AssetRegistry::AcquireTexture(const std::string& path)
+    {
+        std::string canonical = CanonicalPath(path);
+
+        // the path lookup avoids touching the file at all for repeated requests
+        uint64_t contentHash;
+        std::unordered_map<std::string, uint64_t>::iterator knownPath = contentHashByPath.find(canonical);
+        if (knownPath != contentHashByPath.end()) {
+            contentHash = knownPath->second;
+        } else {
+            contentHash = HashFileContents(canonical);
+            contentHashByPath[canonical] = contentHash;
+        }
+
+        std::unordered_map<uint64_t, TextureEntry>::iterator found = texturesByContent.find(contentHash);
+        if (found != texturesByContent.end()) {
+            found->second.refCount++;
+            found->second.duplicateLoads++;
+            duplicateTextureLoads++;
+            return found->second.handle;
+        }
+
+        TextureEntry entry;
+        entry.handle = TextureLoader::Instance().Load(path);
+        entry.contentHash = contentHash;
+        entry.refCount = 1;
+        entry.duplicateLoads = 0;
+        texturesByContent[contentHash] = entry;
+        contentHashByHandle[entry.handle] = contentHash;
+        return entry.handle;
+    }
+
+    void AssetRegistry::ReleaseTexture(TextureHandle handle)
+    {
+        std::unordered_map<TextureHandle, uint64_t>::iterator byHandle = contentHashByHandle.find(handle);
+        if (byHandle == contentHashByHandle.end())
+            return;
+
+        TextureEntry& entry = texturesByContent[byHandle->second];
+        if (--entry.refCount > 0)
+            return;
+
+        releasedTextureBytesSaved += entry.duplicateLoads * TextureLoader::Instance().GetByteSize(handle);
+        TextureLoader::Instance().Release(handle);
+        texturesByContent.erase(byHandle->second);
+        contentHashByHandle.erase(byHandle);
+        // the path -> hash entries stay; they are only a shortcut and the file may be requested again
+    }
+
+    std::string AssetRegistry::MakeGeometryKey(const std::string& fileName, uint32_t optionsHash)
+    {
+        std::ostringstream key;
+        key << CanonicalPath(fileName) << "#" << optionsHash;
+        return key.str();
+    }
+
+    const SharedGeometry* AssetRegistry::AcquireGeometry(const std::string& key)
+    {
+        std::unordered_map<std::string, GeometryEntry>::iterator found = geometryByKey.find(key);
+        if (found == geometryByKey.end())
+            return NULL;
+
+        found->second.refCount++;
+        found->second.duplicateLoads++;
+        duplicateGeometryLoads++;
+        return &found->second.geometry;
+    }
+
+    const SharedGeometry* AssetRegistry::AddGeometry(const std::string& key, const SharedGeometry& geometry)
+    {
+        GeometryEntry& entry = geometryByKey[key];
+        entry.geometry = geometry;
+        entry.refCount = 1;
+        entry.duplicateLoads = 0;
+        return &entry.geometry;
+    }
+
+    void AssetRegistry::ReleaseGeometry(const std::string& key)
+    {
+        std::unordered_map<std::string, GeometryEntry>::iterator found = geometryByKey.find(key);
+        if (found == geometryByKey.end() || --found->second.refCount > 0)
+            return;
+
+        SharedGeometry& geometry = found->second.geometry;
+        releasedGeometryBytesSaved += found->second.duplicateLoads * geometry.bufferBytes;
+
+        // meshes grouped by material share their arena block, which goes only once
+        std::set<GeometryHandle> releasedBlocks;
+        for (size_t i = 0; i < geometry.meshes.size(); i++) {
+            GeometryHandle block = geometry.meshes.at(i).getGeometry();
+            if (releasedBlocks.insert(block).second)
+                GeometryArena::Instance().Release(block);
+            GLuint instanceBuffer = geometry.meshes.at(i).getInstanceBuffer();
+            if (instanceBuffer != 0)
+                glDeleteBuffers(1, &instanceBuffer);
+        }
+        for (size_t i = 0; i < geometry.textures.size(); i++)
+            ReleaseTexture(geometry.textures[i]);
+
+        geometryByKey.erase(found);
+    }
+
+    void AssetRegistry::PrintReport()
+    {
+        size_t textureBytesSaved = releasedTextureBytesSaved;
+        for (std::unordered_map<uint64_t, TextureEntry>::iterator it = texturesByContent.begin(); it != texturesByContent.end(); ++it)
+            textureBytesSaved += it->second.duplicateLoads * TextureLoader::Instance().GetByteSize(it->second.handle);
+
+        size_t geometryBytesSaved = releasedGeometryBytesSaved;
+        for (std::unordered_map<std::string, GeometryEntry>::iterator it = geometryByKey.begin(); it != geometryByKey.end(); ++it)
+            geometryBytesSaved += it->second.duplicateLoads * it->second.geometry.bufferBytes;
+
+        std::cout << "Asset registry : " << texturesByContent.size() << " textures, " << geometryByKey.size() << " models resident" << std::endl;
+        std::cout << "  textures : " << duplicateTextureLoads << " duplicate loads avoided, "
+            << textureBytesSaved << " bytes saved (textures still uploading count as 0)" << std::endl;
+        std::cout << "  geometry : " << duplicateGeometryLoads << " duplicate loads avoided, "
+            << geometryBytesSaved << " bytes saved" << std::endl;
+    }
+}
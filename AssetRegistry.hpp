@@ -0,0 +1,82 @@
+#ifndef AssetRegistry_hpp
+#define AssetRegistry_hpp
+
+#include "Mesh.hpp"
+#include "TextureLoader.hpp"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+    // GPU geometry of one imported model, shared by every Model3D that loads the same file with the same options
+    struct SharedGeometry
+    {
+        std::vector<gps::Mesh> meshes;
+        // textures acquired on behalf of the meshes, released with the geometry
+        std::vector<TextureHandle> textures;
+        size_t bufferBytes;
+    };
+
+    // Process-wide, reference-counted cache of textures and model geometry
+    class AssetRegistry
+    {
+    public:
+        static AssetRegistry& Instance();
+
+        // Returns the texture for the file, loading it only if neither its path nor its contents were seen before.
+        // A model acquires each path once, so every hit counts as a load avoided for another model or another path
+        TextureHandle AcquireTexture(const std::string& path);
+        void ReleaseTexture(TextureHandle handle);
+
+        // Key of a model file imported with the given options
+        std::string MakeGeometryKey(const std::string& fileName, uint32_t optionsHash);
+
+        // Shared geometry for the key with its count bumped, or NULL if it has not been loaded yet
+        const SharedGeometry* AcquireGeometry(const std::string& key);
+        // Registers freshly loaded geometry with one user
+        const SharedGeometry* AddGeometry(const std::string& key, const SharedGeometry& geometry);
+        // Drops one user; the buffers and textures are freed with the last one
+        void ReleaseGeometry(const std::string& key);
+
+        // Prints how many loads were avoided and how many bytes that saved
+        void PrintReport();
+
+    private:
+        struct TextureEntry
+        {
+            TextureHandle handle;
+            uint64_t contentHash;
+            int refCount;
+            size_t duplicateLoads;
+        };
+
+        struct GeometryEntry
+        {
+            SharedGeometry geometry;
+            int refCount;
+            size_t duplicateLoads;
+        };
+
+        std::unordered_map<std::string, uint64_t> contentHashByPath;
+        std::unordered_map<uint64_t, TextureEntry> texturesByContent;
+        std::unordered_map<TextureHandle, uint64_t> contentHashByHandle;
+        std::unordered_map<std::string, GeometryEntry> geometryByKey;
+
+        size_t duplicateTextureLoads = 0;
+        size_t duplicateGeometryLoads = 0;
+        // savings of entries that have already been freed
+        size_t releasedTextureBytesSaved = 0;
+        size_t releasedGeometryBytesSaved = 0;
+
+        AssetRegistry() {}
+        std::string CanonicalPath(const std::string& path);
+
+        AssetRegistry(const AssetRegistry&) = delete;
+        AssetRegistry& operator=(const AssetRegistry&) = delete;
+    };
+}
+
+#endif /* AssetRegistry_hpp */
@@ -0,0 +1,432 @@
+#include "Benchmark.hpp"
+#include "Frustum.hpp"
+#include "GeometryArena.hpp"
+#include "ImagePipeline.hpp"
+#include "ObjParser.hpp"
+#include "OcclusionCuller.hpp"
+#include "RenderStats.hpp"
+#include "ThreadPool.hpp"
+
+#include "glm/gtc/matrix_transform.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    static double SecondsSince(std::chrono::high_resolution_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // Writes a tessellated height field with positions, normals, texture coordinates and quads
+    // until the file reaches the requested size
+    static size_t WriteSyntheticObj(const std::string& fileName, size_t targetBytes)
+    {
+        std::ofstream out(fileName.c_str(), std::ios::binary | std::ios::trunc);
+        char line[160];
+        size_t written = 0;
+        const int gridSize = 64;
+        int tileIndex = 0;
+
+        while (written < targetBytes) {
+            int length = snprintf(line, sizeof(line), "o tile_%d\n", tileIndex);
+            out.write(line, length);
+            written += length;
+
+            for (int z = 0; z <= gridSize; z++) {
+                for (int x = 0; x <= gridSize; x++) {
+                    float height = 0.25f * (float)((x * 7 + z * 13 + tileIndex) % 17) / 17.0f;
+                    length = snprintf(line, sizeof(line), "v %.6f %.6f %.6f\nvn %.4f %.4f %.4f\nvt %.5f %.5f\n",
+                        tileIndex * 10.0f + x * 0.039f, height, z * 0.039f,
+                        0.0f, 1.0f, 0.0f,
+                        x / (float)gridSize, z / (float)gridSize);
+                    out.write(line, length);
+                    written += length;
+                }
+            }
+
+            // relative indices keep every tile self-contained
+            int vertexCount = (gridSize + 1) * (gridSize + 1);
+            for (int z = 0; z < gridSize; z++) {
+                for (int x = 0; x < gridSize; x++) {
+                    int a = z * (gridSize + 1) + x - vertexCount;
+                    int b = a + 1;
+                    int c = a + gridSize + 2;
+                    int d = a + gridSize + 1;
+                    length = snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n",
+                        a, a, a, b, b, b, c, c, c, d, d, d);
+                    out.write(line, length);
+                    written += length;
+                }
+            }
+            tileIndex++;
+        }
+        return written;
+    }
+
+    void RunObjParserBenchmark()
+    {
+        const size_t sizesInMB[] = {10, 100, 1024};
+        const double mb = 1024.0 * 1024.0;
+
+        std::cout << "OBJ parser throughput (MB/s)" << std::endl;
+        std::cout << "size(MB)\ttinyobj\tObjParser\tspeedup" << std::endl;
+
+        for (size_t i = 0; i < sizeof(sizesInMB) / sizeof(sizesInMB[0]); i++) {
+            std::string fileName = "bench_synthetic_" + std::to_string(sizesInMB[i]) + "MB.obj";
+            size_t bytes = WriteSyntheticObj(fileName, sizesInMB[i] * 1024 * 1024);
+
+            tinyobj::attrib_t attrib;
+            std::vector<tinyobj::shape_t> shapes;
+            std::vector<tinyobj::material_t> materials;
+            std::string err;
+
+            std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+            tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), NULL, true);
+            double tinyobjSeconds = SecondsSince(start);
+            size_t tinyobjVertexCount = attrib.vertices.size() / 3;
+
+            ObjParser parser;
+            start = std::chrono::high_resolution_clock::now();
+            parser.Load(&attrib, &shapes, &materials, &err, fileName, "");
+            double parserSeconds = SecondsSince(start);
+
+            if (attrib.vertices.size() / 3 != tinyobjVertexCount)
+                std::cout << "WARNING: parsers disagree on " << fileName << std::endl;
+
+            std::cout << bytes / mb << "\t" << bytes / mb / tinyobjSeconds << "\t" << bytes / mb / parserSeconds
+                << "\t" << tinyobjSeconds / parserSeconds << "x" << std::endl;
+
+            std::remove(fileName.c_str());
+        }
+    }
+
+    // The previous texture path: RGBA flip one byte at a time, then the 2x2 gamma-space box filter
+    // a software glGenerateMipmap runs, on one thread
+    static void LegacyFlipAndMips(std::vector<unsigned char>& rgba, int width, int height)
+    {
+        int widthInBytes = width * 4;
+        for (int row = 0; row < height / 2; row++) {
+            unsigned char* top = rgba.data() + row * widthInBytes;
+            unsigned char* bottom = rgba.data() + (height - row - 1) * widthInBytes;
+            for (int col = 0; col < widthInBytes; col++) {
+                unsigned char temp = *top;
+                *top++ = *bottom;
+                *bottom++ = temp;
+            }
+        }
+
+        std::vector<unsigned char> level = rgba;
+        while (width > 1 || height > 1) {
+            int halfWidth = width > 1 ? width / 2 : 1;
+            int halfHeight = height > 1 ? height / 2 : 1;
+            std::vector<unsigned char> half((size_t)halfWidth * halfHeight * 4);
+            for (int y = 0; y < halfHeight; y++) {
+                int y1 = 2 * y + 1 < height ? 2 * y + 1 : height - 1;
+                for (int x = 0; x < halfWidth; x++) {
+                    int x1 = 2 * x + 1 < width ? 2 * x + 1 : width - 1;
+                    for (int c = 0; c < 4; c++) {
+                        int sum = level[((size_t)2 * y * width + 2 * x) * 4 + c] + level[((size_t)2 * y * width + x1) * 4 + c]
+                            + level[((size_t)y1 * width + 2 * x) * 4 + c] + level[((size_t)y1 * width + x1) * 4 + c];
+                        half[((size_t)y * halfWidth + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+                    }
+                }
+            }
+            level.swap(half);
+            width = halfWidth;
+            height = halfHeight;
+        }
+    }
+
+    void RunImagePipelineBenchmark()
+    {
+        const int sizes[] = {256, 512, 1024, 2048, 4096};
+
+        std::cout << "Image preprocessing, flip + full mip chain (ms), kernels: " << ImagePipeline::GetSimdName() << std::endl;
+        std::cout << "size\tlegacy RGBA\tRGB box\tRGB kaiser\tspeedup (box)" << std::endl;
+
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            int size = sizes[i];
+            std::vector<unsigned char> rgba((size_t)size * size * 4);
+            std::vector<unsigned char> rgb((size_t)size * size * 3);
+            for (size_t p = 0; p < (size_t)size * size; p++) {
+                unsigned char value = (unsigned char)((p * 2654435761u) >> 24);
+                rgba[p * 4 + 0] = rgb[p * 3 + 0] = value;
+                rgba[p * 4 + 1] = rgb[p * 3 + 1] = (unsigned char)(value ^ 0x5A);
+                rgba[p * 4 + 2] = rgb[p * 3 + 2] = (unsigned char)(p % size);
+                rgba[p * 4 + 3] = 255;
+            }
+
+            std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+            LegacyFlipAndMips(rgba, size, size);
+            double legacySeconds = SecondsSince(start);
+
+            start = std::chrono::high_resolution_clock::now();
+            ImagePipeline::FlipRows(rgb.data(), size, size, 3);
+            std::vector<ImageLevel> boxLevels = ImagePipeline::BuildMipChain(rgb.data(), size, size, 3, true, MIP_FILTER_BOX);
+            double boxSeconds = SecondsSince(start);
+
+            start = std::chrono::high_resolution_clock::now();
+            ImagePipeline::FlipRows(rgb.data(), size, size, 3);
+            std::vector<ImageLevel> kaiserLevels = ImagePipeline::BuildMipChain(rgb.data(), size, size, 3, true, MIP_FILTER_KAISER);
+            double kaiserSeconds = SecondsSince(start);
+
+            std::cout << size << "x" << size << "\t" << legacySeconds * 1000.0 << "\t" << boxSeconds * 1000.0 << "\t"
+                << kaiserSeconds * 1000.0 << "\t" << legacySeconds / boxSeconds << "x" << std::endl;
+        }
+    }
+
+    // Box with every face split into subdivisions x subdivisions quads, counter-clockwise seen from outside
+    static void AppendBox(OccluderGeometry& geometry, const glm::vec3& boxMin, const glm::vec3& boxMax, int subdivisions)
+    {
+        glm::vec3 center = (boxMin + boxMax) * 0.5f;
+        glm::vec3 half = (boxMax - boxMin) * 0.5f;
+        for (int axis = 0; axis < 3; axis++) {
+            for (int side = -1; side <= 1; side += 2) {
+                glm::vec3 normal(0.0f), u(0.0f), v(0.0f);
+                normal[axis] = (float)side;
+                u[(axis + 1) % 3] = half[(axis + 1) % 3];
+                v[(axis + 2) % 3] = half[(axis + 2) % 3];
+                if (side < 0)
+                    std::swap(u, v);
+                uint32_t first = (uint32_t)geometry.positions.size();
+                for (int j = 0; j <= subdivisions; j++) {
+                    for (int i = 0; i <= subdivisions; i++) {
+                        float s = 2.0f * i / subdivisions - 1.0f;
+                        float t = 2.0f * j / subdivisions - 1.0f;
+                        geometry.positions.push_back(center + normal * half[axis] + u * s + v * t);
+                    }
+                }
+                for (int j = 0; j < subdivisions; j++) {
+                    for (int i = 0; i < subdivisions; i++) {
+                        uint32_t a = first + j * (subdivisions + 1) + i;
+                        uint32_t b = a + 1;
+                        uint32_t c = b + subdivisions + 1;
+                        uint32_t d = a + subdivisions + 1;
+                        uint32_t quad[6] = {a, b, c, a, c, d};
+                        geometry.indices.insert(geometry.indices.end(), quad, quad + 6);
+                    }
+                }
+            }
+        }
+    }
+
+    void RunOcclusionBenchmark()
+    {
+        const int frameCount = 200;
+        const int propCount = 4096;
+
+        // a house and two sheds among props scattered over a 100 x 100 park
+        OccluderGeometry occluders;
+        AppendBox(occluders, glm::vec3(-6.0f, 0.0f, -5.0f), glm::vec3(6.0f, 7.0f, 5.0f), 16);
+        AppendBox(occluders, glm::vec3(15.0f, 0.0f, -3.0f), glm::vec3(19.0f, 3.0f, 3.0f), 8);
+        AppendBox(occluders, glm::vec3(-20.0f, 0.0f, 10.0f), glm::vec3(-14.0f, 3.0f, 14.0f), 8);
+        std::vector<MeshBounds> props(propCount);
+        uint32_t seed = 12345u;
+        for (int i = 0; i < propCount; i++) {
+            glm::vec3 position;
+            for (int axis = 0; axis < 3; axis += 2) {
+                seed = seed * 1664525u + 1013904223u;
+                position[axis] = (float)(seed >> 8) / (float)(1u << 24) * 100.0f - 50.0f;
+            }
+            position.y = 0.0f;
+            props[i].boundsMin = position - glm::vec3(0.4f, 0.0f, 0.4f);
+            props[i].boundsMax = position + glm::vec3(0.4f, 1.5f, 0.4f);
+            props[i].sphereCenter = (props[i].boundsMin + props[i].boundsMax) * 0.5f;
+            props[i].sphereRadius = glm::length(props[i].boundsMax - props[i].sphereCenter);
+        }
+
+        OcclusionCuller occlusionCuller;
+        FrustumCuller frustumCuller;
+        frustumCuller.SetBounds(props);
+        std::vector<uint32_t> visible;
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1024.0f / 768.0f, 0.1f, 1000.0f);
+        glm::mat4 identity(1.0f);
+        double buildSeconds = 0.0;
+        double testSeconds = 0.0;
+        size_t inFrustum = 0;
+        size_t occluded = 0;
+
+        for (int frame = 0; frame < frameCount; frame++) {
+            // walk around the house at eye height, looking across it
+            float angle = 6.2831853f * frame / frameCount;
+            glm::vec3 eye(std::cos(angle) * 25.0f, 1.7f, std::sin(angle) * 25.0f);
+            glm::mat4 view = glm::lookAt(eye, glm::vec3(0.0f, 1.7f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+            std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+            occlusionCuller.BeginFrame(projection * view);
+            occlusionCuller.AddOccluder(occluders, identity);
+            occlusionCuller.Rasterize();
+            buildSeconds += SecondsSince(start);
+
+            frustumCuller.Cull(Frustum::FromMatrix(projection * view), visible);
+            start = std::chrono::high_resolution_clock::now();
+            for (size_t i = 0; i < visible.size(); i++) {
+                if (occlusionCuller.IsOccluded(props[visible[i]], identity))
+                    occluded++;
+            }
+            testSeconds += SecondsSince(start);
+            inFrustum += visible.size();
+        }
+
+        std::cout << "Occlusion culling, " << occlusionCuller.GetWidth() << "x" << occlusionCuller.GetHeight() << " buffer, "
+            << occluders.indices.size() / 3 << " occluder triangles, " << propCount << " props, kernels: "
+            << ImagePipeline::GetSimdName() << ", " << ThreadPool::Shared().GetThreadCount() << " workers" << std::endl;
+        std::cout << "per frame: build " << buildSeconds * 1000.0 / frameCount << " ms, test "
+            << testSeconds * 1000.0 / frameCount << " ms (" << testSeconds * 1e9 / (double)std::max(inFrustum, (size_t)1)
+            << " ns per box), " << (double)inFrustum / frameCount << " props in the frustum, "
+            << (double)occluded / frameCount << " occluded" << std::endl;
+    }
+
+    // Model matrices on a square grid around the origin, each turned a little so no two instances look the same
+    static std::vector<glm::mat4> MakeInstanceGrid(size_t count, float spacing)
+    {
+        std::vector<glm::mat4> models(count);
+        size_t side = (size_t)std::ceil(std::sqrt((double)count));
+        for (size_t i = 0; i < count; i++) {
+            glm::vec3 position(((float)(i % side) - side * 0.5f) * spacing, 0.0f, ((float)(i / side) - side * 0.5f) * spacing);
+            models[i] = glm::rotate(glm::translate(glm::mat4(1.0f), position), (float)(i % 360) * 0.0174533f,
+                glm::vec3(0.0f, 1.0f, 0.0f));
+        }
+        return models;
+    }
+
+    // CPU submit and GL_TIME_ELAPSED GPU time of one pass, in milliseconds
+    struct PassTimings
+    {
+        double cpuMilliseconds;
+        double gpuMilliseconds;
+    };
+
+    // Runs the baseline and then the candidate repeatCount times each, draining the GL queue before every pass, and
+    // averages their timings into `timings`. `report` runs untimed after the last pass of each, with 0 for the
+    // baseline; with a `speedupLabel` the GPU speedup of the candidate is printed last.
+    static void CompareWorkloads(const std::function<void()>& baseline, const std::function<void()>& candidate,
+        int repeatCount, const std::function<void(int, const PassTimings&)>& report, const char* speedupLabel,
+        PassTimings timings[2])
+    {
+        const std::function<void()>* workloads[] = {&baseline, &candidate};
+        GLuint timer;
+        glGenQueries(1, &timer);
+
+        for (int method = 0; method < 2; method++) {
+            timings[method].cpuMilliseconds = 0.0;
+            timings[method].gpuMilliseconds = 0.0;
+            for (int repeat = 0; repeat < repeatCount; repeat++) {
+                // nothing from the previous pass may still be queued
+                glFinish();
+                std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+                glBeginQuery(GL_TIME_ELAPSED, timer);
+                (*workloads[method])();
+                glEndQuery(GL_TIME_ELAPSED);
+                timings[method].cpuMilliseconds += SecondsSince(start) * 1000.0;
+
+                GLuint64 gpuNanoseconds = 0;
+                glGetQueryObjectui64v(timer, GL_QUERY_RESULT, &gpuNanoseconds);
+                timings[method].gpuMilliseconds += gpuNanoseconds / 1e6;
+            }
+            timings[method].cpuMilliseconds /= repeatCount;
+            timings[method].gpuMilliseconds /= repeatCount;
+            if (report)
+                report(method, timings[method]);
+        }
+
+        if (speedupLabel)
+            std::cout << "GPU speedup with " << speedupLabel << ": "
+                << timings[0].gpuMilliseconds / std::max(timings[1].gpuMilliseconds, 1e-6) << "x" << std::endl;
+        glDeleteQueries(1, &timer);
+    }
+
+    void RunInstancingBenchmark(Model3D& model, Shader loopShader, Shader instancedShader, UniformBuffers& uniformBuffers,
+        const glm::mat4& view)
+    {
+        const size_t counts[] = {1, 100, 10000, 100000};
+        const int repeatCount = 5;
+
+        std::cout << "Draw loop against DrawInstanced (ms per pass, CPU submit / GPU), " << repeatCount << " passes each" << std::endl;
+        std::cout << "instances\tloop CPU\tloop GPU\tinstanced CPU\tinstanced GPU\tspeedup" << std::endl;
+
+        for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+            std::vector<glm::mat4> models = MakeInstanceGrid(counts[c], 2.0f);
+            PassTimings timings[2];
+            CompareWorkloads([&]() {
+                for (size_t i = 0; i < models.size(); i++) {
+                    uniformBuffers.PushObject(ObjectUniforms::Make(models[i], view));
+                    model.Draw(loopShader);
+                }
+            }, [&]() {
+                uniformBuffers.PushObject(ObjectUniforms::Make(glm::mat4(1.0f), view));
+                model.DrawInstanced(instancedShader, models);
+            }, repeatCount, nullptr, nullptr, timings);
+
+            // a pass costs whichever of the two sides it is bound by
+            double loopMilliseconds = std::max(timings[0].cpuMilliseconds, timings[0].gpuMilliseconds);
+            double instancedMilliseconds = std::max(timings[1].cpuMilliseconds, timings[1].gpuMilliseconds);
+            std::cout << counts[c] << "\t" << timings[0].cpuMilliseconds << "\t" << timings[0].gpuMilliseconds << "\t"
+                << timings[1].cpuMilliseconds << "\t" << timings[1].gpuMilliseconds << "\t"
+                << loopMilliseconds / std::max(instancedMilliseconds, 1e-6) << "x" << std::endl;
+        }
+    }
+
+    void RunDepthPassBenchmark(const std::function<void()>& depthPass)
+    {
+        const int repeatCount = 20;
+        const char* labels[] = {"full vertices", "position stream"};
+        GeometryArena& arena = GeometryArena::Instance();
+        bool wasUsing = arena.IsUsingPositionStreams();
+
+        std::cout << "Depth pass without and with the position-only streams (per pass), " << repeatCount << " passes each" << std::endl;
+        std::cout << "vertices\tCPU ms\tGPU ms\tvertex KB\tdraws\tposition-only draws" << std::endl;
+
+        // each pass gets a frame of the stats to itself
+        PassTimings timings[2];
+        CompareWorkloads([&]() {
+            arena.UsePositionStreams(false);
+            RenderStats::Instance().BeginFrame();
+            depthPass();
+        }, [&]() {
+            arena.UsePositionStreams(true);
+            RenderStats::Instance().BeginFrame();
+            depthPass();
+        }, repeatCount, [&](int method, const PassTimings& passTimings) {
+            RenderStats::Instance().BeginFrame();
+            const FrameStats& stats = RenderStats::Instance().GetLastFrame();
+            std::cout << labels[method] << "\t" << passTimings.cpuMilliseconds << "\t" << passTimings.gpuMilliseconds << "\t"
+                << stats.vertexBytes / 1024.0 << "\t" << stats.drawCalls << "\t" << stats.positionOnlyDraws << std::endl;
+        }, "the position streams", timings);
+        arena.UsePositionStreams(wasUsing);
+    }
+
+    void RunDepthPrepassBenchmark(RenderQueue& queue, const Shader& depthShader, const std::function<void()>& frame)
+    {
+        const int repeatCount = 20;
+        const char* labels[] = {"shading only", "depth pre-pass"};
+        bool wasEnabled = queue.IsDepthPrepassEnabled();
+
+        std::cout << "Frames without and with the depth pre-pass (per frame), " << repeatCount << " frames each" << std::endl;
+        std::cout << "mode\tCPU ms\tGPU ms\tdraws\ttriangles" << std::endl;
+
+        PassTimings timings[2];
+        CompareWorkloads([&]() {
+            queue.SetDepthPrepass(false, depthShader);
+            frame();
+        }, [&]() {
+            queue.SetDepthPrepass(true, depthShader);
+            frame();
+        }, repeatCount, [&](int method, const PassTimings& passTimings) {
+            // the frame opens a new stats frame itself, so the last one is still being counted
+            RenderStats::Instance().BeginFrame();
+            const FrameStats& stats = RenderStats::Instance().GetLastFrame();
+            std::cout << labels[method] << "\t" << passTimings.cpuMilliseconds << "\t" << passTimings.gpuMilliseconds << "\t"
+                << stats.drawCalls << "\t" << stats.triangles << std::endl;
+        }, "the depth pre-pass", timings);
+        queue.SetDepthPrepass(wasEnabled, depthShader);
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef Benchmark_hpp
+#define Benchmark_hpp
+
+#include "Model3D.hpp"
+#include "RenderQueue.hpp"
+#include "UniformBuffers.hpp"
+
+#include <functional>
+
+namespace gps {
+
+    // Offline measurements, started from the command line (see main)
+
+    // --bench-obj: ObjParser against tinyobj::LoadObj on synthetic .obj files from 10 MB to 1 GB
+    void RunObjParserBenchmark();
+
+    // --bench-image: ImagePipeline flip and mip chain against the old byte-swap flip and gamma-space box filter
+    void RunImagePipelineBenchmark();
+
+    // --bench-occlusion: OcclusionCuller build and test times on a synthetic park, a house and ground among props
+    void RunOcclusionBenchmark();
+
+    // --bench-instancing, or the B key: needs the GL context and a loaded model. Draws the model 1, 100, 10k and 100k
+    // times as a loop of Draw calls with one ObjectUniforms slot each, then as one DrawInstanced, and reports the CPU
+    // submit and GPU times of both
+    void RunInstancingBenchmark(Model3D& model, Shader loopShader, Shader instancedShader, UniformBuffers& uniformBuffers,
+        const glm::mat4& view);
+
+    // --bench-depth, or the V key: needs the GL context and the loaded scene. Runs the depth pass without the
+    // GeometryArena's position-only streams and then with them, and reports its CPU submit and GPU times and the
+    // vertex bytes its draws fetched
+    void RunDepthPassBenchmark(const std::function<void()>& depthPass);
+
+    // --bench-prepass, or the T key: needs the GL context and the loaded scene. Renders whole frames through the queue
+    // without and then with its depth pre-pass and reports their CPU submit and GPU times
+    void RunDepthPrepassBenchmark(RenderQueue& queue, const Shader& depthShader, const std::function<void()>& frame);
+}
+
+#endif /* Benchmark_hpp */
@@ -19,6 +19,10 @@ namespace gps {
         return glm::lookAt(cameraPosition, cameraTarget, cameraUpDirection);
     }
 
+    Frustum Camera::getFrustum(const glm::mat4& projection) {
+        return Frustum::FromMatrix(projection * getViewMatrix());
+    }
+
     //update the camera internal parameters following a camera move event
     void Camera::move(MOVE_DIRECTION direction, float speed) {
 		if (direction == MOVE_FORWARD) {
@@ -4,6 +4,8 @@
 #include "glm/glm.hpp"
 #include "glm/gtx/transform.hpp"
 
+#include "Frustum.hpp"
+
 #include <string>
 
 namespace gps {
@@ -18,6 +20,8 @@ namespace gps {
         Camera(glm::vec3 cameraPosition, glm::vec3 cameraTarget, glm::vec3 cameraUp);
         //return the view matrix, using the glm::lookAt() function
         glm::mat4 getViewMatrix();
+        //return the world-space view frustum for the given projection matrix
+        Frustum getFrustum(const glm::mat4& projection);
         //update the camera internal parameters following a camera move event
         void move(MOVE_DIRECTION direction, float speed);
         //update the camera internal parameters following a camera rotate event
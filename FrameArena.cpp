@@ -0,0 +1,63 @@
+#include "FrameArena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace gps {
+
+    FrameArena::FrameArena(size_t blockBytes) : blockBytes(blockBytes)
+    {
+    }
+
+    void FrameArena::AddBlock(size_t bytes)
+    {
+        if (!blocks.empty())
+            spilledBytes += offset;
+        Block block;
+        block.memory.reset(new unsigned char[bytes]);
+        block.size = bytes;
+        blocks.push_back(std::move(block));
+        offset = 0;
+    }
+
+    void* FrameArena::Allocate(size_t bytes, size_t alignment)
+    {
+        if (!blocks.empty()) {
+            Block& block = blocks.back();
+            uintptr_t base = (uintptr_t)block.memory.get();
+            size_t aligned = (size_t)(((base + offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base);
+            if (aligned + bytes <= block.size) {
+                offset = aligned + bytes;
+                return block.memory.get() + aligned;
+            }
+        }
+
+        // a new block at least as large as the request, with room to align it
+        AddBlock(std::max(blockBytes, bytes + alignment));
+        return Allocate(bytes, alignment);
+    }
+
+    void FrameArena::Reset()
+    {
+        if (blocks.size() > 1) {
+            size_t total = GetCapacity();
+            blocks.clear();
+            AddBlock(total);
+        }
+        offset = 0;
+        spilledBytes = 0;
+    }
+
+    size_t FrameArena::GetUsedBytes() const
+    {
+        return spilledBytes + offset;
+    }
+
+    size_t FrameArena::GetCapacity() const
+    {
+        size_t total = 0;
+        for (size_t i = 0; i < blocks.size(); i++)
+            total += blocks[i].size;
+        return total;
+    }
+}
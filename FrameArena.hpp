@@ -0,0 +1,53 @@
+#ifndef FrameArena_hpp
+#define FrameArena_hpp
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace gps {
+
+    // Linear allocator for data that lives for one frame. Allocations bump a pointer and are all released by Reset;
+    // once the arena has grown to what a frame needs, later frames make no heap allocations.
+    class FrameArena
+    {
+    public:
+        explicit FrameArena(size_t blockBytes = 64 * 1024);
+
+        void* Allocate(size_t bytes, size_t alignment);
+
+        // Copies the value into the arena; nothing is ever destroyed, hence the trivial types only
+        template <typename T>
+        T* Create(const T& value)
+        {
+            static_assert(std::is_trivially_destructible<T>::value, "FrameArena never runs destructors");
+            return new (Allocate(sizeof(T), alignof(T))) T(value);
+        }
+
+        // Releases every allocation; a frame that spilled into several blocks leaves one block holding them all
+        void Reset();
+
+        size_t GetUsedBytes() const;
+        size_t GetCapacity() const;
+
+    private:
+        struct Block
+        {
+            std::unique_ptr<unsigned char[]> memory;
+            size_t size;
+        };
+
+        size_t blockBytes;
+        std::vector<Block> blocks;
+        // bytes taken from the last block
+        size_t offset = 0;
+        // bytes taken from the blocks before it
+        size_t spilledBytes = 0;
+
+        void AddBlock(size_t bytes);
+    };
+}
+
+#endif /* FrameArena_hpp */
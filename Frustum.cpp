@@ -0,0 +1,226 @@
+#include "Frustum.hpp"
+#include "Simd.hpp"
+
+#include <cmath>
+
+namespace gps {
+
+    // Kernel results besides the index of the rejecting plane
+    static const int8_t SPHERE_INSIDE = -1;
+    static const int8_t SPHERE_STRADDLES = 6;
+
+    static glm::vec4 NormalizePlane(const glm::vec4& plane)
+    {
+        float length = glm::length(glm::vec3(plane));
+        return length > 0.0f ? plane / length : plane;
+    }
+
+    Frustum Frustum::FromMatrix(const glm::mat4& matrix)
+    {
+        // glm is column-major: matrix[c][r]
+        glm::vec4 row0(matrix[0][0], matrix[1][0], matrix[2][0], matrix[3][0]);
+        glm::vec4 row1(matrix[0][1], matrix[1][1], matrix[2][1], matrix[3][1]);
+        glm::vec4 row2(matrix[0][2], matrix[1][2], matrix[2][2], matrix[3][2]);
+        glm::vec4 row3(matrix[0][3], matrix[1][3], matrix[2][3], matrix[3][3]);
+
+        Frustum frustum;
+        frustum.planes[0] = NormalizePlane(row3 + row0);
+        frustum.planes[1] = NormalizePlane(row3 - row0);
+        frustum.planes[2] = NormalizePlane(row3 + row1);
+        frustum.planes[3] = NormalizePlane(row3 - row1);
+        frustum.planes[4] = NormalizePlane(row3 + row2);
+        frustum.planes[5] = NormalizePlane(row3 - row2);
+        return frustum;
+    }
+
+    Frustum Frustum::ToObjectSpace(const glm::mat4& modelMatrix) const
+    {
+        // dot(plane, M * p) == dot(transpose(M) * plane, p); renormalized so distances are in object units
+        glm::mat4 transposed = glm::transpose(modelMatrix);
+        Frustum frustum;
+        for (int i = 0; i < 6; i++)
+            frustum.planes[i] = NormalizePlane(transposed * planes[i]);
+        return frustum;
+    }
+
+    void FrustumCuller::SetBounds(const std::vector<MeshBounds>& bounds)
+    {
+        size_t count = bounds.size();
+        centerX.resize(count);
+        centerY.resize(count);
+        centerZ.resize(count);
+        radius.resize(count);
+        boxCenters.resize(count);
+        boxExtents.resize(count);
+        rejectingPlane.assign(count, SPHERE_INSIDE);
+
+        for (size_t i = 0; i < count; i++) {
+            centerX[i] = bounds[i].sphereCenter.x;
+            centerY[i] = bounds[i].sphereCenter.y;
+            centerZ[i] = bounds[i].sphereCenter.z;
+            radius[i] = bounds[i].sphereRadius;
+            boxCenters[i] = (bounds[i].boundsMin + bounds[i].boundsMax) * 0.5f;
+            boxExtents[i] = (bounds[i].boundsMax - bounds[i].boundsMin) * 0.5f;
+        }
+
+        candidates.reserve(count);
+        candidateX.reserve(count);
+        candidateY.reserve(count);
+        candidateZ.reserve(count);
+        candidateRadius.reserve(count);
+        candidateResult.reserve(count);
+    }
+
+    size_t FrustumCuller::GetCount() const
+    {
+        return radius.size();
+    }
+
+    // Tests spheres [first, count) one at a time
+    static void TestSpheresScalar(const Frustum& frustum, const float* x, const float* y, const float* z, const float* r,
+        int8_t* result, size_t first, size_t count)
+    {
+        for (size_t i = first; i < count; i++) {
+            int8_t sphereResult = SPHERE_INSIDE;
+            for (int p = 0; p < 6; p++) {
+                const glm::vec4& plane = frustum.planes[p];
+                float distance = plane.x * x[i] + plane.y * y[i] + plane.z * z[i] + plane.w;
+                if (distance < -r[i]) {
+                    sphereResult = (int8_t)p;
+                    break;
+                }
+                if (distance < r[i])
+                    sphereResult = SPHERE_STRADDLES;
+            }
+            result[i] = sphereResult;
+        }
+    }
+
+    // Per-lane result from the masks of the lanes outside each plane and of the lanes crossing any plane
+    static void ResolveLanes(const int* outsideMasks, int straddleMask, int8_t* result, int laneCount)
+    {
+        for (int lane = 0; lane < laneCount; lane++) {
+            int8_t laneResult = (straddleMask >> lane) & 1 ? SPHERE_STRADDLES : SPHERE_INSIDE;
+            for (int p = 0; p < 6; p++) {
+                if ((outsideMasks[p] >> lane) & 1) {
+                    laneResult = (int8_t)p;
+                    break;
+                }
+            }
+            result[lane] = laneResult;
+        }
+    }
+
+    static void TestSpheres(const Frustum& frustum, const float* x, const float* y, const float* z, const float* r,
+        int8_t* result, size_t count)
+    {
+        size_t i = 0;
+        int outsideMasks[6];
+#if defined(GPS_SIMD_AVX2)
+        for (; i + 8 <= count; i += 8) {
+            __m256 cx = _mm256_loadu_ps(x + i);
+            __m256 cy = _mm256_loadu_ps(y + i);
+            __m256 cz = _mm256_loadu_ps(z + i);
+            __m256 radii = _mm256_loadu_ps(r + i);
+            __m256 negativeRadii = _mm256_sub_ps(_mm256_setzero_ps(), radii);
+            int straddleMask = 0;
+            int anyOutside = 0;
+            for (int p = 0; p < 6; p++) {
+                const glm::vec4& plane = frustum.planes[p];
+                __m256 distance = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(plane.x)), _mm256_mul_ps(cy, _mm256_set1_ps(plane.y))),
+                    _mm256_add_ps(_mm256_mul_ps(cz, _mm256_set1_ps(plane.z)), _mm256_set1_ps(plane.w)));
+                outsideMasks[p] = _mm256_movemask_ps(_mm256_cmp_ps(distance, negativeRadii, _CMP_LT_OQ));
+                straddleMask |= _mm256_movemask_ps(_mm256_cmp_ps(distance, radii, _CMP_LT_OQ));
+                anyOutside |= outsideMasks[p];
+            }
+            if (!(anyOutside | straddleMask)) {
+                for (int lane = 0; lane < 8; lane++)
+                    result[i + lane] = SPHERE_INSIDE;
+                continue;
+            }
+            ResolveLanes(outsideMasks, straddleMask, result + i, 8);
+        }
+#endif
+#if defined(GPS_SIMD_AVX2) || defined(GPS_SIMD_SSE2)
+        for (; i + 4 <= count; i += 4) {
+            __m128 cx = _mm_loadu_ps(x + i);
+            __m128 cy = _mm_loadu_ps(y + i);
+            __m128 cz = _mm_loadu_ps(z + i);
+            __m128 radii = _mm_loadu_ps(r + i);
+            __m128 negativeRadii = _mm_sub_ps(_mm_setzero_ps(), radii);
+            int straddleMask = 0;
+            for (int p = 0; p < 6; p++) {
+                const glm::vec4& plane = frustum.planes[p];
+                __m128 distance = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_mul_ps(cy, _mm_set1_ps(plane.y))),
+                    _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+                outsideMasks[p] = _mm_movemask_ps(_mm_cmplt_ps(distance, negativeRadii));
+                straddleMask |= _mm_movemask_ps(_mm_cmplt_ps(distance, radii));
+            }
+            ResolveLanes(outsideMasks, straddleMask, result + i, 4);
+        }
+#endif
+        (void)outsideMasks;
+        TestSpheresScalar(frustum, x, y, z, r, result, i, count);
+    }
+
+    bool FrustumCuller::BoxOutside(uint32_t index, const Frustum& frustum)
+    {
+        const glm::vec3& center = boxCenters[index];
+        const glm::vec3& extent = boxExtents[index];
+        for (int p = 0; p < 6; p++) {
+            const glm::vec4& plane = frustum.planes[p];
+            float distance = glm::dot(glm::vec3(plane), center) + plane.w;
+            float reach = extent.x * std::fabs(plane.x) + extent.y * std::fabs(plane.y) + extent.z * std::fabs(plane.z);
+            if (distance + reach < 0.0f) {
+                rejectingPlane[index] = (int8_t)p;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void FrustumCuller::Cull(const Frustum& frustum, std::vector<uint32_t>& visible)
+    {
+        visible.clear();
+        candidates.clear();
+        candidateX.clear();
+        candidateY.clear();
+        candidateZ.clear();
+        candidateRadius.clear();
+
+        // whatever was culled last frame is most likely still behind the same plane
+        size_t count = GetCount();
+        for (size_t i = 0; i < count; i++) {
+            int8_t plane = rejectingPlane[i];
+            if (plane >= 0) {
+                const glm::vec4& p = frustum.planes[plane];
+                if (p.x * centerX[i] + p.y * centerY[i] + p.z * centerZ[i] + p.w < -radius[i])
+                    continue;
+            }
+            candidates.push_back((uint32_t)i);
+            candidateX.push_back(centerX[i]);
+            candidateY.push_back(centerY[i]);
+            candidateZ.push_back(centerZ[i]);
+            candidateRadius.push_back(radius[i]);
+        }
+
+        candidateResult.resize(candidates.size());
+        TestSpheres(frustum, candidateX.data(), candidateY.data(), candidateZ.data(), candidateRadius.data(),
+            candidateResult.data(), candidates.size());
+
+        for (size_t c = 0; c < candidates.size(); c++) {
+            uint32_t index = candidates[c];
+            int8_t result = candidateResult[c];
+            if (result >= 0 && result < SPHERE_STRADDLES) {
+                rejectingPlane[index] = result;
+                continue;
+            }
+            if (result == SPHERE_STRADDLES && BoxOutside(index, frustum))
+                continue;
+            rejectingPlane[index] = SPHERE_INSIDE;
+            visible.push_back(index);
+        }
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef Frustum_hpp
+#define Frustum_hpp
+
+#include "glm/glm.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    // Object-space bounds of a mesh, computed at load
+    struct MeshBounds
+    {
+        glm::vec3 boundsMin = glm::vec3(0.0f);
+        glm::vec3 boundsMax = glm::vec3(0.0f);
+        glm::vec3 sphereCenter = glm::vec3(0.0f);
+        float sphereRadius = 0.0f;
+    };
+
+    // Left, right, bottom, top, near and far planes with unit normals pointing inside:
+    // a point p is inside when dot(plane.xyz, p) + plane.w >= 0 for every plane
+    struct Frustum
+    {
+        glm::vec4 planes[6];
+
+        // Planes of a view-projection matrix (Gribb and Hartmann), in the space the matrix maps from
+        static Frustum FromMatrix(const glm::mat4& matrix);
+
+        // The same frustum in the object space of a model matrix, so object-space bounds can be tested directly
+        Frustum ToObjectSpace(const glm::mat4& modelMatrix) const;
+    };
+
+    // Culls a fixed set of bounds against a frustum, four (SSE2) or eight (AVX2) spheres at a time.
+    // Bounds that were culled last frame are first re-tested against the plane that culled them, which usually
+    // still does; only the rest go through the full sphere test, and spheres that straddle a plane get an
+    // exact box test.
+    class FrustumCuller
+    {
+    public:
+        void SetBounds(const std::vector<MeshBounds>& bounds);
+        size_t GetCount() const;
+
+        // Indices of the bounds inside or intersecting the frustum, ascending; the frustum must be in the space
+        // of the bounds
+        void Cull(const Frustum& frustum, std::vector<uint32_t>& visible);
+
+    private:
+        // spheres, structure of arrays
+        std::vector<float> centerX;
+        std::vector<float> centerY;
+        std::vector<float> centerZ;
+        std::vector<float> radius;
+        // boxes as center and half extent
+        std::vector<glm::vec3> boxCenters;
+        std::vector<glm::vec3> boxExtents;
+        // plane that culled each bound last frame, -1 if it was visible
+        std::vector<int8_t> rejectingPlane;
+
+        // gathered spheres of the current full test
+        std::vector<uint32_t> candidates;
+        std::vector<float> candidateX;
+        std::vector<float> candidateY;
+        std::vector<float> candidateZ;
+        std::vector<float> candidateRadius;
+        std::vector<int8_t> candidateResult;
+
+        bool BoxOutside(uint32_t index, const Frustum& frustum);
+    };
+}
+
+#endif /* Frustum_hpp */
@@ -0,0 +1,177 @@
+#include "GLState.hpp"
+#include "RenderStats.hpp"
+
+namespace gps {
+
+    GLState& GLState::Instance()
+    {
+        static GLState instance;
+        return instance;
+    }
+
+    bool GLState::Changed(bool changed)
+    {
+        RenderStats::Instance().AddStateChange(changed);
+        return changed;
+    }
+
+    int GLState::GetCapabilityIndex(GLenum capability)
+    {
+        switch (capability) {
+        case GL_BLEND: return CAPABILITY_BLEND;
+        case GL_DEPTH_TEST: return CAPABILITY_DEPTH_TEST;
+        case GL_CULL_FACE: return CAPABILITY_CULL_FACE;
+        default: return -1;
+        }
+    }
+
+    int GLState::GetTargetIndex(GLenum target)
+    {
+        switch (target) {
+        case GL_TEXTURE_2D: return 0;
+        case GL_TEXTURE_CUBE_MAP: return 1;
+        case GL_TEXTURE_2D_ARRAY: return 2;
+        default: return -1;
+        }
+    }
+
+    void GLState::UseProgram(GLuint program)
+    {
+        if (Changed(this->program != program)) {
+            glUseProgram(program);
+            this->program = program;
+        }
+    }
+
+    void GLState::BindVertexArray(GLuint vertexArray)
+    {
+        if (Changed(this->vertexArray != vertexArray)) {
+            RenderStats::Instance().AddVertexArrayBind();
+            glBindVertexArray(vertexArray);
+            this->vertexArray = vertexArray;
+        }
+    }
+
+    void GLState::BindTexture(GLuint unit, GLenum target, GLuint texture)
+    {
+        int targetIndex = GetTargetIndex(target);
+        bool tracked = unit < TRACKED_TEXTURE_UNITS && targetIndex >= 0;
+        if (!Changed(!tracked || textures[unit][targetIndex] != texture))
+            return;
+
+        // part of the bind that was already counted, so the unit switch is not a request of its own
+        if (activeUnit != unit) {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            activeUnit = unit;
+        }
+        glBindTexture(target, texture);
+        if (tracked)
+            textures[unit][targetIndex] = texture;
+    }
+
+    void GLState::UnbindTextures(GLenum target, GLuint firstUnit, GLuint endUnit)
+    {
+        for (GLuint unit = firstUnit; unit < endUnit; unit++)
+            BindTexture(unit, target, 0);
+    }
+
+    void GLState::SetEnabled(GLenum capability, bool enabled)
+    {
+        int index = GetCapabilityIndex(capability);
+        if (!Changed(index < 0 || capabilities[index] != enabled))
+            return;
+
+        if (enabled)
+            glEnable(capability);
+        else
+            glDisable(capability);
+        if (index >= 0)
+            capabilities[index] = enabled;
+    }
+
+    bool GLState::IsEnabled(GLenum capability) const
+    {
+        int index = GetCapabilityIndex(capability);
+        return index >= 0 ? capabilities[index] : glIsEnabled(capability) == GL_TRUE;
+    }
+
+    void GLState::DepthFunc(GLenum function)
+    {
+        if (Changed(depthFunction != function)) {
+            glDepthFunc(function);
+            depthFunction = function;
+        }
+    }
+
+    void GLState::DepthMask(bool write)
+    {
+        if (Changed(depthWrite != write)) {
+            glDepthMask(write ? GL_TRUE : GL_FALSE);
+            depthWrite = write;
+        }
+    }
+
+    void GLState::ColorMask(bool write)
+    {
+        if (Changed(colorWrite != write)) {
+            GLboolean mask = write ? GL_TRUE : GL_FALSE;
+            glColorMask(mask, mask, mask, mask);
+            colorWrite = write;
+        }
+    }
+
+    bool GLState::IsDepthWriteEnabled() const
+    {
+        return depthWrite;
+    }
+
+    bool GLState::IsColorWriteEnabled() const
+    {
+        return colorWrite;
+    }
+
+    void GLState::CullFace(GLenum face)
+    {
+        if (Changed(cullFace != face)) {
+            glCullFace(face);
+            cullFace = face;
+        }
+    }
+
+    void GLState::BlendFunc(GLenum source, GLenum destination)
+    {
+        if (Changed(blendSource != source || blendDestination != destination)) {
+            glBlendFunc(source, destination);
+            blendSource = source;
+            blendDestination = destination;
+        }
+    }
+
+    void GLState::PolygonMode(GLenum mode)
+    {
+        if (Changed(polygonMode != mode)) {
+            glPolygonMode(GL_FRONT_AND_BACK, mode);
+            polygonMode = mode;
+        }
+    }
+
+    void GLState::DeleteTexture(GLuint texture)
+    {
+        if (texture == 0)
+            return;
+        glDeleteTextures(1, &texture);
+        for (GLuint unit = 0; unit < TRACKED_TEXTURE_UNITS; unit++)
+            for (int target = 0; target < 3; target++)
+                if (textures[unit][target] == texture)
+                    textures[unit][target] = 0;
+    }
+
+    void GLState::DeleteVertexArray(GLuint vertexArray)
+    {
+        if (vertexArray == 0)
+            return;
+        glDeleteVertexArrays(1, &vertexArray);
+        if (this->vertexArray == vertexArray)
+            this->vertexArray = 0;
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef GLState_hpp
+#define GLState_hpp
+
+#include <GL/glew.h>
+
+namespace gps {
+
+    // Shadow copy of the GL state the renderer changes between draws. Every bind and state change goes through it,
+    // and a request matching what is already current never reaches the driver. The cache starts from the GL
+    // defaults, so code that bypasses it must not touch the state it tracks.
+    class GLState
+    {
+    public:
+        // Texture units with their bindings tracked; binds to higher units always go through
+        static const GLuint TRACKED_TEXTURE_UNITS = 16;
+
+        static GLState& Instance();
+
+        void UseProgram(GLuint program);
+        void BindVertexArray(GLuint vertexArray);
+        // GL_TEXTURE_2D, GL_TEXTURE_CUBE_MAP and GL_TEXTURE_2D_ARRAY are tracked per unit
+        void BindTexture(GLuint unit, GLenum target, GLuint texture);
+        // Binds no texture to the units [firstUnit, endUnit) that still hold one
+        void UnbindTextures(GLenum target, GLuint firstUnit, GLuint endUnit);
+
+        // GL_BLEND, GL_DEPTH_TEST and GL_CULL_FACE are tracked, any other capability goes through
+        void SetEnabled(GLenum capability, bool enabled);
+        bool IsEnabled(GLenum capability) const;
+        void DepthFunc(GLenum function);
+        void DepthMask(bool write);
+        void ColorMask(bool write);
+        bool IsDepthWriteEnabled() const;
+        bool IsColorWriteEnabled() const;
+        void CullFace(GLenum face);
+        void BlendFunc(GLenum source, GLenum destination);
+        // Core profiles only accept GL_FRONT_AND_BACK
+        void PolygonMode(GLenum mode);
+
+        // Deleting a bound object resets its binding, so deletes go through here as well
+        void DeleteTexture(GLuint texture);
+        void DeleteVertexArray(GLuint vertexArray);
+
+    private:
+        enum CAPABILITY {CAPABILITY_BLEND, CAPABILITY_DEPTH_TEST, CAPABILITY_CULL_FACE, CAPABILITY_COUNT};
+
+        GLuint program = 0;
+        GLuint vertexArray = 0;
+        GLuint activeUnit = 0;
+        // [unit][0] is the GL_TEXTURE_2D binding, [unit][1] the GL_TEXTURE_CUBE_MAP one, [unit][2] the GL_TEXTURE_2D_ARRAY one
+        GLuint textures[TRACKED_TEXTURE_UNITS][3] = {};
+        bool capabilities[CAPABILITY_COUNT] = {};
+        GLenum depthFunction = GL_LESS;
+        bool depthWrite = true;
+        bool colorWrite = true;
+        GLenum cullFace = GL_BACK;
+        GLenum blendSource = GL_ONE;
+        GLenum blendDestination = GL_ZERO;
+        GLenum polygonMode = GL_FILL;
+
+        // Counts the request and says whether it has to be issued
+        static bool Changed(bool changed);
+        static int GetCapabilityIndex(GLenum capability);
+        static int GetTargetIndex(GLenum target);
+
+        GLState() {}
+
+        GLState(const GLState&) = delete;
+        GLState& operator=(const GLState&) = delete;
+    };
+}
+
+#endif /* GLState_hpp */
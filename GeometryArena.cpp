@@ -0,0 +1,464 @@
+#include "GeometryArena.hpp"
+#include "GLState.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+namespace gps {
+
+    // Smallest pool, so the park's first meshes do not move the pool over and over while it fills up
+    static const size_t MIN_POOL_VERTICES = 1 << 16;
+    static const size_t MIN_POOL_INDICES = 1 << 18;
+
+    static size_t GetIndexSize(GLenum indexType)
+    {
+        return indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(GLuint);
+    }
+
+    // Uninitialized storage; the copy target is used so that no vertex array's element buffer changes
+    static GLuint CreateBuffer(size_t bytes, GLenum usage)
+    {
+        GLuint buffer;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, bytes, NULL, usage);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return buffer;
+    }
+
+    void RangeAllocator::Reset(size_t capacity, size_t used)
+    {
+        freeRanges.clear();
+        this->capacity = capacity;
+        if (used < capacity)
+            freeRanges[used] = capacity - used;
+    }
+
+    size_t RangeAllocator::Allocate(size_t count)
+    {
+        for (std::map<size_t, size_t>::iterator it = freeRanges.begin(); it != freeRanges.end(); ++it) {
+            if (it->second < count)
+                continue;
+            size_t offset = it->first;
+            size_t remaining = it->second - count;
+            freeRanges.erase(it);
+            if (remaining > 0)
+                freeRanges[offset + count] = remaining;
+            return offset;
+        }
+        return INVALID_OFFSET;
+    }
+
+    void RangeAllocator::Free(size_t offset, size_t count)
+    {
+        if (count == 0)
+            return;
+
+        std::map<size_t, size_t>::iterator next = freeRanges.lower_bound(offset);
+        // joins the range ending right before it
+        if (next != freeRanges.begin()) {
+            std::map<size_t, size_t>::iterator previous = next;
+            --previous;
+            if (previous->first + previous->second == offset) {
+                offset = previous->first;
+                count += previous->second;
+                freeRanges.erase(previous);
+            }
+        }
+        // and the one starting right after it
+        if (next != freeRanges.end() && offset + count == next->first) {
+            count += next->second;
+            freeRanges.erase(next);
+        }
+        freeRanges[offset] = count;
+    }
+
+    size_t RangeAllocator::GetCapacity() const
+    {
+        return capacity;
+    }
+
+    size_t RangeAllocator::GetFreeCount() const
+    {
+        size_t freeCount = 0;
+        for (std::map<size_t, size_t>::const_iterator it = freeRanges.begin(); it != freeRanges.end(); ++it)
+            freeCount += it->second;
+        return freeCount;
+    }
+
+    size_t RangeAllocator::GetHoleCount() const
+    {
+        size_t holes = GetFreeCount();
+        if (!freeRanges.empty()) {
+            std::map<size_t, size_t>::const_reverse_iterator last = freeRanges.rbegin();
+            if (last->first + last->second == capacity)
+                holes -= last->second;
+        }
+        return holes;
+    }
+
+    GeometryArena& GeometryArena::Instance()
+    {
+        static GeometryArena instance;
+        return instance;
+    }
+
+    uint32_t GeometryArena::GetPool(VERTEX_FORMAT format, GLenum indexType)
+    {
+        for (size_t i = 0; i < pools.size(); i++)
+            if (pools[i].format == format && pools[i].indexType == indexType)
+                return (uint32_t)i;
+
+        // every pool VAO points its decode attributes at this buffer, so it exists before the first one
+        if (decodeBuffer == 0)
+            decodeBuffer = CreateBuffer(MAX_INDIRECT_DRAWS * sizeof(DrawDecode), GL_STREAM_DRAW);
+
+        Pool pool;
+        pool.format = format;
+        pool.indexType = indexType;
+        pool.positionStream = keepPositionStreams;
+        pools.push_back(pool);
+        Resize((uint32_t)(pools.size() - 1), MIN_POOL_VERTICES, MIN_POOL_INDICES);
+        return (uint32_t)(pools.size() - 1);
+    }
+
+    GeometryHandle GeometryArena::Allocate(VERTEX_FORMAT format, GLenum indexType, const void* vertexData, size_t vertexCount,
+        const void* indexData, size_t indexCount)
+    {
+        if (vertexCount == 0 || indexCount == 0)
+            return 0;
+
+        uint32_t poolIndex = GetPool(format, indexType);
+        size_t firstVertex = pools[poolIndex].vertices.Allocate(vertexCount);
+        size_t firstIndex = pools[poolIndex].indices.Allocate(indexCount);
+        if (firstVertex == RangeAllocator::INVALID_OFFSET || firstIndex == RangeAllocator::INVALID_OFFSET) {
+            if (firstVertex != RangeAllocator::INVALID_OFFSET)
+                pools[poolIndex].vertices.Free(firstVertex, vertexCount);
+            if (firstIndex != RangeAllocator::INVALID_OFFSET)
+                pools[poolIndex].indices.Free(firstIndex, indexCount);
+
+            // packing the live blocks into the larger buffers leaves all the free space in one range at the end
+            size_t vertexCapacity = pools[poolIndex].vertices.GetCapacity();
+            size_t indexCapacity = pools[poolIndex].indices.GetCapacity();
+            Resize(poolIndex, std::max(vertexCapacity * 2, vertexCapacity + vertexCount),
+                std::max(indexCapacity * 2, indexCapacity + indexCount));
+            firstVertex = pools[poolIndex].vertices.Allocate(vertexCount);
+            firstIndex = pools[poolIndex].indices.Allocate(indexCount);
+        }
+
+        const Pool& pool = pools[poolIndex];
+        size_t stride = VertexPacking::GetStride(format);
+        size_t indexSize = GetIndexSize(indexType);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, pool.vertexBuffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, firstVertex * stride, vertexCount * stride, vertexData);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, pool.indexBuffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, firstIndex * indexSize, indexCount * indexSize, indexData);
+        if (pool.positionBuffer != 0) {
+            size_t positionStride = VertexPacking::GetPositionStride(format);
+            positionScratch.resize(vertexCount * positionStride);
+            VertexPacking::ExtractPositions(format, vertexData, vertexCount, positionScratch.data());
+            glBindBuffer(GL_COPY_WRITE_BUFFER, pool.positionBuffer);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, firstVertex * positionStride, positionScratch.size(), positionScratch.data());
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        Slot slot;
+        slot.pool = poolIndex;
+        slot.firstVertex = firstVertex;
+        slot.vertexCount = vertexCount;
+        slot.firstIndex = firstIndex;
+        slot.indexCount = indexCount;
+        slot.live = true;
+        if (!freeSlots.empty()) {
+            GeometryHandle handle = freeSlots.back();
+            freeSlots.pop_back();
+            slots[handle - 1] = slot;
+            return handle;
+        }
+        slots.push_back(slot);
+        return (GeometryHandle)slots.size();
+    }
+
+    void GeometryArena::Release(GeometryHandle handle)
+    {
+        if (handle == 0 || handle > slots.size() || !slots[handle - 1].live)
+            return;
+
+        Slot& slot = slots[handle - 1];
+        Pool& pool = pools[slot.pool];
+        pool.vertices.Free(slot.firstVertex, slot.vertexCount);
+        pool.indices.Free(slot.firstIndex, slot.indexCount);
+        slot.live = false;
+        freeSlots.push_back(handle);
+        if (deleted)
+            return;
+
+        // unloading a model leaves holes the next ones may not fit in; past a quarter of the used space they are
+        // squeezed out, which costs one GPU copy of the live data
+        size_t usedVertices = pool.vertices.GetCapacity() - pool.vertices.GetFreeCount();
+        size_t usedIndices = pool.indices.GetCapacity() - pool.indices.GetFreeCount();
+        if (pool.vertices.GetHoleCount() * 4 > usedVertices || pool.indices.GetHoleCount() * 4 > usedIndices) {
+            Resize(slot.pool, pool.vertices.GetCapacity(), pool.indices.GetCapacity());
+            compactions++;
+        }
+    }
+
+    GeometryBlock GeometryArena::GetBlock(GeometryHandle handle) const
+    {
+        GeometryBlock block = GeometryBlock();
+        if (handle == 0 || handle > slots.size() || !slots[handle - 1].live)
+            return block;
+
+        const Slot& slot = slots[handle - 1];
+        block.vertexArray = pools[slot.pool].vertexArray;
+        block.positionVertexArray = pools[slot.pool].positionVertexArray;
+        block.format = pools[slot.pool].format;
+        block.indexType = pools[slot.pool].indexType;
+        block.firstVertex = (GLint)slot.firstVertex;
+        block.firstIndex = (GLuint)slot.firstIndex;
+        return block;
+    }
+
+    void GeometryArena::Resize(uint32_t poolIndex, size_t vertexCapacity, size_t indexCapacity)
+    {
+        Pool& pool = pools[poolIndex];
+        size_t stride = VertexPacking::GetStride(pool.format);
+        size_t indexSize = GetIndexSize(pool.indexType);
+        GLuint vertexBuffer = CreateBuffer(vertexCapacity * stride, GL_STATIC_DRAW);
+        GLuint indexBuffer = CreateBuffer(indexCapacity * indexSize, GL_STATIC_DRAW);
+        size_t positionStride = VertexPacking::GetPositionStride(pool.format);
+        GLuint positionBuffer = pool.positionStream ? CreateBuffer(vertexCapacity * positionStride, GL_STATIC_DRAW) : 0;
+
+        std::vector<Slot*> blocks;
+        for (size_t i = 0; i < slots.size(); i++)
+            if (slots[i].live && slots[i].pool == poolIndex)
+                blocks.push_back(&slots[i]);
+
+        // the blocks keep their order, each one moved down against the previous
+        size_t vertexCursor = 0;
+        size_t indexCursor = 0;
+        if (!blocks.empty()) {
+            std::sort(blocks.begin(), blocks.end(), [](const Slot* a, const Slot* b) {
+                return a->firstVertex < b->firstVertex;
+            });
+            // the position stream moves the same way, before the blocks learn their new places
+            if (positionBuffer != 0) {
+                glBindBuffer(GL_COPY_READ_BUFFER, pool.positionBuffer);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, positionBuffer);
+                for (size_t i = 0; i < blocks.size(); i++) {
+                    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, blocks[i]->firstVertex * positionStride,
+                        vertexCursor * positionStride, blocks[i]->vertexCount * positionStride);
+                    vertexCursor += blocks[i]->vertexCount;
+                }
+                vertexCursor = 0;
+            }
+
+            glBindBuffer(GL_COPY_READ_BUFFER, pool.vertexBuffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, vertexBuffer);
+            for (size_t i = 0; i < blocks.size(); i++) {
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, blocks[i]->firstVertex * stride,
+                    vertexCursor * stride, blocks[i]->vertexCount * stride);
+                blocks[i]->firstVertex = vertexCursor;
+                vertexCursor += blocks[i]->vertexCount;
+            }
+
+            glBindBuffer(GL_COPY_READ_BUFFER, pool.indexBuffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer);
+            std::sort(blocks.begin(), blocks.end(), [](const Slot* a, const Slot* b) {
+                return a->firstIndex < b->firstIndex;
+            });
+            for (size_t i = 0; i < blocks.size(); i++) {
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, blocks[i]->firstIndex * indexSize,
+                    indexCursor * indexSize, blocks[i]->indexCount * indexSize);
+                blocks[i]->firstIndex = indexCursor;
+                indexCursor += blocks[i]->indexCount;
+            }
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+
+        if (pool.vertexBuffer != 0) {
+            glDeleteBuffers(1, &pool.vertexBuffer);
+            glDeleteBuffers(1, &pool.indexBuffer);
+            glDeleteBuffers(1, &pool.positionBuffer);
+        }
+        pool.vertexBuffer = vertexBuffer;
+        pool.indexBuffer = indexBuffer;
+        pool.positionBuffer = positionBuffer;
+        pool.vertices.Reset(vertexCapacity, vertexCursor);
+        pool.indices.Reset(indexCapacity, indexCursor);
+        SetupVertexArray(pool);
+    }
+
+    void GeometryArena::SetupVertexArray(Pool& pool)
+    {
+        // the name stays the same across moves, so nothing has to learn about the new buffers
+        if (pool.vertexArray == 0)
+            glGenVertexArrays(1, &pool.vertexArray);
+
+        GLState& state = GLState::Instance();
+        state.BindVertexArray(pool.vertexArray);
+        glBindBuffer(GL_ARRAY_BUFFER, pool.vertexBuffer);
+        VertexPacking::SetAttributePointers(pool.format);
+        SetupSharedAttributes(pool);
+
+        if (pool.positionBuffer != 0) {
+            if (pool.positionVertexArray == 0)
+                glGenVertexArrays(1, &pool.positionVertexArray);
+            state.BindVertexArray(pool.positionVertexArray);
+            glBindBuffer(GL_ARRAY_BUFFER, pool.positionBuffer);
+            VertexPacking::SetPositionAttributePointer(pool.format);
+            SetupSharedAttributes(pool);
+        }
+        state.BindVertexArray(0);
+    }
+
+    void GeometryArena::SetupSharedAttributes(const Pool& pool)
+    {
+        // one decode per instance; the arrays are only enabled around indirect draws, constants feed the others
+        glBindBuffer(GL_ARRAY_BUFFER, decodeBuffer);
+        glVertexAttribPointer(DECODE_POSITION_SCALE, 3, GL_FLOAT, GL_FALSE, sizeof(DrawDecode),
+            (GLvoid*)offsetof(DrawDecode, positionScale));
+        glVertexAttribPointer(DECODE_POSITION_OFFSET, 3, GL_FLOAT, GL_FALSE, sizeof(DrawDecode),
+            (GLvoid*)offsetof(DrawDecode, positionOffset));
+        glVertexAttribPointer(DECODE_NORMAL_SCALE, 1, GL_FLOAT, GL_FALSE, sizeof(DrawDecode),
+            (GLvoid*)offsetof(DrawDecode, normalScale));
+        glVertexAttribDivisor(DECODE_POSITION_SCALE, 1);
+        glVertexAttribDivisor(DECODE_POSITION_OFFSET, 1);
+        glVertexAttribDivisor(DECODE_NORMAL_SCALE, 1);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        // meshes drawn once read the identity instance matrix
+        VertexPacking::ClearInstanceAttributes();
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.indexBuffer);
+    }
+
+    void GeometryArena::KeepPositionStreams(bool keep)
+    {
+        keepPositionStreams = keep;
+    }
+
+    void GeometryArena::UsePositionStreams(bool use)
+    {
+        usePositionStreams = use;
+    }
+
+    bool GeometryArena::IsUsingPositionStreams() const
+    {
+        return usePositionStreams;
+    }
+
+    GLuint GeometryArena::GetVertexArray(const GeometryBlock& block, bool positionOnly) const
+    {
+        if (positionOnly && usePositionStreams && block.positionVertexArray != 0)
+            return block.positionVertexArray;
+        return block.vertexArray;
+    }
+
+    size_t GeometryArena::GetFetchStride(const GeometryBlock& block, bool positionOnly) const
+    {
+        if (positionOnly && usePositionStreams && block.positionVertexArray != 0)
+            return VertexPacking::GetPositionStride(block.format);
+        return VertexPacking::GetStride(block.format);
+    }
+
+    bool GeometryArena::IsMultiDrawSupported() const
+    {
+        if (GLEW_VERSION_4_3)
+            return true;
+        return GLEW_ARB_multi_draw_indirect && GLEW_ARB_draw_indirect && GLEW_ARB_base_instance;
+    }
+
+    void GeometryArena::MultiDraw(GLenum indexType, const DrawElementsIndirectCommand* commands, const VertexDecode* decodes,
+        size_t count)
+    {
+        if (indirectBuffer == 0) {
+            glGenBuffers(1, &indirectBuffer);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, MAX_INDIRECT_DRAWS * sizeof(DrawElementsIndirectCommand), NULL, GL_STREAM_DRAW);
+            indirectCursor = 0;
+        }
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, decodeBuffer);
+        glEnableVertexAttribArray(DECODE_POSITION_SCALE);
+        glEnableVertexAttribArray(DECODE_POSITION_OFFSET);
+        glEnableVertexAttribArray(DECODE_NORMAL_SCALE);
+        for (size_t first = 0; first < count; first += MAX_INDIRECT_DRAWS) {
+            size_t batch = std::min(count - first, MAX_INDIRECT_DRAWS);
+            // orphaned when full, like the uniform ring, so the GPU never waits on commands still in flight
+            if (indirectCursor + batch > MAX_INDIRECT_DRAWS) {
+                glBufferData(GL_DRAW_INDIRECT_BUFFER, MAX_INDIRECT_DRAWS * sizeof(DrawElementsIndirectCommand), NULL, GL_STREAM_DRAW);
+                glBufferData(GL_ARRAY_BUFFER, MAX_INDIRECT_DRAWS * sizeof(DrawDecode), NULL, GL_STREAM_DRAW);
+                indirectCursor = 0;
+            }
+
+            // the base instance is the draw's slot, which is where its decode attributes are fetched from
+            commandScratch.assign(commands + first, commands + first + batch);
+            decodeScratch.resize(batch);
+            for (size_t i = 0; i < batch; i++) {
+                commandScratch[i].baseInstance = (GLuint)(indirectCursor + i);
+                decodeScratch[i].positionScale = decodes[first + i].positionScale;
+                decodeScratch[i].positionOffset = decodes[first + i].positionOffset;
+                decodeScratch[i].normalScale = decodes[first + i].normalScale;
+                decodeScratch[i].padding = 0.0f;
+            }
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, indirectCursor * sizeof(DrawElementsIndirectCommand),
+                batch * sizeof(DrawElementsIndirectCommand), commandScratch.data());
+            glBufferSubData(GL_ARRAY_BUFFER, indirectCursor * sizeof(DrawDecode), batch * sizeof(DrawDecode),
+                decodeScratch.data());
+
+            glMultiDrawElementsIndirect(GL_TRIANGLES, indexType,
+                (GLvoid*)(indirectCursor * sizeof(DrawElementsIndirectCommand)), (GLsizei)batch, 0);
+            indirectCursor += batch;
+        }
+        glDisableVertexAttribArray(DECODE_POSITION_SCALE);
+        glDisableVertexAttribArray(DECODE_POSITION_OFFSET);
+        glDisableVertexAttribArray(DECODE_NORMAL_SCALE);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    void GeometryArena::Delete()
+    {
+        for (size_t i = 0; i < pools.size(); i++) {
+            glDeleteBuffers(1, &pools[i].vertexBuffer);
+            glDeleteBuffers(1, &pools[i].indexBuffer);
+            glDeleteBuffers(1, &pools[i].positionBuffer);
+            GLState::Instance().DeleteVertexArray(pools[i].vertexArray);
+            GLState::Instance().DeleteVertexArray(pools[i].positionVertexArray);
+            pools[i].vertexBuffer = pools[i].indexBuffer = pools[i].vertexArray = 0;
+            pools[i].positionBuffer = pools[i].positionVertexArray = 0;
+        }
+        glDeleteBuffers(1, &indirectBuffer);
+        glDeleteBuffers(1, &decodeBuffer);
+        indirectBuffer = decodeBuffer = 0;
+        deleted = true;
+    }
+
+    void GeometryArena::PrintReport() const
+    {
+        size_t liveBlocks = 0;
+        for (size_t i = 0; i < slots.size(); i++)
+            if (slots[i].live)
+                liveBlocks++;
+
+        std::cout << "Geometry arena : " << pools.size() << " pools (one VAO each), " << liveBlocks << " blocks, "
+            << compactions << " compactions" << std::endl;
+        for (size_t i = 0; i < pools.size(); i++) {
+            const Pool& pool = pools[i];
+            std::cout << "  " << VertexPacking::GetFormatName(pool.format) << " / "
+                << (pool.indexType == GL_UNSIGNED_SHORT ? 16 : 32) << "-bit indices : vertices "
+                << pool.vertices.GetCapacity() - pool.vertices.GetFreeCount() << " of " << pool.vertices.GetCapacity()
+                << " (" << pool.vertices.GetHoleCount() << " in holes), indices "
+                << pool.indices.GetCapacity() - pool.indices.GetFreeCount() << " of " << pool.indices.GetCapacity()
+                << " (" << pool.indices.GetHoleCount() << " in holes)";
+            if (pool.positionBuffer != 0) {
+                std::cout << ", position stream " << pool.vertices.GetCapacity() * VertexPacking::GetPositionStride(pool.format)
+                    << " bytes (" << VertexPacking::GetPositionStride(pool.format) << " of " << VertexPacking::GetStride(pool.format)
+                    << " per vertex)";
+            }
+            std::cout << std::endl;
+        }
+    }
+}
@@ -0,0 +1,168 @@
+#ifndef GeometryArena_hpp
+#define GeometryArena_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "VertexPacking.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace gps {
+
+    // Free ranges of a buffer, handed out first fit and merged with their neighbours when given back
+    class RangeAllocator
+    {
+    public:
+        static const size_t INVALID_OFFSET = (size_t)-1;
+
+        // Everything below `used` is taken, the rest is one free range
+        void Reset(size_t capacity, size_t used);
+        size_t Allocate(size_t count);
+        void Free(size_t offset, size_t count);
+
+        size_t GetCapacity() const;
+        size_t GetFreeCount() const;
+        // Free space below the last allocation, which only compaction gives back
+        size_t GetHoleCount() const;
+
+    private:
+        // offset -> size
+        std::map<size_t, size_t> freeRanges;
+        size_t capacity = 0;
+    };
+
+    typedef uint32_t GeometryHandle;
+
+    // Where a block of geometry sits right now; compaction moves blocks, so draws look it up every time
+    struct GeometryBlock
+    {
+        GLuint vertexArray;
+        // the pool's position-only vertex array, 0 when it keeps no position stream
+        GLuint positionVertexArray;
+        VERTEX_FORMAT format;
+        GLenum indexType;
+        GLint firstVertex;
+        GLuint firstIndex;
+    };
+
+    // One draw as glMultiDrawElementsIndirect reads it
+    struct DrawElementsIndirectCommand
+    {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    // Vertex and index buffers shared by every mesh, one pool per vertex format and index type, each with a single VAO.
+    // Meshes sub-allocate ranges from them, so consecutive draws never switch buffers. Releasing a block frees its
+    // ranges; a pool whose holes outgrow a quarter of its used space is compacted on the GPU, and a full one is moved
+    // into buffers twice as large. Pools can keep a second, position-only copy of their vertices, laid out in parallel
+    // so the same indices and base vertices draw from it; depth-only shaders fetch a third or half of the bytes per
+    // vertex through it.
+    class GeometryArena
+    {
+    public:
+        // Indirect draws buffered before the command buffer is orphaned and refilled
+        static const size_t MAX_INDIRECT_DRAWS = 4096;
+
+        static GeometryArena& Instance();
+
+        // Copies the vertices and indices into their pool; 0 for empty geometry
+        GeometryHandle Allocate(VERTEX_FORMAT format, GLenum indexType, const void* vertexData, size_t vertexCount,
+            const void* indexData, size_t indexCount);
+        void Release(GeometryHandle handle);
+        GeometryBlock GetBlock(GeometryHandle handle) const;
+
+        // Whether the pools created from now on keep a position-only stream; set before the first model is loaded
+        void KeepPositionStreams(bool keep);
+        // Whether depth-only draws read the position streams, for comparison against the full vertices
+        void UsePositionStreams(bool use);
+        bool IsUsingPositionStreams() const;
+
+        // Vertex array a draw of the block binds: the position-only one when the shader reads nothing but positions
+        // and the streams are in use
+        GLuint GetVertexArray(const GeometryBlock& block, bool positionOnly) const;
+        // Bytes each vertex fetch of such a draw reads, for bandwidth estimates
+        size_t GetFetchStride(const GeometryBlock& block, bool positionOnly) const;
+
+        // glMultiDrawElementsIndirect with a base instance: GL 4.3, or 4.0 with the ARB extensions
+        bool IsMultiDrawSupported() const;
+
+        // Draws every command from the bound pool VAO in one call; the decodes reach the vertex shader per instance
+        void MultiDraw(GLenum indexType, const DrawElementsIndirectCommand* commands, const VertexDecode* decodes, size_t count);
+
+        // Frees the buffers; every model must be released before it, while the GL context is current
+        void Delete();
+        void PrintReport() const;
+
+    private:
+        struct Pool
+        {
+            VERTEX_FORMAT format;
+            GLenum indexType;
+            GLuint vertexArray = 0;
+            GLuint vertexBuffer = 0;
+            GLuint indexBuffer = 0;
+            // position-only copy of the vertex buffer and the vertex array reading it, both 0 without one
+            bool positionStream = false;
+            GLuint positionVertexArray = 0;
+            GLuint positionBuffer = 0;
+            RangeAllocator vertices;
+            RangeAllocator indices;
+        };
+
+        struct Slot
+        {
+            uint32_t pool;
+            size_t firstVertex;
+            size_t vertexCount;
+            size_t firstIndex;
+            size_t indexCount;
+            bool live;
+        };
+
+        // Decode of one indirect draw, read through attributes 3-5 at the draw's base instance
+        struct DrawDecode
+        {
+            glm::vec3 positionScale;
+            glm::vec3 positionOffset;
+            float normalScale;
+            float padding;
+        };
+
+        std::vector<Pool> pools;
+        // handle - 1 indexes the slots
+        std::vector<Slot> slots;
+        std::vector<GeometryHandle> freeSlots;
+        GLuint indirectBuffer = 0;
+        GLuint decodeBuffer = 0;
+        size_t indirectCursor = 0;
+        std::vector<DrawElementsIndirectCommand> commandScratch;
+        std::vector<DrawDecode> decodeScratch;
+        std::vector<unsigned char> positionScratch;
+        bool keepPositionStreams = false;
+        bool usePositionStreams = true;
+        size_t compactions = 0;
+        bool deleted = false;
+
+        uint32_t GetPool(VERTEX_FORMAT format, GLenum indexType);
+        // Moves the pool into new buffers of the given capacities with its live blocks packed at the start
+        void Resize(uint32_t poolIndex, size_t vertexCapacity, size_t indexCapacity);
+        void SetupVertexArray(Pool& pool);
+        // Points the decode attributes of the bound vertex array at the decode buffer and binds the index buffer
+        void SetupSharedAttributes(const Pool& pool);
+
+        GeometryArena() {}
+
+        GeometryArena(const GeometryArena&) = delete;
+        GeometryArena& operator=(const GeometryArena&) = delete;
+    };
+}
+
+#endif /* GeometryArena_hpp */
@@ -0,0 +1,483 @@
+#include "ImagePipeline.hpp"
+#include "Simd.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+
+namespace gps {
+
+    // Conversion tables between 8-bit sRGB and linear floats
+    struct SrgbTables
+    {
+        static const int LINEAR_STEPS = 4096;
+        float toLinear[256];
+        unsigned char toSrgb[LINEAR_STEPS + 1];
+        // for channels stored as is (alpha, linear images)
+        float unorm[256];
+        unsigned char identity[256];
+
+        SrgbTables()
+        {
+            for (int i = 0; i < 256; i++) {
+                unorm[i] = i / 255.0f;
+                identity[i] = (unsigned char)i;
+            }
+            for (int i = 0; i < 256; i++) {
+                float value = i / 255.0f;
+                toLinear[i] = value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+            }
+            for (int i = 0; i <= LINEAR_STEPS; i++) {
+                float value = i / (float)LINEAR_STEPS;
+                float encoded = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+                toSrgb[i] = (unsigned char)std::lround(std::min(1.0f, std::max(0.0f, encoded)) * 255.0f);
+            }
+        }
+    };
+
+    static const SrgbTables& GetSrgbTables()
+    {
+        static SrgbTables tables;
+        return tables;
+    }
+
+    // Splits the rows into bands and runs them across the pool; small levels stay on the calling thread
+    static void ForEachRowRange(int rowCount, const std::function<void(int, int)>& job)
+    {
+        const int rowsPerBand = 16;
+        int bandCount = (rowCount + rowsPerBand - 1) / rowsPerBand;
+        if (bandCount <= 1) {
+            job(0, rowCount);
+            return;
+        }
+        ThreadPool::Shared().ParallelFor((size_t)bandCount, [&](size_t band) {
+            int first = (int)band * rowsPerBand;
+            job(first, std::min(rowCount, first + rowsPerBand));
+        });
+    }
+
+    static void SwapBytes(unsigned char* a, unsigned char* b, size_t count)
+    {
+        size_t i = 0;
+#if defined(GPS_SIMD_AVX2)
+        for (; i + 32 <= count; i += 32) {
+            __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+            __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+            _mm256_storeu_si256((__m256i*)(a + i), vb);
+            _mm256_storeu_si256((__m256i*)(b + i), va);
+        }
+#endif
+#if defined(GPS_SIMD_AVX2) || defined(GPS_SIMD_SSE2)
+        for (; i + 16 <= count; i += 16) {
+            __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+            __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+            _mm_storeu_si128((__m128i*)(a + i), vb);
+            _mm_storeu_si128((__m128i*)(b + i), va);
+        }
+#endif
+        unsigned char temp[16];
+        for (; i < count; i += 16) {
+            size_t chunk = std::min((size_t)16, count - i);
+            memcpy(temp, a + i, chunk);
+            memcpy(a + i, b + i, chunk);
+            memcpy(b + i, temp, chunk);
+        }
+    }
+
+    // dst[i] = a[i] * wa + b[i] * wb over contiguous floats
+    static void BlendRows(float* destination, const float* a, float wa, const float* b, float wb, size_t count)
+    {
+        size_t i = 0;
+#if defined(GPS_SIMD_AVX2)
+        __m256 wa8 = _mm256_set1_ps(wa);
+        __m256 wb8 = _mm256_set1_ps(wb);
+        for (; i + 8 <= count; i += 8)
+            _mm256_storeu_ps(destination + i, _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(a + i), wa8), _mm256_mul_ps(_mm256_loadu_ps(b + i), wb8)));
+#endif
+#if defined(GPS_SIMD_AVX2) || defined(GPS_SIMD_SSE2)
+        __m128 wa4 = _mm_set1_ps(wa);
+        __m128 wb4 = _mm_set1_ps(wb);
+        for (; i + 4 <= count; i += 4)
+            _mm_storeu_ps(destination + i, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(a + i), wa4), _mm_mul_ps(_mm_loadu_ps(b + i), wb4)));
+#endif
+        for (; i < count; i++)
+            destination[i] = a[i] * wa + b[i] * wb;
+    }
+
+    // Per-channel lookup tables, so the kernels below treat color and alpha alike without branching:
+    // sRGB color goes through the sRGB curve, alpha and linear images are plain scaling
+    struct ChannelTables
+    {
+        const float* toLinear[4];
+        const unsigned char* fromLinear[4];
+        float fromLinearScale[4];
+
+        ChannelTables(int channels, bool srgb)
+        {
+            const SrgbTables& tables = GetSrgbTables();
+            for (int c = 0; c < 4; c++) {
+                bool isAlpha = (channels == 2 || channels == 4) && c == channels - 1;
+                bool isSrgb = srgb && !isAlpha;
+                toLinear[c] = isSrgb ? tables.toLinear : tables.unorm;
+                fromLinear[c] = isSrgb ? tables.toSrgb : tables.identity;
+                fromLinearScale[c] = isSrgb ? (float)SrgbTables::LINEAR_STEPS : 255.0f;
+            }
+        }
+    };
+
+    template <int CHANNELS>
+    static void DecodeRow(const unsigned char* source, float* destination, int width, const ChannelTables& tables)
+    {
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < CHANNELS; c++)
+                destination[x * CHANNELS + c] = tables.toLinear[c][source[x * CHANNELS + c]];
+        }
+    }
+
+    template <int CHANNELS>
+    static void EncodeRow(const float* source, unsigned char* destination, int width, const ChannelTables& tables)
+    {
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < CHANNELS; c++) {
+                float value = std::min(1.0f, std::max(0.0f, source[x * CHANNELS + c]));
+                destination[x * CHANNELS + c] = tables.fromLinear[c][(int)(value * tables.fromLinearScale[c] + 0.5f)];
+            }
+        }
+    }
+
+    // 2x2 average of two rows, read through the channel tables (8-bit source) or directly (linear floats)
+    template <int CHANNELS>
+    static void BoxRow(const unsigned char* row0, const unsigned char* row1, int width, int halfWidth, float* destination,
+        const ChannelTables& tables)
+    {
+        for (int x = 0; x < halfWidth; x++) {
+            int x0 = std::min(2 * x, width - 1) * CHANNELS;
+            int x1 = std::min(2 * x + 1, width - 1) * CHANNELS;
+            for (int c = 0; c < CHANNELS; c++) {
+                const float* table = tables.toLinear[c];
+                destination[x * CHANNELS + c] = 0.25f * (table[row0[x0 + c]] + table[row0[x1 + c]] + table[row1[x0 + c]] + table[row1[x1 + c]]);
+            }
+        }
+    }
+
+    template <int CHANNELS>
+    static void BoxRow(const float* row0, const float* row1, int width, int halfWidth, float* destination, const ChannelTables&)
+    {
+        int x = 0;
+#if defined(GPS_SIMD_AVX2) || defined(GPS_SIMD_SSE2)
+        if (CHANNELS == 4 && width > 1) {
+            __m128 quarter = _mm_set1_ps(0.25f);
+            for (; x < halfWidth; x++) {
+                __m128 top = _mm_add_ps(_mm_loadu_ps(row0 + 8 * x), _mm_loadu_ps(row0 + 8 * x + 4));
+                __m128 bottom = _mm_add_ps(_mm_loadu_ps(row1 + 8 * x), _mm_loadu_ps(row1 + 8 * x + 4));
+                _mm_storeu_ps(destination + 4 * x, _mm_mul_ps(_mm_add_ps(top, bottom), quarter));
+            }
+        }
+#endif
+        for (; x < halfWidth; x++) {
+            int x0 = std::min(2 * x, width - 1) * CHANNELS;
+            int x1 = std::min(2 * x + 1, width - 1) * CHANNELS;
+            for (int c = 0; c < CHANNELS; c++)
+                destination[x * CHANNELS + c] = 0.25f * (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]);
+        }
+    }
+
+    // A level being downsampled: either the 8-bit source or a linear float level
+    struct LevelReader
+    {
+        const unsigned char* bytes;
+        const float* floats;
+        int width;
+        int height;
+        int channels;
+        const ChannelTables* tables;
+
+        // Row y as linear floats; 8-bit rows are converted into scratch
+        const float* Row(int y, float* scratch) const
+        {
+            size_t rowLength = (size_t)width * channels;
+            if (floats)
+                return floats + (size_t)y * rowLength;
+
+            const unsigned char* source = bytes + (size_t)y * rowLength;
+            switch (channels) {
+            case 1: DecodeRow<1>(source, scratch, width, *tables); break;
+            case 2: DecodeRow<2>(source, scratch, width, *tables); break;
+            case 3: DecodeRow<3>(source, scratch, width, *tables); break;
+            default: DecodeRow<4>(source, scratch, width, *tables); break;
+            }
+            return scratch;
+        }
+    };
+
+    template <int CHANNELS, typename T>
+    static void DownsampleBoxRows(const T* source, int width, int height, float* result, int halfWidth, int firstRow, int lastRow,
+        const ChannelTables& tables)
+    {
+        size_t rowLength = (size_t)width * CHANNELS;
+        for (int y = firstRow; y < lastRow; y++) {
+            const T* row0 = source + std::min(2 * y, height - 1) * rowLength;
+            const T* row1 = source + std::min(2 * y + 1, height - 1) * rowLength;
+            BoxRow<CHANNELS>(row0, row1, width, halfWidth, result + (size_t)y * halfWidth * CHANNELS, tables);
+        }
+    }
+
+    template <typename T>
+    static void DownsampleBoxRows(int channels, const T* source, int width, int height, float* result, int halfWidth,
+        int firstRow, int lastRow, const ChannelTables& tables)
+    {
+        switch (channels) {
+        case 1: DownsampleBoxRows<1>(source, width, height, result, halfWidth, firstRow, lastRow, tables); break;
+        case 2: DownsampleBoxRows<2>(source, width, height, result, halfWidth, firstRow, lastRow, tables); break;
+        case 3: DownsampleBoxRows<3>(source, width, height, result, halfWidth, firstRow, lastRow, tables); break;
+        default: DownsampleBoxRows<4>(source, width, height, result, halfWidth, firstRow, lastRow, tables); break;
+        }
+    }
+
+    static void EncodeLevel(const std::vector<float>& linear, int channels, bool srgb, ImageLevel& level)
+    {
+        ChannelTables tables(channels, srgb);
+        size_t rowLength = (size_t)level.width * channels;
+        level.pixels.resize(rowLength * level.height);
+
+        ForEachRowRange(level.height, [&](int firstRow, int lastRow) {
+            for (int y = firstRow; y < lastRow; y++) {
+                const float* source = linear.data() + y * rowLength;
+                unsigned char* destination = level.pixels.data() + y * rowLength;
+                switch (channels) {
+                case 1: EncodeRow<1>(source, destination, level.width, tables); break;
+                case 2: EncodeRow<2>(source, destination, level.width, tables); break;
+                case 3: EncodeRow<3>(source, destination, level.width, tables); break;
+                default: EncodeRow<4>(source, destination, level.width, tables); break;
+                }
+            }
+        });
+    }
+
+    // 2x2 average; odd trailing rows and columns are dropped, as in the usual floor-sized chain
+    static std::vector<float> DownsampleBox(const LevelReader& source, int halfWidth, int halfHeight)
+    {
+        std::vector<float> result((size_t)halfWidth * halfHeight * source.channels);
+        ForEachRowRange(halfHeight, [&](int firstRow, int lastRow) {
+            if (source.floats)
+                DownsampleBoxRows(source.channels, source.floats, source.width, source.height, result.data(), halfWidth, firstRow, lastRow, *source.tables);
+            else
+                DownsampleBoxRows(source.channels, source.bytes, source.width, source.height, result.data(), halfWidth, firstRow, lastRow, *source.tables);
+        });
+        return result;
+    }
+
+    // Kaiser-windowed sinc for 2:1 decimation: 6 taps per axis at source offsets -2.5 .. 2.5
+    static const int KAISER_TAPS = 6;
+
+    static double BesselI0(double x)
+    {
+        double sum = 1.0;
+        double term = 1.0;
+        for (int k = 1; k < 20; k++) {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+        }
+        return sum;
+    }
+
+    static const float* GetKaiserWeights()
+    {
+        struct KaiserWeights
+        {
+            float values[KAISER_TAPS];
+
+            KaiserWeights()
+            {
+                const double alpha = 4.0;
+                const double radius = 1.5;
+                const double pi = 3.14159265358979323846;
+                double total = 0.0;
+                for (int i = 0; i < KAISER_TAPS; i++) {
+                    // distance from the output center, in output pixels
+                    double t = (i - KAISER_TAPS / 2 + 0.5) / 2.0;
+                    double sinc = std::sin(pi * t) / (pi * t);
+                    double ratio = t / radius;
+                    double window = BesselI0(alpha * std::sqrt(1.0 - ratio * ratio)) / BesselI0(alpha);
+                    values[i] = (float)(sinc * window);
+                    total += values[i];
+                }
+                for (int i = 0; i < KAISER_TAPS; i++)
+                    values[i] = (float)(values[i] / total);
+            }
+        };
+        static KaiserWeights weights;
+        return weights.values;
+    }
+
+    // Horizontal 2:1 Kaiser pass over one row; only the first and last outputs need clamped taps
+    template <int CHANNELS>
+    static void KaiserRow(const float* row, int width, float* destination, int halfWidth, const float* weights)
+    {
+        for (int x = 0; x < halfWidth; x++) {
+            int firstTap = 2 * x - KAISER_TAPS / 2 + 1;
+            float sum[CHANNELS] = {};
+            if (firstTap >= 0 && firstTap + KAISER_TAPS <= width) {
+                const float* taps = row + firstTap * CHANNELS;
+                for (int tap = 0; tap < KAISER_TAPS; tap++) {
+                    for (int c = 0; c < CHANNELS; c++)
+                        sum[c] += weights[tap] * taps[tap * CHANNELS + c];
+                }
+            } else {
+                for (int tap = 0; tap < KAISER_TAPS; tap++) {
+                    int sourceX = std::min(std::max(firstTap + tap, 0), width - 1);
+                    for (int c = 0; c < CHANNELS; c++)
+                        sum[c] += weights[tap] * row[sourceX * CHANNELS + c];
+                }
+            }
+            for (int c = 0; c < CHANNELS; c++)
+                destination[x * CHANNELS + c] = sum[c];
+        }
+    }
+
+    static std::vector<float> DownsampleKaiser(const LevelReader& source, int halfWidth, int halfHeight)
+    {
+        const float* weights = GetKaiserWeights();
+        int channels = source.channels;
+        size_t rowLength = (size_t)source.width * channels;
+        size_t halfRowLength = (size_t)halfWidth * channels;
+
+        // horizontal pass: width -> halfWidth, all rows
+        std::vector<float> horizontal(halfRowLength * source.height);
+        ForEachRowRange(source.height, [&](int firstRow, int lastRow) {
+            std::vector<float> scratch(rowLength);
+            for (int y = firstRow; y < lastRow; y++) {
+                const float* row = source.Row(y, scratch.data());
+                float* destination = horizontal.data() + y * halfRowLength;
+                switch (channels) {
+                case 1: KaiserRow<1>(row, source.width, destination, halfWidth, weights); break;
+                case 2: KaiserRow<2>(row, source.width, destination, halfWidth, weights); break;
+                case 3: KaiserRow<3>(row, source.width, destination, halfWidth, weights); break;
+                default: KaiserRow<4>(row, source.width, destination, halfWidth, weights); break;
+                }
+            }
+        });
+
+        // vertical pass: weighted sums of whole rows, which vectorizes
+        std::vector<float> result(halfRowLength * halfHeight);
+        ForEachRowRange(halfHeight, [&](int firstRow, int lastRow) {
+            for (int y = firstRow; y < lastRow; y++) {
+                float* destination = result.data() + y * halfRowLength;
+                std::fill(destination, destination + halfRowLength, 0.0f);
+                for (int tap = 0; tap < KAISER_TAPS; tap++) {
+                    int sourceY = std::min(std::max(2 * y - KAISER_TAPS / 2 + 1 + tap, 0), source.height - 1);
+                    BlendRows(destination, destination, 1.0f, horizontal.data() + sourceY * halfRowLength, weights[tap], halfRowLength);
+                }
+            }
+        });
+        return result;
+    }
+
+    std::vector<unsigned char> ImageBufferPool::Acquire(size_t bytes)
+    {
+        std::vector<unsigned char> buffer;
+        {
+            std::lock_guard<std::mutex> lock(buffersMutex);
+            size_t best = buffers.size();
+            for (size_t i = 0; i < buffers.size(); i++) {
+                if (buffers[i].capacity() >= bytes && (best == buffers.size() || buffers[i].capacity() < buffers[best].capacity()))
+                    best = i;
+            }
+            if (best < buffers.size()) {
+                buffer.swap(buffers[best]);
+                buffers.erase(buffers.begin() + best);
+                pooledBytes -= buffer.capacity();
+            }
+        }
+        buffer.resize(bytes);
+        return buffer;
+    }
+
+    void ImageBufferPool::Release(std::vector<unsigned char>& buffer)
+    {
+        std::vector<unsigned char> released;
+        released.swap(buffer);
+
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        if (released.capacity() > 0 && pooledBytes + released.capacity() <= MAX_POOLED_BYTES) {
+            pooledBytes += released.capacity();
+            buffers.push_back(std::move(released));
+        }
+    }
+
+    void ImageBufferPool::Trim()
+    {
+        std::vector<std::vector<unsigned char> > freed;
+        {
+            std::lock_guard<std::mutex> lock(buffersMutex);
+            freed.swap(buffers);
+            pooledBytes = 0;
+        }
+    }
+
+    ImageBufferPool& ImageBufferPool::Shared()
+    {
+        static ImageBufferPool pool;
+        return pool;
+    }
+
+    void ImagePipeline::FlipRows(unsigned char* pixels, int width, int height, int channels)
+    {
+        size_t rowBytes = (size_t)width * channels;
+        for (int top = 0, bottom = height - 1; top < bottom; top++, bottom--)
+            SwapBytes(pixels + top * rowBytes, pixels + bottom * rowBytes, rowBytes);
+    }
+
+    std::vector<ImageLevel> ImagePipeline::BuildMipChain(const unsigned char* pixels, int width, int height, int channels,
+        bool srgb, MIP_FILTER filter)
+    {
+        std::vector<ImageLevel> levels;
+        ImageLevel base;
+        base.width = width;
+        base.height = height;
+        base.pixels.assign(pixels, pixels + (size_t)width * height * channels);
+        levels.push_back(std::move(base));
+
+        // level 0 is read straight from the bytes; every later level is filtered from the linear floats of the previous one
+        ChannelTables tables(channels, srgb);
+        std::vector<float> linear;
+        while (width > 1 || height > 1) {
+            LevelReader reader;
+            reader.bytes = linear.empty() ? pixels : NULL;
+            reader.floats = linear.empty() ? NULL : linear.data();
+            reader.width = width;
+            reader.height = height;
+            reader.channels = channels;
+            reader.tables = &tables;
+
+            int halfWidth = std::max(1, width / 2);
+            int halfHeight = std::max(1, height / 2);
+            if (filter == MIP_FILTER_KAISER)
+                linear = DownsampleKaiser(reader, halfWidth, halfHeight);
+            else
+                linear = DownsampleBox(reader, halfWidth, halfHeight);
+            width = halfWidth;
+            height = halfHeight;
+
+            ImageLevel level;
+            level.width = width;
+            level.height = height;
+            EncodeLevel(linear, channels, srgb, level);
+            levels.push_back(std::move(level));
+        }
+        return levels;
+    }
+
+    const char* ImagePipeline::GetSimdName()
+    {
+#if defined(GPS_SIMD_AVX2)
+        return "AVX2";
+#elif defined(GPS_SIMD_SSE2)
+        return "SSE2";
+#else
+        return "scalar";
+#endif
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef ImagePipeline_hpp
+#define ImagePipeline_hpp
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace gps {
+
+    enum MIP_FILTER {MIP_FILTER_BOX, MIP_FILTER_KAISER};
+
+    // One level of a mip chain, tightly packed 8-bit pixels
+    struct ImageLevel
+    {
+        int width;
+        int height;
+        std::vector<unsigned char> pixels;
+    };
+
+    // Keeps released pixel buffers for reuse while images are loading, so the faces of a skybox do not go back to the
+    // allocator one after another. Holds at most MAX_POOLED_BYTES and is emptied with Trim once loading is done.
+    // Safe to use from the worker threads.
+    class ImageBufferPool
+    {
+    public:
+        static const size_t MAX_POOLED_BYTES = 64 * 1024 * 1024;
+
+        // Buffer of the requested size, taken from the smallest released buffer that is large enough if there is one
+        std::vector<unsigned char> Acquire(size_t bytes);
+        // Takes over the storage of the buffer, which is left empty; freed instead when the pool is full
+        void Release(std::vector<unsigned char>& buffer);
+        // Frees every pooled buffer
+        void Trim();
+
+        static ImageBufferPool& Shared();
+
+    private:
+        std::mutex buffersMutex;
+        std::vector<std::vector<unsigned char> > buffers;
+        // capacity of the pooled buffers
+        size_t pooledBytes = 0;
+    };
+
+    // CPU preprocessing of decoded images before upload: row flip and gamma-correct mip generation.
+    // Kernels use AVX2 or SSE2 when the build targets them and fall back to scalar code otherwise.
+    class ImagePipeline
+    {
+    public:
+        // Reverses the row order in place so row 0 becomes the bottom one
+        static void FlipRows(unsigned char* pixels, int width, int height, int channels);
+
+        // Full chain down to 1x1, level 0 included. Color channels are filtered in linear space when srgb is set;
+        // alpha (channel 4) is always filtered as is. Rows are processed across the shared thread pool.
+        static std::vector<ImageLevel> BuildMipChain(const unsigned char* pixels, int width, int height, int channels,
+            bool srgb, MIP_FILTER filter);
+
+        // Name of the instruction set the kernels were compiled for
+        static const char* GetSimdName();
+    };
+}
+
+#endif /* ImagePipeline_hpp */
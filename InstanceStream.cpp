@@ -0,0 +1,112 @@
+#include "InstanceStream.hpp"
+#include "RenderStats.hpp"
+#include "VertexPacking.hpp"
+
+#include "glm/gtc/matrix_inverse.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+namespace gps {
+
+    InstanceStream& InstanceStream::Instance()
+    {
+        static InstanceStream instance;
+        return instance;
+    }
+
+    static void FillInstance(InstanceData& instance, const glm::mat4& model)
+    {
+        instance.model = model;
+        glm::mat3 normalMatrix = glm::inverseTranspose(glm::mat3(model));
+        for (int column = 0; column < 3; column++)
+            instance.normalMatrix[column] = glm::vec4(normalMatrix[column], 0.0f);
+    }
+
+    GLintptr InstanceStream::Write(const glm::mat4* models, size_t count, const std::vector<glm::mat4>& locals)
+    {
+        size_t instanceCount = count * std::max<size_t>(locals.size(), 1);
+        if (buffer == 0)
+            glGenBuffers(1, &buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        if (cursor + instanceCount > capacity) {
+            capacity = std::max(capacity, INITIAL_CAPACITY);
+            while (capacity < instanceCount)
+                capacity *= 2;
+            glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+            cursor = 0;
+            generation++;
+            orphans++;
+        }
+
+        // nothing in flight reads this range since the last orphan, so the map need not wait
+        GLintptr offset = (GLintptr)(cursor * sizeof(InstanceData));
+        size_t bytes = instanceCount * sizeof(InstanceData);
+        InstanceData* instances = (InstanceData*)glMapBufferRange(GL_ARRAY_BUFFER, offset, (GLsizeiptr)bytes,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (instances != NULL) {
+            for (size_t i = 0; i < count; i++) {
+                if (locals.empty()) {
+                    FillInstance(instances[i], models[i]);
+                    continue;
+                }
+                for (size_t j = 0; j < locals.size(); j++)
+                    FillInstance(instances[i * locals.size() + j], models[i] * locals[j]);
+            }
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        cursor += instanceCount;
+        bytesWritten += bytes;
+        RenderStats::Instance().AddInstanceUpload(instanceCount, bytes);
+        return offset;
+    }
+
+    uint32_t InstanceStream::GetGeneration() const
+    {
+        return generation;
+    }
+
+    void InstanceStream::SetAttributes(GLintptr offset) const
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        for (GLuint column = 0; column < 4; column++) {
+            GLuint attribute = INSTANCE_MODEL_COLUMN + column;
+            glEnableVertexAttribArray(attribute);
+            glVertexAttribPointer(attribute, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                (GLvoid*)(offset + offsetof(InstanceData, model) + column * sizeof(glm::vec4)));
+            glVertexAttribDivisor(attribute, 1);
+        }
+        for (GLuint column = 0; column < 3; column++) {
+            GLuint attribute = INSTANCE_NORMAL_COLUMN + column;
+            glEnableVertexAttribArray(attribute);
+            glVertexAttribPointer(attribute, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                (GLvoid*)(offset + offsetof(InstanceData, normalMatrix) + column * sizeof(glm::vec4)));
+            glVertexAttribDivisor(attribute, 1);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void InstanceStream::ClearAttributes() const
+    {
+        // only the instanced shaders read the normal matrix, so its constant does not matter
+        for (GLuint column = 0; column < 3; column++)
+            glDisableVertexAttribArray(INSTANCE_NORMAL_COLUMN + column);
+        VertexPacking::ClearInstanceAttributes();
+    }
+
+    void InstanceStream::Delete()
+    {
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+        capacity = cursor = 0;
+        generation++;
+    }
+
+    void InstanceStream::PrintReport() const
+    {
+        std::cout << "Instance stream: " << capacity << " instances (" << capacity * sizeof(InstanceData) << " bytes), "
+            << bytesWritten << " bytes streamed, " << orphans << " orphans" << std::endl;
+    }
+}
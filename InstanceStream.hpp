@@ -0,0 +1,64 @@
+#ifndef InstanceStream_hpp
+#define InstanceStream_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    // One instance as the instanced vertex shaders read it through attributes 6-12
+    struct InstanceData
+    {
+        glm::mat4 model;
+        // inverse transpose of the model's upper 3x3, one vec4 per column so every column stays 16-byte aligned
+        glm::vec4 normalMatrix[3];
+    };
+
+    // Vertex buffer the per-instance transforms of explicit instanced draws are streamed through. Writes go to the
+    // free space after the last one through unsynchronized maps; when the buffer is full it is orphaned, like the
+    // uniform ring, so the GPU never waits on instances still in flight and the CPU never waits on the GPU.
+    class InstanceStream
+    {
+    public:
+        // Instances the buffer starts with; it doubles when a single write does not fit
+        static const size_t INITIAL_CAPACITY = 4096;
+
+        static InstanceStream& Instance();
+
+        // Copies every model matrix, times each of the local transforms when there are any, with its normal matrix;
+        // returns the byte offset of the first instance
+        GLintptr Write(const glm::mat4* models, size_t count, const std::vector<glm::mat4>& locals);
+
+        // Bumped by every orphan: offsets returned before it point into storage the next draws no longer see
+        uint32_t GetGeneration() const;
+
+        // Feeds the instance model (attributes 6-9) and normal matrices (10-12) of the bound vertex array from the
+        // instances at the offset
+        void SetAttributes(GLintptr offset) const;
+        // Disables the instance arrays of the bound vertex array and sets the identity constant back
+        void ClearAttributes() const;
+
+        void Delete();
+        void PrintReport() const;
+
+    private:
+        GLuint buffer = 0;
+        // in instances
+        size_t capacity = 0;
+        size_t cursor = 0;
+        uint32_t generation = 0;
+        size_t bytesWritten = 0;
+        size_t orphans = 0;
+
+        InstanceStream() {}
+
+        InstanceStream(const InstanceStream&) = delete;
+        InstanceStream& operator=(const InstanceStream&) = delete;
+    };
+}
+
+#endif /* InstanceStream_hpp */
@@ -0,0 +1,125 @@
+#include "MappedFile.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <sys/stat.h>
+
+namespace gps {
+
+    bool GetFileStamp(const std::string& fileName, int64_t& modifiedTime, uint64_t& fileSize)
+    {
+        struct stat fileStatus;
+        if (stat(fileName.c_str(), &fileStatus) != 0)
+            return false;
+        modifiedTime = (int64_t)fileStatus.st_mtime;
+        fileSize = (uint64_t)fileStatus.st_size;
+        return true;
+    }
+
+#ifdef _WIN32
+    MappedFile::MappedFile() : data(NULL), size(0), fileHandle(INVALID_HANDLE_VALUE), mappingHandle(NULL)
+    {
+    }
+#else
+    MappedFile::MappedFile() : data(NULL), size(0), fileDescriptor(-1)
+    {
+    }
+#endif
+
+    MappedFile::~MappedFile()
+    {
+        Close();
+    }
+
+    bool MappedFile::Open(const std::string& fileName)
+    {
+        Close();
+
+#ifdef _WIN32
+        fileHandle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (fileHandle == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+            Close();
+            return false;
+        }
+        size = (size_t)fileSize.QuadPart;
+
+        mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mappingHandle == NULL) {
+            Close();
+            return false;
+        }
+
+        data = (const unsigned char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+#else
+        fileDescriptor = open(fileName.c_str(), O_RDONLY);
+        if (fileDescriptor < 0)
+            return false;
+
+        struct stat fileStatus;
+        if (fstat(fileDescriptor, &fileStatus) != 0 || fileStatus.st_size == 0) {
+            Close();
+            return false;
+        }
+        size = (size_t)fileStatus.st_size;
+
+        void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+        data = mapping == MAP_FAILED ? NULL : (const unsigned char*)mapping;
+#endif
+
+        if (data == NULL) {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void MappedFile::Close()
+    {
+#ifdef _WIN32
+        if (data != NULL)
+            UnmapViewOfFile(data);
+        if (mappingHandle != NULL)
+            CloseHandle(mappingHandle);
+        if (fileHandle != INVALID_HANDLE_VALUE)
+            CloseHandle(fileHandle);
+        mappingHandle = NULL;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (data != NULL)
+            munmap((void*)data, size);
+        if (fileDescriptor >= 0)
+            close(fileDescriptor);
+        fileDescriptor = -1;
+#endif
+        data = NULL;
+        size = 0;
+    }
+
+    bool MappedFile::IsOpen() const
+    {
+        return data != NULL;
+    }
+
+    const unsigned char* MappedFile::GetData() const
+    {
+        return data;
+    }
+
+    size_t MappedFile::GetSize() const
+    {
+        return size;
+    }
+}
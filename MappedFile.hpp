@@ -0,0 +1,43 @@
+#ifndef MappedFile_hpp
+#define MappedFile_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace gps {
+
+    // Modification time and size of a file, used by the on-disk caches to detect stale sources
+    bool GetFileStamp(const std::string& fileName, int64_t& modifiedTime, uint64_t& fileSize);
+
+    // Read-only memory mapping of a whole file
+    class MappedFile
+    {
+    public:
+        MappedFile();
+        ~MappedFile();
+
+        // Maps the file into memory, returns false if it cannot be opened
+        bool Open(const std::string& fileName);
+        void Close();
+
+        bool IsOpen() const;
+        const unsigned char* GetData() const;
+        size_t GetSize() const;
+
+    private:
+        const unsigned char* data;
+        size_t size;
+#ifdef _WIN32
+        void* fileHandle;
+        void* mappingHandle;
+#else
+        int fileDescriptor;
+#endif
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+    };
+}
+
+#endif /* MappedFile_hpp */
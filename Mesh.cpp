@@ -1,71 +1,290 @@
 #include "Mesh.hpp"
+#include "GLState.hpp"
+#include "InstanceStream.hpp"
+#include "RenderStats.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+
 namespace gps {
 
+	// ambient, diffuse and specular
+	static const GLuint MESH_TEXTURE_UNITS = 3;
+
+	// Same id for the same textures in the same order
+	static uint32_t GetMaterialId(const std::vector<Texture>& textures)
+	{
+		static std::map<std::vector<TextureHandle>, uint32_t> materialIds;
+		std::vector<TextureHandle> handles(textures.size());
+		for (size_t i = 0; i < textures.size(); i++)
+			handles[i] = textures[i].handle;
+		std::map<std::vector<TextureHandle>, uint32_t>::iterator found = materialIds.find(handles);
+		if (found != materialIds.end())
+			return found->second;
+		uint32_t materialId = (uint32_t)materialIds.size();
+		materialIds[handles] = materialId;
+		return materialId;
+	}
+
+	// Cut-out materials are told apart by their diffuse texture having an alpha channel
+	static bool HasAlphaTestedDiffuse(const std::vector<Texture>& textures)
+	{
+		for (size_t i = 0; i < textures.size(); i++)
+			if (textures[i].type == "diffuseTexture" && TextureLoader::Instance().HasAlpha(textures[i].handle))
+				return true;
+		return false;
+	}
+
 	/* Mesh Constructor */
 	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures)
 	{
 		this->vertices = vertices;
 		this->indices = indices;
 		this->textures = textures;
+		this->materialId = GetMaterialId(textures);
+		this->alphaTested = HasAlphaTestedDiffuse(textures);
 
-		this->setupMesh();
+		this->setupMesh(this->vertices.data(), this->vertices.size(), VERTEX_FLOAT, this->indices.data(), this->indices.size());
 	}
 
-	Buffers Mesh::getBuffers() {
-	    return this->buffers;
+	Mesh::Mesh(const Vertex* vertexData, size_t vertexCount, const GLuint* indexData, size_t indexCount, std::vector<Texture> textures)
+	{
+		this->textures = textures;
+		this->materialId = GetMaterialId(textures);
+		this->alphaTested = HasAlphaTestedDiffuse(textures);
+
+		this->setupMesh(vertexData, vertexCount, VERTEX_FLOAT, indexData, indexCount);
+	}
+
+	Mesh::Mesh(const VertexStream& stream, const GLuint* indexData, size_t indexCount, std::vector<Texture> textures)
+	{
+		this->textures = textures;
+		this->materialId = GetMaterialId(textures);
+		this->alphaTested = HasAlphaTestedDiffuse(textures);
+		this->decode = stream.decode;
+
+		this->setupMesh(stream.vertices.data(), stream.vertexCount, stream.format, indexData, indexCount);
+	}
+
+	Mesh::Mesh(const MeshRange& range, const VertexDecode& decode, std::vector<Texture> textures)
+	{
+		this->textures = textures;
+		this->materialId = GetMaterialId(textures);
+		this->alphaTested = HasAlphaTestedDiffuse(textures);
+		this->decode = decode;
+		this->indexCount = (GLsizei)range.indexCount;
+		this->indexType = GL_UNSIGNED_INT;
+		this->baseVertex = range.baseVertex;
+		this->firstIndex = range.firstIndex;
+		this->vertexCount = range.vertexCount;
+		this->bufferBytes = 0;
+		this->bounds = MeshBounds();
+	}
+
+	void Mesh::setSharedGeometry(GeometryHandle geometry, VERTEX_FORMAT format, GLenum indexType)
+	{
+		this->geometry = geometry;
+		this->indexType = indexType;
+		size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(GLuint);
+		this->bufferBytes = this->vertexCount * VertexPacking::GetStride(format) + this->indexCount * indexSize;
+	}
+
+	GeometryHandle Mesh::getGeometry() const {
+	    return this->geometry;
+	}
+
+	size_t Mesh::getBufferBytes() const {
+	    return this->bufferBytes;
+	}
+
+	GLuint Mesh::getVertexCount() const {
+	    return this->vertexCount;
 	}
 
 	/* Mesh drawing function - also applies associated textures */
 	void Mesh::Draw(gps::Shader shader)
+	{
+		Draw(shader, 0);
+	}
+
+	void Mesh::Draw(gps::Shader shader, int lod)
+	{
+		if (this->geometry == 0)
+			return;
+		bindMaterial(shader);
+
+		//set the vertex decode of the buffer format
+		VertexPacking::SetDecodeAttributes(this->decode);
+
+		DrawElementsIndirectCommand command = getDrawCommand(lod);
+		size_t instanceCount = std::max<size_t>(this->instances.size(), 1);
+		RenderStats::Instance().AddDraw(command.count / 3 * instanceCount, getIndexCount(0) / 3 * instanceCount);
+
+		// the block's place is looked up on every draw, compaction may have moved it
+		GeometryBlock block = GeometryArena::Instance().GetBlock(this->geometry);
+		size_t offset = command.firstIndex * (block.indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(GLuint));
+		bindVertexArray(block, shader, instanceCount);
+		if (this->instanceBuffer == 0) {
+			glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)command.count, block.indexType, (GLvoid*)offset, command.baseVertex);
+			return;
+		}
+		VertexPacking::SetInstanceAttributes(this->instanceBuffer);
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, (GLsizei)command.count, block.indexType, (GLvoid*)offset,
+			(GLsizei)instanceCount, command.baseVertex);
+		VertexPacking::ClearInstanceAttributes();
+    }
+
+	void Mesh::DrawInstances(gps::Shader shader, int lod, GLintptr instanceOffset, size_t instanceCount)
+	{
+		if (this->geometry == 0 || instanceCount == 0)
+			return;
+		bindMaterial(shader);
+		VertexPacking::SetDecodeAttributes(this->decode);
+
+		DrawElementsIndirectCommand command = getDrawCommand(lod);
+		RenderStats::Instance().AddDraw(command.count / 3 * instanceCount, getIndexCount(0) / 3 * instanceCount);
+
+		GeometryBlock block = GeometryArena::Instance().GetBlock(this->geometry);
+		size_t offset = command.firstIndex * (block.indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(GLuint));
+		bindVertexArray(block, shader, instanceCount);
+		// the pool's VAO is shared, the instance arrays must not outlive this draw
+		InstanceStream& stream = InstanceStream::Instance();
+		stream.SetAttributes(instanceOffset);
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, (GLsizei)command.count, block.indexType, (GLvoid*)offset,
+			(GLsizei)instanceCount, command.baseVertex);
+		stream.ClearAttributes();
+	}
+
+	void Mesh::bindVertexArray(const GeometryBlock& block, const gps::Shader& shader, size_t instanceCount) const
+	{
+		// depth-only shaders read the pool's position stream, when it keeps one
+		GeometryArena& arena = GeometryArena::Instance();
+		bool positionOnly = shader.readsPositionOnly();
+		GLuint vertexArray = arena.GetVertexArray(block, positionOnly);
+		RenderStats::Instance().AddVertexFetch(this->vertexCount * arena.GetFetchStride(block, positionOnly) * instanceCount,
+			vertexArray != block.vertexArray);
+		GLState::Instance().BindVertexArray(vertexArray);
+	}
+
+	void Mesh::bindMaterial(gps::Shader shader)
 	{
 		shader.useShaderProgram();
 
-		//set textures
+		//set textures; units this mesh leaves empty must not keep the previous mesh's textures
+		GLState& state = GLState::Instance();
 		for (GLuint i = 0; i < textures.size(); i++)
 		{
-			glActiveTexture(GL_TEXTURE0 + i);
-			glUniform1i(glGetUniformLocation(shader.shaderProgram, this->textures[i].type.c_str()), i);
-			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
+			shader.set(this->textures[i].type, (GLint)i);
+			state.BindTexture(i, GL_TEXTURE_2D, TextureLoader::Instance().GetTextureId(this->textures[i].handle));
 		}
+		state.UnbindTextures(GL_TEXTURE_2D, (GLuint)textures.size(), MESH_TEXTURE_UNITS);
+	}
 
-		glBindVertexArray(this->buffers.VAO);
-		glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+	DrawElementsIndirectCommand Mesh::getDrawCommand(int lod) const
+	{
+		GLuint count = (GLuint)this->indexCount;
+		GLuint offset = 0;
+		if (!this->lods.empty()) {
+			const MeshLod& level = this->lods[std::min(std::max(lod, 0), (int)this->lods.size() - 1)];
+			count = level.indexCount;
+			offset = level.indexOffset;
+		}
 
-        for(GLuint i = 0; i < this->textures.size(); i++)
-        {
-            glActiveTexture(GL_TEXTURE0 + i);
-            glBindTexture(GL_TEXTURE_2D, 0);
-        }
+		GeometryBlock block = GeometryArena::Instance().GetBlock(this->geometry);
+		DrawElementsIndirectCommand command;
+		command.count = count;
+		command.instanceCount = 1;
+		command.firstIndex = block.firstIndex + this->firstIndex + offset;
+		command.baseVertex = block.firstVertex + this->baseVertex;
+		command.baseInstance = 0;
+		return command;
+	}
 
-    }
+	const VertexDecode& Mesh::getDecode() const {
+	    return this->decode;
+	}
+
+	void Mesh::setLods(const std::vector<MeshLod>& lods) {
+	    this->lods = lods;
+	}
+
+	int Mesh::getLodCount() const {
+	    return this->lods.empty() ? 1 : (int)this->lods.size();
+	}
+
+	float Mesh::getLodError(int lod) const {
+	    return this->lods.empty() ? 0.0f : this->lods[lod].error;
+	}
+
+	size_t Mesh::getIndexCount(int lod) const {
+	    if (this->lods.empty())
+	        return (size_t)this->indexCount;
+	    return this->lods[std::min(std::max(lod, 0), (int)this->lods.size() - 1)].indexCount;
+	}
 
-	// Initializes all the buffer objects/arrays
-	void Mesh::setupMesh(){
-		// Create buffers/arrays
-		glGenVertexArrays(1, &this->buffers.VAO);
-		glGenBuffers(1, &this->buffers.VBO);
-		glGenBuffers(1, &this->buffers.EBO);
-
-		glBindVertexArray(this->buffers.VAO);
-		// Load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.VBO);
-		glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers.EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
-
-		// Set the vertex attribute pointers
-		// Vertex Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
-		// Vertex Normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
-		// Vertex Texture Coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
-
-		glBindVertexArray(0);
+	void Mesh::setBounds(const MeshBounds& bounds) {
+	    this->bounds = bounds;
+	}
+
+	const MeshBounds& Mesh::getBounds() const {
+	    return this->bounds;
+	}
+
+	void Mesh::setOccluder(const std::shared_ptr<const OccluderGeometry>& occluder) {
+	    this->occluder = occluder;
+	}
+
+	const OccluderGeometry* Mesh::getOccluder() const {
+	    return this->occluder.get();
+	}
+
+	void Mesh::setInstances(const std::vector<glm::mat4>& instances) {
+	    this->instances = instances;
+	    if (instances.empty())
+	        return;
+	    glGenBuffers(1, &this->instanceBuffer);
+	    glBindBuffer(GL_ARRAY_BUFFER, this->instanceBuffer);
+	    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(glm::mat4), instances.data(), GL_STATIC_DRAW);
+	    glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	const std::vector<glm::mat4>& Mesh::getInstances() const {
+	    return this->instances;
+	}
+
+	GLuint Mesh::getInstanceBuffer() const {
+	    return this->instanceBuffer;
+	}
+
+	uint32_t Mesh::getMaterialId() const {
+	    return this->materialId;
+	}
+
+	bool Mesh::isAlphaTested() const {
+	    return this->alphaTested;
+	}
+
+	// Copies the vertices and indices into a block of the GeometryArena
+	void Mesh::setupMesh(const void* vertexData, size_t vertexCount, VERTEX_FORMAT format, const GLuint* indexData, size_t indexCount){
+		this->indexCount = (GLsizei)indexCount;
+		this->vertexCount = (GLuint)vertexCount;
+		this->bounds = MeshBounds();
+
+		size_t vertexBytes = vertexCount * VertexPacking::GetStride(format);
+		// Small meshes get 16-bit indices, which halves the index buffer
+		size_t indexBytes;
+		GeometryArena& arena = GeometryArena::Instance();
+		if (vertexCount <= 65536) {
+			std::vector<uint16_t> shortIndices(indexData, indexData + indexCount);
+			this->indexType = GL_UNSIGNED_SHORT;
+			indexBytes = indexCount * sizeof(uint16_t);
+			this->geometry = arena.Allocate(format, this->indexType, vertexData, vertexCount, shortIndices.data(), indexCount);
+		} else {
+			this->indexType = GL_UNSIGNED_INT;
+			indexBytes = indexCount * sizeof(GLuint);
+			this->geometry = arena.Allocate(format, this->indexType, vertexData, vertexCount, indexData, indexCount);
+		}
+		this->bufferBytes = vertexBytes + indexBytes;
 	}
 }
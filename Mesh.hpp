@@ -4,8 +4,15 @@
 #include <GL/glew.h>
 #include "glm/glm.hpp"
 
+#include "Frustum.hpp"
+#include "GeometryArena.hpp"
+#include "OcclusionCuller.hpp"
 #include "Shader.hpp"
+#include "TextureLoader.hpp"
+#include "VertexPacking.hpp"
 
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -21,12 +28,46 @@ struct Vertex
 
 struct Texture
 {
-    GLuint id;
+    // resolved to a GL texture through the TextureLoader at draw time
+    TextureHandle handle;
     //ambientTexture, diffuseTexture, specularTexture
     std::string type;
     std::string path;
 };
 
+// Texture a mesh refers to, before it has been loaded
+struct TextureReference
+{
+    std::string type;
+    std::string path;
+};
+
+// One level of detail: a range of the index buffer over the shared vertices
+struct MeshLod
+{
+    uint32_t indexOffset;
+    uint32_t indexCount;
+    // how far the level may deviate from the full mesh, in object space
+    float error;
+};
+
+// CPU-side geometry of one mesh, as produced by the importer
+struct MeshData
+{
+    std::string name;
+    std::vector<Vertex> vertices;
+    // every level of detail, back to back
+    std::vector<GLuint> indices;
+    // level 0 is the full mesh; empty when the whole index buffer is the only level
+    std::vector<MeshLod> lods;
+    std::vector<TextureReference> textures;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    // object-space transforms of the copies drawn with the geometry, the geometry itself first; empty for a mesh
+    // drawn once
+    std::vector<glm::mat4> instances;
+};
+
 struct Material
     {
         glm::vec3 ambient;
@@ -34,10 +75,13 @@ struct Material
         glm::vec3 specular;
     };
 
-struct Buffers {
-    GLuint VAO;
-    GLuint VBO;
-    GLuint EBO;
+// Where a mesh sits inside a GeometryArena block it shares with other meshes
+struct MeshRange
+{
+    GLint baseVertex;
+    GLuint vertexCount;
+    GLuint firstIndex;
+    GLuint indexCount;
 };
 
 class Mesh
@@ -49,16 +93,91 @@ public:
 
 	Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures);
 
-	Buffers getBuffers();
+	// Uploads the given arrays into the GeometryArena, without keeping a CPU-side copy
+	Mesh(const Vertex* vertexData, size_t vertexCount, const GLuint* indexData, size_t indexCount, std::vector<Texture> textures);
+
+	// Uploads a vertex stream in any VERTEX_FORMAT, without keeping a CPU-side copy
+	Mesh(const VertexStream& stream, const GLuint* indexData, size_t indexCount, std::vector<Texture> textures);
+
+	// Draws a range of a geometry block shared with other meshes; it is attached with setSharedGeometry
+	Mesh(const MeshRange& range, const VertexDecode& decode, std::vector<Texture> textures);
+
+	// Points a range mesh at the shared block, counting its own part of it
+	void setSharedGeometry(GeometryHandle geometry, VERTEX_FORMAT format, GLenum indexType);
+
+	// Arena block holding the mesh; meshes sharing one have the same handle
+	GeometryHandle getGeometry() const;
+
+	// Size of the mesh's vertices and indices in the arena
+	size_t getBufferBytes() const;
+	GLuint getVertexCount() const;
 
 	void Draw(gps::Shader shader);
 
+	// Draws one level of detail, clamped to the coarsest one
+	void Draw(gps::Shader shader, int lod);
+
+	// Draws one level of detail once per instance streamed at the offset of the InstanceStream
+	void DrawInstances(gps::Shader shader, int lod, GLintptr instanceOffset, size_t instanceCount);
+
+	// Binds the program and the mesh's textures, as Draw does before drawing
+	void bindMaterial(gps::Shader shader);
+	// One level of detail as an indirect draw, with its position in the arena resolved
+	DrawElementsIndirectCommand getDrawCommand(int lod) const;
+	const VertexDecode& getDecode() const;
+
+	// Index ranges of the levels of detail; without them the whole index buffer is level 0
+	void setLods(const std::vector<MeshLod>& lods);
+	int getLodCount() const;
+	float getLodError(int lod) const;
+	// Indices one level of detail draws, clamped like Draw
+	size_t getIndexCount(int lod) const;
+
+	void setBounds(const MeshBounds& bounds);
+	const MeshBounds& getBounds() const;
+
+	// Object-space transforms to draw the mesh with in one instanced call, uploaded to an instance buffer;
+	// empty for a mesh drawn once
+	void setInstances(const std::vector<glm::mat4>& instances);
+	const std::vector<glm::mat4>& getInstances() const;
+	GLuint getInstanceBuffer() const;
+
+	// Coarse CPU-side copy rasterized by the OcclusionCuller; null for meshes too small to hide anything
+	void setOccluder(const std::shared_ptr<const OccluderGeometry>& occluder);
+	const OccluderGeometry* getOccluder() const;
+
+	// Meshes with the same textures share an id, so draws can be grouped by it
+	uint32_t getMaterialId() const;
+
+	// Whether the diffuse texture has an alpha channel, whose cut-out texels only the alpha-tested shader
+	// permutation discards; decided once when the mesh is created
+	bool isAlphaTested() const;
+
 private:
     /*  Render data  */
-    Buffers buffers;
-
-	// Initializes all the buffer objects/arrays
-	void setupMesh();
+    GeometryHandle geometry = 0;
+    GLsizei indexCount;
+    // GL_UNSIGNED_SHORT when every index fits in 16 bits
+    GLenum indexType;
+    // start of the mesh in a shared block, 0 in its own
+    GLint baseVertex = 0;
+    GLuint firstIndex = 0;
+    GLuint vertexCount = 0;
+    size_t bufferBytes;
+    VertexDecode decode;
+    std::vector<MeshLod> lods;
+    MeshBounds bounds;
+    std::shared_ptr<const OccluderGeometry> occluder;
+    uint32_t materialId;
+    bool alphaTested;
+    std::vector<glm::mat4> instances;
+    GLuint instanceBuffer = 0;
+
+	// Binds the block's vertex array the shader reads from and counts the vertex bytes the draw fetches
+	void bindVertexArray(const GeometryBlock& block, const gps::Shader& shader, size_t instanceCount) const;
+
+	// Copies the vertices and indices into a block of the GeometryArena
+	void setupMesh(const void* vertexData, size_t vertexCount, VERTEX_FORMAT format, const GLuint* indexData, size_t indexCount);
 
 };
 
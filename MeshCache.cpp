@@ -0,0 +1,384 @@
+#include "MeshCache.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace gps {
+
+    // Bump whenever the layout below or the meaning of the baked data changes
+    static const uint32_t MESH_CACHE_VERSION = 4;
+    static const char MESH_CACHE_MAGIC[4] = {'G', 'P', 'M', 'C'};
+    // Vertex and index blobs start on this boundary so they can be handed to glBufferData as they are
+    static const uint64_t MESH_CACHE_ALIGNMENT = 16;
+
+    struct MeshCacheHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t optionsHash;
+        uint32_t meshCount;
+        uint32_t sourceFileCount;
+        uint32_t textureCount;
+        uint32_t lodCount;
+        uint32_t instanceCount;
+        uint64_t sourceTableOffset;
+        uint64_t meshTableOffset;
+        uint64_t textureTableOffset;
+        uint64_t lodTableOffset;
+        uint64_t instanceTableOffset;
+        uint64_t stringsOffset;
+        uint64_t stringsSize;
+        uint64_t fileSize;
+    };
+
+    // File the cache was built from, with the stamp it had at bake time
+    struct SourceFileRecord
+    {
+        uint32_t pathOffset;
+        uint32_t pathLength;
+        int64_t modifiedTime;
+        uint64_t fileSize;
+    };
+
+    struct MeshRecord
+    {
+        uint64_t vertexOffset;
+        uint64_t indexOffset;
+        uint32_t vertexCount;
+        uint32_t indexCount;
+        uint32_t firstTexture;
+        uint32_t textureCount;
+        uint32_t firstLod;
+        uint32_t lodCount;
+        uint32_t firstInstance;
+        uint32_t instanceCount;
+        uint32_t nameOffset;
+        uint32_t nameLength;
+        float boundsMin[3];
+        float boundsMax[3];
+    };
+
+    // Range of the mesh's index blob; the first one of a mesh is the full detail level
+    struct LodRecord
+    {
+        uint32_t indexOffset;
+        uint32_t indexCount;
+        float error;
+        uint32_t padding;
+    };
+
+    // Object-space transform of one copy of an instanced mesh, column by column
+    struct InstanceRecord
+    {
+        float transform[16];
+    };
+
+    struct TextureRecord
+    {
+        uint32_t typeOffset;
+        uint32_t typeLength;
+        uint32_t pathOffset;
+        uint32_t pathLength;
+    };
+
+    static_assert(sizeof(Vertex) == 32, "baked caches assume a tightly packed Vertex");
+
+    static uint64_t AlignUp(uint64_t value)
+    {
+        return (value + MESH_CACHE_ALIGNMENT - 1) & ~(MESH_CACHE_ALIGNMENT - 1);
+    }
+
+    // Appends a string to the string table and returns its offset
+    static uint32_t AddString(std::string& strings, const std::string& value)
+    {
+        uint32_t offset = (uint32_t)strings.size();
+        strings += value;
+        return offset;
+    }
+
+    static void WritePadding(std::ofstream& out, uint64_t& position, uint64_t target)
+    {
+        static const char zeros[MESH_CACHE_ALIGNMENT] = {};
+        out.write(zeros, (std::streamsize)(target - position));
+        position = target;
+    }
+
+    std::string MeshCache::GetCachePath(const std::string& objFileName)
+    {
+        return objFileName + ".gpmesh";
+    }
+
+    bool MeshCache::Write(const std::string& objFileName, const std::vector<std::string>& sourceFiles,
+        uint32_t optionsHash, const std::vector<MeshData>& meshes)
+    {
+        std::string strings;
+        std::vector<SourceFileRecord> sourceRecords;
+        std::vector<MeshRecord> meshRecords;
+        std::vector<TextureRecord> textureRecords;
+        std::vector<LodRecord> lodRecords;
+        std::vector<InstanceRecord> instanceRecords;
+
+        for (size_t i = 0; i < sourceFiles.size(); i++) {
+            SourceFileRecord record;
+            if (!GetFileStamp(sourceFiles[i], record.modifiedTime, record.fileSize))
+                continue;
+            record.pathOffset = AddString(strings, sourceFiles[i]);
+            record.pathLength = (uint32_t)sourceFiles[i].size();
+            sourceRecords.push_back(record);
+        }
+
+        for (size_t i = 0; i < meshes.size(); i++) {
+            MeshRecord record = {};
+            record.vertexCount = (uint32_t)meshes[i].vertices.size();
+            record.indexCount = (uint32_t)meshes[i].indices.size();
+            record.firstTexture = (uint32_t)textureRecords.size();
+            record.textureCount = (uint32_t)meshes[i].textures.size();
+            record.firstLod = (uint32_t)lodRecords.size();
+            record.lodCount = (uint32_t)meshes[i].lods.size();
+            record.firstInstance = (uint32_t)instanceRecords.size();
+            record.instanceCount = (uint32_t)meshes[i].instances.size();
+            record.nameOffset = AddString(strings, meshes[i].name);
+            record.nameLength = (uint32_t)meshes[i].name.size();
+            for (int axis = 0; axis < 3; axis++) {
+                record.boundsMin[axis] = meshes[i].boundsMin[axis];
+                record.boundsMax[axis] = meshes[i].boundsMax[axis];
+            }
+            meshRecords.push_back(record);
+
+            for (size_t l = 0; l < meshes[i].lods.size(); l++) {
+                LodRecord lod = {};
+                lod.indexOffset = meshes[i].lods[l].indexOffset;
+                lod.indexCount = meshes[i].lods[l].indexCount;
+                lod.error = meshes[i].lods[l].error;
+                lodRecords.push_back(lod);
+            }
+
+            for (size_t n = 0; n < meshes[i].instances.size(); n++) {
+                InstanceRecord instance;
+                memcpy(instance.transform, &meshes[i].instances[n][0][0], sizeof(instance.transform));
+                instanceRecords.push_back(instance);
+            }
+
+            for (size_t t = 0; t < meshes[i].textures.size(); t++) {
+                TextureRecord texture;
+                texture.typeOffset = AddString(strings, meshes[i].textures[t].type);
+                texture.typeLength = (uint32_t)meshes[i].textures[t].type.size();
+                texture.pathOffset = AddString(strings, meshes[i].textures[t].path);
+                texture.pathLength = (uint32_t)meshes[i].textures[t].path.size();
+                textureRecords.push_back(texture);
+            }
+        }
+
+        // lay out the tables first, then the aligned geometry blobs
+        MeshCacheHeader header = {};
+        memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+        header.version = MESH_CACHE_VERSION;
+        header.optionsHash = optionsHash;
+        header.meshCount = (uint32_t)meshRecords.size();
+        header.sourceFileCount = (uint32_t)sourceRecords.size();
+        header.textureCount = (uint32_t)textureRecords.size();
+        header.lodCount = (uint32_t)lodRecords.size();
+        header.instanceCount = (uint32_t)instanceRecords.size();
+        header.sourceTableOffset = sizeof(MeshCacheHeader);
+        header.meshTableOffset = header.sourceTableOffset + sourceRecords.size() * sizeof(SourceFileRecord);
+        header.textureTableOffset = header.meshTableOffset + meshRecords.size() * sizeof(MeshRecord);
+        header.lodTableOffset = header.textureTableOffset + textureRecords.size() * sizeof(TextureRecord);
+        header.instanceTableOffset = header.lodTableOffset + lodRecords.size() * sizeof(LodRecord);
+        header.stringsOffset = header.instanceTableOffset + instanceRecords.size() * sizeof(InstanceRecord);
+        header.stringsSize = strings.size();
+
+        uint64_t offset = header.stringsOffset + header.stringsSize;
+        for (size_t i = 0; i < meshRecords.size(); i++) {
+            meshRecords[i].vertexOffset = AlignUp(offset);
+            offset = meshRecords[i].vertexOffset + (uint64_t)meshRecords[i].vertexCount * sizeof(Vertex);
+            meshRecords[i].indexOffset = AlignUp(offset);
+            offset = meshRecords[i].indexOffset + (uint64_t)meshRecords[i].indexCount * sizeof(GLuint);
+        }
+        header.fileSize = offset;
+
+        // write to a temporary file so a crash never leaves a half-written cache behind
+        std::string cachePath = GetCachePath(objFileName);
+        std::string temporaryPath = cachePath + ".tmp";
+        std::ofstream out(temporaryPath.c_str(), std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cerr << "WARNING: could not write mesh cache " << cachePath << std::endl;
+            return false;
+        }
+
+        out.write((const char*)&header, sizeof(header));
+        out.write((const char*)sourceRecords.data(), sourceRecords.size() * sizeof(SourceFileRecord));
+        out.write((const char*)meshRecords.data(), meshRecords.size() * sizeof(MeshRecord));
+        out.write((const char*)textureRecords.data(), textureRecords.size() * sizeof(TextureRecord));
+        out.write((const char*)lodRecords.data(), lodRecords.size() * sizeof(LodRecord));
+        out.write((const char*)instanceRecords.data(), instanceRecords.size() * sizeof(InstanceRecord));
+        out.write(strings.data(), strings.size());
+
+        uint64_t position = header.stringsOffset + header.stringsSize;
+        for (size_t i = 0; i < meshes.size(); i++) {
+            WritePadding(out, position, meshRecords[i].vertexOffset);
+            out.write((const char*)meshes[i].vertices.data(), meshes[i].vertices.size() * sizeof(Vertex));
+            position += meshes[i].vertices.size() * sizeof(Vertex);
+
+            WritePadding(out, position, meshRecords[i].indexOffset);
+            out.write((const char*)meshes[i].indices.data(), meshes[i].indices.size() * sizeof(GLuint));
+            position += meshes[i].indices.size() * sizeof(GLuint);
+        }
+
+        bool written = out.good();
+        out.close();
+        if (!written) {
+            std::remove(temporaryPath.c_str());
+            std::cerr << "WARNING: could not write mesh cache " << cachePath << std::endl;
+            return false;
+        }
+
+        std::remove(cachePath.c_str());
+        if (std::rename(temporaryPath.c_str(), cachePath.c_str()) != 0) {
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+
+        std::cout << "Baked mesh cache : " << cachePath << " (" << header.fileSize << " bytes)" << std::endl;
+        return true;
+    }
+
+    bool MeshCache::Open(const std::string& objFileName, uint32_t optionsHash)
+    {
+        if (!file.Open(GetCachePath(objFileName)))
+            return false;
+
+        if (!Validate(optionsHash)) {
+            file.Close();
+            return false;
+        }
+        return true;
+    }
+
+    void MeshCache::Close()
+    {
+        file.Close();
+    }
+
+    bool MeshCache::Validate(uint32_t optionsHash)
+    {
+        if (file.GetSize() < sizeof(MeshCacheHeader))
+            return false;
+
+        const MeshCacheHeader* header = (const MeshCacheHeader*)file.GetData();
+        if (memcmp(header->magic, MESH_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != MESH_CACHE_VERSION ||
+            header->optionsHash != optionsHash ||
+            header->fileSize != file.GetSize())
+            return false;
+
+        uint64_t fileSize = file.GetSize();
+        if (header->sourceTableOffset + (uint64_t)header->sourceFileCount * sizeof(SourceFileRecord) > fileSize ||
+            header->meshTableOffset + (uint64_t)header->meshCount * sizeof(MeshRecord) > fileSize ||
+            header->textureTableOffset + (uint64_t)header->textureCount * sizeof(TextureRecord) > fileSize ||
+            header->lodTableOffset + (uint64_t)header->lodCount * sizeof(LodRecord) > fileSize ||
+            header->instanceTableOffset + (uint64_t)header->instanceCount * sizeof(InstanceRecord) > fileSize ||
+            header->stringsOffset + header->stringsSize > fileSize)
+            return false;
+
+        // stale if any source file changed since the bake
+        const SourceFileRecord* sources = (const SourceFileRecord*)(file.GetData() + header->sourceTableOffset);
+        for (uint32_t i = 0; i < header->sourceFileCount; i++) {
+            if ((uint64_t)sources[i].pathOffset + sources[i].pathLength > header->stringsSize)
+                return false;
+            int64_t modifiedTime;
+            uint64_t sourceSize;
+            std::string sourcePath = ReadString(sources[i].pathOffset, sources[i].pathLength);
+            if (!GetFileStamp(sourcePath, modifiedTime, sourceSize) ||
+                modifiedTime != sources[i].modifiedTime || sourceSize != sources[i].fileSize)
+                return false;
+        }
+
+        const MeshRecord* meshRecords = (const MeshRecord*)(file.GetData() + header->meshTableOffset);
+        for (uint32_t i = 0; i < header->meshCount; i++) {
+            const MeshRecord& record = meshRecords[i];
+            if (record.vertexOffset % MESH_CACHE_ALIGNMENT != 0 || record.indexOffset % MESH_CACHE_ALIGNMENT != 0 ||
+                record.vertexOffset + (uint64_t)record.vertexCount * sizeof(Vertex) > fileSize ||
+                record.indexOffset + (uint64_t)record.indexCount * sizeof(GLuint) > fileSize ||
+                (uint64_t)record.firstTexture + record.textureCount > header->textureCount ||
+                (uint64_t)record.firstLod + record.lodCount > header->lodCount ||
+                (uint64_t)record.firstInstance + record.instanceCount > header->instanceCount ||
+                (uint64_t)record.nameOffset + record.nameLength > header->stringsSize)
+                return false;
+        }
+
+        // every level has to lie inside the index blob of its mesh
+        const LodRecord* lods = (const LodRecord*)(file.GetData() + header->lodTableOffset);
+        for (uint32_t i = 0; i < header->meshCount; i++) {
+            for (uint32_t l = 0; l < meshRecords[i].lodCount; l++) {
+                const LodRecord& lod = lods[meshRecords[i].firstLod + l];
+                if ((uint64_t)lod.indexOffset + lod.indexCount > meshRecords[i].indexCount)
+                    return false;
+            }
+        }
+
+        const TextureRecord* textures = (const TextureRecord*)(file.GetData() + header->textureTableOffset);
+        for (uint32_t i = 0; i < header->textureCount; i++) {
+            if ((uint64_t)textures[i].typeOffset + textures[i].typeLength > header->stringsSize ||
+                (uint64_t)textures[i].pathOffset + textures[i].pathLength > header->stringsSize)
+                return false;
+        }
+
+        return true;
+    }
+
+    std::string MeshCache::ReadString(uint32_t offset, uint32_t length) const
+    {
+        const MeshCacheHeader* header = (const MeshCacheHeader*)file.GetData();
+        return std::string((const char*)file.GetData() + header->stringsOffset + offset, length);
+    }
+
+    size_t MeshCache::GetMeshCount() const
+    {
+        if (!file.IsOpen())
+            return 0;
+        return ((const MeshCacheHeader*)file.GetData())->meshCount;
+    }
+
+    CachedMesh MeshCache::GetMesh(size_t index) const
+    {
+        const MeshCacheHeader* header = (const MeshCacheHeader*)file.GetData();
+        const MeshRecord& record = ((const MeshRecord*)(file.GetData() + header->meshTableOffset))[index];
+        const TextureRecord* textures = (const TextureRecord*)(file.GetData() + header->textureTableOffset);
+
+        CachedMesh mesh;
+        mesh.name = ReadString(record.nameOffset, record.nameLength);
+        mesh.vertices = (const Vertex*)(file.GetData() + record.vertexOffset);
+        mesh.vertexCount = record.vertexCount;
+        mesh.indices = (const GLuint*)(file.GetData() + record.indexOffset);
+        mesh.indexCount = record.indexCount;
+        mesh.boundsMin = glm::vec3(record.boundsMin[0], record.boundsMin[1], record.boundsMin[2]);
+        mesh.boundsMax = glm::vec3(record.boundsMax[0], record.boundsMax[1], record.boundsMax[2]);
+
+        const LodRecord* lods = (const LodRecord*)(file.GetData() + header->lodTableOffset);
+        for (uint32_t l = 0; l < record.lodCount; l++) {
+            MeshLod lod;
+            lod.indexOffset = lods[record.firstLod + l].indexOffset;
+            lod.indexCount = lods[record.firstLod + l].indexCount;
+            lod.error = lods[record.firstLod + l].error;
+            mesh.lods.push_back(lod);
+        }
+
+        const InstanceRecord* instances = (const InstanceRecord*)(file.GetData() + header->instanceTableOffset);
+        for (uint32_t n = 0; n < record.instanceCount; n++) {
+            glm::mat4 transform;
+            memcpy(&transform[0][0], instances[record.firstInstance + n].transform, sizeof(instances[n].transform));
+            mesh.instances.push_back(transform);
+        }
+
+        for (uint32_t t = 0; t < record.textureCount; t++) {
+            const TextureRecord& texture = textures[record.firstTexture + t];
+            TextureReference reference;
+            reference.type = ReadString(texture.typeOffset, texture.typeLength);
+            reference.path = ReadString(texture.pathOffset, texture.pathLength);
+            mesh.textures.push_back(reference);
+        }
+        return mesh;
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef MeshCache_hpp
+#define MeshCache_hpp
+
+#include "Mesh.hpp"
+#include "MappedFile.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // View of one mesh stored in a baked cache file; the pointers reference the mapped file
+    struct CachedMesh
+    {
+        std::string name;
+        const Vertex* vertices;
+        uint32_t vertexCount;
+        const GLuint* indices;
+        uint32_t indexCount;
+        std::vector<MeshLod> lods;
+        std::vector<TextureReference> textures;
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        std::vector<glm::mat4> instances;
+    };
+
+    // Versioned binary file holding GPU-ready geometry baked from an .obj, stored next to it
+    class MeshCache
+    {
+    public:
+        // Returns the path of the cache file that belongs to an .obj file
+        static std::string GetCachePath(const std::string& objFileName);
+
+        // Bakes the meshes to disk, recording the source files the cache depends on
+        static bool Write(const std::string& objFileName, const std::vector<std::string>& sourceFiles,
+            uint32_t optionsHash, const std::vector<MeshData>& meshes);
+
+        // Maps the cache of an .obj file; fails if it is missing, corrupt, built with other options or older than its sources
+        bool Open(const std::string& objFileName, uint32_t optionsHash);
+        void Close();
+
+        size_t GetMeshCount() const;
+        CachedMesh GetMesh(size_t index) const;
+
+    private:
+        MappedFile file;
+
+        bool Validate(uint32_t optionsHash);
+        std::string ReadString(uint32_t offset, uint32_t length) const;
+    };
+}
+
+#endif /* MeshCache_hpp */
@@ -0,0 +1,292 @@
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace gps {
+
+    const float MeshOptimizer::OVERDRAW_THRESHOLD = 1.05f;
+
+    static const GLuint UNUSED_VERTEX = 0xffffffffu;
+
+    // FIFO cache over vertex ids; a vertex is resident while fewer than cacheSize misses followed its own
+    class FifoCacheSimulator
+    {
+    public:
+        FifoCacheSimulator(size_t vertexCount, int cacheSize)
+            : insertedAt(vertexCount, 0), cacheSize((uint32_t)cacheSize), timestamp((uint32_t)cacheSize + 1)
+        {
+        }
+
+        // True on a miss
+        bool Access(GLuint vertex)
+        {
+            if (timestamp - insertedAt[vertex] <= cacheSize)
+                return false;
+            insertedAt[vertex] = timestamp++;
+            return true;
+        }
+
+        void Flush()
+        {
+            timestamp += cacheSize + 1;
+        }
+
+    private:
+        std::vector<uint32_t> insertedAt;
+        uint32_t cacheSize;
+        uint32_t timestamp;
+    };
+
+    CacheStats MeshOptimizer::AnalyzeVertexCache(const std::vector<GLuint>& indices, size_t vertexCount, int cacheSize)
+    {
+        CacheStats stats;
+        if (indices.size() < 3)
+            return stats;
+
+        FifoCacheSimulator cache(vertexCount, cacheSize);
+        std::vector<char> referenced(vertexCount, 0);
+        size_t misses = 0;
+        size_t referencedCount = 0;
+        for (size_t i = 0; i < indices.size(); i++) {
+            if (cache.Access(indices[i]))
+                misses++;
+            if (!referenced[indices[i]]) {
+                referenced[indices[i]] = 1;
+                referencedCount++;
+            }
+        }
+
+        stats.acmr = (float)misses / (float)(indices.size() / 3);
+        stats.atvr = (float)misses / (float)referencedCount;
+        return stats;
+    }
+
+    // Next fanning vertex after a dead end: a recently used vertex that still has triangles, else the next one in input order
+    static int64_t SkipDeadEnd(std::vector<GLuint>& deadEndStack, const std::vector<uint32_t>& liveTriangles, size_t& cursor)
+    {
+        while (!deadEndStack.empty()) {
+            GLuint vertex = deadEndStack.back();
+            deadEndStack.pop_back();
+            if (liveTriangles[vertex] > 0)
+                return vertex;
+        }
+        for (; cursor < liveTriangles.size(); cursor++) {
+            if (liveTriangles[cursor] > 0)
+                return (int64_t)cursor;
+        }
+        return -1;
+    }
+
+    std::vector<size_t> MeshOptimizer::OptimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount, int cacheSize)
+    {
+        std::vector<size_t> hardBoundaries;
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0)
+            return hardBoundaries;
+
+        // triangles around every vertex, in one array with per-vertex offsets
+        std::vector<uint32_t> liveTriangles(vertexCount, 0);
+        for (size_t i = 0; i < triangleCount * 3; i++)
+            liveTriangles[indices[i]]++;
+        std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+        for (size_t v = 0; v < vertexCount; v++)
+            adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+        std::vector<uint32_t> adjacency(triangleCount * 3);
+        std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (size_t i = 0; i < triangleCount * 3; i++)
+            adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+
+        std::vector<uint32_t> cacheTime(vertexCount, 0);
+        std::vector<char> emitted(triangleCount, 0);
+        std::vector<GLuint> deadEndStack;
+        std::vector<GLuint> candidates;
+        std::vector<GLuint> output;
+        output.reserve(triangleCount * 3);
+
+        uint32_t timestamp = (uint32_t)cacheSize + 1;
+        size_t cursor = 0;
+        int64_t fanningVertex = SkipDeadEnd(deadEndStack, liveTriangles, cursor);
+        hardBoundaries.push_back(0);
+
+        while (fanningVertex >= 0) {
+            // emit every remaining triangle around the fanning vertex
+            candidates.clear();
+            for (uint32_t a = adjacencyOffsets[fanningVertex]; a < adjacencyOffsets[fanningVertex + 1]; a++) {
+                uint32_t triangle = adjacency[a];
+                if (emitted[triangle])
+                    continue;
+                for (int corner = 0; corner < 3; corner++) {
+                    GLuint vertex = indices[triangle * 3 + corner];
+                    output.push_back(vertex);
+                    deadEndStack.push_back(vertex);
+                    candidates.push_back(vertex);
+                    liveTriangles[vertex]--;
+                    if (timestamp - cacheTime[vertex] > (uint32_t)cacheSize)
+                        cacheTime[vertex] = timestamp++;
+                }
+                emitted[triangle] = 1;
+            }
+
+            // prefer the vertex that has been in the cache longest and will still be there after its own fan
+            int64_t nextVertex = -1;
+            int64_t bestPriority = -1;
+            for (size_t i = 0; i < candidates.size(); i++) {
+                GLuint vertex = candidates[i];
+                if (liveTriangles[vertex] == 0)
+                    continue;
+                int64_t priority = 0;
+                if ((int64_t)(timestamp - cacheTime[vertex]) + 2 * (int64_t)liveTriangles[vertex] <= cacheSize)
+                    priority = timestamp - cacheTime[vertex];
+                if (priority > bestPriority) {
+                    bestPriority = priority;
+                    nextVertex = vertex;
+                }
+            }
+
+            if (nextVertex < 0) {
+                nextVertex = SkipDeadEnd(deadEndStack, liveTriangles, cursor);
+                if (nextVertex >= 0)
+                    hardBoundaries.push_back(output.size() / 3);
+            }
+            fanningVertex = nextVertex;
+        }
+
+        indices.swap(output);
+        return hardBoundaries;
+    }
+
+    // Area-weighted center and normal of a run of triangles
+    struct ClusterShape
+    {
+        glm::vec3 centroid;
+        glm::vec3 normal;
+        float area;
+    };
+
+    static ClusterShape MeasureTriangles(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+        size_t firstTriangle, size_t endTriangle)
+    {
+        ClusterShape shape = {glm::vec3(0.0f), glm::vec3(0.0f), 0.0f};
+        for (size_t t = firstTriangle; t < endTriangle; t++) {
+            const glm::vec3& p0 = vertices[indices[t * 3 + 0]].Position;
+            const glm::vec3& p1 = vertices[indices[t * 3 + 1]].Position;
+            const glm::vec3& p2 = vertices[indices[t * 3 + 2]].Position;
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float area = glm::length(normal) * 0.5f;
+            shape.centroid += (p0 + p1 + p2) * (area / 3.0f);
+            shape.normal += normal;
+            shape.area += area;
+        }
+        if (shape.area > 0.0f)
+            shape.centroid /= shape.area;
+        return shape;
+    }
+
+    size_t MeshOptimizer::OptimizeOverdraw(const std::vector<Vertex>& vertices, std::vector<GLuint>& indices,
+        const std::vector<size_t>& hardBoundaries, int cacheSize, float threshold)
+    {
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0)
+            return 0;
+
+        // cut the order into clusters wherever the cache allows it: at Tipsify's dead ends and wherever a
+        // cluster's own ACMR has come down close to that of the whole mesh
+        float splitAcmr = AnalyzeVertexCache(indices, vertices.size(), cacheSize).acmr * threshold;
+        std::vector<size_t> clusterStarts;
+        FifoCacheSimulator cache(vertices.size(), cacheSize);
+        size_t nextHardBoundary = 0;
+        size_t clusterMisses = 0;
+        size_t clusterTriangles = 0;
+        bool split = true;
+        for (size_t t = 0; t < triangleCount; t++) {
+            while (nextHardBoundary < hardBoundaries.size() && hardBoundaries[nextHardBoundary] < t)
+                nextHardBoundary++;
+            if (nextHardBoundary < hardBoundaries.size() && hardBoundaries[nextHardBoundary] == t)
+                split = true;
+            if (split) {
+                clusterStarts.push_back(t);
+                cache.Flush();
+                clusterMisses = 0;
+                clusterTriangles = 0;
+                split = false;
+            }
+
+            for (int corner = 0; corner < 3; corner++) {
+                if (cache.Access(indices[t * 3 + corner]))
+                    clusterMisses++;
+            }
+            clusterTriangles++;
+            if ((float)clusterMisses <= splitAcmr * (float)clusterTriangles)
+                split = true;
+        }
+        clusterStarts.push_back(triangleCount);
+
+        size_t clusterCount = clusterStarts.size() - 1;
+        if (clusterCount < 2)
+            return clusterCount;
+
+        // outward-facing clusters tend to occlude the rest of the mesh, so they go first (Sander et al. 2007)
+        ClusterShape meshShape = MeasureTriangles(vertices, indices, 0, triangleCount);
+        std::vector<float> sortKeys(clusterCount);
+        std::vector<size_t> order(clusterCount);
+        for (size_t c = 0; c < clusterCount; c++) {
+            ClusterShape shape = MeasureTriangles(vertices, indices, clusterStarts[c], clusterStarts[c + 1]);
+            float normalLength = glm::length(shape.normal);
+            sortKeys[c] = normalLength > 0.0f ? glm::dot(shape.centroid - meshShape.centroid, shape.normal / normalLength) : 0.0f;
+            order[c] = c;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });
+
+        std::vector<GLuint> sorted;
+        sorted.reserve(triangleCount * 3);
+        for (size_t i = 0; i < clusterCount; i++) {
+            size_t c = order[i];
+            sorted.insert(sorted.end(), indices.begin() + clusterStarts[c] * 3, indices.begin() + clusterStarts[c + 1] * 3);
+        }
+        // a trailing partial triangle, if any, stays where it was
+        sorted.insert(sorted.end(), indices.begin() + triangleCount * 3, indices.end());
+        indices.swap(sorted);
+        return clusterCount;
+    }
+
+    void MeshOptimizer::OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices)
+    {
+        std::vector<GLuint> remap(vertices.size(), UNUSED_VERTEX);
+        GLuint nextVertex = 0;
+        for (size_t i = 0; i < indices.size(); i++) {
+            if (remap[indices[i]] == UNUSED_VERTEX)
+                remap[indices[i]] = nextVertex++;
+            indices[i] = remap[indices[i]];
+        }
+        // unreferenced vertices are kept at the end
+        for (size_t v = 0; v < vertices.size(); v++) {
+            if (remap[v] == UNUSED_VERTEX)
+                remap[v] = nextVertex++;
+        }
+
+        std::vector<Vertex> reordered(vertices.size());
+        for (size_t v = 0; v < vertices.size(); v++)
+            reordered[remap[v]] = vertices[v];
+        vertices.swap(reordered);
+    }
+
+    MeshOptimizerReport MeshOptimizer::Optimize(MeshData& mesh)
+    {
+        MeshOptimizerReport report;
+        size_t vertexCount = mesh.vertices.size();
+        if (mesh.indices.size() % 3 != 0)
+            return report;
+        report.original = AnalyzeVertexCache(mesh.indices, vertexCount, CACHE_SIZE);
+
+        std::vector<size_t> hardBoundaries = OptimizeVertexCache(mesh.indices, vertexCount, CACHE_SIZE);
+        report.vertexCache = AnalyzeVertexCache(mesh.indices, vertexCount, CACHE_SIZE);
+
+        report.clusterCount = OptimizeOverdraw(mesh.vertices, mesh.indices, hardBoundaries, CACHE_SIZE, OVERDRAW_THRESHOLD);
+        report.overdraw = AnalyzeVertexCache(mesh.indices, vertexCount, CACHE_SIZE);
+
+        OptimizeVertexFetch(mesh.vertices, mesh.indices);
+        report.vertexFetch = AnalyzeVertexCache(mesh.indices, vertexCount, CACHE_SIZE);
+        return report;
+    }
+}
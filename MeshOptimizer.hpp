@@ -0,0 +1,58 @@
+#ifndef MeshOptimizer_hpp
+#define MeshOptimizer_hpp
+
+#include "Mesh.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+    // Post-transform cache efficiency of an index order, simulated on a FIFO cache
+    struct CacheStats
+    {
+        // cache misses per triangle (0.5 is ideal for large regular meshes, 3 the worst)
+        float acmr = 0.0f;
+        // cache misses per referenced vertex (1 is ideal)
+        float atvr = 0.0f;
+    };
+
+    // Cache statistics after each optimization pass
+    struct MeshOptimizerReport
+    {
+        CacheStats original;
+        CacheStats vertexCache;
+        CacheStats overdraw;
+        CacheStats vertexFetch;
+        size_t clusterCount = 0;
+    };
+
+    // Reorders the triangles and vertices of an imported mesh for the GPU: Tipsify for the vertex cache, a
+    // view-independent cluster sort against overdraw, then vertex order of first use for fetch locality
+    class MeshOptimizer
+    {
+    public:
+        // FIFO size used both by Tipsify and the simulation; small enough to suit every GPU
+        static const int CACHE_SIZE = 16;
+        // Clusters may be cut where their ACMR stays within this factor of the whole mesh
+        static const float OVERDRAW_THRESHOLD;
+
+        static CacheStats AnalyzeVertexCache(const std::vector<GLuint>& indices, size_t vertexCount, int cacheSize);
+
+        // Tipsify (Sander et al. 2007); returns the first triangle of every cluster it had to restart at a dead end
+        static std::vector<size_t> OptimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount, int cacheSize);
+
+        // Splits the triangle order into clusters and draws the outward-facing ones, the likely occluders, first;
+        // returns the cluster count
+        static size_t OptimizeOverdraw(const std::vector<Vertex>& vertices, std::vector<GLuint>& indices,
+            const std::vector<size_t>& hardBoundaries, int cacheSize, float threshold);
+
+        // Renumbers the vertices in the order the indices first use them
+        static void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices);
+
+        // Runs all three passes; meshes whose index count is not a multiple of 3 are left alone
+        static MeshOptimizerReport Optimize(MeshData& mesh);
+    };
+}
+
+#endif /* MeshOptimizer_hpp */
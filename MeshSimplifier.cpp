@@ -0,0 +1,326 @@
+#include "MeshSimplifier.hpp"
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+namespace gps {
+
+    static const GLuint NO_VERTEX = 0xffffffffu;
+    // A level has to drop at least this share of the previous level's triangles to be worth keeping
+    static const float MIN_LEVEL_REDUCTION = 0.15f;
+    // Coarser levels would no longer resemble the mesh from any distance, as a share of the bounds diagonal
+    static const float MAX_LEVEL_ERROR = 0.1f;
+    // Collapses may not turn a triangle further than this (cosine of about 75 degrees)
+    static const float MIN_NORMAL_COSINE = 0.25f;
+
+    // Sum of squared distances to a set of area-weighted planes
+    struct Quadric
+    {
+        double a00, a01, a02, a11, a12, a22;
+        double b0, b1, b2;
+        double c;
+        double weight;
+
+        void AddPlane(const glm::vec3& normal, float distance, float area)
+        {
+            double nx = normal.x, ny = normal.y, nz = normal.z, d = distance, w = area;
+            a00 += w * nx * nx; a01 += w * nx * ny; a02 += w * nx * nz;
+            a11 += w * ny * ny; a12 += w * ny * nz; a22 += w * nz * nz;
+            b0 += w * nx * d; b1 += w * ny * d; b2 += w * nz * d;
+            c += w * d * d;
+            weight += w;
+        }
+
+        void Add(const Quadric& other)
+        {
+            a00 += other.a00; a01 += other.a01; a02 += other.a02;
+            a11 += other.a11; a12 += other.a12; a22 += other.a22;
+            b0 += other.b0; b1 += other.b1; b2 += other.b2;
+            c += other.c;
+            weight += other.weight;
+        }
+
+        double Evaluate(const glm::vec3& p) const
+        {
+            double x = p.x, y = p.y, z = p.z;
+            return a00 * x * x + 2.0 * a01 * x * y + 2.0 * a02 * x * z + a11 * y * y + 2.0 * a12 * y * z + a22 * z * z
+                + 2.0 * (b0 * x + b1 * y + b2 * z) + c;
+        }
+    };
+
+    struct PositionKey
+    {
+        uint32_t bits[3];
+
+        bool operator==(const PositionKey& other) const {
+            return bits[0] == other.bits[0] && bits[1] == other.bits[1] && bits[2] == other.bits[2];
+        }
+    };
+
+    struct PositionKeyHash
+    {
+        size_t operator()(const PositionKey& key) const {
+            uint64_t hash = 14695981039346656037ULL;
+            for (int i = 0; i < 3; i++) {
+                hash ^= key.bits[i];
+                hash *= 1099511628211ULL;
+            }
+            return (size_t)hash;
+        }
+    };
+
+    static PositionKey MakePositionKey(const glm::vec3& position)
+    {
+        PositionKey key;
+        for (int axis = 0; axis < 3; axis++) {
+            // -0 and 0 are the same place
+            float value = position[axis] == 0.0f ? 0.0f : position[axis];
+            memcpy(&key.bits[axis], &value, sizeof(float));
+        }
+        return key;
+    }
+
+    static uint64_t MakeEdgeKey(GLuint from, GLuint to)
+    {
+        return ((uint64_t)from << 32) | to;
+    }
+
+    // Collapse of every vertex at one position onto the vertices at a neighbouring position
+    struct Collapse
+    {
+        GLuint from;
+        GLuint to;
+        float error;
+    };
+
+    std::vector<GLuint> MeshSimplifier::Simplify(const std::vector<Vertex>& vertices, const std::vector<GLuint>& sourceIndices,
+        size_t targetIndexCount, float targetError, float& resultError)
+    {
+        resultError = 0.0f;
+        std::vector<GLuint> indices(sourceIndices.begin(), sourceIndices.begin() + sourceIndices.size() / 3 * 3);
+        size_t vertexCount = vertices.size();
+
+        // vertices that share a position (split by a seam) form a group named after its first vertex,
+        // linked in a ring through nextInGroup
+        std::vector<GLuint> group(vertexCount);
+        std::vector<GLuint> nextInGroup(vertexCount);
+        std::unordered_map<PositionKey, GLuint, PositionKeyHash> groupOfPosition;
+        groupOfPosition.reserve(vertexCount);
+        for (GLuint v = 0; v < (GLuint)vertexCount; v++) {
+            GLuint first = groupOfPosition.emplace(MakePositionKey(vertices[v].Position), v).first->second;
+            group[v] = first;
+            if (first == v) {
+                nextInGroup[v] = v;
+            } else {
+                nextInGroup[v] = nextInGroup[first];
+                nextInGroup[first] = v;
+            }
+        }
+
+        // every edge of a closed two-manifold surface is used once in each direction; any other edge is a border
+        std::unordered_map<uint64_t, uint32_t> edgeUses;
+        edgeUses.reserve(indices.size());
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            for (int e = 0; e < 3; e++) {
+                GLuint a = group[indices[i + e]];
+                GLuint b = group[indices[i + (e + 1) % 3]];
+                if (a != b)
+                    edgeUses[MakeEdgeKey(a, b)]++;
+            }
+        }
+        std::vector<char> locked(vertexCount, 0);
+        for (auto edge = edgeUses.begin(); edge != edgeUses.end(); ++edge) {
+            GLuint a = (GLuint)(edge->first >> 32);
+            GLuint b = (GLuint)(edge->first & 0xffffffffu);
+            auto reverse = edgeUses.find(MakeEdgeKey(b, a));
+            if (edge->second != 1 || reverse == edgeUses.end() || reverse->second != 1)
+                locked[a] = locked[b] = 1;
+        }
+
+        std::vector<Quadric> quadrics(vertexCount);
+        memset(quadrics.data(), 0, quadrics.size() * sizeof(Quadric));
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            const glm::vec3& p0 = vertices[indices[i + 0]].Position;
+            const glm::vec3& p1 = vertices[indices[i + 1]].Position;
+            const glm::vec3& p2 = vertices[indices[i + 2]].Position;
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float doubleArea = glm::length(normal);
+            if (doubleArea == 0.0f)
+                continue;
+            normal /= doubleArea;
+            for (int corner = 0; corner < 3; corner++)
+                quadrics[group[indices[i + corner]]].AddPlane(normal, -glm::dot(normal, p0), doubleArea * 0.5f);
+        }
+
+        std::vector<GLuint> remap(vertexCount);
+        std::vector<char> touched(vertexCount);
+        std::vector<uint32_t> adjacencyOffsets(vertexCount + 1);
+        std::vector<uint32_t> adjacency;
+        std::vector<Collapse> collapses;
+        std::vector<std::pair<GLuint, GLuint> > memberTargets;
+
+        while (indices.size() > targetIndexCount) {
+            // triangles around every vertex
+            std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+            for (size_t i = 0; i < indices.size(); i++)
+                adjacencyOffsets[indices[i] + 1]++;
+            for (size_t v = 0; v < vertexCount; v++)
+                adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+            adjacency.resize(indices.size());
+            std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+            for (size_t i = 0; i < indices.size(); i++)
+                adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+
+            // cost of collapsing every edge either way, cheapest first
+            collapses.clear();
+            for (size_t i = 0; i < indices.size(); i += 3) {
+                for (int e = 0; e < 3; e++) {
+                    GLuint a = group[indices[i + e]];
+                    GLuint b = group[indices[i + (e + 1) % 3]];
+                    if (a == b || locked[a])
+                        continue;
+                    Quadric quadric = quadrics[a];
+                    quadric.Add(quadrics[b]);
+                    double error = quadric.weight > 0.0 ? quadric.Evaluate(vertices[b].Position) / quadric.weight : 0.0;
+                    Collapse collapse = {a, b, (float)std::sqrt(std::max(error, 0.0))};
+                    collapses.push_back(collapse);
+                }
+            }
+            std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.error < y.error; });
+
+            for (size_t v = 0; v < vertexCount; v++)
+                remap[v] = (GLuint)v;
+            std::fill(touched.begin(), touched.end(), 0);
+            size_t trianglesToRemove = (indices.size() - targetIndexCount + 2) / 3;
+            size_t removedTriangles = 0;
+            size_t appliedCollapses = 0;
+
+            for (size_t c = 0; c < collapses.size() && removedTriangles < trianglesToRemove; c++) {
+                const Collapse& collapse = collapses[c];
+                if (collapse.error > targetError)
+                    break;
+                // one collapse per neighbourhood and pass keeps the costs above valid
+                if (touched[collapse.from] || touched[collapse.to])
+                    continue;
+
+                // every vertex at the old position moves to the vertex at the new position it shares an edge with,
+                // which keeps it on its own side of a seam
+                memberTargets.clear();
+                bool valid = true;
+                GLuint member = collapse.from;
+                do {
+                    GLuint target = NO_VERTEX;
+                    for (uint32_t a = adjacencyOffsets[member]; a < adjacencyOffsets[member + 1] && valid; a++) {
+                        for (int corner = 0; corner < 3; corner++) {
+                            GLuint u = remap[indices[adjacency[a] * 3 + corner]];
+                            if (group[u] != collapse.to)
+                                continue;
+                            if (target != NO_VERTEX && target != u)
+                                valid = false;
+                            target = u;
+                        }
+                    }
+                    if (adjacencyOffsets[member] != adjacencyOffsets[member + 1]) {
+                        if (target == NO_VERTEX)
+                            valid = false;
+                        memberTargets.push_back(std::make_pair(member, target));
+                    }
+                    member = nextInGroup[member];
+                } while (member != collapse.from && valid);
+                if (!valid || memberTargets.empty())
+                    continue;
+
+                // reject collapses that fold a surviving triangle over
+                size_t collapsedTriangles = 0;
+                for (size_t m = 0; m < memberTargets.size() && valid; m++) {
+                    GLuint from = memberTargets[m].first;
+                    for (uint32_t a = adjacencyOffsets[from]; a < adjacencyOffsets[from + 1]; a++) {
+                        GLuint corners[3];
+                        for (int corner = 0; corner < 3; corner++)
+                            corners[corner] = remap[indices[adjacency[a] * 3 + corner]];
+                        GLuint g0 = group[corners[0]], g1 = group[corners[1]], g2 = group[corners[2]];
+                        if (g0 == g1 || g1 == g2 || g0 == g2)
+                            continue;
+                        if (g0 == collapse.to || g1 == collapse.to || g2 == collapse.to) {
+                            collapsedTriangles++;
+                            continue;
+                        }
+                        glm::vec3 before = glm::cross(vertices[corners[1]].Position - vertices[corners[0]].Position,
+                            vertices[corners[2]].Position - vertices[corners[0]].Position);
+                        for (int corner = 0; corner < 3; corner++) {
+                            if (corners[corner] == from)
+                                corners[corner] = memberTargets[m].second;
+                        }
+                        glm::vec3 after = glm::cross(vertices[corners[1]].Position - vertices[corners[0]].Position,
+                            vertices[corners[2]].Position - vertices[corners[0]].Position);
+                        if (glm::dot(before, after) <= MIN_NORMAL_COSINE * glm::length(before) * glm::length(after)) {
+                            valid = false;
+                            break;
+                        }
+                    }
+                }
+                if (!valid)
+                    continue;
+
+                for (size_t m = 0; m < memberTargets.size(); m++)
+                    remap[memberTargets[m].first] = memberTargets[m].second;
+                quadrics[collapse.to].Add(quadrics[collapse.from]);
+                touched[collapse.from] = touched[collapse.to] = 1;
+                removedTriangles += collapsedTriangles;
+                resultError = std::max(resultError, collapse.error);
+                appliedCollapses++;
+            }
+
+            if (appliedCollapses == 0)
+                break;
+
+            // drop the triangles that lost their area
+            std::vector<GLuint> collapsed;
+            collapsed.reserve(indices.size());
+            for (size_t i = 0; i < indices.size(); i += 3) {
+                GLuint a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+                if (group[a] == group[b] || group[b] == group[c] || group[a] == group[c])
+                    continue;
+                collapsed.push_back(a);
+                collapsed.push_back(b);
+                collapsed.push_back(c);
+            }
+            indices.swap(collapsed);
+        }
+
+        return indices;
+    }
+
+    void MeshSimplifier::BuildLodChain(MeshData& mesh, int levelCount)
+    {
+        mesh.lods.clear();
+        MeshLod fullDetail = {0, (uint32_t)mesh.indices.size(), 0.0f};
+        mesh.lods.push_back(fullDetail);
+        if (mesh.indices.size() % 3 != 0)
+            return;
+
+        float maxError = glm::length(mesh.boundsMax - mesh.boundsMin) * MAX_LEVEL_ERROR;
+        std::vector<GLuint> previous = mesh.indices;
+        float error = 0.0f;
+        for (int level = 1; level < levelCount; level++) {
+            size_t targetIndexCount = previous.size() / 6 * 3;
+            float levelError;
+            std::vector<GLuint> levelIndices = MeshSimplifier::Simplify(mesh.vertices, previous, targetIndexCount, maxError, levelError);
+            if ((float)levelIndices.size() > (float)previous.size() * (1.0f - MIN_LEVEL_REDUCTION))
+                break;
+
+            // each level is simplified from the previous one, so the errors add up
+            error += levelError;
+            MeshOptimizer::OptimizeVertexCache(levelIndices, mesh.vertices.size(), MeshOptimizer::CACHE_SIZE);
+
+            MeshLod lod = {(uint32_t)mesh.indices.size(), (uint32_t)levelIndices.size(), error};
+            mesh.lods.push_back(lod);
+            mesh.indices.insert(mesh.indices.end(), levelIndices.begin(), levelIndices.end());
+            previous.swap(levelIndices);
+        }
+    }
+}
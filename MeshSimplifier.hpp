@@ -0,0 +1,29 @@
+#ifndef MeshSimplifier_hpp
+#define MeshSimplifier_hpp
+
+#include "Mesh.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+    // Quadric error metric simplification (Garland and Heckbert 1997) by half-edge collapses, so every level
+    // reuses the vertices of the full mesh and only needs its own index range.
+    // Open edges (mesh and material borders) are locked; a collapse across a UV or normal seam moves every
+    // vertex of the seam along its own side, so attributes never bleed across it.
+    class MeshSimplifier
+    {
+    public:
+        // Collapses edges until the index count reaches targetIndexCount or the next collapse would move the surface
+        // further than targetError (object-space distance); resultError receives the largest error committed
+        static std::vector<GLuint> Simplify(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+            size_t targetIndexCount, float targetError, float& resultError);
+
+        // Appends up to levelCount - 1 coarser levels, each about half the previous one, to mesh.indices and
+        // describes every level, the full one included, in mesh.lods
+        static void BuildLodChain(MeshData& mesh, int levelCount);
+    };
+}
+
+#endif /* MeshSimplifier_hpp */
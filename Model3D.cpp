@@ -1,16 +1,434 @@
 #include "Model3D.hpp"
+#include "AssetRegistry.hpp"
+#include "InstanceStream.hpp"
+#include "MeshCache.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshSimplifier.hpp"
+#include "ObjParser.hpp"
+#include "RenderStats.hpp"
+#include "ShapeInstancer.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <unordered_map>
 
 namespace gps {
 
+	// Key used to recognise face corners that resolve to the same vertex
+	struct VertexKey
+	{
+		int32_t values[8];
+
+		bool operator==(const VertexKey& other) const {
+			for (int i = 0; i < 8; i++)
+				if (values[i] != other.values[i])
+					return false;
+			return true;
+		}
+	};
+
+	struct VertexKeyHash
+	{
+		size_t operator()(const VertexKey& key) const {
+			// FNV-1a over the key words
+			uint64_t hash = 14695981039346656037ULL;
+			for (int i = 0; i < 8; i++) {
+				hash ^= (uint32_t)key.values[i];
+				hash *= 1099511628211ULL;
+			}
+			return (size_t)hash;
+		}
+	};
+
+	// Builds the dedup key of a vertex, either from its OBJ index triple or from its quantized attributes
+	static VertexKey MakeVertexKey(VERTEX_DEDUP_MODE mode, const tinyobj::index_t& idx, const gps::Vertex& vertex)
+	{
+		VertexKey key = {};
+		if (mode == DEDUP_INDEX_TRIPLE) {
+			key.values[0] = idx.vertex_index;
+			key.values[1] = idx.normal_index;
+			key.values[2] = idx.texcoord_index;
+			return key;
+		}
+
+		// positions snap to 0.1mm, normals and texture coordinates to 1/4096
+		key.values[0] = (int32_t)std::lround(vertex.Position.x * 10000.0f);
+		key.values[1] = (int32_t)std::lround(vertex.Position.y * 10000.0f);
+		key.values[2] = (int32_t)std::lround(vertex.Position.z * 10000.0f);
+		key.values[3] = (int32_t)std::lround(vertex.Normal.x * 4096.0f);
+		key.values[4] = (int32_t)std::lround(vertex.Normal.y * 4096.0f);
+		key.values[5] = (int32_t)std::lround(vertex.Normal.z * 4096.0f);
+		key.values[6] = (int32_t)std::lround(vertex.TexCoords.x * 4096.0f);
+		key.values[7] = (int32_t)std::lround(vertex.TexCoords.y * 4096.0f);
+		return key;
+	}
+
+	// Faces of one mesh while ReadOBJ collects them
+	struct MeshBuilder
+	{
+		std::string name;
+		int materialId = -1;
+		size_t cornerCount = 0;
+		std::vector<gps::Vertex> vertices;
+		std::vector<GLuint> indices;
+		// Maps an already emitted vertex to its index in `vertices`
+		std::unordered_map<VertexKey, GLuint, VertexKeyHash> vertexLookup;
+	};
+
+	// Ambient, diffuse and specular maps of a material, in that order
+	static std::vector<gps::TextureReference> GetMaterialTextures(const tinyobj::material_t& material, const std::string& basePath)
+	{
+		const std::string* paths[3] = {&material.ambient_texname, &material.diffuse_texname, &material.specular_texname};
+		const char* types[3] = {"ambientTexture", "diffuseTexture", "specularTexture"};
+		std::vector<gps::TextureReference> textures;
+		for (int i = 0; i < 3; i++) {
+			if (paths[i]->empty())
+				continue;
+			gps::TextureReference currentTexture;
+			currentTexture.path = basePath + *paths[i];
+			currentTexture.type = types[i];
+			textures.push_back(currentTexture);
+		}
+		return textures;
+	}
+
+	// Merges the meshes that are not instanced into one per material; the instanced ones stay apart
+	static void MergeByMaterial(std::vector<gps::MeshData>& meshData, const std::vector<int>& materialIds,
+		const std::vector<tinyobj::material_t>& materials)
+	{
+		std::vector<gps::MeshData> merged;
+		std::map<int, size_t> mergedByMaterial;
+		for (size_t i = 0; i < meshData.size(); i++) {
+			if (!meshData[i].instances.empty()) {
+				merged.push_back(std::move(meshData[i]));
+				continue;
+			}
+			std::map<int, size_t>::iterator found = mergedByMaterial.find(materialIds[i]);
+			if (found == mergedByMaterial.end()) {
+				found = mergedByMaterial.insert(std::make_pair(materialIds[i], merged.size())).first;
+				merged.push_back(std::move(meshData[i]));
+				merged.back().name = materialIds[i] != -1 ? materials[materialIds[i]].name : "default";
+				continue;
+			}
+
+			gps::MeshData& target = merged[found->second];
+			GLuint baseVertex = (GLuint)target.vertices.size();
+			target.vertices.insert(target.vertices.end(), meshData[i].vertices.begin(), meshData[i].vertices.end());
+			for (size_t n = 0; n < meshData[i].indices.size(); n++)
+				target.indices.push_back(baseVertex + meshData[i].indices[n]);
+			if (baseVertex == 0) {
+				target.boundsMin = meshData[i].boundsMin;
+				target.boundsMax = meshData[i].boundsMax;
+			} else if (!meshData[i].vertices.empty()) {
+				target.boundsMin = glm::min(target.boundsMin, meshData[i].boundsMin);
+				target.boundsMax = glm::max(target.boundsMax, meshData[i].boundsMax);
+			}
+		}
+		meshData.swap(merged);
+	}
+
+	// Identifies the import settings a baked cache was built with
+	static uint32_t HashImportOptions(const ImportOptions& options)
+	{
+		uint32_t hash = 2166136261u;
+		hash = (hash ^ (uint32_t)options.dedupMode) * 16777619u;
+		hash = (hash ^ (uint32_t)options.optimizeMeshes) * 16777619u;
+		hash = (hash ^ (uint32_t)options.lodLevelCount) * 16777619u;
+		hash = (hash ^ (uint32_t)options.grouping) * 16777619u;
+		hash = (hash ^ (uint32_t)options.instanceRepeatedShapes) * 16777619u;
+		// caches folded under another distance cap hold differently clustered instances
+		if (options.instanceRepeatedShapes) {
+			uint32_t foldBits;
+			std::memcpy(&foldBits, &ShapeInstancer::MAX_FOLD_DISTANCE, sizeof(foldBits));
+			hash = (hash ^ foldBits) * 16777619u;
+		}
+		// the two parsers are meant to agree, but a cache baked by one must not hide a difference in the other
+		hash = (hash ^ (uint32_t)options.useParallelObjParser) * 16777619u;
+		return hash;
+	}
+
+	// Collects the .mtl files an .obj pulls in through `mtllib`, so the cache can watch them
+	static std::vector<std::string> FindMaterialLibraries(const std::string& fileName, const std::string& basePath)
+	{
+		std::vector<std::string> libraries;
+		std::ifstream objFile(fileName.c_str());
+		std::string line;
+		while (std::getline(objFile, line)) {
+			if (line.compare(0, 7, "mtllib ") != 0)
+				continue;
+			size_t start = line.find_first_not_of(" \t", 7);
+			size_t end = line.find_last_not_of(" \t\r");
+			if (start != std::string::npos && end >= start)
+				libraries.push_back(basePath + line.substr(start, end - start + 1));
+		}
+		return libraries;
+	}
+
 	void Model3D::LoadModel(std::string fileName)
 	{
         std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
-		ReadOBJ(fileName, basePath);
+		LoadModel(fileName, basePath);
 	}
 
     void Model3D::LoadModel(std::string fileName, std::string basePath)
 	{
-		ReadOBJ(fileName, basePath);
+		uint32_t optionsHash = HashImportOptions(importOptions);
+
+		// another Model3D may already have uploaded this file with the same options
+		// the baked cache keeps float vertices, but uploaded geometry differs per vertex format
+		uint32_t occluderBits;
+		std::memcpy(&occluderBits, &importOptions.occluderMinRadius, sizeof(occluderBits));
+		uint32_t geometryHash = (optionsHash ^ (uint32_t)importOptions.vertexFormat) * 16777619u;
+		geometryHash = (geometryHash ^ occluderBits) * 16777619u;
+		geometryKey = AssetRegistry::Instance().MakeGeometryKey(fileName, geometryHash);
+		const SharedGeometry* shared = AssetRegistry::Instance().AcquireGeometry(geometryKey);
+		if (shared) {
+			std::cout << "Loading : " << fileName << " (shared)" << std::endl;
+			meshes = shared->meshes;
+			return;
+		}
+
+		// the baked cache skips the text parse entirely when it is still fresh
+		MeshCache cache;
+		if (importOptions.useMeshCache && cache.Open(fileName, optionsHash)) {
+			std::cout << "Loading : " << fileName << " (baked cache)" << std::endl;
+			for (size_t i = 0; i < cache.GetMeshCount(); i++) {
+				CachedMesh cachedMesh = cache.GetMesh(i);
+				AddMesh(cachedMesh.name, cachedMesh.vertices, cachedMesh.vertexCount, cachedMesh.indices, cachedMesh.indexCount,
+					cachedMesh.lods, cachedMesh.boundsMin, cachedMesh.boundsMax, cachedMesh.textures, cachedMesh.instances);
+			}
+			UploadSharedGeometry();
+			RegisterGeometry();
+			return;
+		}
+
+		std::vector<gps::MeshData> meshData;
+		std::vector<std::string> materialLibraries;
+		ReadOBJ(fileName, basePath, meshData, materialLibraries);
+
+		// optimized and simplified once here, the baked cache keeps the result
+		ProcessMeshes(meshData);
+
+		if (importOptions.useMeshCache) {
+			std::vector<std::string> sourceFiles = materialLibraries;
+			sourceFiles.insert(sourceFiles.begin(), fileName);
+			MeshCache::Write(fileName, sourceFiles, optionsHash, meshData);
+		}
+
+		for (size_t i = 0; i < meshData.size(); i++) {
+			AddMesh(meshData[i].name, meshData[i].vertices.data(), meshData[i].vertices.size(), meshData[i].indices.data(),
+				meshData[i].indices.size(), meshData[i].lods, meshData[i].boundsMin, meshData[i].boundsMax, meshData[i].textures,
+				meshData[i].instances);
+		}
+		UploadSharedGeometry();
+		RegisterGeometry();
+	}
+
+	void Model3D::ProcessMeshes(std::vector<gps::MeshData>& meshData)
+	{
+		std::vector<MeshOptimizerReport> reports(meshData.size());
+		ThreadPool::Shared().ParallelFor(meshData.size(), [&](size_t i) {
+			if (importOptions.optimizeMeshes)
+				reports[i] = MeshOptimizer::Optimize(meshData[i]);
+			// the levels are simplified from the optimized mesh and share its vertex order
+			if (importOptions.lodLevelCount > 1)
+				MeshSimplifier::BuildLodChain(meshData[i], importOptions.lodLevelCount);
+		});
+
+		for (size_t i = 0; i < meshData.size(); i++) {
+			if (importOptions.optimizeMeshes) {
+				const MeshOptimizerReport& report = reports[i];
+				std::cout << "  mesh " << meshData[i].name << " ACMR " << report.original.acmr << " -> " << report.vertexCache.acmr
+					<< " (vertex cache) -> " << report.overdraw.acmr << " (overdraw, " << report.clusterCount << " clusters) -> "
+					<< report.vertexFetch.acmr << " (fetch), ATVR " << report.original.atvr << " -> " << report.vertexCache.atvr
+					<< " -> " << report.overdraw.atvr << " -> " << report.vertexFetch.atvr << std::endl;
+			}
+			if (meshData[i].lods.size() > 1) {
+				std::cout << "  mesh " << meshData[i].name << " LOD triangles";
+				for (size_t l = 0; l < meshData[i].lods.size(); l++)
+					std::cout << (l == 0 ? " " : " / ") << meshData[i].lods[l].indexCount / 3 << " (error " << meshData[i].lods[l].error << ")";
+				std::cout << std::endl;
+			}
+		}
+	}
+
+	// Box from the importer, sphere around its center reaching the farthest vertex
+	static MeshBounds ComputeMeshBounds(const gps::Vertex* vertices, size_t vertexCount, const glm::vec3& boundsMin,
+		const glm::vec3& boundsMax)
+	{
+		MeshBounds bounds;
+		bounds.boundsMin = boundsMin;
+		bounds.boundsMax = boundsMax;
+		bounds.sphereCenter = (boundsMin + boundsMax) * 0.5f;
+		float radiusSquared = 0.0f;
+		for (size_t v = 0; v < vertexCount; v++) {
+			glm::vec3 offset = vertices[v].Position - bounds.sphereCenter;
+			radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+		}
+		bounds.sphereRadius = std::sqrt(radiusSquared);
+		return bounds;
+	}
+
+	// Box around every instance's transformed box, sphere around its center reaching every instance's sphere
+	static MeshBounds ComputeInstanceBounds(const MeshBounds& bounds, const std::vector<glm::mat4>& instances)
+	{
+		MeshBounds result;
+		result.boundsMin = glm::vec3(FLT_MAX);
+		result.boundsMax = glm::vec3(-FLT_MAX);
+		for (size_t n = 0; n < instances.size(); n++) {
+			for (int corner = 0; corner < 8; corner++) {
+				glm::vec3 point((corner & 1) ? bounds.boundsMax.x : bounds.boundsMin.x, (corner & 2) ? bounds.boundsMax.y : bounds.boundsMin.y,
+					(corner & 4) ? bounds.boundsMax.z : bounds.boundsMin.z);
+				point = glm::vec3(instances[n] * glm::vec4(point, 1.0f));
+				result.boundsMin = glm::min(result.boundsMin, point);
+				result.boundsMax = glm::max(result.boundsMax, point);
+			}
+		}
+		result.sphereCenter = (result.boundsMin + result.boundsMax) * 0.5f;
+		result.sphereRadius = 0.0f;
+		for (size_t n = 0; n < instances.size(); n++) {
+			glm::vec3 center = glm::vec3(instances[n] * glm::vec4(bounds.sphereCenter, 1.0f));
+			float scale = glm::length(glm::vec3(instances[n][0]));
+			result.sphereRadius = std::max(result.sphereRadius, glm::length(center - result.sphereCenter) + bounds.sphereRadius * scale);
+		}
+		return result;
+	}
+
+	// Coarsest level an occluder may use, as a share of the bounding radius: coarser ones could hide what is visible
+	static const float OCCLUDER_MAX_ERROR = 0.01f;
+
+	// Positions of the coarsest level within OCCLUDER_MAX_ERROR, compacted to the vertices it uses
+	static std::shared_ptr<const OccluderGeometry> BuildOccluder(const gps::Vertex* vertices, const GLuint* indices,
+		size_t indexCount, const std::vector<gps::MeshLod>& lods, float sphereRadius)
+	{
+		size_t first = lods.empty() ? 0 : lods[0].indexOffset;
+		size_t count = lods.empty() ? indexCount : lods[0].indexCount;
+		for (size_t l = 1; l < lods.size(); l++) {
+			if (lods[l].error <= sphereRadius * OCCLUDER_MAX_ERROR) {
+				first = lods[l].indexOffset;
+				count = lods[l].indexCount;
+			}
+		}
+
+		std::shared_ptr<OccluderGeometry> occluder = std::make_shared<OccluderGeometry>();
+		std::unordered_map<GLuint, uint32_t> remap;
+		occluder->indices.reserve(count);
+		for (size_t i = first; i < first + count; i++) {
+			std::pair<std::unordered_map<GLuint, uint32_t>::iterator, bool> inserted =
+				remap.insert(std::make_pair(indices[i], (uint32_t)occluder->positions.size()));
+			if (inserted.second)
+				occluder->positions.push_back(vertices[indices[i]].Position);
+			occluder->indices.push_back(inserted.first->second);
+		}
+		return occluder;
+	}
+
+	void Model3D::AddMesh(const std::string& name, const gps::Vertex* vertices, size_t vertexCount, const GLuint* indices,
+		size_t indexCount, const std::vector<gps::MeshLod>& lods, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+		const std::vector<gps::TextureReference>& textures, const std::vector<glm::mat4>& instances)
+	{
+		MeshBounds bounds = ComputeMeshBounds(vertices, vertexCount, boundsMin, boundsMax);
+		std::shared_ptr<const OccluderGeometry> occluder;
+		if (importOptions.occluderMinRadius > 0.0f && bounds.sphereRadius >= importOptions.occluderMinRadius) {
+			occluder = BuildOccluder(vertices, indices, indexCount, lods, bounds.sphereRadius);
+			std::cout << "  mesh " << name << " occluder: " << occluder->indices.size() / 3 << " triangles" << std::endl;
+		}
+
+		VertexStream stream;
+		PackingError error;
+		if (importOptions.vertexFormat != VERTEX_FLOAT)
+			VertexPacking::Pack(vertices, vertexCount, boundsMin, boundsMax, importOptions.vertexFormat, stream, error);
+
+		size_t packedBytes;
+		if (importOptions.grouping == GROUP_BY_MATERIAL) {
+			// appended to the model's shared block, which UploadSharedGeometry allocates once every mesh is in
+			MeshRange range;
+			range.baseVertex = (GLint)(sharedVertices.size() / VertexPacking::GetStride(importOptions.vertexFormat));
+			range.vertexCount = (GLuint)vertexCount;
+			range.firstIndex = (GLuint)sharedIndices.size();
+			range.indexCount = (GLuint)indexCount;
+			const unsigned char* vertexBytes = importOptions.vertexFormat == VERTEX_FLOAT
+				? (const unsigned char*)vertices : stream.vertices.data();
+			sharedVertices.insert(sharedVertices.end(), vertexBytes,
+				vertexBytes + vertexCount * VertexPacking::GetStride(importOptions.vertexFormat));
+			sharedIndices.insert(sharedIndices.end(), indices, indices + indexCount);
+			meshes.push_back(gps::Mesh(range, stream.decode, LoadTextures(textures)));
+			packedBytes = vertexCount * VertexPacking::GetStride(importOptions.vertexFormat) + indexCount * sizeof(GLuint);
+		} else if (importOptions.vertexFormat == VERTEX_FLOAT) {
+			meshes.push_back(gps::Mesh(vertices, vertexCount, indices, indexCount, LoadTextures(textures)));
+			packedBytes = meshes.back().getBufferBytes();
+		} else {
+			meshes.push_back(gps::Mesh(stream, indices, indexCount, LoadTextures(textures)));
+			packedBytes = meshes.back().getBufferBytes();
+		}
+		meshes.back().setLods(lods);
+		// culled and sorted as a whole, so the bounds cover every copy; the occluder stays in the mesh's own space
+		meshes.back().setBounds(instances.empty() ? bounds : ComputeInstanceBounds(bounds, instances));
+		meshes.back().setOccluder(occluder);
+		meshes.back().setInstances(instances);
+		if (!instances.empty())
+			std::cout << "  mesh " << name << " drawn as " << instances.size() << " instances" << std::endl;
+
+		if (importOptions.vertexFormat == VERTEX_FLOAT)
+			return;
+		size_t floatBytes = vertexCount * sizeof(gps::Vertex) + indexCount * sizeof(GLuint);
+		std::cout << "  mesh " << name << " " << VertexPacking::GetFormatName(importOptions.vertexFormat) << ": "
+			<< floatBytes << " -> " << packedBytes << " bytes, max error position " << error.position
+			<< ", normal " << error.normalDegrees << " deg, uv " << error.texCoord << std::endl;
+	}
+
+	void Model3D::UploadSharedGeometry()
+	{
+		if (sharedIndices.empty())
+			return;
+
+		// the indices are relative to each mesh's base vertex, so 16 bits do as long as every mesh is small
+		bool shortIndices = true;
+		for (size_t i = 0; i < meshes.size(); i++)
+			shortIndices = shortIndices && meshes[i].getVertexCount() <= 65536;
+
+		size_t vertexCount = sharedVertices.size() / VertexPacking::GetStride(importOptions.vertexFormat);
+		GeometryHandle geometry;
+		GLenum indexType;
+		size_t indexBytes;
+		if (shortIndices) {
+			std::vector<uint16_t> packedIndices(sharedIndices.begin(), sharedIndices.end());
+			indexType = GL_UNSIGNED_SHORT;
+			indexBytes = packedIndices.size() * sizeof(uint16_t);
+			geometry = GeometryArena::Instance().Allocate(importOptions.vertexFormat, indexType, sharedVertices.data(),
+				vertexCount, packedIndices.data(), packedIndices.size());
+		} else {
+			indexType = GL_UNSIGNED_INT;
+			indexBytes = sharedIndices.size() * sizeof(GLuint);
+			geometry = GeometryArena::Instance().Allocate(importOptions.vertexFormat, indexType, sharedVertices.data(),
+				vertexCount, sharedIndices.data(), sharedIndices.size());
+		}
+		for (size_t i = 0; i < meshes.size(); i++)
+			meshes[i].setSharedGeometry(geometry, importOptions.vertexFormat, indexType);
+
+		std::cout << "  " << meshes.size() << " meshes share one arena block: " << sharedVertices.size() << " vertex bytes, "
+			<< indexBytes << " index bytes" << std::endl;
+		std::vector<unsigned char>().swap(sharedVertices);
+		std::vector<GLuint>().swap(sharedIndices);
+	}
+
+	// Hands the freshly built meshes and their textures over to the registry
+	void Model3D::RegisterGeometry()
+	{
+		SharedGeometry geometry;
+		geometry.meshes = meshes;
+		geometry.textures.swap(acquiredTextures);
+		acquiredByPath.clear();
+		geometry.bufferBytes = 0;
+		for (size_t i = 0; i < meshes.size(); i++)
+			geometry.bufferBytes += meshes[i].getBufferBytes();
+		AssetRegistry::Instance().AddGeometry(geometryKey, geometry);
 	}
 
 	// Draw each mesh from the model
@@ -20,17 +438,246 @@ namespace gps {
 			meshes[i].Draw(shaderProgram);
 	}
 
+	void Model3D::DrawInstanced(gps::Shader shaderProgram, const glm::mat4* modelMatrices, size_t count)
+	{
+		if (count == 0)
+			return;
+		InstanceStream& stream = InstanceStream::Instance();
+		// meshes drawn once share one copy of the matrices; a folded mesh needs each of its copies of every instance
+		GLintptr sharedOffset = -1;
+		uint32_t sharedGeneration = 0;
+		for (size_t i = 0; i < meshes.size(); i++) {
+			const std::vector<glm::mat4>& copies = meshes[i].getInstances();
+			if (!copies.empty()) {
+				GLintptr offset = stream.Write(modelMatrices, count, copies);
+				meshes[i].DrawInstances(shaderProgram, 0, offset, count * copies.size());
+				continue;
+			}
+			if (sharedOffset < 0 || sharedGeneration != stream.GetGeneration()) {
+				sharedOffset = stream.Write(modelMatrices, count, copies);
+				sharedGeneration = stream.GetGeneration();
+			}
+			meshes[i].DrawInstances(shaderProgram, 0, sharedOffset, count);
+		}
+	}
+
+	void Model3D::DrawInstanced(gps::Shader shaderProgram, const std::vector<glm::mat4>& modelMatrices)
+	{
+		DrawInstanced(shaderProgram, modelMatrices.data(), modelMatrices.size());
+	}
+
+	void Model3D::Draw(gps::Shader shaderProgram, const glm::mat4& modelMatrix, const RenderView& view)
+	{
+		if (meshLods.size() != meshes.size())
+			meshLods.assign(meshes.size(), 0);
+
+		if (view.cullingEnabled) {
+			if (culler.GetCount() != meshes.size()) {
+				std::vector<MeshBounds> bounds(meshes.size());
+				for (size_t i = 0; i < meshes.size(); i++)
+					bounds[i] = meshes[i].getBounds();
+				culler.SetBounds(bounds);
+			}
+			// one plane transform per model instead of one bounds transform per mesh
+			culler.Cull(view.frustum.ToObjectSpace(modelMatrix), visibleMeshes);
+		} else {
+			visibleMeshes.resize(meshes.size());
+			for (size_t i = 0; i < meshes.size(); i++)
+				visibleMeshes[i] = (uint32_t)i;
+		}
+		size_t frustumCulled = meshes.size() - visibleMeshes.size();
+
+		// the boxes are tested against the occluders before anything reaches GL
+		size_t occluded = 0;
+		if (view.occlusion) {
+			size_t kept = 0;
+			for (size_t v = 0; v < visibleMeshes.size(); v++) {
+				uint32_t i = visibleMeshes[v];
+				if (view.occlusion->IsOccluded(meshes[i].getBounds(), modelMatrix))
+					occluded++;
+				else
+					visibleMeshes[kept++] = i;
+			}
+			visibleMeshes.resize(kept);
+		}
+		RenderStats::Instance().AddCulling(visibleMeshes.size(), frustumCulled, occluded);
+
+		if (!view.occlusionQueries) {
+			for (size_t v = 0; v < visibleMeshes.size(); v++) {
+				uint32_t i = visibleMeshes[v];
+				SubmitMesh(i, SelectLod(i, modelMatrix, view), QUERY_NONE, shaderProgram, modelMatrix, view);
+			}
+			return;
+		}
+
+		if (meshQueries.size() != meshes.size())
+			meshQueries.assign(meshes.size(), MeshQuery());
+		glm::vec3 objectCameraPosition = glm::vec3(glm::inverse(modelMatrix) * glm::vec4(view.cameraPosition, 1.0f));
+		for (size_t v = 0; v < visibleMeshes.size(); v++) {
+			uint32_t i = visibleMeshes[v];
+			int lod = SelectLod(i, modelMatrix, view);
+			QUERY_MODE queryMode = QUERY_NONE;
+			if (meshes[i].getIndexCount(lod) / 3 >= view.occlusionQueries->minTriangles)
+				queryMode = PrepareQuery(i, objectCameraPosition, *view.occlusionQueries);
+			SubmitMesh(i, lod, queryMode, shaderProgram, modelMatrix, view);
+		}
+	}
+
+	void Model3D::SubmitMesh(size_t meshIndex, int lod, QUERY_MODE queryMode, gps::Shader shaderProgram,
+		const glm::mat4& modelMatrix, const RenderView& view)
+	{
+		GLuint query = queryMode != QUERY_NONE ? meshQueries[meshIndex].query : 0;
+		// only cut-out materials pay for the discard, the opaque permutation keeps early depth testing
+		bool alphaTested = view.alphaTestedShader && meshes[meshIndex].isAlphaTested();
+		if (alphaTested)
+			shaderProgram = *view.alphaTestedShader;
+		if (view.queue)
+			view.queue->Submit(shaderProgram, meshes[meshIndex], lod, alphaTested, queryMode, query, view.occlusionQueries);
+		else
+			RenderQueue::DrawMesh(shaderProgram, meshes[meshIndex], lod, queryMode, query, view.occlusionQueries, modelMatrix);
+	}
+
+	QUERY_MODE Model3D::PrepareQuery(size_t meshIndex, const glm::vec3& objectCameraPosition, OcclusionQueries& queries)
+	{
+		const gps::Mesh& mesh = meshes[meshIndex];
+		MeshQuery& state = meshQueries[meshIndex];
+		if (state.query == 0)
+			state.query = queries.CreateQuery();
+
+		// an earlier query is only read once the GPU has its result, never waited for
+		if (state.pending) {
+			GLuint available = GL_FALSE;
+			glGetQueryObjectuiv(state.query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available) {
+				GLuint anySamples = GL_FALSE;
+				glGetQueryObjectuiv(state.query, GL_QUERY_RESULT, &anySamples);
+				state.visible = anySamples != GL_FALSE;
+				state.pending = false;
+				RenderStats::Instance().AddQueryResult(queries.GetFrame() - state.issuedFrame,
+					state.proxy && !state.visible ? state.conditionalDraws : 0);
+			}
+		}
+
+		// from inside the box its faces may be clipped away by the near plane, so it cannot stand in for the mesh
+		const MeshBounds& bounds = mesh.getBounds();
+		glm::vec3 margin = (bounds.boundsMax - bounds.boundsMin) * 0.01f + glm::vec3(0.1f);
+		if (glm::all(glm::greaterThanEqual(objectCameraPosition, bounds.boundsMin - margin))
+			&& glm::all(glm::lessThanEqual(objectCameraPosition, bounds.boundsMax + margin))) {
+			state.visible = true;
+			return QUERY_NONE;
+		}
+
+		if (state.pending) {
+			// no new query until the last one is read; a hidden mesh stays conditional on its proxy
+			if (state.visible)
+				return QUERY_NONE;
+			state.conditionalDraws++;
+			return QUERY_CONDITIONAL;
+		}
+
+		state.pending = true;
+		state.issuedFrame = queries.GetFrame();
+		state.proxy = !state.visible;
+		state.conditionalDraws = 0;
+		// visible last frame: the draw itself tells whether it still is
+		if (state.visible)
+			return QUERY_ISSUE;
+
+		// hidden last frame: the GPU skips the draw unless the box passes a sample
+		state.conditionalDraws++;
+		return QUERY_PROXY;
+	}
+
+	void Model3D::GetBounds(glm::vec3& boundsMin, glm::vec3& boundsMax) const
+	{
+		boundsMin = boundsMax = glm::vec3(0.0f);
+		for (size_t i = 0; i < meshes.size(); i++) {
+			const MeshBounds& bounds = meshes[i].getBounds();
+			boundsMin = i == 0 ? bounds.boundsMin : glm::min(boundsMin, bounds.boundsMin);
+			boundsMax = i == 0 ? bounds.boundsMax : glm::max(boundsMax, bounds.boundsMax);
+		}
+	}
+
+	void Model3D::AddOccluders(OcclusionCuller& occlusionCuller, const glm::mat4& modelMatrix) const
+	{
+		for (size_t i = 0; i < meshes.size(); i++) {
+			if (!meshes[i].getOccluder())
+				continue;
+			const std::vector<glm::mat4>& instances = meshes[i].getInstances();
+			if (instances.empty())
+				occlusionCuller.AddOccluder(*meshes[i].getOccluder(), modelMatrix);
+			for (size_t n = 0; n < instances.size(); n++)
+				occlusionCuller.AddOccluder(*meshes[i].getOccluder(), modelMatrix * instances[n]);
+		}
+	}
+
+	// Coarsest level whose error projects to at most view.maxScreenError pixels
+	int Model3D::SelectLod(size_t meshIndex, const glm::mat4& modelMatrix, const RenderView& view)
+	{
+		const gps::Mesh& mesh = meshes[meshIndex];
+		int current = meshLods[meshIndex];
+		if (!view.lodEnabled || mesh.getLodCount() <= 1) {
+			meshLods[meshIndex] = 0;
+			return 0;
+		}
+
+		// distance from the camera to the bounding sphere, in world space
+		float scale = std::max(glm::length(glm::vec3(modelMatrix[0])), std::max(glm::length(glm::vec3(modelMatrix[1])),
+			glm::length(glm::vec3(modelMatrix[2]))));
+		const MeshBounds& bounds = mesh.getBounds();
+		glm::vec3 center = glm::vec3(modelMatrix * glm::vec4(bounds.sphereCenter, 1.0f));
+		float radius = bounds.sphereRadius * scale;
+		float distance = std::max(glm::length(center - view.cameraPosition) - radius, view.nearDistance);
+		float pixelsPerUnit = view.projectionScale * scale / distance;
+
+		int selected = 0;
+		for (int lod = 1; lod < mesh.getLodCount(); lod++) {
+			if (mesh.getLodError(lod) * pixelsPerUnit <= view.maxScreenError)
+				selected = lod;
+		}
+
+		// moving to a coarser level needs a margin below the threshold, so a camera resting near the switch
+		// distance does not make the level flicker back and forth
+		if (selected > current) {
+			int coarser = current;
+			for (int lod = current + 1; lod <= selected; lod++) {
+				if (mesh.getLodError(lod) * pixelsPerUnit <= view.maxScreenError * (1.0f - view.hysteresis))
+					coarser = lod;
+			}
+			selected = coarser;
+		}
+		meshLods[meshIndex] = selected;
+		return selected;
+	}
+
+	void Model3D::SetImportOptions(const ImportOptions& options)
+	{
+		importOptions = options;
+	}
+
 	// Does the parsing of the .obj file and fills in the data structure
-	void Model3D::ReadOBJ(std::string fileName, std::string basePath){
+	void Model3D::ReadOBJ(std::string fileName, std::string basePath, std::vector<gps::MeshData>& meshData,
+		std::vector<std::string>& materialLibraries){
 
         std::cout << "Loading : " << fileName << std::endl;
 		tinyobj::attrib_t attrib;
 		std::vector<tinyobj::shape_t> shapes;
 		std::vector<tinyobj::material_t> materials;
-		int materialId;
 
 		std::string err;
-		bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), GL_TRUE);
+		bool ret;
+		if (importOptions.useParallelObjParser) {
+			ObjParser parser;
+			ret = parser.Load(&attrib, &shapes, &materials, &err, fileName, basePath);
+			materialLibraries = parser.GetMaterialLibraries();
+			if (ret) {
+				std::cout << "Parsed " << parser.GetParsedBytes() / (1024.0 * 1024.0) << " MB in " << parser.GetParseSeconds() * 1000.0
+					<< " ms (" << parser.GetParsedBytes() / (1024.0 * 1024.0) / parser.GetParseSeconds() << " MB/s)" << std::endl;
+			}
+		} else {
+			ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), GL_TRUE);
+			materialLibraries = FindMaterialLibraries(fileName, basePath);
+		}
 
 		if (!err.empty()) { // `err` may contain warning message.
 			std::cerr << err << std::endl;
@@ -43,19 +690,36 @@ namespace gps {
 		std::cout << "# of shapes    : " << shapes.size() << std::endl;
 		std::cout << "# of materials : " << materials.size() << std::endl;
 
+		// Faces are grouped by material, within each shape or across all of them; a group becomes one mesh. Repeated
+		// shapes can only be recognised while each is still its own mesh, so instancing groups across shapes afterwards
+		bool acrossShapes = importOptions.grouping == GROUP_BY_MATERIAL && !importOptions.instanceRepeatedShapes;
+		std::vector<MeshBuilder> builders;
+		std::map<std::pair<size_t, int>, size_t> builderByGroup;
+
 		// Loop over shapes
 		for (size_t s = 0; s < shapes.size(); s++) {
-			std::vector<gps::Vertex> vertices;
-			std::vector<GLuint> indices;
-			std::vector<gps::Texture> textures;
-
 			// Loop over faces(polygon)
 			size_t index_offset = 0;
 			for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
 				int fv = shapes[s].mesh.num_face_vertices[f];
 
-				//gps::Texture currentTexture = LoadTexture("index1.png", "ambientTexture");
-				//textures.push_back(currentTexture);
+				// Only try to read materials if the .mtl file is present
+				int materialId = -1;
+				if (f < shapes[s].mesh.material_ids.size() && !materials.empty())
+					materialId = shapes[s].mesh.material_ids[f];
+
+				std::pair<size_t, int> group(acrossShapes ? 0 : s, materialId);
+				std::map<std::pair<size_t, int>, size_t>::iterator found = builderByGroup.find(group);
+				if (found == builderByGroup.end()) {
+					found = builderByGroup.insert(std::make_pair(group, builders.size())).first;
+					builders.push_back(MeshBuilder());
+					builders.back().materialId = materialId;
+					if (acrossShapes)
+						builders.back().name = materialId != -1 ? materials[materialId].name : "default";
+					else
+						builders.back().name = shapes[s].name;
+				}
+				MeshBuilder& builder = builders[found->second];
 
 				// Loop over vertices in the face.
 				for (size_t v = 0; v < fv; v++) {
@@ -75,159 +739,119 @@ namespace gps {
 						ty = attrib.texcoords[2 * idx.texcoord_index + 1];
 					}
 
-					glm::vec3 vertexPosition(vx, vy, vz);
-					glm::vec3 vertexNormal(nx, ny, nz);
-					glm::vec2 vertexTexCoords(tx, ty);
-
 					gps::Vertex currentVertex;
-					currentVertex.Position = vertexPosition;
-					currentVertex.Normal = vertexNormal;
-					currentVertex.TexCoords = vertexTexCoords;
-
-					vertices.push_back(currentVertex);
+					currentVertex.Position = glm::vec3(vx, vy, vz);
+					currentVertex.Normal = glm::vec3(nx, ny, nz);
+					currentVertex.TexCoords = glm::vec2(tx, ty);
+					builder.cornerCount++;
+
+					if (importOptions.dedupMode == DEDUP_NONE) {
+						builder.indices.push_back(builder.vertices.size());
+						builder.vertices.push_back(currentVertex);
+						continue;
+					}
 
-					indices.push_back(index_offset + v);
+					VertexKey key = MakeVertexKey(importOptions.dedupMode, idx, currentVertex);
+					auto emitted = builder.vertexLookup.find(key);
+					if (emitted != builder.vertexLookup.end()) {
+						builder.indices.push_back(emitted->second);
+					} else {
+						GLuint newIndex = builder.vertices.size();
+						builder.vertexLookup.emplace(key, newIndex);
+						builder.vertices.push_back(currentVertex);
+						builder.indices.push_back(newIndex);
+					}
 				}
 
 				index_offset += fv;
 			}
+		}
 
-			// get material id
-			// Only try to read materials if the .mtl file is present
-			int a = shapes[s].mesh.material_ids.size();
-			if (a > 0 && materials.size()>0) {
-				materialId = shapes[s].mesh.material_ids[0];
-				if (materialId != -1) {
-					gps::Material currentMaterial;
-					currentMaterial.ambient = glm::vec3(materials[materialId].ambient[0], materials[materialId].ambient[1], materials[materialId].ambient[2]);
-					currentMaterial.diffuse = glm::vec3(materials[materialId].diffuse[0], materials[materialId].diffuse[1], materials[materialId].diffuse[2]);
-					currentMaterial.specular = glm::vec3(materials[materialId].specular[0], materials[materialId].specular[1], materials[materialId].specular[2]);
-
-					//ambient texture
-					std::string ambientTexturePath = materials[materialId].ambient_texname;
-					if (!ambientTexturePath.empty())
-					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + ambientTexturePath, "ambientTexture");
-						textures.push_back(currentTexture);
-					}
-
-					//diffuse texture
-					std::string diffuseTexturePath = materials[materialId].diffuse_texname;
-					if (!diffuseTexturePath.empty())
-					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + diffuseTexturePath, "diffuseTexture");
-						textures.push_back(currentTexture);
-					}
-
-					//specular texture
-					std::string specularTexturePath = materials[materialId].specular_texname;
-					if (!specularTexturePath.empty())
-					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + specularTexturePath, "specularTexture");
-						textures.push_back(currentTexture);
-					}
+		size_t totalCornerCount = 0;
+		size_t totalVertexCount = 0;
+		std::vector<int> materialIds;
+		for (size_t m = 0; m < builders.size(); m++) {
+			MeshBuilder& builder = builders[m];
+			std::cout << "  mesh " << m << " (" << builder.name << ") vertices: " << builder.cornerCount << " -> "
+				<< builder.vertices.size() << ", VBO bytes: " << builder.cornerCount * sizeof(gps::Vertex) << " -> "
+				<< builder.vertices.size() * sizeof(gps::Vertex) << std::endl;
+			totalCornerCount += builder.cornerCount;
+			totalVertexCount += builder.vertices.size();
+
+			gps::MeshData currentMesh;
+			currentMesh.name = builder.name;
+			if (builder.materialId != -1)
+				currentMesh.textures = GetMaterialTextures(materials[builder.materialId], basePath);
+			currentMesh.boundsMin = glm::vec3(0.0f);
+			currentMesh.boundsMax = glm::vec3(0.0f);
+			if (!builder.vertices.empty()) {
+				currentMesh.boundsMin = currentMesh.boundsMax = builder.vertices[0].Position;
+				for (size_t v = 1; v < builder.vertices.size(); v++) {
+					currentMesh.boundsMin = glm::min(currentMesh.boundsMin, builder.vertices[v].Position);
+					currentMesh.boundsMax = glm::max(currentMesh.boundsMax, builder.vertices[v].Position);
 				}
 			}
-
-			meshes.push_back(gps::Mesh(vertices, indices, textures));
+			currentMesh.vertices.swap(builder.vertices);
+			currentMesh.indices.swap(builder.indices);
+			meshData.push_back(std::move(currentMesh));
+			materialIds.push_back(builder.materialId);
 		}
-	}
-
-	// Retrieves a texture associated with the object - by its name and type
-	gps::Texture Model3D::LoadTexture(std::string path, std::string type) {
 
-			for (int i = 0; i < loadedTextures.size(); i++) {
-				if (loadedTextures[i].path == path)
-				{
-					//already loaded texture
-					return loadedTextures[i];
-				}
-			}
+		if (importOptions.instanceRepeatedShapes) {
+			InstancingReport report = ShapeInstancer::FoldRepeatedShapes(meshData, materialIds);
+			std::cout << "# of shapes    : " << report.totalShapes << " -> " << report.uniqueShapes << " unique ("
+				<< report.instancedMeshes << " instanced, " << report.foldedCopies << " copies folded)" << std::endl;
+			std::cout << "  geometry bytes " << report.bytesBefore << " -> " << report.bytesAfter << " (saved "
+				<< (long long)report.bytesBefore - (long long)report.bytesAfter << "), draw calls saved: "
+				<< report.foldedCopies << std::endl;
+			if (importOptions.grouping == GROUP_BY_MATERIAL)
+				MergeByMaterial(meshData, materialIds, materials);
+		}
 
-			gps::Texture currentTexture;
-			currentTexture.id = ReadTextureFromFile(path.c_str());
-			currentTexture.type = std::string(type);
-			currentTexture.path = path;
+		std::cout << "# of meshes    : " << meshData.size() << " (" << (importOptions.grouping == GROUP_BY_MATERIAL ? "grouped by material"
+			: "split by material per shape") << ")" << std::endl;
+		std::cout << "# of vertices  : " << totalCornerCount << " -> " << totalVertexCount
+			<< " (VBO bytes " << totalCornerCount * sizeof(gps::Vertex) << " -> " << totalVertexCount * sizeof(gps::Vertex) << ")" << std::endl;
+	}
 
-			loadedTextures.push_back(currentTexture);
+	// Loads every texture a mesh refers to
+	std::vector<gps::Texture> Model3D::LoadTextures(const std::vector<gps::TextureReference>& references)
+	{
+		std::vector<gps::Texture> textures;
+		for (size_t i = 0; i < references.size(); i++)
+			textures.push_back(LoadTexture(references[i].path, references[i].type));
+		return textures;
+	}
 
+	// Retrieves a texture associated with the object - by its name and type
+	gps::Texture Model3D::LoadTexture(std::string path, std::string type)
+	{
+		gps::Texture currentTexture;
+		currentTexture.type = type;
+		currentTexture.path = path;
+
+		//already acquired for another mesh of this model
+		std::map<std::string, TextureHandle>::iterator found = acquiredByPath.find(path);
+		if (found != acquiredByPath.end()) {
+			currentTexture.handle = found->second;
 			return currentTexture;
 		}
 
-	// Reads the pixel data from an image file and loads it into the video memory
-	GLuint Model3D::ReadTextureFromFile(const char* file_name) {
-		int x, y, n;
-		int force_channels = 4;
-		unsigned char* image_data = stbi_load(file_name, &x, &y, &n, force_channels);
-		if (!image_data) {
-			fprintf(stderr, "ERROR: could not load %s\n", file_name);
-			return false;
-		}
-		// NPOT check
-		if ((x & (x - 1)) != 0 || (y & (y - 1)) != 0) {
-			fprintf(
-				stderr, "WARNING: texture %s is not power-of-2 dimensions\n", file_name
-			);
-		}
-
-		int width_in_bytes = x * 4;
-		unsigned char *top = NULL;
-		unsigned char *bottom = NULL;
-		unsigned char temp = 0;
-		int half_height = y / 2;
-
-		for (int row = 0; row < half_height; row++) {
-			top = image_data + row * width_in_bytes;
-			bottom = image_data + (y - row - 1) * width_in_bytes;
-			for (int col = 0; col < width_in_bytes; col++) {
-				temp = *top;
-				*top = *bottom;
-				*bottom = temp;
-				top++;
-				bottom++;
-			}
-		}
-
-		GLuint textureID;
-		glGenTextures(1, &textureID);
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(
-			GL_TEXTURE_2D,
-			0,
-			GL_SRGB, //GL_SRGB,//GL_RGBA,
-			x,
-			y,
-			0,
-			GL_RGBA,
-			GL_UNSIGNED_BYTE,
-			image_data
-		);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glBindTexture(GL_TEXTURE_2D, 0);
-
-		return textureID;
+		currentTexture.handle = AssetRegistry::Instance().AcquireTexture(path);
+		acquiredByPath[path] = currentTexture.handle;
+		acquiredTextures.push_back(currentTexture.handle);
+		return currentTexture;
+	}
+
+	void Model3D::Release() {
+		// the buffers and textures go away with the last model using them
+		if (!geometryKey.empty())
+			AssetRegistry::Instance().ReleaseGeometry(geometryKey);
+		geometryKey.clear();
+		meshes.clear();
 	}
 
 	Model3D::~Model3D() {
-        for (size_t i = 0; i < loadedTextures.size(); i++) {
-            glDeleteTextures(1, &loadedTextures.at(i).id);
-        }
-
-        for (size_t i = 0; i < meshes.size(); i++) {
-            GLuint VBO = meshes.at(i).getBuffers().VBO;
-            GLuint EBO = meshes.at(i).getBuffers().EBO;
-            GLuint VAO = meshes.at(i).getBuffers().VAO;
-            glDeleteBuffers(1, &VBO);
-            glDeleteBuffers(1, &EBO);
-            glDeleteVertexArrays(1, &VAO);
-        }
+		Release();
 	}
 }
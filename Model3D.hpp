@@ -2,42 +2,182 @@
 #define Model3D_hpp
 
 #include "Mesh.hpp"
+#include "OcclusionQueries.hpp"
+#include "RenderQueue.hpp"
 
 #include "tiny_obj_loader.h"
 #include "stb_image.h"
 
 #include <iostream>
+#include <map>
 #include <string>
 #include <vector>
 
 namespace gps {
 
+    // How ReadOBJ decides that two face corners are the same vertex
+    enum VERTEX_DEDUP_MODE {DEDUP_NONE, DEDUP_INDEX_TRIPLE, DEDUP_QUANTIZED_ATTRIBUTES};
+
+    // How ReadOBJ turns shapes into meshes: each shape split by material into its own arena block, or the faces of
+    // every shape regrouped by material into ranges of one shared block
+    enum MESH_GROUPING {GROUP_BY_SHAPE, GROUP_BY_MATERIAL};
+
+    // Settings applied when a model is imported from disk
+    struct ImportOptions
+    {
+        VERTEX_DEDUP_MODE dedupMode = DEDUP_INDEX_TRIPLE;
+        MESH_GROUPING grouping = GROUP_BY_SHAPE;
+        // Fold shapes that repeat up to translation, rotation and uniform scale into one instanced mesh; grouping by
+        // material then only merges the shapes left over
+        bool instanceRepeatedShapes = false;
+        // Load from / bake to a binary cache next to the .obj
+        bool useMeshCache = true;
+        // Parse with the multithreaded ObjParser instead of tinyobj::LoadObj
+        bool useParallelObjParser = true;
+        // Reorder triangles and vertices for the vertex cache, overdraw and fetch locality before baking
+        bool optimizeMeshes = true;
+        // Levels of detail generated per mesh, the full one included; 1 turns simplification off
+        int lodLevelCount = 4;
+        // Vertex buffer layout; the packed ones quantize against the mesh bounds at load time
+        VERTEX_FORMAT vertexFormat = VERTEX_PACKED;
+        // Meshes whose bounding sphere reaches this radius (object space) keep a coarse CPU copy to rasterize as
+        // occluders; 0 keeps none
+        float occluderMinRadius = 0.0f;
+    };
+
+    // View the meshes are culled and their levels of detail chosen for, updated once per frame
+    struct RenderView
+    {
+        glm::vec3 cameraPosition = glm::vec3(0.0f);
+        // world-space planes of the view-projection matrix
+        Frustum frustum = Frustum();
+        // pixels covered by one world unit at distance 1: projection[1][1] * viewport height / 2
+        float projectionScale = 1.0f;
+        // largest error a level may show on screen, in pixels
+        float maxScreenError = 1.0f;
+        // share of maxScreenError a coarser level has to stay below before it replaces the current one
+        float hysteresis = 0.25f;
+        // distances are clamped to this, so a camera inside the bounds gets full detail
+        float nearDistance = 0.1f;
+        bool lodEnabled = true;
+        bool cullingEnabled = true;
+        // occluders rasterized for this frame; null skips occlusion culling
+        const OcclusionCuller* occlusion = nullptr;
+        // hardware occlusion queries for expensive meshes; null draws them unconditionally
+        OcclusionQueries* occlusionQueries = nullptr;
+        // queue the mesh draws are submitted to; null draws them right away
+        RenderQueue* queue = nullptr;
+        // permutation meshes with cut-out textures are drawn with; null draws them with the given shader
+        const gps::Shader* alphaTestedShader = nullptr;
+    };
+
+    // Occlusion query of one mesh, carried over from frame to frame
+    struct MeshQuery
+    {
+        GLuint query = 0;
+        uint32_t issuedFrame = 0;
+        // the query has not been read back yet
+        bool pending = false;
+        // result of the last query read back
+        bool visible = true;
+        // the pending query is a bounding box proxy the real draw is conditional on
+        bool proxy = false;
+        // conditional draws made on the pending query
+        size_t conditionalDraws = 0;
+    };
+
     class Model3D
     {
 
     public:
         ~Model3D();
 
+		// Hands the meshes back to the registry, while the GL context and the singletons still exist; the model
+		// is not drawn afterwards and its destructor does nothing
+		void Release();
+
 		void LoadModel(std::string fileName);
 
 		void LoadModel(std::string fileName, std::string basePath);
 
 		void Draw(gps::Shader shaderProgram);
 
+		// Draws the meshes inside the view frustum, each at the level of detail its projected error allows
+		void Draw(gps::Shader shaderProgram, const glm::mat4& modelMatrix, const RenderView& view);
+
+		// Draws every mesh once per model matrix in one instanced call per mesh, at full detail and without culling.
+		// The matrices are streamed with their normal matrices through the InstanceStream and applied before the
+		// model of the ObjectUniforms in use; basicInstanced.vert reads the normal matrices
+		void DrawInstanced(gps::Shader shaderProgram, const glm::mat4* modelMatrices, size_t count);
+		void DrawInstanced(gps::Shader shaderProgram, const std::vector<glm::mat4>& modelMatrices);
+
+		// Box around every mesh and its instances, in object space; empty models give a point at the origin
+		void GetBounds(glm::vec3& boundsMin, glm::vec3& boundsMax) const;
+
+		// Hands the occluder meshes to the culler for the current frame
+		void AddOccluders(OcclusionCuller& occlusionCuller, const glm::mat4& modelMatrix) const;
+
+		// Must be called before LoadModel to take effect
+		void SetImportOptions(const ImportOptions& options);
+
     private:
 		// Component meshes - group of objects
         std::vector<gps::Mesh> meshes;
-		// Associated textures
-        std::vector<gps::Texture> loadedTextures;
+		// Registry entry the meshes belong to; empty once released
+		std::string geometryKey;
+		// Textures acquired while building the meshes, handed over to the registry with them
+		std::vector<TextureHandle> acquiredTextures;
+		// The same textures by path, so meshes sharing a material take a single reference
+		std::map<std::string, TextureHandle> acquiredByPath;
+		// Settings used by the next LoadModel call
+		ImportOptions importOptions;
+		// Level of detail each mesh was last drawn at
+		std::vector<int> meshLods;
+		// Bounds of the meshes, tested against the view frustum in object space
+		FrustumCuller culler;
+		// Meshes that passed the last cull
+		std::vector<uint32_t> visibleMeshes;
+		// Occlusion query state of every mesh
+		std::vector<MeshQuery> meshQueries;
+		// Vertices and indices of the meshes grouped by material, until UploadSharedGeometry puts them in the arena
+		std::vector<unsigned char> sharedVertices;
+		std::vector<GLuint> sharedIndices;
 
 		// Does the parsing of the .obj file and fills in the data structure
-		void ReadOBJ(std::string fileName, std::string basePath);
+		void ReadOBJ(std::string fileName, std::string basePath, std::vector<gps::MeshData>& meshData,
+			std::vector<std::string>& materialLibraries);
 
-		// Retrieves a texture associated with the object - by its name and type
-		gps::Texture LoadTexture(std::string path, std::string type);
+		// Reorders the imported meshes for the GPU, builds their LOD chains and reports both
+		void ProcessMeshes(std::vector<gps::MeshData>& meshData);
+
+		// Converts the vertices to the import vertex format, reports the error and uploads the mesh, or appends it to
+		// the shared data when grouping by material; large meshes also keep an occluder
+		void AddMesh(const std::string& name, const gps::Vertex* vertices, size_t vertexCount, const GLuint* indices,
+			size_t indexCount, const std::vector<gps::MeshLod>& lods, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+			const std::vector<gps::TextureReference>& textures, const std::vector<glm::mat4>& instances);
+
+		int SelectLod(size_t meshIndex, const glm::mat4& modelMatrix, const RenderView& view);
 
-		// Reads the pixel data from an image file and loads it into the video memory
-		GLuint ReadTextureFromFile(const char* file_name);
+		// Reads back the mesh's last query and decides how its draw goes through the next one, skipping it on the
+		// GPU while its bounding box stays hidden
+		QUERY_MODE PrepareQuery(size_t meshIndex, const glm::vec3& objectCameraPosition, OcclusionQueries& queries);
+
+		// Queues the draw, or makes it at once without a queue
+		void SubmitMesh(size_t meshIndex, int lod, QUERY_MODE queryMode, gps::Shader shaderProgram,
+			const glm::mat4& modelMatrix, const RenderView& view);
+
+		// Puts the meshes AddMesh appended to the shared data into one block of the GeometryArena
+		void UploadSharedGeometry();
+
+		// Hands the freshly built meshes and their textures over to the AssetRegistry
+		void RegisterGeometry();
+
+		// Loads every texture a mesh refers to
+		std::vector<gps::Texture> LoadTextures(const std::vector<gps::TextureReference>& references);
+
+		// Retrieves a texture associated with the object - by its name and type - through the AssetRegistry;
+		// the pixels arrive asynchronously
+		gps::Texture LoadTexture(std::string path, std::string type);
     };
 }
 
@@ -0,0 +1,480 @@
+#include "ObjParser.hpp"
+#include "MappedFile.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+namespace gps {
+
+    // Chunks smaller than this are not worth a thread hop
+    static const size_t OBJ_MIN_CHUNK_BYTES = 1 << 20;
+
+    enum OBJ_EVENT_TYPE {OBJ_EVENT_SHAPE, OBJ_EVENT_USEMTL, OBJ_EVENT_MTLLIB};
+
+    // Statement that affects how faces are grouped; replayed in file order during the merge
+    struct ObjEvent
+    {
+        OBJ_EVENT_TYPE type;
+        std::string name;
+        // number of faces of the chunk that precede the statement
+        size_t faceIndex;
+    };
+
+    // Everything parsed from one line-aligned slice of the file
+    struct ObjChunk
+    {
+        const char* begin;
+        const char* end;
+        std::vector<float> vertices;
+        std::vector<float> normals;
+        std::vector<float> texcoords;
+        // triangulated faces, three corners each
+        std::vector<tinyobj::index_t> indices;
+        // corners that used negative (relative) indices, encoded as corner * 3 + component;
+        // they hold a chunk-local index until the merge adds the chunk's attribute offset
+        std::vector<size_t> relativeIndices;
+        std::vector<ObjEvent> events;
+    };
+
+    static inline bool IsBlank(char c)
+    {
+        return c == ' ' || c == '\t';
+    }
+
+    static inline bool IsDigit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    static inline const char* SkipBlanks(const char* p, const char* end)
+    {
+        while (p < end && IsBlank(*p))
+            p++;
+        return p;
+    }
+
+    // Reads the next whitespace delimited word
+    static const char* ParseName(const char* p, const char* end, std::string& name)
+    {
+        p = SkipBlanks(p, end);
+        const char* start = p;
+        while (p < end && !IsBlank(*p))
+            p++;
+        name.assign(start, p - start);
+        return p;
+    }
+
+    // Exact for up to 15 significant digits and exponents within the double fast path
+    static const double POWERS_OF_TEN[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    // Parses a decimal float in place, without allocating or requiring a terminator.
+    // Numbers outside the fast path (very long mantissas, large exponents, inf/nan) go through strtod.
+    static const char* ParseFloat(const char* p, const char* end, float& value)
+    {
+        p = SkipBlanks(p, end);
+        const char* start = p;
+
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negative = *p == '-';
+            p++;
+        }
+
+        uint64_t mantissa = 0;
+        int significantDigits = 0;
+        int exponent = 0;
+        bool anyDigit = false;
+
+        while (p < end && IsDigit(*p)) {
+            anyDigit = true;
+            if (significantDigits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa != 0)
+                    significantDigits++;
+            } else {
+                exponent++;
+            }
+            p++;
+        }
+
+        if (p < end && *p == '.') {
+            p++;
+            while (p < end && IsDigit(*p)) {
+                anyDigit = true;
+                if (significantDigits < 19) {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    if (mantissa != 0)
+                        significantDigits++;
+                    exponent--;
+                }
+                p++;
+            }
+        }
+
+        if (anyDigit && p < end && (*p == 'e' || *p == 'E')) {
+            const char* exponentStart = p;
+            p++;
+            bool negativeExponent = false;
+            if (p < end && (*p == '-' || *p == '+')) {
+                negativeExponent = *p == '-';
+                p++;
+            }
+            if (p < end && IsDigit(*p)) {
+                int explicitExponent = 0;
+                while (p < end && IsDigit(*p)) {
+                    if (explicitExponent < 100000)
+                        explicitExponent = explicitExponent * 10 + (*p - '0');
+                    p++;
+                }
+                exponent += negativeExponent ? -explicitExponent : explicitExponent;
+            } else {
+                p = exponentStart;
+            }
+        }
+
+        if (anyDigit && significantDigits <= 15 && exponent >= -22 && exponent <= 22) {
+            double result = (double)mantissa;
+            result = exponent < 0 ? result / POWERS_OF_TEN[-exponent] : result * POWERS_OF_TEN[exponent];
+            value = (float)(negative ? -result : result);
+            return p;
+        }
+
+        // slow path on a terminated copy of the token
+        const char* tokenEnd = start;
+        while (tokenEnd < end && !IsBlank(*tokenEnd) && *tokenEnd != '\r' && *tokenEnd != '/')
+            tokenEnd++;
+        char buffer[64];
+        size_t length = std::min((size_t)(tokenEnd - start), sizeof(buffer) - 1);
+        memcpy(buffer, start, length);
+        buffer[length] = '\0';
+        char* parsedEnd = NULL;
+        value = (float)strtod(buffer, &parsedEnd);
+        return start + (parsedEnd - buffer);
+    }
+
+    static const char* ParseInt(const char* p, const char* end, int& value)
+    {
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negative = *p == '-';
+            p++;
+        }
+        int result = 0;
+        while (p < end && IsDigit(*p)) {
+            result = result * 10 + (*p - '0');
+            p++;
+        }
+        value = negative ? -result : result;
+        return p;
+    }
+
+    // Turns an OBJ index into a 0-based one; negative indices are made chunk-local and flagged for the merge
+    static int ResolveIndex(int objIndex, size_t localCount, bool& relative)
+    {
+        relative = false;
+        if (objIndex > 0)
+            return objIndex - 1;
+        if (objIndex == 0)
+            return 0;
+        relative = true;
+        return (int)localCount + objIndex;
+    }
+
+    static void ParseChunk(ObjChunk& chunk)
+    {
+        std::vector<tinyobj::index_t> face;
+        std::vector<unsigned char> faceRelative;
+        std::string name;
+
+        const char* p = chunk.begin;
+        while (p < chunk.end) {
+            const char* lineEnd = (const char*)memchr(p, '\n', chunk.end - p);
+            if (lineEnd == NULL)
+                lineEnd = chunk.end;
+            const char* end = lineEnd;
+            if (end > p && end[-1] == '\r')
+                end--;
+
+            const char* token = SkipBlanks(p, end);
+            p = lineEnd + 1;
+            size_t length = end - token;
+            if (length < 2 || token[0] == '#')
+                continue;
+
+            // vertex
+            if (token[0] == 'v' && IsBlank(token[1])) {
+                float x = 0.0f, y = 0.0f, z = 0.0f;
+                token = ParseFloat(token + 2, end, x);
+                token = ParseFloat(token, end, y);
+                ParseFloat(token, end, z);
+                chunk.vertices.push_back(x);
+                chunk.vertices.push_back(y);
+                chunk.vertices.push_back(z);
+                continue;
+            }
+
+            // normal
+            if (length > 2 && token[0] == 'v' && token[1] == 'n' && IsBlank(token[2])) {
+                float x = 0.0f, y = 0.0f, z = 0.0f;
+                token = ParseFloat(token + 3, end, x);
+                token = ParseFloat(token, end, y);
+                ParseFloat(token, end, z);
+                chunk.normals.push_back(x);
+                chunk.normals.push_back(y);
+                chunk.normals.push_back(z);
+                continue;
+            }
+
+            // texcoord
+            if (length > 2 && token[0] == 'v' && token[1] == 't' && IsBlank(token[2])) {
+                float x = 0.0f, y = 0.0f;
+                token = ParseFloat(token + 3, end, x);
+                ParseFloat(token, end, y);
+                chunk.texcoords.push_back(x);
+                chunk.texcoords.push_back(y);
+                continue;
+            }
+
+            // face: i, i/j, i//k or i/j/k per corner, fanned into triangles
+            if (token[0] == 'f' && IsBlank(token[1])) {
+                face.clear();
+                faceRelative.clear();
+                token = SkipBlanks(token + 2, end);
+                while (token < end) {
+                    tinyobj::index_t corner;
+                    corner.vertex_index = -1;
+                    corner.normal_index = -1;
+                    corner.texcoord_index = -1;
+                    unsigned char relativeMask = 0;
+                    bool relative;
+                    int objIndex;
+
+                    token = ParseInt(token, end, objIndex);
+                    corner.vertex_index = ResolveIndex(objIndex, chunk.vertices.size() / 3, relative);
+                    relativeMask |= relative ? 1 : 0;
+                    if (token < end && *token == '/') {
+                        token++;
+                        if (token < end && *token != '/') {
+                            token = ParseInt(token, end, objIndex);
+                            corner.texcoord_index = ResolveIndex(objIndex, chunk.texcoords.size() / 2, relative);
+                            relativeMask |= relative ? 4 : 0;
+                        }
+                        if (token < end && *token == '/') {
+                            token++;
+                            token = ParseInt(token, end, objIndex);
+                            corner.normal_index = ResolveIndex(objIndex, chunk.normals.size() / 3, relative);
+                            relativeMask |= relative ? 2 : 0;
+                        }
+                    }
+                    face.push_back(corner);
+                    faceRelative.push_back(relativeMask);
+
+                    while (token < end && !IsBlank(*token))
+                        token++;
+                    token = SkipBlanks(token, end);
+                }
+
+                for (size_t k = 2; k < face.size(); k++) {
+                    size_t fan[3] = {0, k - 1, k};
+                    for (int c = 0; c < 3; c++) {
+                        size_t corner = chunk.indices.size();
+                        chunk.indices.push_back(face[fan[c]]);
+                        for (int component = 0; component < 3; component++)
+                            if (faceRelative[fan[c]] & (1 << component))
+                                chunk.relativeIndices.push_back(corner * 3 + component);
+                    }
+                }
+                continue;
+            }
+
+            ObjEvent event;
+            event.faceIndex = chunk.indices.size() / 3;
+
+            if (length > 6 && strncmp(token, "usemtl", 6) == 0 && IsBlank(token[6])) {
+                event.type = OBJ_EVENT_USEMTL;
+                ParseName(token + 7, end, event.name);
+                chunk.events.push_back(event);
+                continue;
+            }
+
+            if (length > 6 && strncmp(token, "mtllib", 6) == 0 && IsBlank(token[6])) {
+                event.type = OBJ_EVENT_MTLLIB;
+                ParseName(token + 7, end, event.name);
+                chunk.events.push_back(event);
+                continue;
+            }
+
+            // groups and objects both start a new shape; a group takes its first name
+            if ((token[0] == 'g' || token[0] == 'o') && IsBlank(token[1])) {
+                event.type = OBJ_EVENT_SHAPE;
+                ParseName(token + 2, end, event.name);
+                chunk.events.push_back(event);
+                continue;
+            }
+
+            // everything else is ignored, like tinyobj does
+        }
+    }
+
+    // Moves faces [from, to) of a chunk into the shape being built
+    static void AppendFaces(const ObjChunk& chunk, size_t from, size_t to, int materialId, tinyobj::shape_t& shape)
+    {
+        if (to <= from)
+            return;
+        shape.mesh.indices.insert(shape.mesh.indices.end(), chunk.indices.begin() + from * 3, chunk.indices.begin() + to * 3);
+        shape.mesh.num_face_vertices.insert(shape.mesh.num_face_vertices.end(), to - from, (unsigned char)3);
+        shape.mesh.material_ids.insert(shape.mesh.material_ids.end(), to - from, materialId);
+    }
+
+    bool ObjParser::Load(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes,
+        std::vector<tinyobj::material_t>* materials, std::string* err,
+        const std::string& fileName, const std::string& mtlBasePath)
+    {
+        std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
+
+        attrib->vertices.clear();
+        attrib->normals.clear();
+        attrib->texcoords.clear();
+        shapes->clear();
+        materialLibraries.clear();
+        parsedBytes = 0;
+
+        MappedFile file;
+        if (!file.Open(fileName)) {
+            if (err)
+                *err += "Cannot open file [" + fileName + "]\n";
+            return false;
+        }
+
+        // split into roughly equal slices, each ending on a line break
+        const char* data = (const char*)file.GetData();
+        const char* dataEnd = data + file.GetSize();
+        ThreadPool& pool = ThreadPool::Shared();
+        size_t chunkCount = std::max<size_t>(1, std::min(pool.GetThreadCount() * 4, file.GetSize() / OBJ_MIN_CHUNK_BYTES));
+        size_t chunkSize = file.GetSize() / chunkCount;
+
+        std::vector<ObjChunk> chunks;
+        const char* chunkBegin = data;
+        while (chunkBegin < dataEnd) {
+            const char* chunkEnd = chunks.size() + 1 == chunkCount ? dataEnd : std::min(chunkBegin + chunkSize, dataEnd);
+            const char* lineBreak = (const char*)memchr(chunkEnd, '\n', dataEnd - chunkEnd);
+            chunkEnd = lineBreak == NULL ? dataEnd : lineBreak + 1;
+
+            ObjChunk chunk;
+            chunk.begin = chunkBegin;
+            chunk.end = chunkEnd;
+            chunks.push_back(chunk);
+            chunkBegin = chunkEnd;
+        }
+
+        pool.ParallelFor(chunks.size(), [&chunks](size_t i) { ParseChunk(chunks[i]); });
+
+        // attribute offsets of every chunk, for resolving relative indices
+        std::vector<size_t> vertexOffsets(chunks.size()), normalOffsets(chunks.size()), texcoordOffsets(chunks.size());
+        size_t vertexCount = 0, normalCount = 0, texcoordCount = 0;
+        for (size_t c = 0; c < chunks.size(); c++) {
+            vertexOffsets[c] = vertexCount;
+            normalOffsets[c] = normalCount;
+            texcoordOffsets[c] = texcoordCount;
+            vertexCount += chunks[c].vertices.size();
+            normalCount += chunks[c].normals.size();
+            texcoordCount += chunks[c].texcoords.size();
+        }
+
+        attrib->vertices.resize(vertexCount);
+        attrib->normals.resize(normalCount);
+        attrib->texcoords.resize(texcoordCount);
+        pool.ParallelFor(chunks.size(), [&](size_t c) {
+            ObjChunk& chunk = chunks[c];
+            if (!chunk.vertices.empty())
+                memcpy(&attrib->vertices[vertexOffsets[c]], chunk.vertices.data(), chunk.vertices.size() * sizeof(float));
+            if (!chunk.normals.empty())
+                memcpy(&attrib->normals[normalOffsets[c]], chunk.normals.data(), chunk.normals.size() * sizeof(float));
+            if (!chunk.texcoords.empty())
+                memcpy(&attrib->texcoords[texcoordOffsets[c]], chunk.texcoords.data(), chunk.texcoords.size() * sizeof(float));
+
+            for (size_t r = 0; r < chunk.relativeIndices.size(); r++) {
+                tinyobj::index_t& corner = chunk.indices[chunk.relativeIndices[r] / 3];
+                switch (chunk.relativeIndices[r] % 3) {
+                case 0: corner.vertex_index += (int)(vertexOffsets[c] / 3); break;
+                case 1: corner.normal_index += (int)(normalOffsets[c] / 3); break;
+                case 2: corner.texcoord_index += (int)(texcoordOffsets[c] / 2); break;
+                }
+            }
+            std::vector<float>().swap(chunk.vertices);
+            std::vector<float>().swap(chunk.normals);
+            std::vector<float>().swap(chunk.texcoords);
+        });
+
+        // replay grouping statements in file order
+        std::map<std::string, int> materialMap;
+        tinyobj::MaterialFileReader materialReader(mtlBasePath);
+        tinyobj::shape_t shape;
+        std::string shapeName;
+        int materialId = -1;
+
+        for (size_t c = 0; c < chunks.size(); c++) {
+            const ObjChunk& chunk = chunks[c];
+            size_t faceCursor = 0;
+            for (size_t e = 0; e < chunk.events.size(); e++) {
+                const ObjEvent& event = chunk.events[e];
+                AppendFaces(chunk, faceCursor, event.faceIndex, materialId, shape);
+                faceCursor = event.faceIndex;
+
+                if (event.type == OBJ_EVENT_SHAPE) {
+                    if (!shape.mesh.indices.empty()) {
+                        shape.name = shapeName;
+                        shapes->push_back(tinyobj::shape_t());
+                        std::swap(shapes->back(), shape);
+                    }
+                    shape = tinyobj::shape_t();
+                    shapeName = event.name;
+                } else if (event.type == OBJ_EVENT_USEMTL) {
+                    std::map<std::string, int>::const_iterator found = materialMap.find(event.name);
+                    materialId = found == materialMap.end() ? -1 : found->second;
+                } else {
+                    std::string materialError;
+                    materialReader(event.name, materials, &materialMap, &materialError);
+                    if (err)
+                        *err += materialError;
+                    materialLibraries.push_back(mtlBasePath + event.name);
+                }
+            }
+            AppendFaces(chunk, faceCursor, chunk.indices.size() / 3, materialId, shape);
+        }
+
+        if (!shape.mesh.indices.empty()) {
+            shape.name = shapeName;
+            shapes->push_back(tinyobj::shape_t());
+            std::swap(shapes->back(), shape);
+        }
+
+        parsedBytes = file.GetSize();
+        parseSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+        return true;
+    }
+
+    const std::vector<std::string>& ObjParser::GetMaterialLibraries() const
+    {
+        return materialLibraries;
+    }
+
+    size_t ObjParser::GetParsedBytes() const
+    {
+        return parsedBytes;
+    }
+
+    double ObjParser::GetParseSeconds() const
+    {
+        return parseSeconds;
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef ObjParser_hpp
+#define ObjParser_hpp
+
+#include "tiny_obj_loader.h"
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Memory-mapped .obj reader that parses line-aligned chunks of the file in parallel.
+    // Produces the same attrib_t/shape_t/material_t layout as tinyobj::LoadObj with triangulation on.
+    class ObjParser
+    {
+    public:
+        // Returns false if the file cannot be mapped; `err` may also carry warnings on success
+        bool Load(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes,
+            std::vector<tinyobj::material_t>* materials, std::string* err,
+            const std::string& fileName, const std::string& mtlBasePath);
+
+        // .mtl files pulled in by the last Load, as paths relative to the working directory
+        const std::vector<std::string>& GetMaterialLibraries() const;
+
+        // Size of the last parsed file and the time it took, for throughput reports
+        size_t GetParsedBytes() const;
+        double GetParseSeconds() const;
+
+    private:
+        std::vector<std::string> materialLibraries;
+        size_t parsedBytes = 0;
+        double parseSeconds = 0.0;
+    };
+}
+
+#endif /* ObjParser_hpp */
@@ -0,0 +1,267 @@
+#include "OcclusionCuller.hpp"
+#include "Simd.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    OcclusionCuller::OcclusionCuller(int width, int height)
+        : viewProjection(1.0f), rasterized(false), buildMilliseconds(0.0)
+    {
+        tilesX = std::max(1, (width + TILE_SIZE - 1) / TILE_SIZE);
+        tilesY = std::max(1, (height + TILE_SIZE - 1) / TILE_SIZE);
+        this->width = tilesX * TILE_SIZE;
+        this->height = tilesY * TILE_SIZE;
+        depth.assign((size_t)this->width * this->height, 1.0f);
+        tileMaxDepth.assign((size_t)tilesX * tilesY, 1.0f);
+    }
+
+    void OcclusionCuller::BeginFrame(const glm::mat4& viewProjection)
+    {
+        frameStart = std::chrono::high_resolution_clock::now();
+        this->viewProjection = viewProjection;
+        triangles.clear();
+        rasterized = false;
+    }
+
+    void OcclusionCuller::AddOccluder(const OccluderGeometry& occluder, const glm::mat4& modelMatrix)
+    {
+        glm::mat4 modelViewProjection = viewProjection * modelMatrix;
+        clipVertices.resize(occluder.positions.size());
+        for (size_t v = 0; v < occluder.positions.size(); v++)
+            clipVertices[v] = modelViewProjection * glm::vec4(occluder.positions[v], 1.0f);
+
+        for (size_t i = 0; i + 2 < occluder.indices.size(); i += 3) {
+            const glm::vec4& a = clipVertices[occluder.indices[i + 0]];
+            const glm::vec4& b = clipVertices[occluder.indices[i + 1]];
+            const glm::vec4& c = clipVertices[occluder.indices[i + 2]];
+            // entirely outside one side of the frustum
+            if ((a.x > a.w && b.x > b.w && c.x > c.w) || (a.x < -a.w && b.x < -b.w && c.x < -c.w)
+                || (a.y > a.w && b.y > b.w && c.y > c.w) || (a.y < -a.w && b.y < -b.w && c.y < -c.w)
+                || (a.z > a.w && b.z > b.w && c.z > c.w))
+                continue;
+            AddClipTriangle(a, b, c);
+        }
+    }
+
+    // Clips against the near plane (z >= -w), the only one that matters before the perspective divide
+    void OcclusionCuller::AddClipTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c)
+    {
+        const glm::vec4* input[3] = {&a, &b, &c};
+        float distances[3] = {a.z + a.w, b.z + b.w, c.z + c.w};
+        if (distances[0] >= 0.0f && distances[1] >= 0.0f && distances[2] >= 0.0f) {
+            AddScreenTriangle(a, b, c);
+            return;
+        }
+
+        glm::vec4 polygon[4];
+        int count = 0;
+        for (int i = 0; i < 3; i++) {
+            int next = (i + 1) % 3;
+            if (distances[i] >= 0.0f)
+                polygon[count++] = *input[i];
+            if ((distances[i] >= 0.0f) != (distances[next] >= 0.0f)) {
+                float t = distances[i] / (distances[i] - distances[next]);
+                polygon[count++] = glm::mix(*input[i], *input[next], t);
+            }
+        }
+        for (int i = 2; i < count; i++)
+            AddScreenTriangle(polygon[0], polygon[i - 1], polygon[i]);
+    }
+
+    void OcclusionCuller::AddScreenTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c)
+    {
+        const glm::vec4* clip[3] = {&a, &b, &c};
+        float x[3], y[3], z[3];
+        for (int i = 0; i < 3; i++) {
+            float inverseW = 1.0f / std::max(clip[i]->w, 1e-6f);
+            x[i] = (clip[i]->x * inverseW * 0.5f + 0.5f) * (float)width;
+            y[i] = (clip[i]->y * inverseW * 0.5f + 0.5f) * (float)height;
+            z[i] = clip[i]->z * inverseW * 0.5f + 0.5f;
+        }
+
+        // counter-clockwise front faces; back faces are culled by GL as well, so they hide nothing
+        float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        if (!(area > 0.0f))
+            return;
+
+        // pixel centers at +0.5, clamped as floats first so far-off vertices cannot overflow the conversion
+        float minX = std::max(std::min(x[0], std::min(x[1], x[2])) - 0.5f, 0.0f);
+        float maxX = std::min(std::max(x[0], std::max(x[1], x[2])) - 0.5f, (float)(width - 1));
+        float minY = std::max(std::min(y[0], std::min(y[1], y[2])) - 0.5f, 0.0f);
+        float maxY = std::min(std::max(y[0], std::max(y[1], y[2])) - 0.5f, (float)(height - 1));
+        ScreenTriangle triangle;
+        triangle.minX = (int)std::ceil(minX);
+        triangle.maxX = (int)std::floor(maxX);
+        triangle.minY = (int)std::ceil(minY);
+        triangle.maxY = (int)std::floor(maxY);
+        if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+            return;
+
+        // edge i runs from vertex i to vertex i + 1: E(p) = A * p.x + B * p.y + C
+        for (int i = 0; i < 3; i++) {
+            int next = (i + 1) % 3;
+            triangle.edgeA[i] = y[i] - y[next];
+            triangle.edgeB[i] = x[next] - x[i];
+            triangle.edgeC[i] = x[i] * y[next] - x[next] * y[i];
+        }
+        // z / w is affine in screen space
+        triangle.depthX = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) / area;
+        triangle.depthY = ((x[1] - x[0]) * (z[2] - z[0]) - (x[2] - x[0]) * (z[1] - z[0])) / area;
+        triangle.depthC = z[0] - triangle.depthX * x[0] - triangle.depthY * y[0];
+        triangles.push_back(triangle);
+    }
+
+    void OcclusionCuller::Rasterize()
+    {
+        ThreadPool::Shared().ParallelFor((size_t)tilesY, [this](size_t tileRow) {
+            RasterizeTileRow((int)tileRow);
+        });
+        rasterized = true;
+        buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - frameStart).count();
+    }
+
+    // Every job owns a band of TILE_SIZE rows, so the bands are written without synchronization
+    void OcclusionCuller::RasterizeTileRow(int tileRow)
+    {
+        int firstRow = tileRow * TILE_SIZE;
+        int endRow = firstRow + TILE_SIZE;
+        std::fill(depth.begin() + (size_t)firstRow * width, depth.begin() + (size_t)endRow * width, 1.0f);
+
+        for (size_t t = 0; t < triangles.size(); t++) {
+            const ScreenTriangle& triangle = triangles[t];
+            if (triangle.maxY < firstRow || triangle.minY >= endRow)
+                continue;
+            int rowBegin = std::max(triangle.minY, firstRow);
+            int rowEnd = std::min(triangle.maxY + 1, endRow);
+            // rows are a whole number of tiles wide, so aligned blocks of four never run past the row
+            int columnBegin = triangle.minX & ~3;
+            int columnEnd = triangle.maxX + 1;
+
+            for (int row = rowBegin; row < rowEnd; row++) {
+                float centerY = (float)row + 0.5f;
+                float rowEdge[3];
+                for (int e = 0; e < 3; e++)
+                    rowEdge[e] = triangle.edgeB[e] * centerY + triangle.edgeC[e];
+                float rowDepth = triangle.depthY * centerY + triangle.depthC;
+                float* depthRow = depth.data() + (size_t)row * width;
+                int column = columnBegin;
+#if defined(GPS_SIMD_AVX2) || defined(GPS_SIMD_SSE2)
+                __m128 steps = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+                __m128 zero = _mm_setzero_ps();
+                __m128 a0 = _mm_set1_ps(triangle.edgeA[0]), a1 = _mm_set1_ps(triangle.edgeA[1]), a2 = _mm_set1_ps(triangle.edgeA[2]);
+                __m128 r0 = _mm_set1_ps(rowEdge[0]), r1 = _mm_set1_ps(rowEdge[1]), r2 = _mm_set1_ps(rowEdge[2]);
+                __m128 dx = _mm_set1_ps(triangle.depthX), dr = _mm_set1_ps(rowDepth);
+                for (; column < columnEnd; column += 4) {
+                    __m128 centerX = _mm_add_ps(_mm_set1_ps((float)column), steps);
+                    __m128 inside = _mm_and_ps(
+                        _mm_and_ps(_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, centerX), r0), zero),
+                            _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, centerX), r1), zero)),
+                        _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, centerX), r2), zero));
+                    if (_mm_movemask_ps(inside) == 0)
+                        continue;
+                    __m128 current = _mm_loadu_ps(depthRow + column);
+                    __m128 nearer = _mm_min_ps(current, _mm_add_ps(_mm_mul_ps(dx, centerX), dr));
+                    _mm_storeu_ps(depthRow + column, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, current)));
+                }
+#endif
+                for (; column < columnEnd; column++) {
+                    float centerX = (float)column + 0.5f;
+                    if (triangle.edgeA[0] * centerX + rowEdge[0] < 0.0f || triangle.edgeA[1] * centerX + rowEdge[1] < 0.0f
+                        || triangle.edgeA[2] * centerX + rowEdge[2] < 0.0f)
+                        continue;
+                    depthRow[column] = std::min(depthRow[column], triangle.depthX * centerX + rowDepth);
+                }
+            }
+        }
+
+        for (int tileX = 0; tileX < tilesX; tileX++) {
+            float farthest = 0.0f;
+            for (int row = firstRow; row < endRow; row++) {
+                const float* tileRowDepth = depth.data() + (size_t)row * width + tileX * TILE_SIZE;
+                for (int i = 0; i < TILE_SIZE; i++)
+                    farthest = std::max(farthest, tileRowDepth[i]);
+            }
+            tileMaxDepth[(size_t)tileRow * tilesX + tileX] = farthest;
+        }
+    }
+
+    bool OcclusionCuller::IsOccluded(const MeshBounds& bounds, const glm::mat4& modelMatrix) const
+    {
+        if (!rasterized)
+            return false;
+
+        glm::mat4 modelViewProjection = viewProjection * modelMatrix;
+        float minX = (float)width, maxX = -1.0f, minY = (float)height, maxY = -1.0f, nearest = 1.0f;
+        for (int corner = 0; corner < 8; corner++) {
+            glm::vec3 position((corner & 1) ? bounds.boundsMax.x : bounds.boundsMin.x, (corner & 2) ? bounds.boundsMax.y : bounds.boundsMin.y,
+                (corner & 4) ? bounds.boundsMax.z : bounds.boundsMin.z);
+            glm::vec4 clip = modelViewProjection * glm::vec4(position, 1.0f);
+            if (clip.z < -clip.w || clip.w <= 0.0f)
+                return false;
+            float inverseW = 1.0f / clip.w;
+            float x = (clip.x * inverseW * 0.5f + 0.5f) * (float)width;
+            float y = (clip.y * inverseW * 0.5f + 0.5f) * (float)height;
+            minX = std::min(minX, x);
+            maxX = std::max(maxX, x);
+            minY = std::min(minY, y);
+            maxY = std::max(maxY, y);
+            nearest = std::min(nearest, clip.z * inverseW * 0.5f + 0.5f);
+        }
+
+        // every pixel the rectangle touches
+        int columnBegin = (int)std::floor(std::max(minX, 0.0f));
+        int columnEnd = (int)std::floor(std::min(maxX, (float)width - 1.0f));
+        int rowBegin = (int)std::floor(std::max(minY, 0.0f));
+        int rowEnd = (int)std::floor(std::min(maxY, (float)height - 1.0f));
+        if (columnBegin > columnEnd || rowBegin > rowEnd)
+            return false;
+
+        for (int tileY = rowBegin / TILE_SIZE; tileY <= rowEnd / TILE_SIZE; tileY++) {
+            for (int tileX = columnBegin / TILE_SIZE; tileX <= columnEnd / TILE_SIZE; tileX++) {
+                if (tileMaxDepth[(size_t)tileY * tilesX + tileX] < nearest)
+                    continue;
+                // the tile as a whole is not in front of the box, its pixels under the rectangle may be
+                int rowFirst = std::max(rowBegin, tileY * TILE_SIZE);
+                int rowLast = std::min(rowEnd, tileY * TILE_SIZE + TILE_SIZE - 1);
+                int columnFirst = std::max(columnBegin, tileX * TILE_SIZE);
+                int columnLast = std::min(columnEnd, tileX * TILE_SIZE + TILE_SIZE - 1);
+                for (int row = rowFirst; row <= rowLast; row++) {
+                    const float* depthRow = depth.data() + (size_t)row * width;
+                    for (int column = columnFirst; column <= columnLast; column++) {
+                        if (depthRow[column] >= nearest)
+                            return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    int OcclusionCuller::GetWidth() const
+    {
+        return width;
+    }
+
+    int OcclusionCuller::GetHeight() const
+    {
+        return height;
+    }
+
+    const std::vector<float>& OcclusionCuller::GetDepth() const
+    {
+        return depth;
+    }
+
+    size_t OcclusionCuller::GetTriangleCount() const
+    {
+        return triangles.size();
+    }
+
+    double OcclusionCuller::GetBuildMilliseconds() const
+    {
+        return buildMilliseconds;
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef OcclusionCuller_hpp
+#define OcclusionCuller_hpp
+
+#include "Frustum.hpp"
+
+#include "glm/glm.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    // CPU copy of a mesh (usually one of its coarse levels) rasterized as an occluder
+    struct OccluderGeometry
+    {
+        std::vector<glm::vec3> positions;
+        std::vector<uint32_t> indices;
+    };
+
+    // Software occlusion culling: large occluders are rasterized into a low-resolution depth buffer with a
+    // farthest-depth value per tile, then the boxes of other meshes are tested against it before any GL call.
+    // Works entirely on the CPU, so it needs no GL context.
+    class OcclusionCuller
+    {
+    public:
+        static const int TILE_SIZE = 8;
+
+        // Resolution is rounded up to whole tiles
+        OcclusionCuller(int width = 256, int height = 128);
+
+        // Clears the occluders of the previous frame
+        void BeginFrame(const glm::mat4& viewProjection);
+
+        // Transforms, clips and sets up the triangles of an occluder; front faces are counter-clockwise, as in the GL state
+        void AddOccluder(const OccluderGeometry& occluder, const glm::mat4& modelMatrix);
+
+        // Rasterizes every occluder, one row of tiles per job, and builds the tile depths
+        void Rasterize();
+
+        // True when the box lies entirely behind the rasterized occluders; boxes crossing the near plane
+        // or off screen are never occluded
+        bool IsOccluded(const MeshBounds& bounds, const glm::mat4& modelMatrix) const;
+
+        int GetWidth() const;
+        int GetHeight() const;
+        // Depth in [0, 1], row 0 at the bottom of the screen
+        const std::vector<float>& GetDepth() const;
+        size_t GetTriangleCount() const;
+        // Time spent from BeginFrame to the end of Rasterize
+        double GetBuildMilliseconds() const;
+
+    private:
+        // Triangle in pixel coordinates with its edge functions and depth plane; inside where every edge is >= 0
+        struct ScreenTriangle
+        {
+            float edgeA[3];
+            float edgeB[3];
+            float edgeC[3];
+            float depthX;
+            float depthY;
+            float depthC;
+            int minX;
+            int maxX;
+            int minY;
+            int maxY;
+        };
+
+        int width;
+        int height;
+        int tilesX;
+        int tilesY;
+        glm::mat4 viewProjection;
+        std::vector<float> depth;
+        std::vector<float> tileMaxDepth;
+        std::vector<ScreenTriangle> triangles;
+        std::vector<glm::vec4> clipVertices;
+        bool rasterized;
+        double buildMilliseconds;
+        std::chrono::high_resolution_clock::time_point frameStart;
+
+        void AddClipTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c);
+        void AddScreenTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c);
+        void RasterizeTileRow(int tileRow);
+    };
+}
+
+#endif /* OcclusionCuller_hpp */
@@ -0,0 +1,98 @@
+#include "OcclusionQueries.hpp"
+#include "GLState.hpp"
+
+#include "glm/gtc/matrix_transform.hpp"
+
+#include <algorithm>
+
+namespace gps {
+
+    void OcclusionQueries::Init(const std::string& proxyVertexShader, const std::string& proxyFragmentShader)
+    {
+        proxyShader.loadShader(proxyVertexShader, proxyFragmentShader);
+        proxyMatrixUniform = proxyShader.getUniform("proxyMatrix");
+
+        // unit cube; faces are never culled, so the winding does not matter
+        const GLfloat corners[] = {
+            0.0f, 0.0f, 0.0f,  1.0f, 0.0f, 0.0f,  1.0f, 1.0f, 0.0f,  0.0f, 1.0f, 0.0f,
+            0.0f, 0.0f, 1.0f,  1.0f, 0.0f, 1.0f,  1.0f, 1.0f, 1.0f,  0.0f, 1.0f, 1.0f
+        };
+        const GLubyte faces[] = {
+            0, 1, 2, 0, 2, 3,  4, 6, 5, 4, 7, 6,  0, 4, 5, 0, 5, 1,
+            3, 2, 6, 3, 6, 7,  0, 3, 7, 0, 7, 4,  1, 5, 6, 1, 6, 2
+        };
+
+        glGenVertexArrays(1, &proxyVAO);
+        glGenBuffers(1, &proxyVBO);
+        glGenBuffers(1, &proxyEBO);
+        GLState::Instance().BindVertexArray(proxyVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, proxyVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, proxyEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(faces), faces, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
+        GLState::Instance().BindVertexArray(0);
+    }
+
+    void OcclusionQueries::Delete()
+    {
+        if (!queries.empty())
+            glDeleteQueries((GLsizei)queries.size(), queries.data());
+        queries.clear();
+        glDeleteBuffers(1, &proxyEBO);
+        glDeleteBuffers(1, &proxyVBO);
+        GLState::Instance().DeleteVertexArray(proxyVAO);
+        proxyVAO = proxyVBO = proxyEBO = 0;
+    }
+
+    void OcclusionQueries::BeginFrame(const glm::mat4& viewProjection)
+    {
+        this->viewProjection = viewProjection;
+        frame++;
+    }
+
+    uint32_t OcclusionQueries::GetFrame() const
+    {
+        return frame;
+    }
+
+    GLuint OcclusionQueries::CreateQuery()
+    {
+        GLuint query = 0;
+        glGenQueries(1, &query);
+        queries.push_back(query);
+        return query;
+    }
+
+    void OcclusionQueries::DrawProxy(const MeshBounds& bounds, const glm::mat4& modelMatrix, GLuint query)
+    {
+        // flat meshes get some thickness, a zero-volume box would never pass a sample
+        glm::vec3 extent = bounds.boundsMax - bounds.boundsMin;
+        float padding = std::max(std::max(extent.x, std::max(extent.y, extent.z)) * 0.001f, 1e-4f);
+        glm::mat4 placement = glm::translate(glm::mat4(1.0f), bounds.boundsMin - glm::vec3(padding));
+        placement = glm::scale(placement, extent + glm::vec3(2.0f * padding));
+        glm::mat4 proxyMatrix = viewProjection * modelMatrix * placement;
+
+        proxyShader.useShaderProgram();
+        proxyShader.set(proxyMatrixUniform, proxyMatrix);
+
+        // the cached state answers without the pipeline stall of glIsEnabled
+        GLState& state = GLState::Instance();
+        bool cullFace = state.IsEnabled(GL_CULL_FACE);
+        bool depthWrite = state.IsDepthWriteEnabled();
+        bool colorWrite = state.IsColorWriteEnabled();
+        state.ColorMask(false);
+        state.DepthMask(false);
+        state.SetEnabled(GL_CULL_FACE, false);
+
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, query);
+        state.BindVertexArray(proxyVAO);
+        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, (GLvoid*)0);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+
+        state.SetEnabled(GL_CULL_FACE, cullFace);
+        state.DepthMask(depthWrite);
+        state.ColorMask(colorWrite);
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef OcclusionQueries_hpp
+#define OcclusionQueries_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "Frustum.hpp"
+#include "Shader.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Hardware occlusion queries for expensive meshes. A mesh hidden last frame is replaced by its bounding box
+    // drawn inside a GL_ANY_SAMPLES_PASSED query, and the real draw is wrapped in conditional rendering on that
+    // query; a visible mesh is queried with its own draw. Results are only read once the GPU has them, so the
+    // CPU never waits on a query.
+    class OcclusionQueries
+    {
+    public:
+        // Meshes drawn with fewer triangles cost less than their query
+        size_t minTriangles = 2048;
+
+        // Needs a GL context
+        void Init(const std::string& proxyVertexShader, const std::string& proxyFragmentShader);
+        void Delete();
+
+        void BeginFrame(const glm::mat4& viewProjection);
+        uint32_t GetFrame() const;
+
+        // Query object owned by this instance, deleted with it
+        GLuint CreateQuery();
+
+        // Draws the box without writing color or depth inside a GL_ANY_SAMPLES_PASSED query
+        void DrawProxy(const MeshBounds& bounds, const glm::mat4& modelMatrix, GLuint query);
+
+    private:
+        gps::Shader proxyShader;
+        UniformHandle proxyMatrixUniform = -1;
+        GLuint proxyVAO = 0;
+        GLuint proxyVBO = 0;
+        GLuint proxyEBO = 0;
+        std::vector<GLuint> queries;
+        glm::mat4 viewProjection = glm::mat4(1.0f);
+        uint32_t frame = 0;
+    };
+}
+
+#endif /* OcclusionQueries_hpp */
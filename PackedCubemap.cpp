@@ -0,0 +1,234 @@
+#include "PackedCubemap.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace gps {
+
+    static const uint32_t PACKED_CUBEMAP_VERSION = 1;
+    static const char PACKED_CUBEMAP_MAGIC[4] = {'G', 'P', 'C', 'B'};
+    static const uint64_t PACKED_CUBEMAP_ALIGNMENT = 16;
+
+    struct PackedCubemapHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t format;
+        uint32_t srgb;
+        uint32_t width;
+        uint32_t height;
+        uint32_t levelCount;
+        uint32_t faceFileCount;
+        uint64_t faceFileTableOffset;
+        uint64_t levelTableOffset;
+        uint64_t blobOffset;
+        uint64_t blobSize;
+    };
+
+    struct FaceFileRecord
+    {
+        int64_t modifiedTime;
+        uint64_t fileSize;
+    };
+
+    // Face-major: all levels of face 0, then face 1, ...
+    struct LevelRecord
+    {
+        uint64_t offset;
+        uint64_t size;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    static uint64_t AlignUp(uint64_t value)
+    {
+        return (value + PACKED_CUBEMAP_ALIGNMENT - 1) & ~(PACKED_CUBEMAP_ALIGNMENT - 1);
+    }
+
+    // Bytes a level must have in the given format
+    static uint64_t GetExpectedLevelSize(BLOCK_FORMAT format, uint32_t width, uint32_t height)
+    {
+        if (format == BLOCK_NONE)
+            return (uint64_t)width * height * 3;
+        return TextureCompression::GetLevelSize(format, (int)width, (int)height);
+    }
+
+    bool PackedCubemap::Write(const std::string& fileName, const std::vector<std::string>& faceFiles, BLOCK_FORMAT format,
+        bool srgb, const std::vector<std::vector<ImageLevel> >& faces)
+    {
+        if (faces.size() != FACE_COUNT || faces[0].empty())
+            return false;
+
+        std::vector<FaceFileRecord> faceRecords(faceFiles.size());
+        for (size_t i = 0; i < faceFiles.size(); i++) {
+            if (!GetFileStamp(faceFiles[i], faceRecords[i].modifiedTime, faceRecords[i].fileSize))
+                return false;
+        }
+
+        PackedCubemapHeader header = {};
+        memcpy(header.magic, PACKED_CUBEMAP_MAGIC, sizeof(header.magic));
+        header.version = PACKED_CUBEMAP_VERSION;
+        header.format = (uint32_t)format;
+        header.srgb = srgb ? 1 : 0;
+        header.width = (uint32_t)faces[0][0].width;
+        header.height = (uint32_t)faces[0][0].height;
+        header.levelCount = (uint32_t)faces[0].size();
+        header.faceFileCount = (uint32_t)faceRecords.size();
+        header.faceFileTableOffset = sizeof(PackedCubemapHeader);
+        header.levelTableOffset = header.faceFileTableOffset + faceRecords.size() * sizeof(FaceFileRecord);
+        header.blobOffset = AlignUp(header.levelTableOffset + (uint64_t)FACE_COUNT * header.levelCount * sizeof(LevelRecord));
+
+        std::vector<LevelRecord> levelRecords;
+        uint64_t offset = 0;
+        for (int face = 0; face < FACE_COUNT; face++) {
+            if (faces[face].size() != header.levelCount)
+                return false;
+            for (size_t level = 0; level < faces[face].size(); level++) {
+                LevelRecord record;
+                record.offset = offset;
+                record.size = faces[face][level].pixels.size();
+                record.width = (uint32_t)faces[face][level].width;
+                record.height = (uint32_t)faces[face][level].height;
+                levelRecords.push_back(record);
+                offset += record.size;
+            }
+        }
+        header.blobSize = offset;
+
+        // written under a temporary name so a reader never maps a half-written file
+        std::string temporaryPath = fileName + ".tmp";
+        std::ofstream out(temporaryPath.c_str(), std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cerr << "WARNING: could not write packed cubemap " << fileName << std::endl;
+            return false;
+        }
+
+        out.write((const char*)&header, sizeof(header));
+        out.write((const char*)faceRecords.data(), faceRecords.size() * sizeof(FaceFileRecord));
+        out.write((const char*)levelRecords.data(), levelRecords.size() * sizeof(LevelRecord));
+        static const char zeros[PACKED_CUBEMAP_ALIGNMENT] = {};
+        uint64_t position = header.levelTableOffset + levelRecords.size() * sizeof(LevelRecord);
+        out.write(zeros, (std::streamsize)(header.blobOffset - position));
+        for (int face = 0; face < FACE_COUNT; face++) {
+            for (size_t level = 0; level < faces[face].size(); level++)
+                out.write((const char*)faces[face][level].pixels.data(), (std::streamsize)faces[face][level].pixels.size());
+        }
+
+        bool written = out.good();
+        out.close();
+        if (!written) {
+            std::remove(temporaryPath.c_str());
+            std::cerr << "WARNING: could not write packed cubemap " << fileName << std::endl;
+            return false;
+        }
+
+        std::remove(fileName.c_str());
+        return std::rename(temporaryPath.c_str(), fileName.c_str()) == 0;
+    }
+
+    bool PackedCubemap::Open(const std::string& fileName, const std::vector<std::string>& faceFiles, const BlockFormatSupport& support)
+    {
+        if (!file.Open(fileName))
+            return false;
+
+        if (!Validate(faceFiles, support)) {
+            file.Close();
+            return false;
+        }
+        return true;
+    }
+
+    void PackedCubemap::Close()
+    {
+        file.Close();
+    }
+
+    bool PackedCubemap::Validate(const std::vector<std::string>& faceFiles, const BlockFormatSupport& support)
+    {
+        if (file.GetSize() < sizeof(PackedCubemapHeader))
+            return false;
+
+        const PackedCubemapHeader* header = (const PackedCubemapHeader*)file.GetData();
+        if (memcmp(header->magic, PACKED_CUBEMAP_MAGIC, sizeof(header->magic)) != 0 || header->version != PACKED_CUBEMAP_VERSION)
+            return false;
+        if (header->levelCount == 0 || header->levelCount > 32)
+            return false;
+
+        // a pack written on a machine with other block formats is rebuilt for this driver
+        BLOCK_FORMAT format = (BLOCK_FORMAT)header->format;
+        if (header->format > BLOCK_BC7 || (format != BLOCK_NONE && !TextureCompression::IsSupported(format, support)))
+            return false;
+
+        uint64_t levelTableEnd = header->levelTableOffset + (uint64_t)FACE_COUNT * header->levelCount * sizeof(LevelRecord);
+        if (header->faceFileTableOffset + (uint64_t)header->faceFileCount * sizeof(FaceFileRecord) > header->levelTableOffset
+            || levelTableEnd > header->blobOffset || header->blobOffset + header->blobSize != file.GetSize())
+            return false;
+
+        // stale if any face image changed since the pack was written
+        if (!faceFiles.empty()) {
+            if (faceFiles.size() != header->faceFileCount)
+                return false;
+            const FaceFileRecord* records = (const FaceFileRecord*)(file.GetData() + header->faceFileTableOffset);
+            for (size_t i = 0; i < faceFiles.size(); i++) {
+                int64_t modifiedTime;
+                uint64_t fileSize;
+                if (!GetFileStamp(faceFiles[i], modifiedTime, fileSize))
+                    return false;
+                if (modifiedTime != records[i].modifiedTime || fileSize != records[i].fileSize)
+                    return false;
+            }
+        }
+
+        const LevelRecord* levels = (const LevelRecord*)(file.GetData() + header->levelTableOffset);
+        for (uint32_t i = 0; i < FACE_COUNT * header->levelCount; i++) {
+            if (levels[i].offset + levels[i].size > header->blobSize)
+                return false;
+            if (levels[i].size != GetExpectedLevelSize(format, levels[i].width, levels[i].height))
+                return false;
+        }
+        return true;
+    }
+
+    BLOCK_FORMAT PackedCubemap::GetFormat() const
+    {
+        return (BLOCK_FORMAT)((const PackedCubemapHeader*)file.GetData())->format;
+    }
+
+    bool PackedCubemap::IsSrgb() const
+    {
+        return ((const PackedCubemapHeader*)file.GetData())->srgb != 0;
+    }
+
+    size_t PackedCubemap::GetLevelCount() const
+    {
+        if (!file.IsOpen())
+            return 0;
+        return ((const PackedCubemapHeader*)file.GetData())->levelCount;
+    }
+
+    CubemapLevel PackedCubemap::GetLevel(int face, size_t level) const
+    {
+        const PackedCubemapHeader* header = (const PackedCubemapHeader*)file.GetData();
+        const LevelRecord& record = ((const LevelRecord*)(file.GetData() + header->levelTableOffset))[face * header->levelCount + level];
+
+        CubemapLevel result;
+        result.data = GetBlob() + record.offset;
+        result.size = (size_t)record.size;
+        result.blobOffset = (size_t)record.offset;
+        result.width = (int)record.width;
+        result.height = (int)record.height;
+        return result;
+    }
+
+    const unsigned char* PackedCubemap::GetBlob() const
+    {
+        return file.GetData() + ((const PackedCubemapHeader*)file.GetData())->blobOffset;
+    }
+
+    size_t PackedCubemap::GetBlobSize() const
+    {
+        return (size_t)((const PackedCubemapHeader*)file.GetData())->blobSize;
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef PackedCubemap_hpp
+#define PackedCubemap_hpp
+
+#include "ImagePipeline.hpp"
+#include "MappedFile.hpp"
+#include "TextureCompression.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Mip level of one cubemap face; for block formats the pixels are the compressed blocks
+    struct CubemapLevel
+    {
+        const unsigned char* data;
+        size_t size;
+        // offset of data from the start of the blob, for uploads through a pixel-unpack buffer
+        size_t blobOffset;
+        int width;
+        int height;
+    };
+
+    // Single file holding all six faces of a cubemap with every mip level in one contiguous blob,
+    // either block-compressed or RGB8. It is memory-mapped, so loading it costs no decode and no copy.
+    class PackedCubemap
+    {
+    public:
+        static const int FACE_COUNT = 6;
+
+        // Writes faces[face][level]; the face images are recorded so a stale pack can be detected
+        static bool Write(const std::string& fileName, const std::vector<std::string>& faceFiles, BLOCK_FORMAT format,
+            bool srgb, const std::vector<std::vector<ImageLevel> >& faces);
+
+        // Maps the pack; fails if it is missing, corrupt, in a format the driver lacks, or older than the face
+        // images (pass no face files to skip that check)
+        bool Open(const std::string& fileName, const std::vector<std::string>& faceFiles, const BlockFormatSupport& support);
+        void Close();
+
+        BLOCK_FORMAT GetFormat() const;
+        bool IsSrgb() const;
+        size_t GetLevelCount() const;
+        CubemapLevel GetLevel(int face, size_t level) const;
+
+        // All levels of all faces, back to back
+        const unsigned char* GetBlob() const;
+        size_t GetBlobSize() const;
+
+    private:
+        MappedFile file;
+
+        bool Validate(const std::vector<std::string>& faceFiles, const BlockFormatSupport& support);
+    };
+}
+
+#endif /* PackedCubemap_hpp */
@@ -0,0 +1,254 @@
+#include "RenderQueue.hpp"
+#include "GLState.hpp"
+#include "RenderStats.hpp"
+
+#include <algorithm>
+
+namespace gps {
+
+    static const uint64_t DEPTH_MASK = (1u << 24) - 1;
+    static const uint64_t MATERIAL_MASK = (1u << 24) - 1;
+    static const uint64_t PROGRAM_MASK = (1u << 11) - 1;
+
+    void RenderQueue::BeginFrame(const glm::vec3& cameraPosition, float farDistance)
+    {
+        arena.Reset();
+        entries.clear();
+        shaders.clear();
+        this->cameraPosition = cameraPosition;
+        depthScale = farDistance > 0.0f ? (float)DEPTH_MASK / farDistance : 0.0f;
+        pass = PASS_MAIN;
+        object = nullptr;
+        translucent = false;
+    }
+
+    void RenderQueue::SetPass(RENDER_PASS pass)
+    {
+        this->pass = pass;
+    }
+
+    void RenderQueue::PushObject(const ObjectUniforms& object)
+    {
+        this->object = arena.Create(object);
+        translucent = object.transparency < 1.0f;
+    }
+
+    uint8_t RenderQueue::GetShaderIndex(const gps::Shader& shader)
+    {
+        for (size_t i = 0; i < shaders.size(); i++)
+            if (shaders[i].shaderProgram == shader.shaderProgram)
+                return (uint8_t)i;
+        shaders.push_back(shader);
+        return (uint8_t)(shaders.size() - 1);
+    }
+
+    void RenderQueue::Submit(const gps::Shader& shader, Mesh& mesh, int lod, bool alphaTested, QUERY_MODE queryMode,
+        GLuint query, OcclusionQueries* queries)
+    {
+        // distance of the bounding sphere's center, in world space
+        glm::vec3 center = mesh.getBounds().sphereCenter;
+        if (object)
+            center = glm::vec3(object->model * glm::vec4(center, 1.0f));
+        float scaled = glm::length(center - cameraPosition) * depthScale;
+        uint64_t depth = (uint64_t)std::min(std::max(scaled, 0.0f), (float)DEPTH_MASK);
+
+        uint64_t program = shader.shaderProgram & PROGRAM_MASK;
+        uint64_t material = mesh.getMaterialId() & MATERIAL_MASK;
+        uint64_t key = (uint64_t)pass << 60;
+        if (translucent)
+            key |= (uint64_t)1 << 59 | (DEPTH_MASK - depth) << 35 | program << 24 | material;
+        else
+            key |= program << 48 | depth << 24 | material;
+
+        DrawPacket packet;
+        packet.key = key;
+        packet.mesh = &mesh;
+        packet.object = object;
+        packet.queries = queries;
+        packet.query = query;
+        packet.lod = (int16_t)lod;
+        packet.shaderIndex = GetShaderIndex(shader);
+        packet.queryMode = (uint8_t)queryMode;
+        packet.alphaTested = alphaTested;
+
+        SortEntry entry;
+        entry.key = key;
+        entry.packet = arena.Create(packet);
+        entries.push_back(entry);
+    }
+
+    void RenderQueue::SetMultiDraw(bool enabled)
+    {
+        multiDraw = enabled;
+    }
+
+    bool RenderQueue::IsMultiDrawEnabled() const
+    {
+        return multiDraw;
+    }
+
+    void RenderQueue::SetDepthPrepass(bool enabled, const gps::Shader& depthShader)
+    {
+        depthPrepass = enabled;
+        this->depthShader = depthShader;
+    }
+
+    bool RenderQueue::IsDepthPrepassEnabled() const
+    {
+        return depthPrepass;
+    }
+
+    size_t RenderQueue::GetBatchEnd(size_t first) const
+    {
+        const DrawPacket& head = *entries[first].packet;
+        if (!multiDraw || head.queryMode != QUERY_NONE || !head.mesh->getInstances().empty())
+            return first + 1;
+
+        GeometryBlock block = GeometryArena::Instance().GetBlock(head.mesh->getGeometry());
+        size_t end = first + 1;
+        for (; end < entries.size(); end++) {
+            const DrawPacket& packet = *entries[end].packet;
+            if (packet.queryMode != QUERY_NONE || packet.shaderIndex != head.shaderIndex || packet.object != head.object
+                || packet.mesh->getMaterialId() != head.mesh->getMaterialId() || !packet.mesh->getInstances().empty())
+                break;
+            GeometryBlock other = GeometryArena::Instance().GetBlock(packet.mesh->getGeometry());
+            if (other.vertexArray != block.vertexArray || other.indexType != block.indexType)
+                break;
+        }
+        return end;
+    }
+
+    void RenderQueue::DrawBatch(const gps::Shader& shader, size_t first, size_t end)
+    {
+        commands.clear();
+        decodes.clear();
+        size_t triangles = 0;
+        size_t fullDetailTriangles = 0;
+        size_t vertices = 0;
+        for (size_t i = first; i < end; i++) {
+            const DrawPacket& packet = *entries[i].packet;
+            commands.push_back(packet.mesh->getDrawCommand(packet.lod));
+            decodes.push_back(packet.mesh->getDecode());
+            triangles += commands.back().count / 3;
+            fullDetailTriangles += packet.mesh->getIndexCount(0) / 3;
+            vertices += packet.mesh->getVertexCount();
+        }
+        RenderStats::Instance().AddMultiDraw(commands.size(), triangles, fullDetailTriangles);
+
+        // the run shares its material, so the first mesh binds it for all of them; the position streams are laid
+        // out like the full vertices, so the same commands draw from either vertex array
+        Mesh& head = *entries[first].packet->mesh;
+        head.bindMaterial(shader);
+        GeometryArena& arena = GeometryArena::Instance();
+        GeometryBlock block = arena.GetBlock(head.getGeometry());
+        bool positionOnly = shader.readsPositionOnly();
+        GLuint vertexArray = arena.GetVertexArray(block, positionOnly);
+        RenderStats::Instance().AddVertexFetch(vertices * arena.GetFetchStride(block, positionOnly), vertexArray != block.vertexArray);
+        GLState::Instance().BindVertexArray(vertexArray);
+        arena.MultiDraw(block.indexType, commands.data(), decodes.data(), commands.size());
+    }
+
+    void RenderQueue::Flush(UniformBuffers& uniformBuffers)
+    {
+        std::sort(entries.begin(), entries.end(), [](const SortEntry& a, const SortEntry& b) {
+            return a.key < b.key;
+        });
+        if (depthPrepass)
+            DrawDepthPrepass(uniformBuffers);
+
+        GLState& state = GLState::Instance();
+        const ObjectUniforms* current = nullptr;
+        for (size_t i = 0; i < entries.size(); ) {
+            const DrawPacket& packet = *entries[i].packet;
+            const gps::Shader& shader = shaders[packet.shaderIndex];
+            if (packet.object != current && packet.object) {
+                uniformBuffers.PushObject(*packet.object);
+                current = packet.object;
+            }
+            state.SetEnabled(GL_BLEND, (packet.key >> 59 & 1) != 0);
+            if (depthPrepass) {
+                bool prepassed = IsPrepassed(packet);
+                state.DepthFunc(prepassed ? GL_EQUAL : GL_LEQUAL);
+                state.DepthMask(!prepassed);
+            }
+            size_t end = GetBatchEnd(i);
+            if (end - i > 1)
+                DrawBatch(shader, i, end);
+            else
+                DrawMesh(shader, *packet.mesh, packet.lod, (QUERY_MODE)packet.queryMode, packet.query, packet.queries,
+                    packet.object ? packet.object->model : glm::mat4(1.0f));
+            i = end;
+        }
+        // back to the renderer's defaults for whatever is drawn outside the queue
+        state.SetEnabled(GL_BLEND, false);
+        state.DepthFunc(GL_LEQUAL);
+        state.DepthMask(true);
+        entries.clear();
+    }
+
+    bool RenderQueue::IsPrepassed(const DrawPacket& packet) const
+    {
+        // a draw an occlusion query may skip would leave depth behind that nothing is shaded at
+        return depthPrepass && (packet.key >> 59 & 1) == 0 && !packet.alphaTested
+            && (packet.queryMode == QUERY_NONE || packet.queryMode == QUERY_ISSUE);
+    }
+
+    void RenderQueue::DrawDepthPrepass(UniformBuffers& uniformBuffers)
+    {
+        GLState& state = GLState::Instance();
+        state.ColorMask(false);
+        state.DepthMask(true);
+        state.DepthFunc(GL_LEQUAL);
+        state.SetEnabled(GL_BLEND, false);
+
+        // same order and runs as the shading pass; the depth shader reads the position streams of the arena
+        const ObjectUniforms* current = nullptr;
+        for (size_t i = 0; i < entries.size(); ) {
+            const DrawPacket& packet = *entries[i].packet;
+            if (!IsPrepassed(packet)) {
+                i++;
+                continue;
+            }
+            if (packet.object != current && packet.object) {
+                uniformBuffers.PushObject(*packet.object);
+                current = packet.object;
+            }
+            size_t end = GetBatchEnd(i);
+            if (end - i > 1)
+                DrawBatch(depthShader, i, end);
+            else
+                packet.mesh->Draw(depthShader, packet.lod);
+            i = end;
+        }
+        state.ColorMask(true);
+    }
+
+    size_t RenderQueue::GetPacketCount() const
+    {
+        return entries.size();
+    }
+
+    void RenderQueue::DrawMesh(const gps::Shader& shader, Mesh& mesh, int lod, QUERY_MODE queryMode, GLuint query,
+        OcclusionQueries* queries, const glm::mat4& modelMatrix)
+    {
+        switch (queryMode) {
+        case QUERY_NONE:
+            mesh.Draw(shader, lod);
+            break;
+        case QUERY_ISSUE:
+            glBeginQuery(GL_ANY_SAMPLES_PASSED, query);
+            mesh.Draw(shader, lod);
+            glEndQuery(GL_ANY_SAMPLES_PASSED);
+            break;
+        case QUERY_PROXY:
+            // the proxy binds its own program; Mesh::Draw binds the draw's one back
+            queries->DrawProxy(mesh.getBounds(), modelMatrix, query);
+            // fall through
+        case QUERY_CONDITIONAL:
+            glBeginConditionalRender(query, GL_QUERY_WAIT);
+            mesh.Draw(shader, lod);
+            glEndConditionalRender();
+            break;
+        }
+    }
+}
@@ -0,0 +1,121 @@
+#ifndef RenderQueue_hpp
+#define RenderQueue_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "FrameArena.hpp"
+#include "Mesh.hpp"
+#include "OcclusionQueries.hpp"
+#include "Shader.hpp"
+#include "UniformBuffers.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    // Passes run in this order
+    enum RENDER_PASS {PASS_MAIN};
+
+    // How a draw takes part in its mesh's occlusion query
+    enum QUERY_MODE {
+        QUERY_NONE,
+        // the draw itself is counted by the query
+        QUERY_ISSUE,
+        // the draw is skipped on the GPU unless the pending query passed a sample
+        QUERY_CONDITIONAL,
+        // the bounding box is queried first and the draw made conditional on it
+        QUERY_PROXY
+    };
+
+    // One mesh draw waiting in the queue
+    struct DrawPacket
+    {
+        uint64_t key;
+        Mesh* mesh;
+        const ObjectUniforms* object;
+        OcclusionQueries* queries;
+        GLuint query;
+        int16_t lod;
+        uint8_t shaderIndex;
+        uint8_t queryMode;
+        // drawn with the alpha-tested permutation, so it cannot take part in the depth pre-pass
+        bool alphaTested;
+    };
+
+    // Collects the mesh draws of a frame and submits them sorted by a 64-bit key. From the top bit down the key holds
+    // the pass (4 bits) and a translucency bit; opaque draws follow with the program (11 bits), the quantized depth
+    // (24 bits, front to back) and the material (24 bits), translucent ones with the inverted depth (back to front)
+    // before the program and material. Packets come from a per-frame arena. With multi-draw on, runs of sorted packets
+    // that share the program, object, material and GeometryArena pool are submitted as one indirect draw. With the
+    // depth pre-pass on, the opaque packets are first drawn with a position-only depth shader and then shaded with
+    // GL_EQUAL and no depth writes, so every covered pixel is lit once.
+    class RenderQueue
+    {
+    public:
+        // Opens a new frame; depths are quantized over [0, farDistance] from the camera
+        void BeginFrame(const glm::vec3& cameraPosition, float farDistance);
+        void SetPass(RENDER_PASS pass);
+
+        // Per-object uniforms for the draws submitted after it, uploaded when the queue reaches them; objects with
+        // transparency below 1 are blended
+        void PushObject(const ObjectUniforms& object);
+
+        // `alphaTested` marks a draw the caller gave the alpha-tested permutation, which keeps it out of the pre-pass
+        void Submit(const gps::Shader& shader, Mesh& mesh, int lod, bool alphaTested, QUERY_MODE queryMode = QUERY_NONE,
+            GLuint query = 0, OcclusionQueries* queries = nullptr);
+
+        // Needs GeometryArena::IsMultiDrawSupported; off, every mesh is drawn on its own with a base vertex
+        void SetMultiDraw(bool enabled);
+        bool IsMultiDrawEnabled() const;
+
+        // Lays down the depth of the opaque packets with `depthShader` before shading them; blended, alpha-tested and
+        // occlusion-tested packets are left to the shading pass
+        void SetDepthPrepass(bool enabled, const gps::Shader& depthShader);
+        bool IsDepthPrepassEnabled() const;
+
+        // Sorts the packets, draws them and empties the queue
+        void Flush(UniformBuffers& uniformBuffers);
+
+        size_t GetPacketCount() const;
+
+        // Draws a mesh as its query mode says, with the program and uniforms already in place
+        static void DrawMesh(const gps::Shader& shader, Mesh& mesh, int lod, QUERY_MODE queryMode, GLuint query,
+            OcclusionQueries* queries, const glm::mat4& modelMatrix);
+
+    private:
+        struct SortEntry
+        {
+            uint64_t key;
+            const DrawPacket* packet;
+        };
+
+        FrameArena arena;
+        // reused from frame to frame, so they stop allocating once they reach the frame's size
+        std::vector<SortEntry> entries;
+        std::vector<gps::Shader> shaders;
+        std::vector<DrawElementsIndirectCommand> commands;
+        std::vector<VertexDecode> decodes;
+        glm::vec3 cameraPosition = glm::vec3(0.0f);
+        float depthScale = 0.0f;
+        RENDER_PASS pass = PASS_MAIN;
+        const ObjectUniforms* object = nullptr;
+        bool translucent = false;
+        bool multiDraw = false;
+        bool depthPrepass = false;
+        gps::Shader depthShader;
+
+        uint8_t GetShaderIndex(const gps::Shader& shader);
+        // End of the run of entries from `first` on that one multi-draw can cover
+        size_t GetBatchEnd(size_t first) const;
+        // Draws the entries [first, end) with one glMultiDrawElementsIndirect
+        void DrawBatch(const gps::Shader& shader, size_t first, size_t end);
+        // Whether the packet's depth is laid down by the pre-pass, which leaves it to be shaded with GL_EQUAL
+        bool IsPrepassed(const DrawPacket& packet) const;
+        void DrawDepthPrepass(UniformBuffers& uniformBuffers);
+    };
+}
+
+#endif /* RenderQueue_hpp */
@@ -0,0 +1,187 @@
+#include "RenderStats.hpp"
+
+#include <iostream>
+
+namespace gps {
+
+    RenderStats& RenderStats::Instance()
+    {
+        static RenderStats instance;
+        return instance;
+    }
+
+    void RenderStats::BeginFrame()
+    {
+        if (capturing) {
+            captured.drawCalls += current.drawCalls;
+            captured.triangles += current.triangles;
+            captured.fullDetailTriangles += current.fullDetailTriangles;
+            captured.meshesVisible += current.meshesVisible;
+            captured.meshesCulled += current.meshesCulled;
+            captured.meshesOccluded += current.meshesOccluded;
+            captured.occlusionMilliseconds += current.occlusionMilliseconds;
+            captured.queriesResolved += current.queriesResolved;
+            captured.queryLatencyFrames += current.queryLatencyFrames;
+            captured.drawsSkipped += current.drawsSkipped;
+            captured.uniformCalls += current.uniformCalls;
+            captured.uniformCallsSkipped += current.uniformCallsSkipped;
+            captured.uniformBufferUpdates += current.uniformBufferUpdates;
+            captured.uniformBufferBytes += current.uniformBufferBytes;
+            captured.stateChangesRequested += current.stateChangesRequested;
+            captured.stateChangesIssued += current.stateChangesIssued;
+            captured.vertexArrayBinds += current.vertexArrayBinds;
+            captured.multiDrawCommands += current.multiDrawCommands;
+            captured.instancesStreamed += current.instancesStreamed;
+            captured.instanceBytes += current.instanceBytes;
+            captured.vertexBytes += current.vertexBytes;
+            captured.positionOnlyDraws += current.positionOnlyDraws;
+            capturedFrames++;
+        }
+        last = current;
+        current = FrameStats();
+    }
+
+    void RenderStats::AddDraw(size_t triangles, size_t fullDetailTriangles)
+    {
+        current.drawCalls++;
+        current.triangles += triangles;
+        current.fullDetailTriangles += fullDetailTriangles;
+    }
+
+    void RenderStats::AddMultiDraw(size_t commands, size_t triangles, size_t fullDetailTriangles)
+    {
+        current.drawCalls++;
+        current.multiDrawCommands += commands;
+        current.triangles += triangles;
+        current.fullDetailTriangles += fullDetailTriangles;
+    }
+
+    void RenderStats::AddCulling(size_t visible, size_t culled, size_t occluded)
+    {
+        current.meshesVisible += visible;
+        current.meshesCulled += culled;
+        current.meshesOccluded += occluded;
+    }
+
+    void RenderStats::AddOcclusionTime(double milliseconds)
+    {
+        current.occlusionMilliseconds += milliseconds;
+    }
+
+    void RenderStats::AddQueryResult(size_t latencyFrames, size_t skippedDraws)
+    {
+        current.queriesResolved++;
+        current.queryLatencyFrames += latencyFrames;
+        current.drawsSkipped += skippedDraws;
+    }
+
+    void RenderStats::AddUniformUpdate(bool sent)
+    {
+        if (sent)
+            current.uniformCalls++;
+        else
+            current.uniformCallsSkipped++;
+    }
+
+    void RenderStats::AddUniformBufferUpdate(size_t bytes)
+    {
+        current.uniformBufferUpdates++;
+        current.uniformBufferBytes += bytes;
+    }
+
+    void RenderStats::AddStateChange(bool issued)
+    {
+        current.stateChangesRequested++;
+        if (issued)
+            current.stateChangesIssued++;
+    }
+
+    void RenderStats::AddVertexArrayBind()
+    {
+        current.vertexArrayBinds++;
+    }
+
+    void RenderStats::AddInstanceUpload(size_t instances, size_t bytes)
+    {
+        current.instancesStreamed += instances;
+        current.instanceBytes += bytes;
+    }
+
+    void RenderStats::AddVertexFetch(size_t bytes, bool positionOnly)
+    {
+        current.vertexBytes += bytes;
+        if (positionOnly)
+            current.positionOnlyDraws++;
+    }
+
+    const FrameStats& RenderStats::GetLastFrame() const
+    {
+        return last;
+    }
+
+    void RenderStats::PrintLastFrame() const
+    {
+        std::cout << "Frame : " << last.drawCalls << " draw calls, " << last.triangles << " triangles ("
+            << last.fullDetailTriangles << " at full detail), " << last.meshesVisible << " meshes visible, "
+            << last.meshesCulled << " culled, " << last.meshesOccluded << " occluded (" << last.occlusionMilliseconds
+            << " ms)" << std::endl;
+        std::cout << "Uniforms : " << last.uniformCalls << " GL calls, " << last.uniformCallsSkipped
+            << " redundant ones skipped, " << last.uniformBufferUpdates << " buffer updates (" << last.uniformBufferBytes
+            << " bytes)" << std::endl;
+        std::cout << "GL state : " << last.stateChangesIssued << " calls issued of " << last.stateChangesRequested
+            << " requested" << std::endl;
+        std::cout << "Geometry : " << last.vertexArrayBinds << " VAO binds, " << last.drawCalls << " draw calls, "
+            << last.multiDrawCommands << " meshes drawn through multi-draws, " << last.instancesStreamed
+            << " instances streamed (" << last.instanceBytes << " bytes), ~" << last.vertexBytes
+            << " vertex bytes fetched (" << last.positionOnlyDraws << " position-only draws)" << std::endl;
+        if (last.queriesResolved > 0) {
+            std::cout << "Occlusion queries : " << last.queriesResolved << " read back, latency "
+                << (double)last.queryLatencyFrames / last.queriesResolved << " frames, " << last.drawsSkipped
+                << " draws skipped" << std::endl;
+        }
+    }
+
+    void RenderStats::BeginCapture()
+    {
+        // the frame in flight was drawn before the capture started
+        last = current;
+        current = FrameStats();
+        captured = FrameStats();
+        capturedFrames = 0;
+        capturing = true;
+    }
+
+    void RenderStats::EndCapture(const std::string& label)
+    {
+        BeginFrame();
+        capturing = false;
+        if (capturedFrames == 0)
+            return;
+
+        double frames = (double)capturedFrames;
+        double fullDetail = captured.fullDetailTriangles / frames;
+        double submitted = captured.triangles / frames;
+        std::cout << label << " : " << capturedFrames << " frames, per frame " << captured.drawCalls / frames << " draw calls, "
+            << submitted << " triangles with LOD, " << fullDetail << " at full detail";
+        if (fullDetail > 0.0)
+            std::cout << " (" << 100.0 * submitted / fullDetail << "%)";
+        std::cout << ", " << captured.meshesVisible / frames << " meshes visible, " << captured.meshesCulled / frames
+            << " culled, " << captured.meshesOccluded / frames << " occluded (" << captured.occlusionMilliseconds / frames
+            << " ms)" << std::endl;
+        std::cout << label << " uniforms : " << captured.uniformCalls / frames << " GL calls per frame, "
+            << captured.uniformCallsSkipped / frames << " redundant ones skipped, " << captured.uniformBufferUpdates / frames
+            << " buffer updates (" << captured.uniformBufferBytes / frames << " bytes)" << std::endl;
+        std::cout << label << " GL state : " << captured.stateChangesIssued / frames << " calls issued of "
+            << captured.stateChangesRequested / frames << " requested per frame" << std::endl;
+        std::cout << label << " geometry : " << captured.vertexArrayBinds / frames << " VAO binds, "
+            << captured.drawCalls / frames << " draw calls, " << captured.multiDrawCommands / frames
+            << " meshes drawn through multi-draws, " << captured.instancesStreamed / frames << " instances streamed ("
+            << captured.instanceBytes / frames << " bytes), ~" << captured.vertexBytes / frames << " vertex bytes fetched ("
+            << captured.positionOnlyDraws / frames << " position-only draws) per frame" << std::endl;
+        if (captured.queriesResolved > 0) {
+            std::cout << label << " occlusion queries : " << captured.queriesResolved / frames << " read back per frame, latency "
+                << (double)captured.queryLatencyFrames / captured.queriesResolved << " frames, "
+                << captured.drawsSkipped / frames << " draws skipped per frame" << std::endl;
+        }
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef RenderStats_hpp
+#define RenderStats_hpp
+
+#include <cstddef>
+#include <string>
+
+namespace gps {
+
+    // What one frame submitted to the GPU
+    struct FrameStats
+    {
+        size_t drawCalls = 0;
+        size_t triangles = 0;
+        // triangles the same draws would have submitted at full detail
+        size_t fullDetailTriangles = 0;
+        // meshes drawn, rejected by the view frustum and hidden behind occluders
+        size_t meshesVisible = 0;
+        size_t meshesCulled = 0;
+        size_t meshesOccluded = 0;
+        // CPU time spent building the occlusion buffer
+        double occlusionMilliseconds = 0.0;
+        // occlusion queries read back, the frames they took summed, and the conditional draws they skipped
+        size_t queriesResolved = 0;
+        size_t queryLatencyFrames = 0;
+        size_t drawsSkipped = 0;
+        // glUniform calls made, and redundant ones the shadow copies in gps::Shader left out
+        size_t uniformCalls = 0;
+        size_t uniformCallsSkipped = 0;
+        // writes to the uniform buffers and the bytes they carried
+        size_t uniformBufferUpdates = 0;
+        size_t uniformBufferBytes = 0;
+        // GL state changes the renderer asked gps::GLState for, and the ones it actually issued
+        size_t stateChangesRequested = 0;
+        size_t stateChangesIssued = 0;
+        // vertex arrays actually bound, and the mesh draws folded into multi-draw calls
+        size_t vertexArrayBinds = 0;
+        size_t multiDrawCommands = 0;
+        // instances streamed for explicit instanced draws and the bytes they took
+        size_t instancesStreamed = 0;
+        size_t instanceBytes = 0;
+        // estimate of the vertex bytes the draws fetched, each vertex of a drawn mesh read once per instance, and the
+        // draws that read a position-only stream
+        size_t vertexBytes = 0;
+        size_t positionOnlyDraws = 0;
+    };
+
+    // Per-frame counters of the draws the renderer submits, with averages over a captured span of frames
+    class RenderStats
+    {
+    public:
+        static RenderStats& Instance();
+
+        // Closes the previous frame and starts counting a new one
+        void BeginFrame();
+        void AddDraw(size_t triangles, size_t fullDetailTriangles);
+        // One glMultiDrawElementsIndirect call of `commands` draws
+        void AddMultiDraw(size_t commands, size_t triangles, size_t fullDetailTriangles);
+        void AddCulling(size_t visible, size_t culled, size_t occluded);
+        void AddOcclusionTime(double milliseconds);
+        void AddQueryResult(size_t latencyFrames, size_t skippedDraws);
+        void AddUniformUpdate(bool sent);
+        void AddUniformBufferUpdate(size_t bytes);
+        void AddStateChange(bool issued);
+        void AddVertexArrayBind();
+        void AddInstanceUpload(size_t instances, size_t bytes);
+        void AddVertexFetch(size_t bytes, bool positionOnly);
+
+        // Counts of the last complete frame
+        const FrameStats& GetLastFrame() const;
+        void PrintLastFrame() const;
+
+        // Averages every frame between the two calls, e.g. over the presentation flythrough
+        void BeginCapture();
+        void EndCapture(const std::string& label);
+
+    private:
+        FrameStats current;
+        FrameStats last;
+        FrameStats captured;
+        size_t capturedFrames = 0;
+        bool capturing = false;
+
+        RenderStats() {}
+
+        RenderStats(const RenderStats&) = delete;
+        RenderStats& operator=(const RenderStats&) = delete;
+    };
+}
+
+#endif /* RenderStats_hpp */
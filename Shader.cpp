@@ -1,4 +1,12 @@
 #include "Shader.hpp"
+#include "GLState.hpp"
+#include "RenderStats.hpp"
+#include "UniformBuffers.hpp"
+
+#include "glm/gtc/type_ptr.hpp"
+
+#include <algorithm>
+#include <cstring>
 
 namespace gps {
     std::string Shader::readShaderFile(std::string fileName)
@@ -49,10 +57,26 @@ namespace gps {
         }
     }
 
+    // The defines go right after the #version line, which has to stay first
+    static std::string insertDefines(const std::string& source, const std::string& defines)
+    {
+        if (defines.empty())
+            return source;
+        size_t lineEnd = source.find('\n');
+        if (source.compare(0, 8, "#version") != 0 || lineEnd == std::string::npos)
+            return defines + source;
+        return source.substr(0, lineEnd + 1) + defines + source.substr(lineEnd + 1);
+    }
+
     void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName)
+    {
+        loadShader(vertexShaderFileName, fragmentShaderFileName, "");
+    }
+
+    void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName, const std::string& defines)
     {
         //read, parse and compile the vertex shader
-        std::string v = readShaderFile(vertexShaderFileName);
+        std::string v = insertDefines(readShaderFile(vertexShaderFileName), defines);
         const GLchar* vertexShaderString = v.c_str();
         GLuint vertexShader;
         vertexShader = glCreateShader(GL_VERTEX_SHADER);
@@ -62,7 +86,7 @@ namespace gps {
         shaderCompileLog(vertexShader);
 
         //read, parse and compile the vertex shader
-        std::string f = readShaderFile(fragmentShaderFileName);
+        std::string f = insertDefines(readShaderFile(fragmentShaderFileName), defines);
         const GLchar* fragmentShaderString = f.c_str();
         GLuint fragmentShader;
         fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
@@ -80,11 +104,155 @@ namespace gps {
         glDeleteShader(fragmentShader);
         //check linking info
         shaderLinkLog(this->shaderProgram);
+
+        reflectUniforms();
+        reflectAttributes();
+    }
+
+    // A program whose vertex shader reads the position and nothing else of the vertex can draw from the
+    // position-only streams of the GeometryArena
+    void Shader::reflectAttributes()
+    {
+        GLint attributeCount = 0;
+        GLint maxNameLength = 0;
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_ATTRIBUTES, &attributeCount);
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxNameLength);
+        std::vector<GLchar> nameBuffer(std::max(maxNameLength, 1));
+
+        bool readsPosition = false;
+        bool readsOther = false;
+        for (GLint i = 0; i < attributeCount; i++) {
+            GLint size = 0;
+            GLenum type = GL_NONE;
+            glGetActiveAttrib(this->shaderProgram, (GLuint)i, (GLsizei)nameBuffer.size(), NULL, &size, &type, nameBuffer.data());
+            GLint location = glGetAttribLocation(this->shaderProgram, nameBuffer.data());
+            // 1 and 2 are the normal and the texture coordinates; the decode and instance attributes do not count
+            if (location == 0)
+                readsPosition = true;
+            else if (location == 1 || location == 2)
+                readsOther = true;
+        }
+        this->positionOnly = readsPosition && !readsOther;
+    }
+
+    bool Shader::readsPositionOnly() const
+    {
+        return this->positionOnly;
+    }
+
+    // Looks every active uniform up once, instead of on every draw, and attaches the shared uniform blocks
+    void Shader::reflectUniforms()
+    {
+        this->uniforms = std::make_shared<UniformTable>();
+
+        // GLSL 4.10 cannot give a block its binding, so it is set here by name
+        GLint blockCount = 0;
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORM_BLOCKS, &blockCount);
+        for (GLint i = 0; i < blockCount; i++) {
+            GLchar blockName[64];
+            glGetActiveUniformBlockName(this->shaderProgram, (GLuint)i, sizeof(blockName), NULL, blockName);
+            GLint binding = UniformBuffers::GetBlockBinding(blockName);
+            if (binding >= 0)
+                glUniformBlockBinding(this->shaderProgram, (GLuint)i, (GLuint)binding);
+        }
+
+        GLint uniformCount = 0;
+        GLint maxNameLength = 0;
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORMS, &uniformCount);
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+        std::vector<GLchar> nameBuffer(std::max(maxNameLength, 1));
+
+        for (GLint i = 0; i < uniformCount; i++) {
+            GLsizei nameLength = 0;
+            GLint size = 0;
+            GLenum type = GL_NONE;
+            glGetActiveUniform(this->shaderProgram, (GLuint)i, (GLsizei)nameBuffer.size(), &nameLength, &size, &type, nameBuffer.data());
+            std::string name(nameBuffer.data(), nameLength);
+            GLint location = glGetUniformLocation(this->shaderProgram, name.c_str());
+            // members of uniform blocks have no location
+            if (location < 0)
+                continue;
+
+            UniformSlot slot;
+            slot.location = location;
+            slot.type = type;
+            slot.hasValue = false;
+            UniformHandle handle = (UniformHandle)this->uniforms->slots.size();
+            this->uniforms->slots.push_back(slot);
+            this->uniforms->handles[name] = handle;
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+                this->uniforms->handles[name.substr(0, name.size() - 3)] = handle;
+        }
+    }
+
+    UniformHandle Shader::getUniform(const std::string& name) const
+    {
+        if (!this->uniforms)
+            return -1;
+        std::unordered_map<std::string, UniformHandle>::const_iterator found = this->uniforms->handles.find(name);
+        return found == this->uniforms->handles.end() ? -1 : found->second;
+    }
+
+    bool Shader::updateShadow(UniformHandle uniform, const void* value, size_t size)
+    {
+        if (uniform < 0 || !this->uniforms)
+            return false;
+        UniformSlot& slot = this->uniforms->slots[uniform];
+        if (slot.hasValue && std::memcmp(slot.value, value, size) == 0) {
+            RenderStats::Instance().AddUniformUpdate(false);
+            return false;
+        }
+        std::memcpy(slot.value, value, size);
+        slot.hasValue = true;
+        RenderStats::Instance().AddUniformUpdate(true);
+        return true;
+    }
+
+    void Shader::set(UniformHandle uniform, GLint value)
+    {
+        if (updateShadow(uniform, &value, sizeof(value)))
+            glProgramUniform1i(this->shaderProgram, this->uniforms->slots[uniform].location, value);
+    }
+
+    void Shader::set(UniformHandle uniform, GLfloat value)
+    {
+        if (updateShadow(uniform, &value, sizeof(value)))
+            glProgramUniform1f(this->shaderProgram, this->uniforms->slots[uniform].location, value);
+    }
+
+    void Shader::set(UniformHandle uniform, const glm::vec2& value)
+    {
+        if (updateShadow(uniform, glm::value_ptr(value), sizeof(value)))
+            glProgramUniform2fv(this->shaderProgram, this->uniforms->slots[uniform].location, 1, glm::value_ptr(value));
+    }
+
+    void Shader::set(UniformHandle uniform, const glm::vec3& value)
+    {
+        if (updateShadow(uniform, glm::value_ptr(value), sizeof(value)))
+            glProgramUniform3fv(this->shaderProgram, this->uniforms->slots[uniform].location, 1, glm::value_ptr(value));
+    }
+
+    void Shader::set(UniformHandle uniform, const glm::vec4& value)
+    {
+        if (updateShadow(uniform, glm::value_ptr(value), sizeof(value)))
+            glProgramUniform4fv(this->shaderProgram, this->uniforms->slots[uniform].location, 1, glm::value_ptr(value));
+    }
+
+    void Shader::set(UniformHandle uniform, const glm::mat3& value)
+    {
+        if (updateShadow(uniform, glm::value_ptr(value), sizeof(value)))
+            glProgramUniformMatrix3fv(this->shaderProgram, this->uniforms->slots[uniform].location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+
+    void Shader::set(UniformHandle uniform, const glm::mat4& value)
+    {
+        if (updateShadow(uniform, glm::value_ptr(value), sizeof(value)))
+            glProgramUniformMatrix4fv(this->shaderProgram, this->uniforms->slots[uniform].location, 1, GL_FALSE, glm::value_ptr(value));
     }
 
     void Shader::useShaderProgram()
     {
-        glUseProgram(this->shaderProgram);
+        GLState::Instance().UseProgram(this->shaderProgram);
     }
 
 }
@@ -2,23 +2,77 @@
 #define Shader_hpp
 
 #include <GL/glew.h>
+#include "glm/glm.hpp"
 
 #include <iostream>
 #include <fstream>
+#include <memory>
 #include <sstream>
 #include <iostream>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace gps {
 
+// Index of an active uniform in a Shader's table, -1 when the program does not use it
+typedef int UniformHandle;
+
 class Shader
 {
 public:
     GLuint shaderProgram;
     void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName);
+    // Permutation of the same sources, with lines such as "#define ALPHA_TEST\n" put in front of both stages
+    void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName, const std::string& defines);
     void useShaderProgram();
 
+    // Handle of an active uniform, found in the table built after linking; arrays also answer to their base name
+    UniformHandle getUniform(const std::string& name) const;
+
+    // Typed uniform updates through glProgramUniform, so the program does not have to be bound. Every copy
+    // of a Shader shares one shadow copy of the values, and a value equal to the last one set is not sent again.
+    void set(UniformHandle uniform, GLint value);
+    void set(UniformHandle uniform, GLfloat value);
+    void set(UniformHandle uniform, const glm::vec2& value);
+    void set(UniformHandle uniform, const glm::vec3& value);
+    void set(UniformHandle uniform, const glm::vec4& value);
+    void set(UniformHandle uniform, const glm::mat3& value);
+    void set(UniformHandle uniform, const glm::mat4& value);
+
+    // True when the vertex shader reads no vertex attribute but the position, e.g. the depth-only passes
+    bool readsPositionOnly() const;
+
+    template <typename T>
+    void set(const std::string& name, const T& value)
+    {
+        set(getUniform(name), value);
+    }
+
 private:
+    // Active uniform with the last value sent to it
+    struct UniformSlot
+    {
+        GLint location;
+        GLenum type;
+        bool hasValue;
+        unsigned char value[sizeof(glm::mat4)];
+    };
+
+    struct UniformTable
+    {
+        std::unordered_map<std::string, UniformHandle> handles;
+        std::vector<UniformSlot> slots;
+    };
+
+    std::shared_ptr<UniformTable> uniforms;
+    bool positionOnly = false;
+
+    // True when the value differs from the shadow copy, which then takes it
+    bool updateShadow(UniformHandle uniform, const void* value, size_t size);
+    void reflectUniforms();
+    void reflectAttributes();
+
     std::string readShaderFile(std::string fileName);
     void shaderCompileLog(GLuint shaderId);
     void shaderLinkLog(GLuint shaderProgramId);
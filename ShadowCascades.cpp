@@ -0,0 +1,245 @@
+#include "ShadowCascades.hpp"
+#include "GLState.hpp"
+
+#include "glm/gtc/matrix_transform.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+
+namespace gps {
+
+    const float ShadowCascades::PLACEMENT_MARGIN = 0.25f;
+    const float ShadowCascades::LIGHT_TOLERANCE_DEGREES = 0.25f;
+
+    // Blend between uniform (0) and logarithmic (1) split distances
+    static const float SPLIT_LAMBDA = 0.75f;
+    // Constant bias in texels of the coarser map; the slope-scaled part comes from the polygon offset
+    static const float BIAS_TEXELS = 1.5f;
+
+    GLuint ShadowCascades::CreateDepthArray(GLsizei resolution)
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        GLState::Instance().BindTexture(STATIC_SHADOW_UNIT, GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, resolution, resolution, CASCADE_COUNT, 0,
+            GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        // filtered comparisons give 2x2 PCF for free; outside the map nothing is in shadow
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        GLfloat border[] = {1.0f, 1.0f, 1.0f, 1.0f};
+        glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        return texture;
+    }
+
+    void ShadowCascades::Init(GLsizei staticResolution, GLsizei overlayResolution)
+    {
+        this->staticResolution = staticResolution;
+        this->overlayResolution = overlayResolution;
+        depthMapTexture = CreateDepthArray(staticResolution);
+        overlayTexture = CreateDepthArray(overlayResolution);
+
+        // depth only: the layers are attached one at a time in BeginLayer
+        glGenFramebuffers(1, &shadowMapFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthMapTexture, 0, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cerr << "Shadow map framebuffer is incomplete" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        Invalidate();
+    }
+
+    void ShadowCascades::Delete()
+    {
+        GLState::Instance().DeleteTexture(depthMapTexture);
+        GLState::Instance().DeleteTexture(overlayTexture);
+        glDeleteFramebuffers(1, &shadowMapFBO);
+        depthMapTexture = overlayTexture = shadowMapFBO = 0;
+    }
+
+    void ShadowCascades::Update(const glm::mat4& view, float fovY, float aspect, float nearPlane, float shadowDistance,
+        const glm::vec3& towardsLight, const glm::vec3& casterMin, const glm::vec3& casterMax)
+    {
+        updates++;
+        glm::vec3 direction = glm::normalize(towardsLight);
+        if (glm::dot(direction, lightDirection) < std::cos(glm::radians(LIGHT_TOLERANCE_DEGREES))) {
+            lightDirection = direction;
+            // the light looks down -z of its space; any up vector not parallel to it will do
+            glm::vec3 up = std::fabs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+            lightRotation = glm::mat3(glm::lookAt(glm::vec3(0.0f), -direction, up));
+            Invalidate();
+        }
+        if (!caching)
+            Invalidate();
+
+        // every caster between the light and the receivers has to fit in the depth range
+        float minZ = FLT_MAX;
+        float maxZ = -FLT_MAX;
+        for (int corner = 0; corner < 8; corner++) {
+            glm::vec3 point((corner & 1) ? casterMax.x : casterMin.x, (corner & 2) ? casterMax.y : casterMin.y,
+                (corner & 4) ? casterMax.z : casterMin.z);
+            float z = (lightRotation * point).z;
+            minZ = std::min(minZ, z);
+            maxZ = std::max(maxZ, z);
+        }
+        float nearDepth = -maxZ - 1.0f;
+        float farDepth = -minZ + 1.0f;
+
+        glm::mat4 inverseView = glm::inverse(view);
+        float tanY = std::tan(fovY * 0.5f);
+        float tanX = tanY * aspect;
+        float start = nearPlane;
+        for (int c = 0; c < CASCADE_COUNT; c++) {
+            float t = (float)(c + 1) / CASCADE_COUNT;
+            float logSplit = nearPlane * std::pow(shadowDistance / nearPlane, t);
+            float uniformSplit = nearPlane + (shadowDistance - nearPlane) * t;
+            float end = uniformSplit + (logSplit - uniformSplit) * SPLIT_LAMBDA;
+
+            // bounding sphere of the slice; its radius does not change as the camera turns
+            glm::vec3 corners[8];
+            glm::vec3 center(0.0f);
+            for (int i = 0; i < 8; i++) {
+                float distance = (i & 4) ? end : start;
+                glm::vec4 eye(((i & 1) ? 1.0f : -1.0f) * tanX * distance, ((i & 2) ? 1.0f : -1.0f) * tanY * distance, -distance, 1.0f);
+                corners[i] = glm::vec3(inverseView * eye);
+                center += corners[i] * 0.125f;
+            }
+            float radius = 0.0f;
+            for (int i = 0; i < 8; i++)
+                radius = std::max(radius, glm::length(corners[i] - center));
+            radius = std::ceil(radius * 16.0f) / 16.0f;
+
+            Cascade& cascade = cascades[c];
+            if (cascade.end != end)
+                uniformsChanged = true;
+            cascade.end = end;
+            start = end;
+
+            // the static map stays valid while the slice's sphere is inside the square it was rendered for
+            glm::vec2 lightCenter = glm::vec2(lightRotation * center);
+            bool outside = glm::any(glm::greaterThan(glm::abs(lightCenter - cascade.center) + radius, glm::vec2(cascade.halfSize)));
+            if (!cascade.staticDirty && !outside && cascade.nearDepth == nearDepth && cascade.farDepth == farDepth)
+                continue;
+
+            // whole texels, so a re-rendered map lines up with the last one instead of shimmering
+            cascade.halfSize = radius * (1.0f + PLACEMENT_MARGIN);
+            float texel = 2.0f * cascade.halfSize / staticResolution;
+            cascade.center = glm::floor(lightCenter / texel) * texel;
+            cascade.nearDepth = nearDepth;
+            cascade.farDepth = farDepth;
+            cascade.matrix = glm::ortho(cascade.center.x - cascade.halfSize, cascade.center.x + cascade.halfSize,
+                cascade.center.y - cascade.halfSize, cascade.center.y + cascade.halfSize, nearDepth, farDepth)
+                * glm::mat4(lightRotation);
+            cascade.staticDirty = true;
+            uniformsChanged = true;
+        }
+    }
+
+    void ShadowCascades::Invalidate()
+    {
+        for (int c = 0; c < CASCADE_COUNT; c++)
+            cascades[c].staticDirty = true;
+    }
+
+    void ShadowCascades::SetCaching(bool enabled)
+    {
+        caching = enabled;
+    }
+
+    bool ShadowCascades::IsCachingEnabled() const
+    {
+        return caching;
+    }
+
+    bool ShadowCascades::IsStaticDirty(int cascade) const
+    {
+        return cascades[cascade].staticDirty;
+    }
+
+    void ShadowCascades::BeginLayer(GLuint texture, GLsizei resolution, int cascade, gps::Shader depthShader)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, cascade);
+        glViewport(0, 0, resolution, resolution);
+        GLState& state = GLState::Instance();
+        state.DepthMask(true);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        // slope-scaled bias keeps surfaces at grazing angles from shadowing themselves
+        state.SetEnabled(GL_POLYGON_OFFSET_FILL, true);
+        glPolygonOffset(2.0f, 4.0f);
+        depthShader.set("cascade", (GLint)cascade);
+    }
+
+    void ShadowCascades::BeginStatic(int cascade, gps::Shader depthShader)
+    {
+        BeginLayer(depthMapTexture, staticResolution, cascade, depthShader);
+        cascades[cascade].staticDirty = false;
+        staticRenders++;
+    }
+
+    void ShadowCascades::BeginOverlay(int cascade, gps::Shader depthShader)
+    {
+        BeginLayer(overlayTexture, overlayResolution, cascade, depthShader);
+        overlayRenders++;
+    }
+
+    void ShadowCascades::End(GLsizei viewportWidth, GLsizei viewportHeight)
+    {
+        GLState::Instance().SetEnabled(GL_POLYGON_OFFSET_FILL, false);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, viewportWidth, viewportHeight);
+    }
+
+    Frustum ShadowCascades::GetFrustum(int cascade) const
+    {
+        return Frustum::FromMatrix(cascades[cascade].matrix);
+    }
+
+    ShadowUniforms ShadowCascades::GetUniforms(bool enabled) const
+    {
+        ShadowUniforms shadows = ShadowUniforms();
+        float ends[MAX_SHADOW_CASCADES] = {};
+        float bias[MAX_SHADOW_CASCADES] = {};
+        GLsizei coarsest = std::min(staticResolution, overlayResolution);
+        for (int c = 0; c < CASCADE_COUNT; c++) {
+            shadows.cascadeMatrices[c] = cascades[c].matrix;
+            ends[c] = cascades[c].end;
+            // a texel's size in world units, over the [0, 1] depth range
+            float texel = 2.0f * cascades[c].halfSize / std::max<GLsizei>(coarsest, 1);
+            bias[c] = BIAS_TEXELS * texel / std::max(cascades[c].farDepth - cascades[c].nearDepth, 1e-3f);
+        }
+        shadows.cascadeEnds = glm::vec4(ends[0], ends[1], ends[2], ends[3]);
+        shadows.cascadeBias = glm::vec4(bias[0], bias[1], bias[2], bias[3]);
+        shadows.cascadeCount = enabled ? CASCADE_COUNT : 0;
+        return shadows;
+    }
+
+    bool ShadowCascades::TakeUniformsChanged()
+    {
+        bool changed = uniformsChanged;
+        uniformsChanged = false;
+        return changed;
+    }
+
+    void ShadowCascades::BindTextures() const
+    {
+        GLState& state = GLState::Instance();
+        state.BindTexture(STATIC_SHADOW_UNIT, GL_TEXTURE_2D_ARRAY, depthMapTexture);
+        state.BindTexture(OVERLAY_SHADOW_UNIT, GL_TEXTURE_2D_ARRAY, overlayTexture);
+    }
+
+    void ShadowCascades::PrintReport() const
+    {
+        size_t cascadeFrames = updates * CASCADE_COUNT;
+        std::cout << "Shadow cascades: " << updates << " frames, " << staticRenders << " static cascade renders ("
+            << (cascadeFrames ? 100.0 * staticRenders / cascadeFrames : 0.0) << "% of " << cascadeFrames << " cascade-frames, "
+            << staticResolution << "^2), " << overlayRenders << " overlay renders (" << overlayResolution << "^2)" << std::endl;
+    }
+}
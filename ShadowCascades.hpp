@@ -0,0 +1,103 @@
+#ifndef ShadowCascades_hpp
+#define ShadowCascades_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "Frustum.hpp"
+#include "Shader.hpp"
+#include "UniformBuffers.hpp"
+
+#include <cstddef>
+
+namespace gps {
+
+    // Texture units the shadow maps are bound to, above the mesh textures
+    enum SHADOW_TEXTURE_UNIT {STATIC_SHADOW_UNIT = 4, OVERLAY_SHADOW_UNIT = 5};
+
+    // Cascaded shadow maps of a directional light, split in two: a cached map of the static casters, re-rendered per
+    // cascade only when the light turns or the camera leaves the area the cascade was rendered for, and a smaller
+    // overlay of the dynamic casters, rendered every frame over the same light matrices. The shaders take the darker
+    // of the two. Each cascade is a square fit around the bounding sphere of its slice of the camera frustum, grown
+    // by a margin the camera can move in and snapped to whole texels.
+    class ShadowCascades
+    {
+    public:
+        static const int CASCADE_COUNT = 3;
+        // Share of the sphere radius a cascade is grown by, which is how far the camera may go before a re-render
+        static const float PLACEMENT_MARGIN;
+        // Degrees the light may turn before every static cascade is re-rendered
+        static const float LIGHT_TOLERANCE_DEGREES;
+
+        // Needs a GL context; the overlay may be smaller, it only holds the small moving casters
+        void Init(GLsizei staticResolution, GLsizei overlayResolution);
+        void Delete();
+
+        // Fits the cascades to the camera frustum up to `shadowDistance` and marks the static ones whose area or light
+        // changed. `towardsLight` is the world-space light direction; the casters' bounds set the depth range.
+        void Update(const glm::mat4& view, float fovY, float aspect, float nearPlane, float shadowDistance,
+            const glm::vec3& towardsLight, const glm::vec3& casterMin, const glm::vec3& casterMax);
+
+        // Forces every static cascade to be re-rendered, e.g. after the static casters moved
+        void Invalidate();
+        // With the cache off every static cascade is re-rendered every frame, for comparison
+        void SetCaching(bool enabled);
+        bool IsCachingEnabled() const;
+
+        bool IsStaticDirty(int cascade) const;
+        // Binds the framebuffer to one layer of the static or the overlay map and clears it; the depth shader's
+        // `cascade` uniform picks the matrix. Casters drawn until End go into that layer.
+        void BeginStatic(int cascade, gps::Shader depthShader);
+        void BeginOverlay(int cascade, gps::Shader depthShader);
+        // Restores the default framebuffer and the viewport
+        void End(GLsizei viewportWidth, GLsizei viewportHeight);
+
+        // World-space frustum of a cascade's light volume, for culling the casters drawn into it
+        Frustum GetFrustum(int cascade) const;
+        // Matrices, distances and biases for the ShadowUniforms block; cascadeCount is 0 with `enabled` false
+        ShadowUniforms GetUniforms(bool enabled) const;
+        // True once after Update moved a cascade, when the uniforms need to be sent again
+        bool TakeUniformsChanged();
+
+        // Binds both maps to their units
+        void BindTextures() const;
+
+        void PrintReport() const;
+
+    private:
+        struct Cascade
+        {
+            // light-space square the static map was rendered for
+            glm::vec2 center = glm::vec2(0.0f);
+            float halfSize = 0.0f;
+            float nearDepth = 0.0f;
+            float farDepth = 0.0f;
+            // eye-space distance the cascade reaches
+            float end = 0.0f;
+            glm::mat4 matrix = glm::mat4(1.0f);
+            bool staticDirty = true;
+        };
+
+        Cascade cascades[CASCADE_COUNT];
+        GLuint shadowMapFBO = 0;
+        // depth arrays, one layer per cascade
+        GLuint depthMapTexture = 0;
+        GLuint overlayTexture = 0;
+        GLsizei staticResolution = 0;
+        GLsizei overlayResolution = 0;
+        // rotation from world space into light space, and the light it was built for
+        glm::mat3 lightRotation = glm::mat3(1.0f);
+        glm::vec3 lightDirection = glm::vec3(0.0f);
+        bool caching = true;
+        bool uniformsChanged = true;
+
+        size_t updates = 0;
+        size_t staticRenders = 0;
+        size_t overlayRenders = 0;
+
+        void BeginLayer(GLuint texture, GLsizei resolution, int cascade, gps::Shader depthShader);
+        static GLuint CreateDepthArray(GLsizei resolution);
+    };
+}
+
+#endif /* ShadowCascades_hpp */
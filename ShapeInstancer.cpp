@@ -0,0 +1,242 @@
+#include "ShapeInstancer.hpp"
+
+#include "glm/gtc/matrix_transform.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+
+namespace gps {
+
+    const float ShapeInstancer::POSITION_TOLERANCE = 1e-3f;
+    const float ShapeInstancer::MAX_FOLD_DISTANCE = 8.0f;
+
+    // Normals of a folded copy may turn this far from the transformed ones (cosine of about 2.5 degrees)
+    static const float MIN_NORMAL_COSINE = 0.999f;
+    static const float TEXCOORD_TOLERANCE = 1e-4f;
+
+    // Centroid and RMS radius: what is left of a shape once translation and scale are taken out
+    struct ShapeFrame
+    {
+        glm::vec3 centroid;
+        float radius;
+    };
+
+    static ShapeFrame ComputeFrame(const MeshData& mesh)
+    {
+        ShapeFrame frame;
+        glm::dvec3 sum(0.0);
+        for (size_t v = 0; v < mesh.vertices.size(); v++)
+            sum += glm::dvec3(mesh.vertices[v].Position);
+        frame.centroid = glm::vec3(sum / (double)std::max<size_t>(mesh.vertices.size(), 1));
+
+        double squared = 0.0;
+        for (size_t v = 0; v < mesh.vertices.size(); v++) {
+            glm::vec3 offset = mesh.vertices[v].Position - frame.centroid;
+            squared += glm::dot(offset, offset);
+        }
+        frame.radius = (float)std::sqrt(squared / (double)std::max<size_t>(mesh.vertices.size(), 1));
+        return frame;
+    }
+
+    static void HashWord(uint64_t& hash, uint32_t word)
+    {
+        hash ^= word;
+        hash *= 1099511628211ULL;
+    }
+
+    // FNV-1a over everything a rotation, translation or uniform scale leaves unchanged; the radial distances only
+    // go in as one coarse average, so rounding noise between copies rarely puts them in different buckets
+    static uint64_t HashShape(const MeshData& mesh, int materialId, const ShapeFrame& frame)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        HashWord(hash, (uint32_t)materialId);
+        HashWord(hash, (uint32_t)mesh.vertices.size());
+        HashWord(hash, (uint32_t)mesh.indices.size());
+        for (size_t i = 0; i < mesh.indices.size(); i++)
+            HashWord(hash, mesh.indices[i]);
+
+        double radialSum = 0.0;
+        for (size_t v = 0; v < mesh.vertices.size(); v++) {
+            HashWord(hash, (uint32_t)std::lround(mesh.vertices[v].TexCoords.x * 1024.0f));
+            HashWord(hash, (uint32_t)std::lround(mesh.vertices[v].TexCoords.y * 1024.0f));
+            radialSum += glm::length(mesh.vertices[v].Position - frame.centroid);
+        }
+        double meanRadial = radialSum / (double)mesh.vertices.size() / frame.radius;
+        HashWord(hash, (uint32_t)std::lround(meanRadial * 64.0));
+        return hash;
+    }
+
+    // Eigenvector of the largest eigenvalue of a symmetric 4x4 matrix, by cyclic Jacobi rotations
+    static void GetLargestEigenvector(double a[4][4], double result[4])
+    {
+        double vectors[4][4] = {{1.0, 0.0, 0.0, 0.0}, {0.0, 1.0, 0.0, 0.0}, {0.0, 0.0, 1.0, 0.0}, {0.0, 0.0, 0.0, 1.0}};
+        for (int sweep = 0; sweep < 32; sweep++) {
+            double offDiagonal = 0.0;
+            for (int p = 0; p < 4; p++)
+                for (int q = p + 1; q < 4; q++)
+                    offDiagonal += a[p][q] * a[p][q];
+            if (offDiagonal < 1e-24)
+                break;
+
+            for (int p = 0; p < 4; p++) {
+                for (int q = p + 1; q < 4; q++) {
+                    if (std::fabs(a[p][q]) < 1e-30)
+                        continue;
+                    // rotation in the (p, q) plane that zeroes a[p][q]
+                    double theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+                    double t = (theta >= 0.0 ? 1.0 : -1.0) / (std::fabs(theta) + std::sqrt(theta * theta + 1.0));
+                    double c = 1.0 / std::sqrt(t * t + 1.0);
+                    double s = t * c;
+                    for (int k = 0; k < 4; k++) {
+                        double kp = a[k][p], kq = a[k][q];
+                        a[k][p] = c * kp - s * kq;
+                        a[k][q] = s * kp + c * kq;
+                    }
+                    for (int k = 0; k < 4; k++) {
+                        double pk = a[p][k], qk = a[q][k];
+                        a[p][k] = c * pk - s * qk;
+                        a[q][k] = s * pk + c * qk;
+                    }
+                    for (int k = 0; k < 4; k++) {
+                        double kp = vectors[k][p], kq = vectors[k][q];
+                        vectors[k][p] = c * kp - s * kq;
+                        vectors[k][q] = s * kp + c * kq;
+                    }
+                }
+            }
+        }
+
+        int largest = 0;
+        for (int i = 1; i < 4; i++)
+            if (a[i][i] > a[largest][largest])
+                largest = i;
+        for (int k = 0; k < 4; k++)
+            result[k] = vectors[k][largest];
+    }
+
+    // Rotation taking the centered, scaled `from` vertices closest to the `to` ones: the unit quaternion maximizing
+    // sum(to . (q from q*)) is the top eigenvector of Horn's 4x4 matrix
+    static glm::mat3 SolveRotation(const MeshData& from, const ShapeFrame& fromFrame, const MeshData& to,
+        const ShapeFrame& toFrame)
+    {
+        double s[3][3] = {};
+        for (size_t v = 0; v < from.vertices.size(); v++) {
+            glm::dvec3 a = glm::dvec3(from.vertices[v].Position - fromFrame.centroid) / (double)fromFrame.radius;
+            glm::dvec3 b = glm::dvec3(to.vertices[v].Position - toFrame.centroid) / (double)toFrame.radius;
+            for (int i = 0; i < 3; i++)
+                for (int j = 0; j < 3; j++)
+                    s[i][j] += a[i] * b[j];
+        }
+
+        double n[4][4] = {
+            {s[0][0] + s[1][1] + s[2][2], s[1][2] - s[2][1], s[2][0] - s[0][2], s[0][1] - s[1][0]},
+            {s[1][2] - s[2][1], s[0][0] - s[1][1] - s[2][2], s[0][1] + s[1][0], s[2][0] + s[0][2]},
+            {s[2][0] - s[0][2], s[0][1] + s[1][0], -s[0][0] + s[1][1] - s[2][2], s[1][2] + s[2][1]},
+            {s[0][1] - s[1][0], s[2][0] + s[0][2], s[1][2] + s[2][1], -s[0][0] - s[1][1] + s[2][2]}
+        };
+        double q[4];
+        GetLargestEigenvector(n, q);
+        double w = q[0], x = q[1], y = q[2], z = q[3];
+
+        // glm matrices are indexed [column][row]
+        glm::mat3 rotation;
+        rotation[0][0] = (float)(1.0 - 2.0 * (y * y + z * z));
+        rotation[0][1] = (float)(2.0 * (x * y + w * z));
+        rotation[0][2] = (float)(2.0 * (x * z - w * y));
+        rotation[1][0] = (float)(2.0 * (x * y - w * z));
+        rotation[1][1] = (float)(1.0 - 2.0 * (x * x + z * z));
+        rotation[1][2] = (float)(2.0 * (y * z + w * x));
+        rotation[2][0] = (float)(2.0 * (x * z + w * y));
+        rotation[2][1] = (float)(2.0 * (y * z - w * x));
+        rotation[2][2] = (float)(1.0 - 2.0 * (x * x + y * y));
+        return rotation;
+    }
+
+    // Transform mapping `prototype` onto `copy`, if one reproduces every vertex of the copy
+    static bool MatchShape(const MeshData& prototype, const ShapeFrame& prototypeFrame, const MeshData& copy,
+        const ShapeFrame& copyFrame, glm::mat4& transform)
+    {
+        if (prototype.vertices.size() != copy.vertices.size() || prototype.indices != copy.indices)
+            return false;
+
+        glm::mat3 rotation = SolveRotation(prototype, prototypeFrame, copy, copyFrame);
+        float scale = copyFrame.radius / prototypeFrame.radius;
+        transform = glm::translate(glm::mat4(1.0f), copyFrame.centroid) * glm::mat4(rotation * scale)
+            * glm::translate(glm::mat4(1.0f), -prototypeFrame.centroid);
+
+        float tolerance = ShapeInstancer::POSITION_TOLERANCE * copyFrame.radius;
+        for (size_t v = 0; v < copy.vertices.size(); v++) {
+            const Vertex& a = prototype.vertices[v];
+            const Vertex& b = copy.vertices[v];
+            glm::vec3 position = glm::vec3(transform * glm::vec4(a.Position, 1.0f));
+            if (glm::length(position - b.Position) > tolerance)
+                return false;
+            if (glm::any(glm::greaterThan(glm::abs(a.TexCoords - b.TexCoords), glm::vec2(TEXCOORD_TOLERANCE))))
+                return false;
+            float lengths = glm::length(a.Normal) * glm::length(b.Normal);
+            if (lengths > 0.0f && glm::dot(rotation * a.Normal, b.Normal) < MIN_NORMAL_COSINE * lengths)
+                return false;
+        }
+        return true;
+    }
+
+    static size_t GetGeometryBytes(const MeshData& mesh)
+    {
+        return mesh.vertices.size() * sizeof(Vertex) + mesh.indices.size() * sizeof(GLuint);
+    }
+
+    InstancingReport ShapeInstancer::FoldRepeatedShapes(std::vector<MeshData>& meshes, std::vector<int>& materialIds)
+    {
+        InstancingReport report;
+        report.totalShapes = meshes.size();
+
+        std::vector<ShapeFrame> frames(meshes.size());
+        std::vector<bool> folded(meshes.size(), false);
+        std::unordered_map<uint64_t, std::vector<size_t> > prototypesByHash;
+        for (size_t i = 0; i < meshes.size(); i++) {
+            report.bytesBefore += GetGeometryBytes(meshes[i]);
+            frames[i] = ComputeFrame(meshes[i]);
+            // points, lines and shapes without extent have no rotation to solve
+            if (meshes[i].vertices.size() < 3 || !(frames[i].radius > 0.0f) || !meshes[i].lods.empty())
+                continue;
+
+            std::vector<size_t>& candidates = prototypesByHash[HashShape(meshes[i], materialIds[i], frames[i])];
+            for (size_t c = 0; c < candidates.size() && !folded[i]; c++) {
+                size_t prototype = candidates[c];
+                glm::mat4 transform;
+                // too far away, it starts a cluster of its own with its neighbours
+                if (materialIds[prototype] != materialIds[i]
+                    || glm::length(frames[i].centroid - frames[prototype].centroid) > MAX_FOLD_DISTANCE
+                    || !MatchShape(meshes[prototype], frames[prototype], meshes[i], frames[i], transform))
+                    continue;
+                if (meshes[prototype].instances.empty())
+                    meshes[prototype].instances.push_back(glm::mat4(1.0f));
+                meshes[prototype].instances.push_back(transform);
+                folded[i] = true;
+            }
+            if (!folded[i])
+                candidates.push_back(i);
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < meshes.size(); i++) {
+            if (folded[i])
+                continue;
+            if (kept != i) {
+                meshes[kept] = std::move(meshes[i]);
+                materialIds[kept] = materialIds[i];
+            }
+            report.bytesAfter += GetGeometryBytes(meshes[kept]) + meshes[kept].instances.size() * sizeof(glm::mat4);
+            if (!meshes[kept].instances.empty())
+                report.instancedMeshes++;
+            kept++;
+        }
+        meshes.resize(kept);
+        materialIds.resize(kept);
+        report.uniqueShapes = kept;
+        report.foldedCopies = report.totalShapes - kept;
+        return report;
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef ShapeInstancer_hpp
+#define ShapeInstancer_hpp
+
+#include "Mesh.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+    // What folding the repeated shapes of a model saved
+    struct InstancingReport
+    {
+        size_t totalShapes = 0;
+        size_t uniqueShapes = 0;
+        // meshes drawn more than once, and the copies they replaced
+        size_t instancedMeshes = 0;
+        size_t foldedCopies = 0;
+        // float vertex and index bytes of every shape, and of the unique ones plus their instance transforms
+        size_t bytesBefore = 0;
+        size_t bytesAfter = 0;
+    };
+
+    // Finds shapes that are copies of each other up to translation, rotation and uniform scale. Every shape is
+    // centered on its centroid and scaled to unit RMS radius; a hash of the result that ignores the rotation
+    // (topology, texture coordinates, material, radial distances) groups the candidates, and the rotation between
+    // two candidates is solved in closed form (Horn 1987) from their corresponding vertices. A copy is only folded
+    // when the transform reproduces every one of its vertices and normals.
+    class ShapeInstancer
+    {
+    public:
+        // Largest distance a folded vertex may land from its original, as a share of the shape's RMS radius
+        static const float POSITION_TOLERANCE;
+        // Farthest a copy's centroid may be from its prototype's, in object space. A folded mesh is culled and picks
+        // its level of detail as one object, over the bounds of all its copies; the cap keeps those bounds to a
+        // neighbourhood, at the cost of one more instanced draw for every cluster of copies beyond it.
+        static const float MAX_FOLD_DISTANCE;
+
+        // Removes the copies from `meshes` (and their entries from `materialIds`); the mesh each was folded into
+        // keeps its own geometry and lists one object-space transform per copy, itself first
+        static InstancingReport FoldRepeatedShapes(std::vector<MeshData>& meshes, std::vector<int>& materialIds);
+    };
+}
+
+#endif /* ShapeInstancer_hpp */
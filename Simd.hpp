@@ -0,0 +1,14 @@
+#ifndef Simd_hpp
+#define Simd_hpp
+
+// Instruction set the SIMD kernels are compiled for: AVX2 when the build enables it (/arch:AVX2),
+// otherwise SSE2, which every x64 target has; other targets use the scalar paths
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define GPS_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GPS_SIMD_SSE2
+#endif
+
+#endif /* Simd_hpp */
@@ -8,76 +8,261 @@
 
 #include "SkyBox.hpp"
 
+#include "GLState.hpp"
+#include "ThreadPool.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
 
 
 
 namespace gps {
-    
-    SkyBox::SkyBox()
+
+    // Reads a face image into a pooled buffer
+    static bool ReadFaceFile(const char* path, std::vector<unsigned char>& bytes)
+    {
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in)
+            return false;
+        std::streamoff size = in.tellg();
+        if (size <= 0)
+            return false;
+        bytes = ImageBufferPool::Shared().Acquire((size_t)size);
+        in.seekg(0);
+        return (bool)in.read((char*)bytes.data(), size);
+    }
+
+    // Decodes one face into its mip chain, block-compressed unless format is BLOCK_NONE (RGB8 then)
+    static bool DecodeFace(const char* path, BLOCK_FORMAT format, std::vector<ImageLevel>& levels)
+    {
+        std::vector<unsigned char> fileBytes;
+        if (!ReadFaceFile(path, fileBytes)) {
+            ImageBufferPool::Shared().Release(fileBytes);
+            fprintf(stderr, "ERROR: could not load %s\n", path);
+            return false;
+        }
+
+        int width, height, n;
+        int channels = format == BLOCK_NONE ? 3 : 4;
+        unsigned char* image = stbi_load_from_memory(fileBytes.data(), (int)fileBytes.size(), &width, &height, &n, channels);
+        ImageBufferPool::Shared().Release(fileBytes);
+        if (!image) {
+            fprintf(stderr, "ERROR: could not load %s\n", path);
+            return false;
+        }
+
+        // faces are not flipped and stay linear
+        if (format == BLOCK_NONE) {
+            levels = ImagePipeline::BuildMipChain(image, width, height, channels, false, MIP_FILTER_BOX);
+        } else {
+            CompressedImage compressed;
+            TextureCompression::Compress(image, width, height, format, false, compressed);
+            levels.resize(compressed.levelSizes.size());
+            for (size_t level = 0; level < levels.size(); level++) {
+                levels[level].width = width;
+                levels[level].height = height;
+                levels[level].pixels = ImageBufferPool::Shared().Acquire(compressed.levelSizes[level]);
+                memcpy(levels[level].pixels.data(), compressed.data.data() + compressed.levelOffsets[level], compressed.levelSizes[level]);
+                width = width > 1 ? width / 2 : 1;
+                height = height > 1 ? height / 2 : 1;
+            }
+        }
+        stbi_image_free(image);
+        return true;
+    }
+
+    SkyBox::SkyBox() : skyboxVAO(0), skyboxVBO(0), cubemapTexture(0)
     {
        
     }
     
     void SkyBox::Load(std::vector<const GLchar*> cubeMapFaces)
     {
-        cubemapTexture = LoadSkyBoxTextures(cubeMapFaces);
-        InitSkyBox();
+        Load(cubeMapFaces, std::string());
+    }
+
+    void SkyBox::Load(std::vector<const GLchar*> cubeMapFaces, const std::string& packedFileName)
+    {
+        if (!packedFileName.empty()) {
+            std::vector<std::string> faceFiles(cubeMapFaces.begin(), cubeMapFaces.end());
+            PackedCubemap pack;
+            if (pack.Open(packedFileName, faceFiles, TextureCompression::QuerySupport())) {
+                SetTexture(UploadPackedCubemap(pack));
+                return;
+            }
+        }
+        SetTexture(LoadSkyBoxTextures(cubeMapFaces, packedFileName));
+    }
+
+    bool SkyBox::LoadPacked(const std::string& packedFileName)
+    {
+        PackedCubemap pack;
+        if (!pack.Open(packedFileName, std::vector<std::string>(), TextureCompression::QuerySupport()))
+            return false;
+        GLuint texture = UploadPackedCubemap(pack);
+        if (texture == 0)
+            return false;
+        SetTexture(texture);
+        return true;
+    }
+
+    void SkyBox::SetTexture(GLuint texture)
+    {
+        GLState::Instance().DeleteTexture(cubemapTexture);
+        cubemapTexture = texture;
+        // the cube geometry does not depend on the texture, so swaps keep it
+        if (skyboxVAO == 0)
+            InitSkyBox();
     }
     
-    void SkyBox::Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix)
+    void SkyBox::Draw(gps::Shader shader)
     {
         shader.useShaderProgram();
         
-        //set the view and projection matrices
-        glm::mat4 transformedView = glm::mat4(glm::mat3(viewMatrix));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(transformedView));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projectionMatrix));
+        //the view and projection come from the frame block; the shader drops the translation itself
+        //the sky sits on the far plane, which the scene-wide GL_LEQUAL lets through
+        GLState& state = GLState::Instance();
+        state.DepthFunc(GL_LEQUAL);
         
-        glDepthFunc(GL_LEQUAL);
-        
-        glBindVertexArray(skyboxVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glUniform1i(glGetUniformLocation(shader.shaderProgram, "skybox"), 0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+        state.BindVertexArray(skyboxVAO);
+        shader.set("skybox", (GLint)0);
+        state.BindTexture(0, GL_TEXTURE_CUBE_MAP, cubemapTexture);
         glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
-        
-        glDepthFunc(GL_LESS);
     }
     
-    GLuint SkyBox::LoadSkyBoxTextures(std::vector<const GLchar*> skyBoxFaces)
+    GLuint SkyBox::LoadSkyBoxTextures(std::vector<const GLchar*> skyBoxFaces, const std::string& packedFileName)
     {
+        if (skyBoxFaces.size() != PackedCubemap::FACE_COUNT) {
+            fprintf(stderr, "ERROR: a skybox needs %d faces\n", PackedCubemap::FACE_COUNT);
+            return 0;
+        }
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+        // skyboxes are opaque, so every face gets the same opaque format
+        BlockFormatSupport support = TextureCompression::QuerySupport();
+        BLOCK_FORMAT format = support.s3tc ? BLOCK_BC1 : (support.bptc ? BLOCK_BC7 : BLOCK_NONE);
+
+        std::vector<std::vector<ImageLevel> > faces(skyBoxFaces.size());
+        std::vector<char> decoded(skyBoxFaces.size(), 0);
+        ThreadPool::Shared().ParallelFor(skyBoxFaces.size(), [&](size_t i) {
+            decoded[i] = DecodeFace(skyBoxFaces[i], format, faces[i]) ? 1 : 0;
+        });
+        double decodeSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+        GLuint textureID = 0;
+        bool valid = true;
+        for (size_t i = 0; i < faces.size(); i++) {
+            // every face of a cubemap needs the same size
+            if (!decoded[i] || faces[i].size() != faces[0].size() || faces[i][0].width != faces[0][0].width
+                || faces[i][0].height != faces[0][0].height)
+                valid = false;
+        }
+
+        size_t uploadedBytes = 0;
+        if (valid) {
+            std::vector<std::vector<CubemapLevel> > levels(faces.size());
+            for (size_t i = 0; i < faces.size(); i++) {
+                for (size_t level = 0; level < faces[i].size(); level++) {
+                    CubemapLevel cubemapLevel;
+                    cubemapLevel.data = faces[i][level].pixels.data();
+                    cubemapLevel.size = faces[i][level].pixels.size();
+                    cubemapLevel.blobOffset = 0;
+                    cubemapLevel.width = faces[i][level].width;
+                    cubemapLevel.height = faces[i][level].height;
+                    levels[i].push_back(cubemapLevel);
+                    uploadedBytes += cubemapLevel.size;
+                }
+            }
+            textureID = UploadCubemap(format, levels, NULL, 0);
+
+            if (!packedFileName.empty()) {
+                std::vector<std::string> faceFiles(skyBoxFaces.begin(), skyBoxFaces.end());
+                PackedCubemap::Write(packedFileName, faceFiles, format, false, faces);
+            }
+        } else {
+            fprintf(stderr, "ERROR: skybox faces differ in size\n");
+        }
+
+        for (size_t i = 0; i < faces.size(); i++) {
+            for (size_t level = 0; level < faces[i].size(); level++)
+                ImageBufferPool::Shared().Release(faces[i][level].pixels);
+        }
+
+        if (textureID != 0) {
+            double loadSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+            std::cout << "Skybox : decoded " << faces.size() << " faces as " << (format == BLOCK_NONE ? "RGB8" : TextureCompression::GetFormatName(format))
+                << " in " << decodeSeconds * 1000.0 << " ms, " << uploadedBytes / 1024 << " KB loaded in " << loadSeconds * 1000.0 << " ms" << std::endl;
+        }
+        return textureID;
+    }
+
+    // The mapped blob is copied into one pixel-unpack buffer and goes to the driver from there; nothing is decoded
+    GLuint SkyBox::UploadPackedCubemap(const PackedCubemap& pack)
+    {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+        std::vector<std::vector<CubemapLevel> > levels(PackedCubemap::FACE_COUNT);
+        for (int face = 0; face < PackedCubemap::FACE_COUNT; face++) {
+            for (size_t level = 0; level < pack.GetLevelCount(); level++)
+                levels[face].push_back(pack.GetLevel(face, level));
+        }
+        GLuint textureID = UploadCubemap(pack.GetFormat(), levels, pack.GetBlob(), pack.GetBlobSize());
+
+        double loadSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        std::cout << "Skybox : packed cubemap " << (pack.GetFormat() == BLOCK_NONE ? "RGB8" : TextureCompression::GetFormatName(pack.GetFormat()))
+            << ", " << pack.GetBlobSize() / 1024 << " KB loaded in " << loadSeconds * 1000.0 << " ms" << std::endl;
+        return textureID;
+    }
+
+    // Uploads faces[face][level]; with a blob every level is read from a pixel-unpack buffer at its blob offset
+    GLuint SkyBox::UploadCubemap(BLOCK_FORMAT format, const std::vector<std::vector<CubemapLevel> >& faces,
+        const unsigned char* blob, size_t blobSize)
+    {
+        GLuint pbo = 0;
+        if (blob != NULL) {
+            glGenBuffers(1, &pbo);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)blobSize, blob, GL_STREAM_DRAW);
+        }
+
         GLuint textureID;
         glGenTextures(1, &textureID);
-        glActiveTexture(GL_TEXTURE0);
-        
-        int width,height, n;
-        unsigned char* image;
-        int force_channels = 3;
-        
-        glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-        for(GLuint i = 0; i < skyBoxFaces.size(); i++)
-        {
-            image = stbi_load(skyBoxFaces[i], &width, &height, &n, force_channels);
-            if (!image) {
-                fprintf(stderr, "ERROR: could not load %s\n", skyBoxFaces[i]);
-                return false;
+        GLState::Instance().BindTexture(0, GL_TEXTURE_CUBE_MAP, textureID);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+        for (GLuint i = 0; i < faces.size(); i++) {
+            for (size_t level = 0; level < faces[i].size(); level++) {
+                const CubemapLevel& source = faces[i][level];
+                const GLvoid* pixels = blob != NULL ? (const GLvoid*)source.blobOffset : (const GLvoid*)source.data;
+                if (format == BLOCK_NONE) {
+                    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, (GLint)level, GL_RGB8, source.width, source.height, 0,
+                        GL_RGB, GL_UNSIGNED_BYTE, pixels);
+                } else {
+                    glCompressedTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, (GLint)level,
+                        TextureCompression::GetInternalFormat(format, false), source.width, source.height, 0, (GLsizei)source.size, pixels);
+                }
             }
-            glTexImage2D(
-                         GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
-                         GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image
-                         );
         }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, (GLint)faces[0].size() - 1);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-        
+        GLState::Instance().BindTexture(0, GL_TEXTURE_CUBE_MAP, 0);
+
+        if (pbo != 0) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glDeleteBuffers(1, &pbo);
+        }
         return textureID;
     }
-    
+
     void SkyBox::InitSkyBox()
     {
         GLfloat skyboxVertices[] = {
@@ -127,14 +312,14 @@ namespace gps {
         glGenVertexArrays(1, &(this->skyboxVAO));
         glGenBuffers(1, &skyboxVBO);
         
-        glBindVertexArray(skyboxVAO);
+        GLState::Instance().BindVertexArray(skyboxVAO);
         glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
         glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
         
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
         
-        glBindVertexArray(0);
+        GLState::Instance().BindVertexArray(0);
     }
     
     GLuint SkyBox::GetTextureId()
@@ -11,6 +11,9 @@
 
 #include <stdio.h>
 #include "Shader.hpp"
+#include "PackedCubemap.hpp"
+#include "TextureCompression.hpp"
+#include <string>
 #include <vector>
 #include "stb_image.h"
 #include "glm/glm.hpp"
@@ -22,13 +25,21 @@ namespace gps {
     public:
         SkyBox();
         void Load(std::vector<const GLchar*> cubeMapFaces);
-        void Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix);
+        // Maps the packed cubemap if it is newer than the faces, otherwise decodes the faces and writes the pack
+        void Load(std::vector<const GLchar*> cubeMapFaces, const std::string& packedFileName);
+        // Swaps in a packed cubemap without looking at its source faces; false if it cannot be used
+        bool LoadPacked(const std::string& packedFileName);
+        void Draw(gps::Shader shader);
         GLuint GetTextureId();
     private:
         GLuint skyboxVAO;
         GLuint skyboxVBO;
         GLuint cubemapTexture;
-        GLuint LoadSkyBoxTextures(std::vector<const GLchar*> cubeMapFaces);
+        GLuint LoadSkyBoxTextures(std::vector<const GLchar*> cubeMapFaces, const std::string& packedFileName);
+        GLuint UploadPackedCubemap(const PackedCubemap& pack);
+        GLuint UploadCubemap(BLOCK_FORMAT format, const std::vector<std::vector<CubemapLevel> >& faces,
+            const unsigned char* blob, size_t blobSize);
+        void SetTexture(GLuint texture);
         void InitSkyBox();
     };
 }
@@ -0,0 +1,717 @@
+#include "TextureCompression.hpp"
+#include "ImagePipeline.hpp"
+#include "MappedFile.hpp"
+#include "ThreadPool.hpp"
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace gps {
+
+    // DDS layout, see the DirectX "DDS_HEADER" and "DDS_HEADER_DXT10" documentation
+    struct DDSPixelFormat
+    {
+        uint32_t size;
+        uint32_t flags;
+        uint32_t fourCC;
+        uint32_t rgbBitCount;
+        uint32_t rBitMask;
+        uint32_t gBitMask;
+        uint32_t bBitMask;
+        uint32_t aBitMask;
+    };
+
+    struct DDSHeader
+    {
+        uint32_t size;
+        uint32_t flags;
+        uint32_t height;
+        uint32_t width;
+        uint32_t pitchOrLinearSize;
+        uint32_t depth;
+        uint32_t mipMapCount;
+        // reserved1 carries our own tag: which source the file was baked from and how
+        uint32_t reserved1[11];
+        DDSPixelFormat pixelFormat;
+        uint32_t caps;
+        uint32_t caps2;
+        uint32_t caps3;
+        uint32_t caps4;
+        uint32_t reserved2;
+    };
+
+    struct DDSHeaderDX10
+    {
+        uint32_t dxgiFormat;
+        uint32_t resourceDimension;
+        uint32_t miscFlag;
+        uint32_t arraySize;
+        uint32_t miscFlags2;
+    };
+
+    static_assert(sizeof(DDSHeader) == 124, "DDS header must match the file layout");
+    static_assert(sizeof(DDSHeaderDX10) == 20, "DX10 header must match the file layout");
+
+    static const uint32_t DDS_MAGIC = 0x20534444; // "DDS "
+    static const uint32_t DDS_FOURCC_DX10 = 0x30315844; // "DX10"
+    static const uint32_t DDS_FLAGS = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000;
+    static const uint32_t DDS_CAPS = 0x8 | 0x1000 | 0x400000;
+    static const uint32_t DDPF_FOURCC = 0x4;
+    static const uint32_t DDS_DIMENSION_TEXTURE2D = 3;
+
+    static const uint32_t DXGI_BC1_UNORM = 71;
+    static const uint32_t DXGI_BC1_UNORM_SRGB = 72;
+    static const uint32_t DXGI_BC3_UNORM = 77;
+    static const uint32_t DXGI_BC3_UNORM_SRGB = 78;
+    static const uint32_t DXGI_BC7_UNORM = 98;
+    static const uint32_t DXGI_BC7_UNORM_SRGB = 99;
+
+    static const uint32_t TEXTURE_CACHE_TAG = 0x43545047; // "GPTC"
+    static const uint32_t TEXTURE_CACHE_VERSION = 3;
+    static const uint32_t TEXTURE_CACHE_FLIPPED = 0x1;
+    // the source has texels that are not fully opaque
+    static const uint32_t TEXTURE_CACHE_ALPHA = 0x2;
+
+    static double SecondsSince(std::chrono::high_resolution_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    static size_t GetBlockBytes(BLOCK_FORMAT format)
+    {
+        return format == BLOCK_BC1 ? 8 : 16;
+    }
+
+    static uint32_t GetDxgiFormat(BLOCK_FORMAT format, bool srgb)
+    {
+        switch (format) {
+        case BLOCK_BC1: return srgb ? DXGI_BC1_UNORM_SRGB : DXGI_BC1_UNORM;
+        case BLOCK_BC3: return srgb ? DXGI_BC3_UNORM_SRGB : DXGI_BC3_UNORM;
+        case BLOCK_BC7: return srgb ? DXGI_BC7_UNORM_SRGB : DXGI_BC7_UNORM;
+        default: return 0;
+        }
+    }
+
+    // ---- block encoders ----
+
+    // Copies a 4x4 block, repeating the edge pixels of images smaller than a block
+    static void FetchBlock(const unsigned char* rgba, int width, int height, int blockX, int blockY, unsigned char block[16][4])
+    {
+        for (int y = 0; y < 4; y++) {
+            int sourceY = std::min(blockY * 4 + y, height - 1);
+            for (int x = 0; x < 4; x++) {
+                int sourceX = std::min(blockX * 4 + x, width - 1);
+                memcpy(block[y * 4 + x], rgba + ((size_t)sourceY * width + sourceX) * 4, 4);
+            }
+        }
+    }
+
+    // Fits a line through the block colors (first `channels` components) and returns its two extreme points
+    static void FitEndpoints(const unsigned char block[16][4], int channels, float start[4], float end[4])
+    {
+        float mean[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        for (int i = 0; i < 16; i++)
+            for (int c = 0; c < channels; c++)
+                mean[c] += block[i][c] / 16.0f;
+
+        float covariance[4][4] = {};
+        for (int i = 0; i < 16; i++) {
+            for (int a = 0; a < channels; a++) {
+                for (int b = 0; b < channels; b++)
+                    covariance[a][b] += (block[i][a] - mean[a]) * (block[i][b] - mean[b]);
+            }
+        }
+
+        // power iteration for the principal axis
+        float axis[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+        for (int iteration = 0; iteration < 8; iteration++) {
+            float next[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+            float length = 0.0f;
+            for (int a = 0; a < channels; a++) {
+                for (int b = 0; b < channels; b++)
+                    next[a] += covariance[a][b] * axis[b];
+                length = std::max(length, std::fabs(next[a]));
+            }
+            if (length < 1e-6f)
+                break;
+            for (int a = 0; a < channels; a++)
+                axis[a] = next[a] / length;
+        }
+
+        float lengthSquared = 0.0f;
+        for (int c = 0; c < channels; c++)
+            lengthSquared += axis[c] * axis[c];
+
+        float minT = 0.0f;
+        float maxT = 0.0f;
+        for (int i = 0; i < 16; i++) {
+            float t = 0.0f;
+            for (int c = 0; c < channels; c++)
+                t += (block[i][c] - mean[c]) * axis[c];
+            t /= lengthSquared;
+            minT = std::min(minT, t);
+            maxT = std::max(maxT, t);
+        }
+
+        for (int c = 0; c < 4; c++) {
+            start[c] = c < channels ? std::min(255.0f, std::max(0.0f, mean[c] + minT * axis[c])) : 255.0f;
+            end[c] = c < channels ? std::min(255.0f, std::max(0.0f, mean[c] + maxT * axis[c])) : 255.0f;
+        }
+    }
+
+    // Least-squares endpoints for fixed per-pixel weights (0 = first endpoint, 1 = second)
+    static bool RefitEndpoints(const unsigned char block[16][4], const float weights[16], int channels, float start[4], float end[4])
+    {
+        float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+        float ax[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        float bx[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        for (int i = 0; i < 16; i++) {
+            float beta = weights[i];
+            float alpha = 1.0f - beta;
+            aa += alpha * alpha;
+            bb += beta * beta;
+            ab += alpha * beta;
+            for (int c = 0; c < channels; c++) {
+                ax[c] += alpha * block[i][c];
+                bx[c] += beta * block[i][c];
+            }
+        }
+
+        float determinant = aa * bb - ab * ab;
+        if (std::fabs(determinant) < 1e-6f)
+            return false;
+        for (int c = 0; c < channels; c++) {
+            start[c] = std::min(255.0f, std::max(0.0f, (ax[c] * bb - bx[c] * ab) / determinant));
+            end[c] = std::min(255.0f, std::max(0.0f, (bx[c] * aa - ax[c] * ab) / determinant));
+        }
+        return true;
+    }
+
+    static uint16_t PackRGB565(const float color[4])
+    {
+        int r = (int)std::lround(color[0] * 31.0f / 255.0f);
+        int g = (int)std::lround(color[1] * 63.0f / 255.0f);
+        int b = (int)std::lround(color[2] * 31.0f / 255.0f);
+        return (uint16_t)((r << 11) | (g << 5) | b);
+    }
+
+    static void UnpackRGB565(uint16_t packed, int color[3])
+    {
+        int r = (packed >> 11) & 31;
+        int g = (packed >> 5) & 63;
+        int b = packed & 31;
+        color[0] = (r << 3) | (r >> 2);
+        color[1] = (g << 2) | (g >> 4);
+        color[2] = (b << 3) | (b >> 2);
+    }
+
+    // Picks the nearest of the four palette colors per pixel; returns the packed index word
+    static uint32_t SelectColorIndices(const unsigned char block[16][4], uint16_t color0, uint16_t color1, float weights[16])
+    {
+        int palette[4][3];
+        UnpackRGB565(color0, palette[0]);
+        UnpackRGB565(color1, palette[1]);
+        for (int c = 0; c < 3; c++) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        static const float paletteWeights[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+
+        uint32_t indices = 0;
+        for (int i = 0; i < 16; i++) {
+            int bestIndex = 0;
+            int bestError = INT32_MAX;
+            for (int p = 0; p < 4; p++) {
+                int error = 0;
+                for (int c = 0; c < 3; c++) {
+                    int delta = block[i][c] - palette[p][c];
+                    error += delta * delta;
+                }
+                if (error < bestError) {
+                    bestError = error;
+                    bestIndex = p;
+                }
+            }
+            indices |= (uint32_t)bestIndex << (2 * i);
+            weights[i] = paletteWeights[bestIndex];
+        }
+        return indices;
+    }
+
+    // BC1 color block in four-color mode (also the color half of BC3)
+    static void EncodeColorBlock(const unsigned char block[16][4], unsigned char* output)
+    {
+        float start[4], end[4];
+        FitEndpoints(block, 3, start, end);
+
+        uint16_t color0 = 0, color1 = 0;
+        uint32_t indices = 0;
+        float weights[16];
+        for (int pass = 0; pass < 2; pass++) {
+            color0 = PackRGB565(end);
+            color1 = PackRGB565(start);
+            // four-color mode needs color0 > color1
+            if (color0 < color1)
+                std::swap(color0, color1);
+            if (color0 == color1) {
+                indices = 0;
+                break;
+            }
+            indices = SelectColorIndices(block, color0, color1, weights);
+
+            // one least-squares refit of (color0, color1) against the chosen indices, then select again
+            if (pass == 1 || !RefitEndpoints(block, weights, 3, end, start))
+                break;
+        }
+
+        output[0] = (unsigned char)(color0 & 0xFF);
+        output[1] = (unsigned char)(color0 >> 8);
+        output[2] = (unsigned char)(color1 & 0xFF);
+        output[3] = (unsigned char)(color1 >> 8);
+        for (int i = 0; i < 4; i++)
+            output[4 + i] = (unsigned char)(indices >> (8 * i));
+    }
+
+    // BC3 alpha block in eight-value mode
+    static void EncodeAlphaBlock(const unsigned char block[16][4], unsigned char* output)
+    {
+        int alpha0 = 0;
+        int alpha1 = 255;
+        for (int i = 0; i < 16; i++) {
+            alpha0 = std::max(alpha0, (int)block[i][3]);
+            alpha1 = std::min(alpha1, (int)block[i][3]);
+        }
+
+        output[0] = (unsigned char)alpha0;
+        output[1] = (unsigned char)alpha1;
+        memset(output + 2, 0, 6);
+        if (alpha0 == alpha1)
+            return;
+
+        int palette[8];
+        palette[0] = alpha0;
+        palette[1] = alpha1;
+        for (int p = 1; p < 7; p++)
+            palette[p + 1] = ((7 - p) * alpha0 + p * alpha1) / 7;
+
+        uint64_t indices = 0;
+        for (int i = 0; i < 16; i++) {
+            int bestIndex = 0;
+            int bestError = 256;
+            for (int p = 0; p < 8; p++) {
+                int error = std::abs(block[i][3] - palette[p]);
+                if (error < bestError) {
+                    bestError = error;
+                    bestIndex = p;
+                }
+            }
+            indices |= (uint64_t)bestIndex << (3 * i);
+        }
+        for (int i = 0; i < 6; i++)
+            output[2 + i] = (unsigned char)(indices >> (8 * i));
+    }
+
+    static void EncodeBC1Block(const unsigned char block[16][4], unsigned char* output)
+    {
+        EncodeColorBlock(block, output);
+    }
+
+    static void EncodeBC3Block(const unsigned char block[16][4], unsigned char* output)
+    {
+        EncodeAlphaBlock(block, output);
+        EncodeColorBlock(block, output + 8);
+    }
+
+    // Writes `count` bits LSB first into a 128-bit block
+    static void WriteBits(unsigned char* output, int& position, uint32_t value, int count)
+    {
+        for (int i = 0; i < count; i++, position++)
+            output[position >> 3] |= (unsigned char)(((value >> i) & 1) << (position & 7));
+    }
+
+    // Quantizes an endpoint to BC7 mode 6 precision: 7 bits per channel plus a shared low bit
+    static void QuantizeBC7Endpoint(const float endpoint[4], int quantized[4], int& pBit, int decoded[4])
+    {
+        int bestError = INT32_MAX;
+        for (int p = 0; p < 2; p++) {
+            int error = 0;
+            int candidate[4];
+            for (int c = 0; c < 4; c++) {
+                candidate[c] = std::min(127, std::max(0, (int)std::lround((endpoint[c] - p) / 2.0f)));
+                int delta = ((candidate[c] << 1) | p) - (int)std::lround(endpoint[c]);
+                error += delta * delta;
+            }
+            if (error < bestError) {
+                bestError = error;
+                pBit = p;
+                for (int c = 0; c < 4; c++) {
+                    quantized[c] = candidate[c];
+                    decoded[c] = (candidate[c] << 1) | p;
+                }
+            }
+        }
+    }
+
+    // BC7 mode 6: one subset, RGBA endpoints, 4-bit indices. Good on both opaque and alpha content.
+    static void EncodeBC7Block(const unsigned char block[16][4], unsigned char* output)
+    {
+        static const int weightTable[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+        float endpoints[2][4];
+        FitEndpoints(block, 4, endpoints[0], endpoints[1]);
+
+        int quantized[2][4];
+        int pBits[2];
+        int decoded[2][4];
+        int indices[16];
+        for (int pass = 0; pass < 2; pass++) {
+            QuantizeBC7Endpoint(endpoints[0], quantized[0], pBits[0], decoded[0]);
+            QuantizeBC7Endpoint(endpoints[1], quantized[1], pBits[1], decoded[1]);
+
+            float weights[16];
+            for (int i = 0; i < 16; i++) {
+                int bestError = INT32_MAX;
+                for (int w = 0; w < 16; w++) {
+                    int error = 0;
+                    for (int c = 0; c < 4; c++) {
+                        int value = ((64 - weightTable[w]) * decoded[0][c] + weightTable[w] * decoded[1][c] + 32) >> 6;
+                        int delta = block[i][c] - value;
+                        error += delta * delta;
+                    }
+                    if (error < bestError) {
+                        bestError = error;
+                        indices[i] = w;
+                    }
+                }
+                weights[i] = weightTable[indices[i]] / 64.0f;
+            }
+
+            if (pass == 1 || !RefitEndpoints(block, weights, 4, endpoints[0], endpoints[1]))
+                break;
+        }
+
+        // the anchor index is stored without its high bit, so it must be below 8
+        if (indices[0] >= 8) {
+            for (int c = 0; c < 4; c++)
+                std::swap(quantized[0][c], quantized[1][c]);
+            std::swap(pBits[0], pBits[1]);
+            for (int i = 0; i < 16; i++)
+                indices[i] = 15 - indices[i];
+        }
+
+        memset(output, 0, 16);
+        int position = 0;
+        WriteBits(output, position, 1 << 6, 7);
+        for (int c = 0; c < 4; c++) {
+            WriteBits(output, position, quantized[0][c], 7);
+            WriteBits(output, position, quantized[1][c], 7);
+        }
+        WriteBits(output, position, pBits[0], 1);
+        WriteBits(output, position, pBits[1], 1);
+        WriteBits(output, position, indices[0], 3);
+        for (int i = 1; i < 16; i++)
+            WriteBits(output, position, indices[i], 4);
+    }
+
+    static void CompressLevel(const unsigned char* rgba, int width, int height, BLOCK_FORMAT format, unsigned char* output)
+    {
+        int blocksX = (width + 3) / 4;
+        int blocksY = (height + 3) / 4;
+        size_t blockBytes = GetBlockBytes(format);
+
+        // rows of blocks are independent; large levels spread across the pool
+        ThreadPool::Shared().ParallelFor((size_t)blocksY, [&](size_t blockY) {
+            unsigned char block[16][4];
+            for (int blockX = 0; blockX < blocksX; blockX++) {
+                FetchBlock(rgba, width, height, blockX, (int)blockY, block);
+                unsigned char* destination = output + (blockY * blocksX + blockX) * blockBytes;
+                if (format == BLOCK_BC1)
+                    EncodeBC1Block(block, destination);
+                else if (format == BLOCK_BC3)
+                    EncodeBC3Block(block, destination);
+                else
+                    EncodeBC7Block(block, destination);
+            }
+        });
+    }
+
+    // ---- public interface ----
+
+    BlockFormatSupport TextureCompression::QuerySupport()
+    {
+        BlockFormatSupport support;
+        // sRGB DXT formats come from EXT_texture_sRGB; BPTC has its sRGB variant built in
+        support.s3tc = GLEW_EXT_texture_compression_s3tc && GLEW_EXT_texture_sRGB;
+        support.bptc = GLEW_ARB_texture_compression_bptc || GLEW_VERSION_4_2;
+        return support;
+    }
+
+    std::string TextureCompression::GetCachePath(const std::string& imagePath)
+    {
+        return imagePath + ".dds";
+    }
+
+    bool TextureCompression::IsSupported(BLOCK_FORMAT format, const BlockFormatSupport& support)
+    {
+        return format == BLOCK_BC7 ? support.bptc : (format != BLOCK_NONE && support.s3tc);
+    }
+
+    size_t TextureCompression::GetLevelSize(BLOCK_FORMAT format, int width, int height)
+    {
+        return (size_t)((width + 3) / 4) * (size_t)((height + 3) / 4) * GetBlockBytes(format);
+    }
+
+    GLenum TextureCompression::GetInternalFormat(BLOCK_FORMAT format, bool srgb)
+    {
+        switch (format) {
+        case BLOCK_BC1: return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case BLOCK_BC3: return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case BLOCK_BC7: return srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : GL_COMPRESSED_RGBA_BPTC_UNORM;
+        default: return 0;
+        }
+    }
+
+    const char* TextureCompression::GetFormatName(BLOCK_FORMAT format)
+    {
+        switch (format) {
+        case BLOCK_BC1: return "BC1";
+        case BLOCK_BC3: return "BC3";
+        case BLOCK_BC7: return "BC7";
+        default: return "none";
+        }
+    }
+
+    size_t TextureCompression::GetUncompressedSize(int width, int height, size_t levelCount)
+    {
+        size_t bytes = 0;
+        for (size_t level = 0; level < levelCount; level++) {
+            bytes += (size_t)width * height * 4;
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+        return bytes;
+    }
+
+    void TextureCompression::Compress(const unsigned char* rgba, int width, int height, BLOCK_FORMAT format, bool srgb,
+        CompressedImage& image)
+    {
+        image.format = format;
+        image.srgb = srgb;
+        image.width = width;
+        image.height = height;
+        image.levelOffsets.clear();
+        image.levelSizes.clear();
+
+        // mips are filtered in linear space before encoding, so sRGB textures do not darken with distance
+        std::vector<ImageLevel> levels = ImagePipeline::BuildMipChain(rgba, width, height, 4, srgb, MIP_FILTER_KAISER);
+
+        size_t totalSize = 0;
+        for (size_t i = 0; i < levels.size(); i++) {
+            image.levelOffsets.push_back(totalSize);
+            image.levelSizes.push_back(GetLevelSize(format, levels[i].width, levels[i].height));
+            totalSize += image.levelSizes.back();
+        }
+        image.data.assign(totalSize, 0);
+
+        for (size_t i = 0; i < levels.size(); i++)
+            CompressLevel(levels[i].pixels.data(), levels[i].width, levels[i].height, format, image.data.data() + image.levelOffsets[i]);
+    }
+
+    bool TextureCompression::LoadOrCompress(const std::string& imagePath, bool flipVertically, bool srgb,
+        const BlockFormatSupport& support, CompressedImage& image)
+    {
+        if (!support.s3tc && !support.bptc)
+            return false;
+
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        if (ReadCache(imagePath, flipVertically, srgb, support, image)) {
+            image.fromCache = true;
+            image.loadSeconds = SecondsSince(start);
+            image.encodeSeconds = 0.0;
+            return true;
+        }
+
+        int width, height, n;
+        unsigned char* pixels = stbi_load(imagePath.c_str(), &width, &height, &n, 4);
+        if (!pixels)
+            return false;
+
+        if (flipVertically)
+            ImagePipeline::FlipRows(pixels, width, height, 4);
+        double decodeSeconds = SecondsSince(start);
+
+        bool hasAlpha = false;
+        for (size_t i = 3; i < (size_t)width * height * 4 && !hasAlpha; i += 4)
+            hasAlpha = pixels[i] != 255;
+
+        // BC1 halves the footprint of opaque images; alpha needs BC7, or BC3 where BPTC is missing
+        BLOCK_FORMAT format;
+        if (hasAlpha)
+            format = support.bptc ? BLOCK_BC7 : BLOCK_BC3;
+        else
+            format = support.s3tc ? BLOCK_BC1 : BLOCK_BC7;
+
+        std::chrono::high_resolution_clock::time_point encodeStart = std::chrono::high_resolution_clock::now();
+        Compress(pixels, width, height, format, srgb, image);
+        image.hasAlpha = hasAlpha;
+        stbi_image_free(pixels);
+
+        image.fromCache = false;
+        image.encodeSeconds = SecondsSince(encodeStart);
+        image.sourceDecodeSeconds = decodeSeconds;
+        image.loadSeconds = SecondsSince(start);
+
+        if (!WriteCache(imagePath, flipVertically, image))
+            fprintf(stderr, "WARNING: could not write texture cache %s\n", GetCachePath(imagePath).c_str());
+        return true;
+    }
+
+    // Maps the cache of the image and reads its headers; false if there is none or it is stale
+    static bool OpenCache(const std::string& imagePath, bool flipVertically, MappedFile& file, DDSHeader& header,
+        DDSHeaderDX10& headerDX10)
+    {
+        int64_t sourceTime;
+        uint64_t sourceSize;
+        if (!GetFileStamp(imagePath, sourceTime, sourceSize))
+            return false;
+
+        if (!file.Open(TextureCompression::GetCachePath(imagePath)))
+            return false;
+
+        const size_t headersSize = sizeof(uint32_t) + sizeof(DDSHeader) + sizeof(DDSHeaderDX10);
+        if (file.GetSize() < headersSize)
+            return false;
+
+        uint32_t magic;
+        memcpy(&magic, file.GetData(), sizeof(magic));
+        memcpy(&header, file.GetData() + sizeof(magic), sizeof(header));
+        memcpy(&headerDX10, file.GetData() + sizeof(magic) + sizeof(header), sizeof(headerDX10));
+
+        if (magic != DDS_MAGIC || header.size != sizeof(DDSHeader) || header.pixelFormat.fourCC != DDS_FOURCC_DX10)
+            return false;
+        if (header.reserved1[0] != TEXTURE_CACHE_TAG || header.reserved1[1] != TEXTURE_CACHE_VERSION)
+            return false;
+
+        // stale if the source changed since the bake, or if it was baked for another orientation
+        uint64_t bakedTime = (uint64_t)header.reserved1[3] | ((uint64_t)header.reserved1[4] << 32);
+        if ((int64_t)bakedTime != sourceTime || header.reserved1[5] != (uint32_t)sourceSize)
+            return false;
+        return ((header.reserved1[2] & TEXTURE_CACHE_FLIPPED) != 0) == flipVertically;
+    }
+
+    bool TextureCompression::ReadCachedAlpha(const std::string& imagePath, bool flipVertically, bool& hasAlpha)
+    {
+        MappedFile file;
+        DDSHeader header;
+        DDSHeaderDX10 headerDX10;
+        if (!OpenCache(imagePath, flipVertically, file, header, headerDX10))
+            return false;
+        hasAlpha = (header.reserved1[2] & TEXTURE_CACHE_ALPHA) != 0;
+        return true;
+    }
+
+    bool TextureCompression::ReadCache(const std::string& imagePath, bool flipVertically, bool srgb,
+        const BlockFormatSupport& support, CompressedImage& image)
+    {
+        MappedFile file;
+        DDSHeader header;
+        DDSHeaderDX10 headerDX10;
+        if (!OpenCache(imagePath, flipVertically, file, header, headerDX10))
+            return false;
+        const size_t headersSize = sizeof(uint32_t) + sizeof(DDSHeader) + sizeof(DDSHeaderDX10);
+
+        BLOCK_FORMAT format = BLOCK_NONE;
+        const BLOCK_FORMAT candidates[3] = {BLOCK_BC1, BLOCK_BC3, BLOCK_BC7};
+        for (int i = 0; i < 3; i++) {
+            if (headerDX10.dxgiFormat == GetDxgiFormat(candidates[i], srgb))
+                format = candidates[i];
+        }
+        // a cache baked on a machine with other formats is rebuilt for this driver
+        if (format == BLOCK_NONE || !IsSupported(format, support))
+            return false;
+        if (header.width == 0 || header.height == 0 || header.mipMapCount == 0 || header.mipMapCount > 32)
+            return false;
+
+        image.format = format;
+        image.srgb = srgb;
+        image.hasAlpha = (header.reserved1[2] & TEXTURE_CACHE_ALPHA) != 0;
+        image.width = (int)header.width;
+        image.height = (int)header.height;
+        image.levelOffsets.clear();
+        image.levelSizes.clear();
+
+        size_t totalSize = 0;
+        int levelWidth = image.width;
+        int levelHeight = image.height;
+        for (uint32_t level = 0; level < header.mipMapCount; level++) {
+            image.levelOffsets.push_back(totalSize);
+            image.levelSizes.push_back(GetLevelSize(format, levelWidth, levelHeight));
+            totalSize += image.levelSizes.back();
+            levelWidth = std::max(1, levelWidth / 2);
+            levelHeight = std::max(1, levelHeight / 2);
+        }
+        if (file.GetSize() != headersSize + totalSize)
+            return false;
+
+        image.data.assign(file.GetData() + headersSize, file.GetData() + headersSize + totalSize);
+        image.sourceDecodeSeconds = header.reserved1[6] / 1000000.0;
+        return true;
+    }
+
+    bool TextureCompression::WriteCache(const std::string& imagePath, bool flipVertically, const CompressedImage& image)
+    {
+        int64_t sourceTime;
+        uint64_t sourceSize;
+        if (!GetFileStamp(imagePath, sourceTime, sourceSize))
+            return false;
+
+        DDSHeader header = {};
+        header.size = sizeof(DDSHeader);
+        header.flags = DDS_FLAGS;
+        header.height = (uint32_t)image.height;
+        header.width = (uint32_t)image.width;
+        header.pitchOrLinearSize = (uint32_t)image.levelSizes[0];
+        header.mipMapCount = (uint32_t)image.levelSizes.size();
+        header.reserved1[0] = TEXTURE_CACHE_TAG;
+        header.reserved1[1] = TEXTURE_CACHE_VERSION;
+        header.reserved1[2] = (flipVertically ? TEXTURE_CACHE_FLIPPED : 0) | (image.hasAlpha ? TEXTURE_CACHE_ALPHA : 0);
+        header.reserved1[3] = (uint32_t)((uint64_t)sourceTime & 0xFFFFFFFFu);
+        header.reserved1[4] = (uint32_t)((uint64_t)sourceTime >> 32);
+        header.reserved1[5] = (uint32_t)sourceSize;
+        header.reserved1[6] = (uint32_t)(image.sourceDecodeSeconds * 1000000.0);
+        header.pixelFormat.size = sizeof(DDSPixelFormat);
+        header.pixelFormat.flags = DDPF_FOURCC;
+        header.pixelFormat.fourCC = DDS_FOURCC_DX10;
+        header.caps = DDS_CAPS;
+
+        DDSHeaderDX10 headerDX10 = {};
+        headerDX10.dxgiFormat = GetDxgiFormat(image.format, image.srgb);
+        headerDX10.resourceDimension = DDS_DIMENSION_TEXTURE2D;
+        headerDX10.arraySize = 1;
+
+        // written under a temporary name so a reader never maps a half-written file
+        std::string cachePath = GetCachePath(imagePath);
+        std::string temporaryPath = cachePath + ".tmp";
+        {
+            std::ofstream out(temporaryPath.c_str(), std::ios::binary | std::ios::trunc);
+            if (!out)
+                return false;
+            out.write((const char*)&DDS_MAGIC, sizeof(DDS_MAGIC));
+            out.write((const char*)&header, sizeof(header));
+            out.write((const char*)&headerDX10, sizeof(headerDX10));
+            out.write((const char*)image.data.data(), (std::streamsize)image.data.size());
+            if (!out)
+                return false;
+        }
+
+        std::remove(cachePath.c_str());
+        return std::rename(temporaryPath.c_str(), cachePath.c_str()) == 0;
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef TextureCompression_hpp
+#define TextureCompression_hpp
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    enum BLOCK_FORMAT {BLOCK_NONE, BLOCK_BC1, BLOCK_BC3, BLOCK_BC7};
+
+    // Block formats the driver can sample, queried on the GL thread and handed to the workers
+    struct BlockFormatSupport
+    {
+        // BC1 and BC3 (S3TC / DXT1, DXT5)
+        bool s3tc = false;
+        // BC7 (BPTC)
+        bool bptc = false;
+    };
+
+    // Block-compressed mip chain of one image, level 0 first, all levels in one contiguous buffer
+    struct CompressedImage
+    {
+        BLOCK_FORMAT format = BLOCK_NONE;
+        bool srgb = false;
+        // any texel of the source is not fully opaque, from the scan made when the cache was baked
+        bool hasAlpha = false;
+        int width = 0;
+        int height = 0;
+        std::vector<size_t> levelOffsets;
+        std::vector<size_t> levelSizes;
+        std::vector<unsigned char> data;
+
+        // Timings of the last LoadOrCompress call
+        bool fromCache = false;
+        double loadSeconds = 0.0;
+        double encodeSeconds = 0.0;
+        // Time it took to decode the source image, measured when the cache was baked
+        double sourceDecodeSeconds = 0.0;
+    };
+
+    // CPU block encoder (BC1 for opaque images, BC7 or BC3 for images with alpha) with a DDS cache next to the source
+    class TextureCompression
+    {
+    public:
+        static BlockFormatSupport QuerySupport();
+
+        // Returns the DDS cache path of a source image
+        static std::string GetCachePath(const std::string& imagePath);
+
+        // Loads the cached mip chain of the image, or decodes, compresses and caches it; false if no block format is
+        // supported or the image cannot be read, in which case the caller uploads it uncompressed.
+        // Flipped images have row 0 at the bottom, as glTexImage2D expects for 2D textures.
+        static bool LoadOrCompress(const std::string& imagePath, bool flipVertically, bool srgb,
+            const BlockFormatSupport& support, CompressedImage& image);
+
+        // Reads whether the source has non-opaque texels from the headers of its cache; false if there is no fresh one
+        static bool ReadCachedAlpha(const std::string& imagePath, bool flipVertically, bool& hasAlpha);
+
+        // Builds the gamma-correct mip chain of an RGBA8 image and block-compresses every level
+        static void Compress(const unsigned char* rgba, int width, int height, BLOCK_FORMAT format, bool srgb,
+            CompressedImage& image);
+
+        // Whether the driver can sample the block format
+        static bool IsSupported(BLOCK_FORMAT format, const BlockFormatSupport& support);
+
+        // Bytes of one compressed level
+        static size_t GetLevelSize(BLOCK_FORMAT format, int width, int height);
+
+        static GLenum GetInternalFormat(BLOCK_FORMAT format, bool srgb);
+        static const char* GetFormatName(BLOCK_FORMAT format);
+
+        // Size of the same mip chain as uncompressed RGBA8
+        static size_t GetUncompressedSize(int width, int height, size_t levelCount);
+
+    private:
+        static bool ReadCache(const std::string& imagePath, bool flipVertically, bool srgb,
+            const BlockFormatSupport& support, CompressedImage& image);
+        static bool WriteCache(const std::string& imagePath, bool flipVertically, const CompressedImage& image);
+    };
+}
+
+#endif /* TextureCompression_hpp */
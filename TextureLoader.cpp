@@ -0,0 +1,331 @@
+#include "TextureLoader.hpp"
+#include "GLState.hpp"
+#include "ThreadPool.hpp"
+
+#include "stb_image.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+namespace gps {
+
+    TextureLoader& TextureLoader::Instance()
+    {
+        static TextureLoader loader;
+        return loader;
+    }
+
+    TextureHandle TextureLoader::Load(const std::string& path)
+    {
+        TextureSlot slot;
+        slot.path = path;
+        slot.state = TEXTURE_DECODING;
+        slot.textureId = 0;
+        slot.byteSize = 0;
+        // decided here, before the first draw, so a mesh never changes shader permutation while its texture streams in:
+        // the cache records whether the baked texels were all opaque, without one the source's channels decide
+        if (!TextureCompression::ReadCachedAlpha(path, true, slot.hasAlpha)) {
+            int width, height, channels = 0;
+            slot.hasAlpha = stbi_info(path.c_str(), &width, &height, &channels) && (channels == 2 || channels == 4);
+        }
+        slots.push_back(slot);
+        pendingCount++;
+
+        // the extension flags are read here because the workers have no GL context
+        if (!supportQueried) {
+            blockSupport = TextureCompression::QuerySupport();
+            supportQueried = true;
+        }
+        BlockFormatSupport support = blockSupport;
+
+        TextureHandle handle = (TextureHandle)slots.size();
+        ThreadPool::Shared().Submit([this, handle, path, support]() { Decode(handle, path, support); });
+        return handle;
+    }
+
+    // Runs on a worker: decodes the image, flips it so row 0 is the bottom one, as GL expects, and builds its mip chain
+    void TextureLoader::Decode(TextureHandle handle, std::string path, BlockFormatSupport support)
+    {
+        DecodedImage image;
+        image.handle = handle;
+        image.width = 0;
+        image.height = 0;
+        image.channels = 0;
+
+        if (TextureCompression::LoadOrCompress(path, true, true, support, image.compressed)) {
+            image.width = image.compressed.width;
+            image.height = image.compressed.height;
+            std::lock_guard<std::mutex> lock(decodedMutex);
+            decoded.push_back(std::move(image));
+            return;
+        }
+
+        // RGB sources stay 3 channels instead of growing a constant alpha
+        int n = 4;
+        stbi_info(path.c_str(), &image.width, &image.height, &n);
+        int force_channels = (n == 2 || n == 4) ? 4 : 3;
+        unsigned char* pixels = stbi_load(path.c_str(), &image.width, &image.height, &n, force_channels);
+
+        if (pixels) {
+            image.channels = force_channels;
+            ImagePipeline::FlipRows(pixels, image.width, image.height, image.channels);
+            image.levels = ImagePipeline::BuildMipChain(pixels, image.width, image.height, image.channels, true, MIP_FILTER_BOX);
+            stbi_image_free(pixels);
+        } else {
+            fprintf(stderr, "ERROR: could not load %s\n", path.c_str());
+        }
+
+        std::lock_guard<std::mutex> lock(decodedMutex);
+        decoded.push_back(std::move(image));
+    }
+
+    void TextureLoader::Update(double budgetMilliseconds)
+    {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+        // always finish at least one upload so loading makes progress under any budget
+        do {
+            DecodedImage image;
+            {
+                std::lock_guard<std::mutex> lock(decodedMutex);
+                if (decoded.empty())
+                    return;
+                image = std::move(decoded.front());
+                decoded.pop_front();
+            }
+
+            TextureSlot& slot = slots[image.handle - 1];
+            pendingCount--;
+            bool compressed = image.compressed.format != BLOCK_NONE;
+            if (slot.state == TEXTURE_RELEASED || (image.levels.empty() && !compressed)) {
+                if (slot.state != TEXTURE_RELEASED)
+                    slot.state = TEXTURE_FAILED;
+                continue;
+            }
+
+            if (compressed)
+                UploadCompressed(image);
+            else
+                Upload(image);
+        } while (std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() < budgetMilliseconds);
+    }
+
+    // Copies the mip chain into an orphaned unpack buffer and lets the driver DMA it into immutable storage
+    void TextureLoader::Upload(const DecodedImage& image)
+    {
+        TextureSlot& slot = slots[image.handle - 1];
+        size_t imageBytes = 0;
+        for (size_t level = 0; level < image.levels.size(); level++)
+            imageBytes += image.levels[level].pixels.size();
+
+        // NPOT check
+        if ((image.width & (image.width - 1)) != 0 || (image.height & (image.height - 1)) != 0) {
+            fprintf(stderr, "WARNING: texture %s is not power-of-2 dimensions\n", slot.path.c_str());
+        }
+
+        if (pixelUnpackBuffer == 0)
+            glGenBuffers(1, &pixelUnpackBuffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelUnpackBuffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, imageBytes, NULL, GL_STREAM_DRAW);
+        unsigned char* staging = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, imageBytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (staging) {
+            size_t offset = 0;
+            for (size_t level = 0; level < image.levels.size(); level++) {
+                memcpy(staging + offset, image.levels[level].pixels.data(), image.levels[level].pixels.size());
+                offset += image.levels[level].pixels.size();
+            }
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        } else {
+            // mapping failed, upload straight from client memory
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+
+        GLenum internalFormat = image.channels == 4 ? GL_SRGB8_ALPHA8 : GL_SRGB8;
+        GLenum pixelFormat = image.channels == 4 ? GL_RGBA : GL_RGB;
+        GLsizei levelCount = (GLsizei)image.levels.size();
+
+        GLuint textureID;
+        glGenTextures(1, &textureID);
+        GLState::Instance().BindTexture(0, GL_TEXTURE_2D, textureID);
+        if (GLEW_ARB_texture_storage)
+            glTexStorage2D(GL_TEXTURE_2D, levelCount, internalFormat, image.width, image.height);
+
+        // RGB rows are not 4-byte aligned in general
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        size_t offset = 0;
+        for (GLsizei level = 0; level < levelCount; level++) {
+            const ImageLevel& current = image.levels[level];
+            const GLvoid* source = staging ? (const GLvoid*)offset : (const GLvoid*)current.pixels.data();
+            if (GLEW_ARB_texture_storage)
+                glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, current.width, current.height, pixelFormat, GL_UNSIGNED_BYTE, source);
+            else
+                glTexImage2D(GL_TEXTURE_2D, level, internalFormat, current.width, current.height, 0, pixelFormat, GL_UNSIGNED_BYTE, source);
+            offset += current.pixels.size();
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        GLState::Instance().BindTexture(0, GL_TEXTURE_2D, 0);
+
+        slot.textureId = textureID;
+        // drivers pad RGB8 texels to four bytes
+        slot.byteSize = TextureCompression::GetUncompressedSize(image.width, image.height, image.levels.size());
+        slot.state = TEXTURE_READY;
+    }
+
+    // Same PBO path as Upload, but every pre-built mip level goes in with glCompressedTexImage2D
+    void TextureLoader::UploadCompressed(const DecodedImage& image)
+    {
+        TextureSlot& slot = slots[image.handle - 1];
+        const CompressedImage& compressed = image.compressed;
+        size_t imageBytes = compressed.data.size();
+
+        if (pixelUnpackBuffer == 0)
+            glGenBuffers(1, &pixelUnpackBuffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelUnpackBuffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, imageBytes, NULL, GL_STREAM_DRAW);
+        void* staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, imageBytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (staging) {
+            memcpy(staging, compressed.data.data(), imageBytes);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        } else {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+
+        GLenum internalFormat = TextureCompression::GetInternalFormat(compressed.format, compressed.srgb);
+        GLuint textureID;
+        glGenTextures(1, &textureID);
+        GLState::Instance().BindTexture(0, GL_TEXTURE_2D, textureID);
+        int levelWidth = compressed.width;
+        int levelHeight = compressed.height;
+        for (size_t level = 0; level < compressed.levelSizes.size(); level++) {
+            const GLvoid* source = staging ? (const GLvoid*)compressed.levelOffsets[level] : (const GLvoid*)(compressed.data.data() + compressed.levelOffsets[level]);
+            glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)level, internalFormat, levelWidth, levelHeight, 0,
+                (GLsizei)compressed.levelSizes[level], source);
+            levelWidth = levelWidth > 1 ? levelWidth / 2 : 1;
+            levelHeight = levelHeight > 1 ? levelHeight / 2 : 1;
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)compressed.levelSizes.size() - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        GLState::Instance().BindTexture(0, GL_TEXTURE_2D, 0);
+
+        slot.textureId = textureID;
+        slot.byteSize = imageBytes;
+        slot.state = TEXTURE_READY;
+
+        size_t rgbaBytes = TextureCompression::GetUncompressedSize(compressed.width, compressed.height, compressed.levelSizes.size());
+        compressedCount++;
+        compressedBytes += imageBytes;
+        uncompressedBytes += rgbaBytes;
+        if (compressed.fromCache) {
+            cachedCount++;
+            cacheLoadSeconds += compressed.loadSeconds;
+            cacheSourceDecodeSeconds += compressed.sourceDecodeSeconds;
+        } else {
+            bakeSeconds += compressed.loadSeconds;
+        }
+
+        std::cout << "Texture " << slot.path << " : " << TextureCompression::GetFormatName(compressed.format) << " "
+            << compressed.width << "x" << compressed.height << ", " << rgbaBytes / 1024 << " KB -> " << imageBytes / 1024 << " KB, ";
+        if (compressed.fromCache) {
+            std::cout << "cache loaded in " << compressed.loadSeconds * 1000.0 << " ms (source decode took "
+                << compressed.sourceDecodeSeconds * 1000.0 << " ms)" << std::endl;
+        } else {
+            std::cout << "baked in " << compressed.loadSeconds * 1000.0 << " ms (decode " << compressed.sourceDecodeSeconds * 1000.0
+                << " ms, encode " << compressed.encodeSeconds * 1000.0 << " ms)" << std::endl;
+        }
+    }
+
+    void TextureLoader::PrintReport() const
+    {
+        const double mb = 1024.0 * 1024.0;
+        std::cout << "Texture compression : " << compressedCount << " textures block-compressed, VRAM "
+            << uncompressedBytes / mb << " MB -> " << compressedBytes / mb << " MB (saved " << (uncompressedBytes - compressedBytes) / mb << " MB)" << std::endl;
+        std::cout << "  " << cachedCount << " loaded from the DDS cache in " << cacheLoadSeconds * 1000.0 << " ms vs "
+            << cacheSourceDecodeSeconds * 1000.0 << " ms to decode their sources; " << compressedCount - cachedCount
+            << " baked in " << bakeSeconds * 1000.0 << " ms" << std::endl;
+    }
+
+    void TextureLoader::Flush()
+    {
+        while (GetPendingCount() > 0) {
+            Update(1000.0);
+            if (GetPendingCount() > 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    GLuint TextureLoader::GetTextureId(TextureHandle handle)
+    {
+        if (handle == 0 || handle > slots.size() || slots[handle - 1].state != TEXTURE_READY)
+            return GetPlaceholder();
+        return slots[handle - 1].textureId;
+    }
+
+    bool TextureLoader::IsReady(TextureHandle handle) const
+    {
+        return handle != 0 && handle <= slots.size() && slots[handle - 1].state == TEXTURE_READY;
+    }
+
+    bool TextureLoader::HasAlpha(TextureHandle handle) const
+    {
+        return handle != 0 && handle <= slots.size() && slots[handle - 1].hasAlpha;
+    }
+
+    size_t TextureLoader::GetByteSize(TextureHandle handle) const
+    {
+        if (!IsReady(handle))
+            return 0;
+        return slots[handle - 1].byteSize;
+    }
+
+    void TextureLoader::Release(TextureHandle handle)
+    {
+        if (handle == 0 || handle > slots.size())
+            return;
+
+        TextureSlot& slot = slots[handle - 1];
+        if (slot.state == TEXTURE_READY)
+            GLState::Instance().DeleteTexture(slot.textureId);
+        slot.textureId = 0;
+        slot.byteSize = 0;
+        slot.state = TEXTURE_RELEASED;
+    }
+
+    size_t TextureLoader::GetPendingCount() const
+    {
+        return pendingCount;
+    }
+
+    // Flat grey 2x2 texture shown while the real one is still loading
+    GLuint TextureLoader::GetPlaceholder()
+    {
+        if (placeholderTexture != 0)
+            return placeholderTexture;
+
+        const unsigned char grey[2 * 2 * 4] = {
+            128, 128, 128, 255, 128, 128, 128, 255,
+            128, 128, 128, 255, 128, 128, 128, 255
+        };
+        glGenTextures(1, &placeholderTexture);
+        GLState::Instance().BindTexture(0, GL_TEXTURE_2D, placeholderTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8, 2, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        GLState::Instance().BindTexture(0, GL_TEXTURE_2D, 0);
+        return placeholderTexture;
+    }
+}
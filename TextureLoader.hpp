@@ -0,0 +1,113 @@
+#ifndef TextureLoader_hpp
+#define TextureLoader_hpp
+
+#include "ImagePipeline.hpp"
+#include "TextureCompression.hpp"
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Identifies a texture owned by the TextureLoader; 0 is never a valid handle
+    typedef uint32_t TextureHandle;
+
+    // Decodes images on the shared worker pool and streams them to the GPU through a pixel-unpack buffer.
+    // Images are block-compressed (and cached on disk) when the driver supports it, uploaded as RGBA8 otherwise.
+    // Until a texture is uploaded its handle resolves to a small placeholder.
+    class TextureLoader
+    {
+    public:
+        static TextureLoader& Instance();
+
+        // Queues the image for decoding and returns immediately
+        TextureHandle Load(const std::string& path);
+
+        // Current GL texture for the handle: the real one once uploaded, the placeholder until then
+        GLuint GetTextureId(TextureHandle handle);
+
+        bool IsReady(TextureHandle handle) const;
+        // Whether the image has non-opaque texels, as its texture cache records them, or whether its source has an
+        // alpha channel until a cache exists; decided by Load, so it is known while the texture still streams in
+        bool HasAlpha(TextureHandle handle) const;
+
+        // GPU memory of the uploaded texture including its mip chain; 0 until it is ready
+        size_t GetByteSize(TextureHandle handle) const;
+
+        // Finishes pending uploads on the GL thread; stops starting new ones once the budget is spent
+        void Update(double budgetMilliseconds);
+
+        // Blocks until every queued texture is decoded and uploaded
+        void Flush();
+
+        // Deletes the GL texture; a decode still in flight is discarded when it completes
+        void Release(TextureHandle handle);
+
+        size_t GetPendingCount() const;
+
+        // Prints the VRAM saved by block compression and how much faster cached textures loaded than their sources
+        void PrintReport() const;
+
+    private:
+        enum TEXTURE_STATE {TEXTURE_DECODING, TEXTURE_READY, TEXTURE_FAILED, TEXTURE_RELEASED};
+
+        struct TextureSlot
+        {
+            std::string path;
+            TEXTURE_STATE state;
+            GLuint textureId;
+            size_t byteSize;
+            bool hasAlpha;
+        };
+
+        // Output of a worker, waiting for the GL thread
+        struct DecodedImage
+        {
+            TextureHandle handle;
+            int width;
+            int height;
+            int channels;
+            // full mip chain, level 0 first
+            std::vector<ImageLevel> levels;
+            // used instead of levels when its format is not BLOCK_NONE
+            CompressedImage compressed;
+        };
+
+        // Only touched on the GL thread
+        std::vector<TextureSlot> slots;
+        GLuint placeholderTexture = 0;
+        GLuint pixelUnpackBuffer = 0;
+        size_t pendingCount = 0;
+        bool supportQueried = false;
+        BlockFormatSupport blockSupport;
+
+        // Compression statistics, GL thread only
+        size_t compressedCount = 0;
+        size_t cachedCount = 0;
+        size_t compressedBytes = 0;
+        size_t uncompressedBytes = 0;
+        double cacheLoadSeconds = 0.0;
+        double cacheSourceDecodeSeconds = 0.0;
+        double bakeSeconds = 0.0;
+
+        // Filled by the workers
+        mutable std::mutex decodedMutex;
+        std::deque<DecodedImage> decoded;
+
+        TextureLoader() {}
+        void Decode(TextureHandle handle, std::string path, BlockFormatSupport support);
+        void Upload(const DecodedImage& image);
+        void UploadCompressed(const DecodedImage& image);
+        GLuint GetPlaceholder();
+
+        TextureLoader(const TextureLoader&) = delete;
+        TextureLoader& operator=(const TextureLoader&) = delete;
+    };
+}
+
+#endif /* TextureLoader_hpp */
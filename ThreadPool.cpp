@@ -0,0 +1,120 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace gps {
+
+    ThreadPool::ThreadPool(size_t threadCount) : stopping(false)
+    {
+        if (threadCount == 0) {
+            threadCount = std::thread::hardware_concurrency();
+            if (threadCount == 0)
+                threadCount = 4;
+        }
+
+        for (size_t i = 0; i < threadCount; i++)
+            workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(jobsMutex);
+            stopping = true;
+        }
+        jobsAvailable.notify_all();
+
+        for (size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+
+    std::future<void> ThreadPool::Submit(std::function<void()> job)
+    {
+        std::packaged_task<void()> task(job);
+        std::future<void> result = task.get_future();
+        {
+            std::lock_guard<std::mutex> lock(jobsMutex);
+            jobs.push_back(std::move(task));
+        }
+        jobsAvailable.notify_one();
+        return result;
+    }
+
+    // Shared between the caller of ParallelFor and the helper jobs, which may outlive the call
+    struct ParallelForState
+    {
+        std::atomic<size_t> nextIndex;
+        std::atomic<size_t> finishedCount;
+        size_t count;
+        std::function<void(size_t)> job;
+        std::mutex finishedMutex;
+        std::condition_variable allFinished;
+    };
+
+    // Pulls indices until none are left
+    static void DrainParallelFor(const std::shared_ptr<ParallelForState>& state)
+    {
+        size_t finished = 0;
+        for (size_t i = state->nextIndex++; i < state->count; i = state->nextIndex++) {
+            state->job(i);
+            finished++;
+        }
+
+        if (finished > 0 && state->finishedCount.fetch_add(finished) + finished == state->count) {
+            std::lock_guard<std::mutex> lock(state->finishedMutex);
+            state->allFinished.notify_all();
+        }
+    }
+
+    void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& job)
+    {
+        if (count == 0)
+            return;
+
+        std::shared_ptr<ParallelForState> state = std::make_shared<ParallelForState>();
+        state->nextIndex = 0;
+        state->finishedCount = 0;
+        state->count = count;
+        state->job = job;
+
+        // helpers that start after the work is gone return immediately, so nested calls from
+        // inside a worker cannot deadlock waiting on a queued helper
+        size_t helperCount = std::min(workers.size(), count - 1);
+        for (size_t i = 0; i < helperCount; i++)
+            Submit([state]() { DrainParallelFor(state); });
+
+        DrainParallelFor(state);
+
+        std::unique_lock<std::mutex> lock(state->finishedMutex);
+        state->allFinished.wait(lock, [&state]() { return state->finishedCount == state->count; });
+    }
+
+    size_t ThreadPool::GetThreadCount() const
+    {
+        return workers.size();
+    }
+
+    ThreadPool& ThreadPool::Shared()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    void ThreadPool::WorkerLoop()
+    {
+        while (true) {
+            std::packaged_task<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(jobsMutex);
+                jobsAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                if (stopping && jobs.empty())
+                    return;
+                task = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            task();
+        }
+    }
+}
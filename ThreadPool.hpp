@@ -0,0 +1,48 @@
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+    // Fixed set of worker threads consuming a FIFO of jobs
+    class ThreadPool
+    {
+    public:
+        // 0 threads means one per hardware core
+        explicit ThreadPool(size_t threadCount = 0);
+        ~ThreadPool();
+
+        // Queues a job; the future becomes ready once it has run
+        std::future<void> Submit(std::function<void()> job);
+
+        // Runs job(i) for every i in [0, count) across the workers and the calling thread, then waits
+        void ParallelFor(size_t count, const std::function<void(size_t)>& job);
+
+        size_t GetThreadCount() const;
+
+        // Pool shared by the loaders, created on first use
+        static ThreadPool& Shared();
+
+    private:
+        std::vector<std::thread> workers;
+        std::deque<std::packaged_task<void()> > jobs;
+        std::mutex jobsMutex;
+        std::condition_variable jobsAvailable;
+        bool stopping;
+
+        void WorkerLoop();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+    };
+}
+
+#endif /* ThreadPool_hpp */
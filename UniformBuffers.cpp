@@ -0,0 +1,95 @@
+#include "UniformBuffers.hpp"
+#include "RenderStats.hpp"
+
+#include "glm/gtc/matrix_inverse.hpp"
+
+namespace gps {
+
+    ObjectUniforms ObjectUniforms::Make(const glm::mat4& model, const glm::mat4& view, float transparency)
+    {
+        ObjectUniforms object;
+        object.model = model;
+        glm::mat3 normalMatrix = glm::inverseTranspose(glm::mat3(view * model));
+        for (int column = 0; column < 3; column++)
+            object.normalMatrix[column] = glm::vec4(normalMatrix[column], 0.0f);
+        object.transparency = transparency;
+        object.padding[0] = object.padding[1] = object.padding[2] = 0.0f;
+        return object;
+    }
+
+    void UniformBuffers::Init()
+    {
+        glGenBuffers(1, &frameBuffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, frameBuffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, frameBuffer);
+
+        // no shadows until the first update
+        ShadowUniforms shadows = ShadowUniforms();
+        glGenBuffers(1, &shadowBuffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, shadowBuffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(ShadowUniforms), &shadows, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, SHADOW_BLOCK_BINDING, shadowBuffer);
+
+        // every slot starts on the offset alignment glBindBufferRange requires
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        objectSlotSize = (sizeof(ObjectUniforms) + alignment - 1) / alignment * alignment;
+        objectCursor = 0;
+        glGenBuffers(1, &objectRing);
+        glBindBuffer(GL_UNIFORM_BUFFER, objectRing);
+        glBufferData(GL_UNIFORM_BUFFER, objectSlotSize * OBJECT_RING_SLOTS, NULL, GL_STREAM_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void UniformBuffers::Delete()
+    {
+        glDeleteBuffers(1, &objectRing);
+        glDeleteBuffers(1, &frameBuffer);
+        glDeleteBuffers(1, &shadowBuffer);
+        objectRing = frameBuffer = shadowBuffer = 0;
+    }
+
+    void UniformBuffers::UpdateFrame(const FrameUniforms& frame)
+    {
+        // respecifying the whole store lets the driver hand out fresh memory instead of waiting on last frame
+        glBindBuffer(GL_UNIFORM_BUFFER, frameBuffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), &frame, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        RenderStats::Instance().AddUniformBufferUpdate(sizeof(FrameUniforms));
+    }
+
+    void UniformBuffers::UpdateShadows(const ShadowUniforms& shadows)
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, shadowBuffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(ShadowUniforms), &shadows, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        RenderStats::Instance().AddUniformBufferUpdate(sizeof(ShadowUniforms));
+    }
+
+    void UniformBuffers::PushObject(const ObjectUniforms& object)
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, objectRing);
+        if (objectCursor == OBJECT_RING_SLOTS) {
+            glBufferData(GL_UNIFORM_BUFFER, objectSlotSize * OBJECT_RING_SLOTS, NULL, GL_STREAM_DRAW);
+            objectCursor = 0;
+        }
+        GLintptr offset = (GLintptr)(objectCursor * objectSlotSize);
+        glBufferSubData(GL_UNIFORM_BUFFER, offset, sizeof(ObjectUniforms), &object);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferRange(GL_UNIFORM_BUFFER, OBJECT_BLOCK_BINDING, objectRing, offset, sizeof(ObjectUniforms));
+        objectCursor++;
+        RenderStats::Instance().AddUniformBufferUpdate(sizeof(ObjectUniforms));
+    }
+
+    GLint UniformBuffers::GetBlockBinding(const std::string& blockName)
+    {
+        if (blockName == "FrameUniforms")
+            return FRAME_BLOCK_BINDING;
+        if (blockName == "ObjectUniforms")
+            return OBJECT_BLOCK_BINDING;
+        if (blockName == "ShadowUniforms")
+            return SHADOW_BLOCK_BINDING;
+        return -1;
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef UniformBuffers_hpp
+#define UniformBuffers_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include <cstddef>
+#include <string>
+
+namespace gps {
+
+    // Binding points of the uniform blocks the shaders declare
+    enum UNIFORM_BLOCK_BINDING {FRAME_BLOCK_BINDING = 0, OBJECT_BLOCK_BINDING = 1, SHADOW_BLOCK_BINDING = 2};
+
+    // Cascades the ShadowUniforms block has room for
+    const int MAX_SHADOW_CASCADES = 4;
+
+    // std140 mirror of the FrameUniforms block: the camera, the light and the fog
+    struct FrameUniforms
+    {
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::mat4 lightSpaceTrMatrix;
+        // direction towards the light, in eye space
+        glm::vec3 lightDir;
+        float fogDensity;
+        glm::vec3 lightColor;
+        float padding;
+    };
+
+    // std140 mirror of the ObjectUniforms block
+    struct ObjectUniforms
+    {
+        glm::mat4 model;
+        // a std140 mat3 takes three vec4 columns
+        glm::vec4 normalMatrix[3];
+        float transparency;
+        float padding[3];
+
+        // Model matrix with the eye-space normal matrix derived from it
+        static ObjectUniforms Make(const glm::mat4& model, const glm::mat4& view, float transparency = 1.0f);
+    };
+
+    // std140 mirror of the ShadowUniforms block: where every cascade of the directional light's shadow map sits
+    struct ShadowUniforms
+    {
+        // world space to the cascade's [-1, 1] light clip space
+        glm::mat4 cascadeMatrices[MAX_SHADOW_CASCADES];
+        // eye-space distance each cascade reaches
+        glm::vec4 cascadeEnds;
+        // depth bias of each cascade, in its [0, 1] depth range
+        glm::vec4 cascadeBias;
+        // 0 with shadows off, otherwise the number of cascades in use
+        GLint cascadeCount;
+        GLint padding[3];
+    };
+
+    // One buffer for the per-frame block, rewritten once a frame, and a ring of per-object blocks bound range by
+    // range; the ring is orphaned when it wraps, so the GPU never waits on a slot still in use
+    class UniformBuffers
+    {
+    public:
+        // Per-object slots before the ring wraps
+        static const size_t OBJECT_RING_SLOTS = 1024;
+
+        // Needs a GL context
+        void Init();
+        void Delete();
+
+        void UpdateFrame(const FrameUniforms& frame);
+        // Rewritten only when the cascades move or the shadows are toggled
+        void UpdateShadows(const ShadowUniforms& shadows);
+
+        // Writes the next ring slot and binds it to OBJECT_BLOCK_BINDING for the following draws
+        void PushObject(const ObjectUniforms& object);
+
+        // Binding point of a uniform block by name, -1 for blocks this class does not feed
+        static GLint GetBlockBinding(const std::string& blockName);
+
+    private:
+        GLuint frameBuffer = 0;
+        GLuint shadowBuffer = 0;
+        GLuint objectRing = 0;
+        size_t objectSlotSize = 0;
+        size_t objectCursor = 0;
+    };
+}
+
+#endif /* UniformBuffers_hpp */
@@ -0,0 +1,235 @@
+#include "VertexPacking.hpp"
+#include "Mesh.hpp"
+
+#include "glm/gtc/packing.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace gps {
+
+    static_assert(sizeof(PackedVertex) == 16, "PackedVertex must stay tightly packed");
+    static_assert(sizeof(CompactPackedVertex) == 12, "CompactPackedVertex must stay tightly packed");
+
+    static const float POSITION_STEPS = 65535.0f;
+
+    static glm::vec2 SignNotZero(const glm::vec2& v)
+    {
+        return glm::vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+    }
+
+    // Folds the lower hemisphere over the diagonals of the octahedron
+    static glm::vec2 OctWrap(const glm::vec2& v)
+    {
+        return (glm::vec2(1.0f) - glm::abs(glm::vec2(v.y, v.x))) * SignNotZero(v);
+    }
+
+    // Unit vector to a point on [-1, 1]^2
+    static glm::vec2 OctEncode(const glm::vec3& n)
+    {
+        float sum = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+        if (sum == 0.0f)
+            return glm::vec2(0.0f);
+        glm::vec2 p = glm::vec2(n.x, n.y) / sum;
+        return n.z >= 0.0f ? p : OctWrap(p);
+    }
+
+    // Same decode as basic.vert
+    static glm::vec3 OctDecode(const glm::vec2& e)
+    {
+        glm::vec3 n(e.x, e.y, 1.0f - std::fabs(e.x) - std::fabs(e.y));
+        if (n.z < 0.0f) {
+            glm::vec2 xy = OctWrap(glm::vec2(n.x, n.y));
+            n.x = xy.x;
+            n.y = xy.y;
+        }
+        return glm::normalize(n);
+    }
+
+    // Picks the rounding of the octahedral coordinates that decodes closest to the normal,
+    // which is noticeably better than rounding to nearest at 8 bits
+    static void QuantizeNormal(const glm::vec3& normal, float maxValue, int quantized[2])
+    {
+        glm::vec2 e = OctEncode(normal) * maxValue;
+        float bestDot = -2.0f;
+        for (int i = 0; i < 4; i++) {
+            float qx = (i & 1) ? std::ceil(e.x) : std::floor(e.x);
+            float qy = (i & 2) ? std::ceil(e.y) : std::floor(e.y);
+            qx = std::max(-maxValue, std::min(maxValue, qx));
+            qy = std::max(-maxValue, std::min(maxValue, qy));
+            float d = glm::dot(OctDecode(glm::vec2(qx, qy) / maxValue), normal);
+            if (d > bestDot) {
+                bestDot = d;
+                quantized[0] = (int)qx;
+                quantized[1] = (int)qy;
+            }
+        }
+    }
+
+    size_t VertexPacking::GetStride(VERTEX_FORMAT format)
+    {
+        switch (format) {
+        case VERTEX_PACKED: return sizeof(PackedVertex);
+        case VERTEX_PACKED_COMPACT: return sizeof(CompactPackedVertex);
+        default: return sizeof(Vertex);
+        }
+    }
+
+    size_t VertexPacking::GetPositionStride(VERTEX_FORMAT format)
+    {
+        return format == VERTEX_FLOAT ? sizeof(glm::vec3) : 4 * sizeof(uint16_t);
+    }
+
+    const char* VertexPacking::GetFormatName(VERTEX_FORMAT format)
+    {
+        switch (format) {
+        case VERTEX_PACKED: return "packed";
+        case VERTEX_PACKED_COMPACT: return "packed compact";
+        default: return "float";
+        }
+    }
+
+    void VertexPacking::Pack(const Vertex* vertices, size_t vertexCount, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+        VERTEX_FORMAT format, VertexStream& stream, PackingError& error)
+    {
+        stream.format = format;
+        stream.vertexCount = vertexCount;
+        stream.vertices.assign(vertexCount * GetStride(format), 0);
+        stream.decode = VertexDecode();
+        error = PackingError();
+
+        if (format == VERTEX_FLOAT) {
+            if (vertexCount > 0)
+                memcpy(stream.vertices.data(), vertices, vertexCount * sizeof(Vertex));
+            return;
+        }
+
+        float normalMax = format == VERTEX_PACKED ? 32767.0f : 127.0f;
+        glm::vec3 extent = boundsMax - boundsMin;
+        stream.decode.positionScale = extent / POSITION_STEPS;
+        stream.decode.positionOffset = boundsMin;
+        stream.decode.normalScale = 1.0f / normalMax;
+
+        size_t stride = GetStride(format);
+        for (size_t v = 0; v < vertexCount; v++) {
+            const Vertex& source = vertices[v];
+
+            uint16_t position[3];
+            for (int axis = 0; axis < 3; axis++) {
+                float t = extent[axis] > 0.0f ? (source.Position[axis] - boundsMin[axis]) / extent[axis] : 0.0f;
+                position[axis] = (uint16_t)std::lround(std::max(0.0f, std::min(1.0f, t)) * POSITION_STEPS);
+            }
+
+            float normalLength = glm::length(source.Normal);
+            glm::vec3 normal = normalLength > 0.0f ? source.Normal / normalLength : glm::vec3(0.0f, 0.0f, 1.0f);
+            int quantizedNormal[2];
+            QuantizeNormal(normal, normalMax, quantizedNormal);
+
+            uint16_t texCoords[2] = {glm::packHalf1x16(source.TexCoords.x), glm::packHalf1x16(source.TexCoords.y)};
+
+            unsigned char* destination = stream.vertices.data() + v * stride;
+            if (format == VERTEX_PACKED) {
+                PackedVertex packed = {};
+                memcpy(packed.Position, position, sizeof(position));
+                packed.Normal[0] = (int16_t)quantizedNormal[0];
+                packed.Normal[1] = (int16_t)quantizedNormal[1];
+                memcpy(packed.TexCoords, texCoords, sizeof(texCoords));
+                memcpy(destination, &packed, sizeof(packed));
+            } else {
+                CompactPackedVertex packed = {};
+                memcpy(packed.Position, position, sizeof(position));
+                packed.Normal[0] = (int8_t)quantizedNormal[0];
+                packed.Normal[1] = (int8_t)quantizedNormal[1];
+                memcpy(packed.TexCoords, texCoords, sizeof(texCoords));
+                memcpy(destination, &packed, sizeof(packed));
+            }
+
+            // measure what the shader will reconstruct
+            glm::vec3 decodedPosition = glm::vec3(position[0], position[1], position[2]) * stream.decode.positionScale + boundsMin;
+            error.position = std::max(error.position, glm::length(decodedPosition - source.Position));
+            if (normalLength > 0.0f) {
+                glm::vec3 decodedNormal = OctDecode(glm::vec2((float)quantizedNormal[0], (float)quantizedNormal[1]) / normalMax);
+                float angle = std::acos(std::max(-1.0f, std::min(1.0f, glm::dot(decodedNormal, normal))));
+                error.normalDegrees = std::max(error.normalDegrees, glm::degrees(angle));
+            }
+            for (int i = 0; i < 2; i++)
+                error.texCoord = std::max(error.texCoord, std::fabs(glm::unpackHalf1x16(texCoords[i]) - source.TexCoords[i]));
+        }
+    }
+
+    void VertexPacking::SetAttributePointers(VERTEX_FORMAT format)
+    {
+        glEnableVertexAttribArray(0);
+        glEnableVertexAttribArray(1);
+        glEnableVertexAttribArray(2);
+
+        // integer attributes are converted without normalization; basic.vert applies the VertexDecode scales,
+        // which avoids the snorm conversion rule that differs between GL 4.1 and 4.2
+        if (format == VERTEX_PACKED) {
+            glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, Position));
+            glVertexAttribPointer(1, 2, GL_SHORT, GL_FALSE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, Normal));
+            glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, TexCoords));
+        } else if (format == VERTEX_PACKED_COMPACT) {
+            glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(CompactPackedVertex), (GLvoid*)offsetof(CompactPackedVertex, Position));
+            glVertexAttribPointer(1, 2, GL_BYTE, GL_FALSE, sizeof(CompactPackedVertex), (GLvoid*)offsetof(CompactPackedVertex, Normal));
+            glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(CompactPackedVertex), (GLvoid*)offsetof(CompactPackedVertex, TexCoords));
+        } else {
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
+            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+        }
+    }
+
+    void VertexPacking::ExtractPositions(VERTEX_FORMAT format, const void* vertexData, size_t vertexCount, unsigned char* positions)
+    {
+        size_t stride = GetStride(format);
+        size_t positionStride = GetPositionStride(format);
+        size_t positionSize = format == VERTEX_FLOAT ? sizeof(glm::vec3) : 3 * sizeof(uint16_t);
+        const unsigned char* source = (const unsigned char*)vertexData;
+        for (size_t v = 0; v < vertexCount; v++) {
+            unsigned char* destination = positions + v * positionStride;
+            memcpy(destination, source + v * stride, positionSize);
+            memset(destination + positionSize, 0, positionStride - positionSize);
+        }
+    }
+
+    void VertexPacking::SetPositionAttributePointer(VERTEX_FORMAT format)
+    {
+        glEnableVertexAttribArray(0);
+        if (format == VERTEX_FLOAT)
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, (GLsizei)GetPositionStride(format), (GLvoid*)0);
+        else
+            glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_FALSE, (GLsizei)GetPositionStride(format), (GLvoid*)0);
+    }
+
+    void VertexPacking::SetDecodeAttributes(const VertexDecode& decode)
+    {
+        glVertexAttrib3fv(DECODE_POSITION_SCALE, &decode.positionScale[0]);
+        glVertexAttrib3fv(DECODE_POSITION_OFFSET, &decode.positionOffset[0]);
+        glVertexAttrib1f(DECODE_NORMAL_SCALE, decode.normalScale);
+    }
+
+    void VertexPacking::SetInstanceAttributes(GLuint instanceBuffer)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        for (GLuint column = 0; column < 4; column++) {
+            GLuint attribute = INSTANCE_MODEL_COLUMN + column;
+            glEnableVertexAttribArray(attribute);
+            glVertexAttribPointer(attribute, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (GLvoid*)(column * sizeof(glm::vec4)));
+            glVertexAttribDivisor(attribute, 1);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void VertexPacking::ClearInstanceAttributes()
+    {
+        // the constant of an attribute is not guaranteed to survive draws made with its array enabled
+        for (GLuint column = 0; column < 4; column++) {
+            GLuint attribute = INSTANCE_MODEL_COLUMN + column;
+            glDisableVertexAttribArray(attribute);
+            glVertexAttrib4f(attribute, column == 0 ? 1.0f : 0.0f, column == 1 ? 1.0f : 0.0f, column == 2 ? 1.0f : 0.0f,
+                column == 3 ? 1.0f : 0.0f);
+        }
+    }
+}
@@ -0,0 +1,102 @@
+#ifndef VertexPacking_hpp
+#define VertexPacking_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    struct Vertex;
+
+    // Layout of the vertex buffer of a mesh
+    enum VERTEX_FORMAT {VERTEX_FLOAT, VERTEX_PACKED, VERTEX_PACKED_COMPACT};
+
+    // Attributes carrying the VertexDecode: constant over a draw, or one value per instance in indirect draws
+    enum DECODE_ATTRIBUTE {DECODE_POSITION_SCALE = 3, DECODE_POSITION_OFFSET = 4, DECODE_NORMAL_SCALE = 5};
+
+    // First of the four columns (attributes 6-9) of the per-instance model matrix, the identity for meshes drawn once,
+    // and of the three columns (10-12) of the per-instance normal matrix the instanced shaders read
+    enum INSTANCE_ATTRIBUTE {INSTANCE_MODEL_COLUMN = 6, INSTANCE_NORMAL_COLUMN = 10};
+
+    // 16 bytes: position quantized to 16 bits against the mesh bounds, octahedral normal in 2x16 bits,
+    // half-float texture coordinates
+    struct PackedVertex
+    {
+        uint16_t Position[3];
+        uint16_t padding;
+        int16_t Normal[2];
+        uint16_t TexCoords[2];
+    };
+
+    // 12 bytes: as PackedVertex with the octahedral normal in 2x8 bits
+    struct CompactPackedVertex
+    {
+        uint16_t Position[3];
+        int8_t Normal[2];
+        uint16_t TexCoords[2];
+    };
+
+    // Shader constants that turn a stored vertex back into object space; the identity for float vertices
+    struct VertexDecode
+    {
+        // position = stored * positionScale + positionOffset
+        glm::vec3 positionScale = glm::vec3(1.0f);
+        glm::vec3 positionOffset = glm::vec3(0.0f);
+        // 0 for float normals, otherwise the stored octahedral normal is multiplied by it
+        float normalScale = 0.0f;
+    };
+
+    // Worst-case error of a packed mesh against its float source
+    struct PackingError
+    {
+        // object-space distance
+        float position = 0.0f;
+        float normalDegrees = 0.0f;
+        float texCoord = 0.0f;
+    };
+
+    // Vertex buffer contents of one mesh in a given format
+    struct VertexStream
+    {
+        VERTEX_FORMAT format = VERTEX_FLOAT;
+        std::vector<unsigned char> vertices;
+        size_t vertexCount = 0;
+        VertexDecode decode;
+    };
+
+    class VertexPacking
+    {
+    public:
+        static size_t GetStride(VERTEX_FORMAT format);
+        // Bytes per vertex of a position-only stream: the float position, or the three 16-bit ones padded to 8 bytes
+        static size_t GetPositionStride(VERTEX_FORMAT format);
+        static const char* GetFormatName(VERTEX_FORMAT format);
+
+        // Quantizes the vertices against the bounds; the error is measured by decoding them again
+        static void Pack(const Vertex* vertices, size_t vertexCount, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+            VERTEX_FORMAT format, VertexStream& stream, PackingError& error);
+
+        // Points attributes 0-2 (position, normal, texture coordinates) of the bound vertex array at the bound array buffer
+        static void SetAttributePointers(VERTEX_FORMAT format);
+
+        // Copies the position of every vertex, which all formats store first, into a tightly packed position-only stream
+        static void ExtractPositions(VERTEX_FORMAT format, const void* vertexData, size_t vertexCount, unsigned char* positions);
+        // Points attribute 0 of the bound vertex array at a position-only stream in the bound array buffer; the normal
+        // and texture coordinate arrays stay disabled
+        static void SetPositionAttributePointer(VERTEX_FORMAT format);
+
+        // Sets the decode attributes as constants for the next draws, while their arrays are disabled
+        static void SetDecodeAttributes(const VertexDecode& decode);
+
+        // Feeds the instance matrix of the bound vertex array from a buffer of mat4s, one per instance
+        static void SetInstanceAttributes(GLuint instanceBuffer);
+        // Disables the instance arrays of the bound vertex array and sets the identity constant back
+        static void ClearInstanceAttributes();
+    };
+}
+
+#endif /* VertexPacking_hpp */
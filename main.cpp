@@ -12,10 +12,24 @@
 #include "Camera.hpp"
 #include "Model3D.hpp"
 #include "SkyBox.hpp"
-
+#include "Benchmark.hpp"
+#include "AssetRegistry.hpp"
+#include "GeometryArena.hpp"
+#include "GLState.hpp"
+#include "ImagePipeline.hpp"
+#include "InstanceStream.hpp"
+#include "RenderStats.hpp"
+#include "ShadowCascades.hpp"
+#include "UniformBuffers.hpp"
+
+#include <cfloat>
+#include <fstream>
 #include <iostream>
+#include <string>
 
 void presentation();
+void benchmarkDepthPass();
+void benchmarkDepthPrepass();
 
 // window
 gps::Window myWindow;
@@ -24,7 +38,6 @@ gps::Window myWindow;
 glm::mat4 model;
 glm::mat4 view;
 glm::mat4 projection;
-glm::mat3 normalMatrix;
 
 glm::mat4 modelRotation;
 glm::mat4 normalMatrixRotation;
@@ -32,22 +45,13 @@ glm::mat4 normalMatrixRotation;
 //matrices for the pinwheel
 glm::mat4 modelPinwheel;
 
-// shader uniform locations
-GLint modelLoc;
-GLint modelPinwheelLoc;
-GLint viewLoc;
-GLint projectionLoc;
-GLint normalMatrixLoc;
-
-GLint lightDirLoc;
-GLint lightColorLoc;
-GLint lightPosEyeLoc;
-
-GLuint fogLoc;
-GLuint transparencyLoc;
-
-GLuint shadowMapFBO;
-GLuint depthMapTexture;
+//cascaded shadow maps of the sun: static casters cached, the moving ones redrawn every frame
+gps::ShadowCascades shadowCascades;
+bool shadowsEnabled = true;
+const float SHADOW_DISTANCE = 60.0f;
+//object-space box around the park and the house, turned with `model` for the shadow depth range
+glm::vec3 casterMin;
+glm::vec3 casterMax;
 
 // camera
 gps::Camera myCamera(
@@ -55,6 +59,19 @@ gps::Camera myCamera(
     glm::vec3(0.0f, 0.0f, -10.0f),
     glm::vec3(0.0f, 1.0f, 0.0f));
 
+// levels of detail are picked for this view, refreshed every frame
+gps::RenderView renderView;
+// low-resolution depth of the park's large occluders, rebuilt every frame
+gps::OcclusionCuller occlusionCuller;
+bool occlusionEnabled = true;
+// GPU occlusion queries for the expensive meshes, off until toggled
+gps::OcclusionQueries occlusionQueries;
+bool occlusionQueriesEnabled = false;
+// per-frame block and per-object ring shared by every shader
+gps::UniformBuffers uniformBuffers;
+// mesh draws of the frame, sorted before they are submitted
+gps::RenderQueue renderQueue;
+
 GLfloat cameraSpeed = 0.1f;
 float sensitivityRotateCamera = 0.3f;
 
@@ -71,17 +88,25 @@ gps::Model3D windows;
 gps::Model3D pinwheel_stick;
 gps::Model3D pinwheel_petals;
 
+//copies drawn with one instanced call per mesh; the lamp posts only when their model is there
+bool felinareLoaded = false;
+std::vector<glm::mat4> lampPostModels;
+std::vector<glm::mat4> pinwheelOffsets;
+std::vector<glm::mat4> pinwheelModels;
+
 // shaders
 gps::Shader myBasicShader;
 gps::Shader mySkyBoxShader;
 gps::Shader myDepthMapShader;
+gps::Shader myInstancedShader;
+gps::Shader myAlphaTestedShader;
+gps::Shader myDepthPrepassShader;
 
 //fog variables
 float fogDensityValue;
 
 //transparency variables;
 float transparencyLevel = 0.4f;
-float noTransparency = 1.0f;
 
 //skybox
 gps::SkyBox mySkyBox;
@@ -149,6 +174,83 @@ void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
         glfwSetWindowShouldClose(window, GL_TRUE);
     }
 
+	//print what the last frame submitted
+	if (key == GLFW_KEY_I && action == GLFW_PRESS) {
+		gps::RenderStats::Instance().PrintLastFrame();
+	}
+
+	//toggle the levels of detail
+	if (key == GLFW_KEY_L && action == GLFW_PRESS) {
+		renderView.lodEnabled = !renderView.lodEnabled;
+		std::cout << "LOD " << (renderView.lodEnabled ? "on" : "off") << std::endl;
+	}
+
+	//toggle occlusion culling
+	if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+		occlusionEnabled = !occlusionEnabled;
+		std::cout << "Occlusion culling " << (occlusionEnabled ? "on" : "off") << std::endl;
+	}
+
+	//toggle hardware occlusion queries
+	if (key == GLFW_KEY_K && action == GLFW_PRESS) {
+		occlusionQueriesEnabled = !occlusionQueriesEnabled;
+		std::cout << "Occlusion queries " << (occlusionQueriesEnabled ? "on" : "off") << std::endl;
+	}
+
+	//toggle multi-draw indirect submission against the base-vertex loop
+	if (key == GLFW_KEY_M && action == GLFW_PRESS) {
+		if (gps::GeometryArena::Instance().IsMultiDrawSupported())
+			renderQueue.SetMultiDraw(!renderQueue.IsMultiDrawEnabled());
+		std::cout << "Multi-draw indirect " << (renderQueue.IsMultiDrawEnabled() ? "on" : "off (base-vertex loop)") << std::endl;
+	}
+
+	//draw loop against instanced draws, 1 to 100k copies of the pinwheel petals
+	if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+		gps::RunInstancingBenchmark(pinwheel_petals, myBasicShader, myInstancedShader, uniformBuffers, view);
+	}
+
+	//depth pass with the position-only streams against the full vertices
+	if (key == GLFW_KEY_V && action == GLFW_PRESS) {
+		benchmarkDepthPass();
+	}
+
+	//toggle the depth pre-pass of the opaque meshes
+	if (key == GLFW_KEY_Y && action == GLFW_PRESS) {
+		renderQueue.SetDepthPrepass(!renderQueue.IsDepthPrepassEnabled(), myDepthPrepassShader);
+		std::cout << "Depth pre-pass " << (renderQueue.IsDepthPrepassEnabled() ? "on" : "off") << std::endl;
+	}
+
+	//frames with the depth pre-pass against shading alone
+	if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+		benchmarkDepthPrepass();
+	}
+
+	//toggle the position-only streams of the depth passes
+	if (key == GLFW_KEY_Z && action == GLFW_PRESS) {
+		gps::GeometryArena& arena = gps::GeometryArena::Instance();
+		arena.UsePositionStreams(!arena.IsUsingPositionStreams());
+		std::cout << "Position-only depth streams " << (arena.IsUsingPositionStreams() ? "on" : "off") << std::endl;
+	}
+
+	//toggle the shadows
+	if (key == GLFW_KEY_N && action == GLFW_PRESS) {
+		shadowsEnabled = !shadowsEnabled;
+		uniformBuffers.UpdateShadows(shadowCascades.GetUniforms(shadowsEnabled));
+		std::cout << "Shadows " << (shadowsEnabled ? "on" : "off") << std::endl;
+	}
+
+	//toggle the static shadow cache against re-rendering every cascade every frame
+	if (key == GLFW_KEY_J && action == GLFW_PRESS) {
+		shadowCascades.SetCaching(!shadowCascades.IsCachingEnabled());
+		std::cout << "Static shadow cache " << (shadowCascades.IsCachingEnabled() ? "on" : "off") << std::endl;
+	}
+
+	//toggle frustum culling
+	if (key == GLFW_KEY_F && action == GLFW_PRESS) {
+		renderView.cullingEnabled = !renderView.cullingEnabled;
+		std::cout << "Frustum culling " << (renderView.cullingEnabled ? "on" : "off") << std::endl;
+	}
+
 	if (key >= 0 && key < 1024) {
         if (action == GLFW_PRESS) {
             pressedKeys[key] = true;
@@ -193,10 +295,6 @@ void mouseCallback(GLFWwindow* window, double xpos, double ypos)
 
 			//get view matrix for current camera
 			view = myCamera.getViewMatrix();
-			myBasicShader.useShaderProgram();
-			glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-			//compute normal matrix for teapot
-			normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
 		}
 	}
 
@@ -211,61 +309,44 @@ void processMovement() {
 	if (pressedKeys[GLFW_KEY_Q]) {
 		angleY -= 1.0f;
 		model = glm::rotate(glm::mat4(1.0f), glm::radians(angleY), glm::vec3(0.0f, 1.0f, 0.0f));
-		myBasicShader.useShaderProgram();
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-		normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-		glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+		//the static casters turned with the scene
+		shadowCascades.Invalidate();
 	} 
 
 	if (pressedKeys[GLFW_KEY_E]) {
 		angleY += 1.0f;
 		model = glm::rotate(glm::mat4(1.0f), glm::radians(angleY), glm::vec3(0.0f, 1.0f, 0.0f));
-		myBasicShader.useShaderProgram();
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-		normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-		glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+		shadowCascades.Invalidate();
 	} 
 
 	if (pressedKeys[GLFW_KEY_W]) {
 		myCamera.move(gps::MOVE_FORWARD, cameraSpeed);
 		view = myCamera.getViewMatrix();
-		myBasicShader.useShaderProgram();
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 	} 
 
 	if (pressedKeys[GLFW_KEY_S]) {
 		myCamera.move(gps::MOVE_BACKWARD, cameraSpeed);
 		view = myCamera.getViewMatrix();
-		myBasicShader.useShaderProgram();
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 	} 
 
 	if (pressedKeys[GLFW_KEY_A]) {
 		myCamera.move(gps::MOVE_LEFT, cameraSpeed);
 		view = myCamera.getViewMatrix();
-		myBasicShader.useShaderProgram();
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 	} 
 
 	if (pressedKeys[GLFW_KEY_D]) {
 		myCamera.move(gps::MOVE_RIGHT, cameraSpeed);
 		view = myCamera.getViewMatrix();
-		myBasicShader.useShaderProgram();
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 	} 
 
 	if (pressedKeys[GLFW_KEY_SPACE]) {
 		myCamera.move(gps::MOVE_UP, cameraSpeed);
 		view = myCamera.getViewMatrix();
-		myBasicShader.useShaderProgram();
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 	} 
 
 	if (pressedKeys[GLFW_KEY_LEFT_CONTROL]) {
 		myCamera.move(gps::MOVE_DOWN, cameraSpeed);
 		view = myCamera.getViewMatrix();
-		myBasicShader.useShaderProgram();
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 	} 
 
 	if (pressedKeys[GLFW_KEY_X])
@@ -316,17 +397,17 @@ void processMovement() {
 	
 	//NORMAL
 	if (pressedKeys[GLFW_KEY_1]) {
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		gps::GLState::Instance().PolygonMode(GL_FILL);
 	}
 
 	//WIREFRAME
 	if (pressedKeys[GLFW_KEY_2]) {
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+		gps::GLState::Instance().PolygonMode(GL_LINE);
 	}
 
 	//POINT
 	if (pressedKeys[GLFW_KEY_3]) {
-		glPolygonMode(GL_FRONT_AND_BACK, GL_POINT);
+		gps::GLState::Instance().PolygonMode(GL_POINT);
 	}
 }
 
@@ -344,26 +425,67 @@ void initOpenGLState() {
 	glClearColor(0.7f, 0.7f, 0.7f, 1.0f);
 	glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
     glEnable(GL_FRAMEBUFFER_SRGB);
-	glEnable(GL_DEPTH_TEST); // enable depth-testing
-	glDepthFunc(GL_LESS); // depth-testing interprets a smaller value as "closer"
-	glEnable(GL_CULL_FACE); // cull face
-	glCullFace(GL_BACK); // cull back face
+	gps::GLState& state = gps::GLState::Instance();
+	state.SetEnabled(GL_DEPTH_TEST, true); // enable depth-testing
+	state.DepthFunc(GL_LEQUAL); // smaller or equal depth is "closer", so the skybox on the far plane needs no switch
+	state.SetEnabled(GL_CULL_FACE, true); // cull face
+	state.CullFace(GL_BACK); // cull back face
 	glFrontFace(GL_CCW); // GL_CCW for counter clock-wise
 
-	//For transparency
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glEnable(GL_BLEND);
+	//For transparency; the render queue enables blending for the translucent draws alone
+	state.BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	state.SetEnabled(GL_BLEND, false);
 	glClearColor(0.0, 0.0, 0.0, 0.0);
 }
 
 void initModels() {
     //teapot.LoadModel("models/teapots/teapot_moved.obj");
+	//the shadow casters are drawn again for every cascade, from a copy of the positions alone
+	gps::GeometryArena::Instance().KeepPositionStreams(true);
+	//the terrain, the house and the big props hide most of the park
+	gps::ImportOptions occluderOptions;
+	occluderOptions.occluderMinRadius = 2.0f;
+	//the park's hundreds of small shapes draw as one range of a shared buffer per material
+	occluderOptions.grouping = gps::GROUP_BY_MATERIAL;
+	//its benches, lamps and trees repeat, each repeated shape draws once with a list of transforms
+	occluderOptions.instanceRepeatedShapes = true;
+	parkScene.SetImportOptions(occluderOptions);
     parkScene.LoadModel("objects/test1/park2.obj");
+	occluderOptions.occluderMinRadius = 0.5f;
+	occluderOptions.grouping = gps::GROUP_BY_SHAPE;
+	occluderOptions.instanceRepeatedShapes = false;
+	house.SetImportOptions(occluderOptions);
 	house.LoadModel("objects/test1/house2.obj");
 	windows.LoadModel("objects/test1/windows1.obj");
 	pinwheel_stick.LoadModel("objects/test1/pinwheel/pinwheel_stick_final.obj");
 	pinwheel_petals.LoadModel("objects/test1/pinwheel/pinwheel_test1.obj");
 
+	//the shadows' depth range has to reach every static caster
+	glm::vec3 houseMin, houseMax;
+	parkScene.GetBounds(casterMin, casterMax);
+	house.GetBounds(houseMin, houseMax);
+	casterMin = glm::min(casterMin, houseMin);
+	casterMax = glm::max(casterMax, houseMax);
+
+	//lamp posts in a ring around the park, each turned to face its centre
+	felinareLoaded = std::ifstream("objects/test1/felinare.obj").good();
+	if (felinareLoaded) {
+		felinare.LoadModel("objects/test1/felinare.obj");
+		for (int i = 0; i < 24; i++) {
+			float lampAngle = glm::radians(15.0f * i);
+			glm::mat4 lampPost = glm::translate(glm::mat4(1.0f), glm::vec3(14.0f * glm::cos(lampAngle), 0.0f, 14.0f * glm::sin(lampAngle)));
+			lampPostModels.push_back(glm::rotate(lampPost, -lampAngle, glm::vec3(0.0f, 1.0f, 0.0f)));
+		}
+	}
+	//a bed of pinwheels next to the first one, which stays a plain draw
+	for (int row = 0; row < 3; row++) {
+		for (int column = 0; column < 4; column++) {
+			if (row == 0 && column == 0)
+				continue;
+			pinwheelOffsets.push_back(glm::translate(glm::mat4(1.0f), glm::vec3(0.6f * column, 0.0f, 0.6f * row)));
+		}
+	}
+
 	//initialize skybox
 	std::vector<const GLchar*> faces;
 	faces.push_back("textures/skybox/negx.jpg");  //right
@@ -372,7 +494,11 @@ void initModels() {
 	faces.push_back("textures/skybox/negy.jpg");  //bottom
 	faces.push_back("textures/skybox/negz.jpg");  //back
 	faces.push_back("textures/skybox/posz.jpg");  //front
-	mySkyBox.Load(faces);
+	mySkyBox.Load(faces, "textures/skybox/skybox.gpcube");
+
+	//every mesh lives in the geometry arena; GL 4.3 draws runs of them with one indirect call
+	renderQueue.SetMultiDraw(gps::GeometryArena::Instance().IsMultiDrawSupported());
+	std::cout << "Multi-draw indirect " << (renderQueue.IsMultiDrawEnabled() ? "on" : "unsupported, base-vertex loop") << std::endl;
 }
 
 void initShaders() {
@@ -385,154 +511,160 @@ void initShaders() {
 		"shaders/depthMap.frag"
 	);
 
+	//the same shading for cut-out materials, the only permutation that discards
+	myAlphaTestedShader.loadShader(
+		"shaders/basic.vert",
+		"shaders/basic.frag",
+		"#define ALPHA_TEST\n"
+	);
+	renderView.alphaTestedShader = &myAlphaTestedShader;
+
+	//depth of the opaque meshes, laid down before they are shaded
+	myDepthPrepassShader.loadShader(
+		"shaders/depthPrepass.vert",
+		"shaders/depthMap.frag"
+	);
+	renderQueue.SetDepthPrepass(false, myDepthPrepassShader);
+
+	//basic shading with the model and normal matrices read per instance
+	myInstancedShader.loadShader(
+		"shaders/basicInstanced.vert",
+		"shaders/basic.frag"
+	);
+
+	//the shadow maps sit above the mesh texture units
+	myBasicShader.set("staticShadowMap", (GLint)gps::STATIC_SHADOW_UNIT);
+	myBasicShader.set("overlayShadowMap", (GLint)gps::OVERLAY_SHADOW_UNIT);
+	myInstancedShader.set("staticShadowMap", (GLint)gps::STATIC_SHADOW_UNIT);
+	myInstancedShader.set("overlayShadowMap", (GLint)gps::OVERLAY_SHADOW_UNIT);
+	myAlphaTestedShader.set("staticShadowMap", (GLint)gps::STATIC_SHADOW_UNIT);
+	myAlphaTestedShader.set("overlayShadowMap", (GLint)gps::OVERLAY_SHADOW_UNIT);
+
 	mySkyBoxShader.loadShader(
 		"shaders/skyboxShader.vert",
 		"shaders/skyboxShader.frag"
 	);
+
+	occlusionQueries.Init(
+		"shaders/occlusionProxy.vert",
+		"shaders/occlusionProxy.frag"
+	);
 }
 
 void initUniforms() {
 
-	myBasicShader.useShaderProgram();
-
-    // create model matrix for teapot
+	// create model matrix for teapot
 	model = glm::mat4(1.0f);
-	modelLoc = glGetUniformLocation(myBasicShader.shaderProgram, "model");
-	 
-	lightDirLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightDir");
 	lightRotation = glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f)); glCheckError();
-	glUniform3fv(lightDirLoc, 1, glm::value_ptr(glm::inverseTranspose(glm::mat3(view * lightRotation)) * lightDir)); glCheckError();
-	 
 
 	// get view matrix for current camera
 	view = myCamera.getViewMatrix();
-	viewLoc = glGetUniformLocation(myBasicShader.shaderProgram, "view");
-	// send view matrix to shader
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-	 
-    // compute normal matrix for teapot
-    normalMatrix = glm::mat3(glm::inverseTranspose(view*model));
-	normalMatrixLoc = glGetUniformLocation(myBasicShader.shaderProgram, "normalMatrix");
-	 
+
 	// create projection matrix
 	projection = glm::perspective(glm::radians(45.0f),
                                (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height,
                                0.1f, 100.0f);
-	projectionLoc = glGetUniformLocation(myBasicShader.shaderProgram, "projection");
-	// send projection matrix to shader
-	glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));	
-	 
+
 	//set the light direction (direction towards the light)
 	//lightDir = glm::vec3(0.0f, 1.0f, 1.0f);
 	lightDir = glm::vec3(0.0f, 1.0f, 1.0f);
-	
-	// send light dir to shader
-	glUniform3fv(lightDirLoc, 1, glm::value_ptr(lightDir));
-	 
+
 	//set light color
 	lightColor = glm::vec3(1.0f, 1.0f, 1.0f); //white light
-	lightColorLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightColor");
-	// send light color to shader
-	glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
-	// send light color to shader
-	glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
-	 
-	//fog
-	fogLoc = glGetUniformLocation(myBasicShader.shaderProgram, "fogDensity");
-	glUniform1f(fogLoc, fogDensityValue);
-	 
-	//transparency
-	transparencyLoc = glGetUniformLocation(myBasicShader.shaderProgram, "transparency");
-	glUniform1f(transparencyLoc, transparencyLevel);
-	 
-	//skybox
-	mySkyBoxShader.useShaderProgram();
-	viewLoc = glGetUniformLocation(mySkyBoxShader.shaderProgram, "view");
-	glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-	projectionLoc = glGetUniformLocation(mySkyBoxShader.shaderProgram, "projection");
-	glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
-	 
+
+	// the camera, light and fog go to the shaders through the frame block, updated every frame
+	uniformBuffers.Init();
+}
+
+void initShadowMaps() {
+	//the overlay only holds the pinwheel petals, a quarter of the texels is plenty
+	shadowCascades.Init(2048, 1024);
 }
 
 void renderHouse(gps::Shader shader)
 {
 	shader.useShaderProgram();
 
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-	glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+	renderQueue.PushObject(gps::ObjectUniforms::Make(model, view));
 
-	house.Draw(shader);
+	house.Draw(shader, model, renderView);
 }
 
 void renderWindows(gps::Shader shader)
 {
 	shader.useShaderProgram();
-	glUniform1f(transparencyLoc, transparencyLevel);
-
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
 
-	glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+	renderQueue.PushObject(gps::ObjectUniforms::Make(model, view, transparencyLevel));
 
-	windows.Draw(shader);
-
-	glUniform1f(transparencyLoc, noTransparency);
+	windows.Draw(shader, model, renderView);
 }
 
 void renderParkScene(gps::Shader shader)
 {
     // select active shader program
     shader.useShaderProgram();
-	glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
-	normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-	glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-	glUniform3fv(lightDirLoc, 1, glm::value_ptr(glm::inverseTranspose(glm::mat3(view)) * lightDir));
-	glUniform1f(fogLoc, fogDensityValue); //call the uniform that creates the fog
-
-    //send model matrix data to shader
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
 
-    //send normal matrix data to shader
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    //send model and normal matrix data to shader
+    renderQueue.PushObject(gps::ObjectUniforms::Make(model, view));
 
-    parkScene.Draw(shader);
+    parkScene.Draw(shader, model, renderView);
 }
 
 float pinWheelRotationAngle = 0.0f;
+//turns the petals once per frame, before the shadow pass and the scene both draw them
+void updatePinWheels()
+{
+	pinWheelRotationAngle = pinWheelRotationAngle - 1;
+	modelPinwheel = glm::translate(glm::mat4(1.0f), glm::vec3(-5.51f, 0.58f, -3.38f));
+	modelPinwheel = glm::rotate(modelPinwheel, glm::radians(pinWheelRotationAngle), glm::vec3(0.0f, 0.0f, 1.0f));
+	modelPinwheel = glm::translate(modelPinwheel, glm::vec3(5.51f, -0.58f, 3.38f));
+
+	//every scattered petal turns with the first pinwheel
+	pinwheelModels.resize(pinwheelOffsets.size());
+	for (size_t i = 0; i < pinwheelOffsets.size(); i++)
+		pinwheelModels[i] = pinwheelOffsets[i] * modelPinwheel;
+}
+
 void renderPinWheel(gps::Shader shader)
 {
 	//-------------for the stick----------------------------
 	// select active shader program
 	shader.useShaderProgram();
 
-	//send pinwheel stick model matrix data to shader
-
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-	//send pinwheel stick normal matrix data to shader
-	glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+	//send pinwheel stick model and normal matrix data to shader
+	renderQueue.PushObject(gps::ObjectUniforms::Make(model, view));
 
 	//draw pinwheel stick
-	pinwheel_stick.Draw(shader);
+	pinwheel_stick.Draw(shader, model, renderView);
 
 	//--------------for the petals now----------------------
 	// select active shader program
 	shader.useShaderProgram();
 
-	//send pinwheel stick model matrix data to shader
-		//create model for pinwheel
-	pinWheelRotationAngle = pinWheelRotationAngle - 1;
-	modelPinwheel = glm::translate(glm::mat4(1.0f), glm::vec3(-5.51f, 0.58f, -3.38f));
-	modelPinwheel = glm::rotate(modelPinwheel, glm::radians(pinWheelRotationAngle), glm::vec3(0.0f, 0.0f, 1.0f));
-	modelPinwheel = glm::translate(modelPinwheel, glm::vec3(5.51f, -0.58f, 3.38f));
+	//send pinwheel petals model and normal matrix data to shader
+	renderQueue.PushObject(gps::ObjectUniforms::Make(modelPinwheel, view));
 
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(modelPinwheel));
+	//draw pinwheel stick
+	pinwheel_petals.Draw(shader, modelPinwheel, renderView);
+}
 
-	//send pinwheel stick normal matrix data to shader
-	glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+//the lamp posts and pinwheels scattered around the park; the queue has no instanced packets, so they are drawn
+//right away with the opaque instanced shader and take no part in the depth pre-pass
+void renderScatteredObjects()
+{
+	myInstancedShader.useShaderProgram();
 
-	//draw pinwheel stick
-	pinwheel_petals.Draw(shader);
+	//the lamp posts and sticks stand in the park and turn with the scene
+	uniformBuffers.PushObject(gps::ObjectUniforms::Make(model, view));
+
+	if (felinareLoaded)
+		felinare.DrawInstanced(myInstancedShader, lampPostModels);
+
+	pinwheel_stick.DrawInstanced(myInstancedShader, pinwheelOffsets);
+
+	//the petals carry their whole transform, like the original pinwheel
+	uniformBuffers.PushObject(gps::ObjectUniforms::Make(glm::mat4(1.0f), view));
+	pinwheel_petals.DrawInstanced(myInstancedShader, pinwheelModels);
 }
 
 void renderAllObjects(gps::Shader shader) {
@@ -552,24 +684,170 @@ void renderAllObjects(gps::Shader shader) {
 	modelPinwheel = glm::rotate(glm::mat4(1.0f), glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
 }
 
+//depth of the casters that never move: the park, the house, the sticks and the lamp posts
+void renderStaticCasters(gps::Shader shader, const gps::RenderView& shadowView)
+{
+	shader.useShaderProgram();
+	uniformBuffers.PushObject(gps::ObjectUniforms::Make(model, view));
+	parkScene.Draw(shader, model, shadowView);
+	house.Draw(shader, model, shadowView);
+	pinwheel_stick.Draw(shader, model, shadowView);
+
+	//the scattered copies are placed relative to the scene, so the same model turns them
+	if (felinareLoaded)
+		felinare.DrawInstanced(shader, lampPostModels);
+	pinwheel_stick.DrawInstanced(shader, pinwheelOffsets);
+}
+
+//depth of the turning petals, redrawn every frame into the overlay
+void renderDynamicCasters(gps::Shader shader, const gps::RenderView& shadowView)
+{
+	shader.useShaderProgram();
+	uniformBuffers.PushObject(gps::ObjectUniforms::Make(modelPinwheel, view));
+	pinwheel_petals.Draw(shader, modelPinwheel, shadowView);
+
+	uniformBuffers.PushObject(gps::ObjectUniforms::Make(glm::mat4(1.0f), view));
+	pinwheel_petals.DrawInstanced(shader, pinwheelModels);
+}
+
+void renderShadows()
+{
+	//the box around the static casters, turned with the scene
+	glm::vec3 worldMin(FLT_MAX), worldMax(-FLT_MAX);
+	for (int corner = 0; corner < 8; corner++) {
+		glm::vec3 point((corner & 1) ? casterMax.x : casterMin.x, (corner & 2) ? casterMax.y : casterMin.y, (corner & 4) ? casterMax.z : casterMin.z);
+		point = glm::vec3(model * glm::vec4(point, 1.0f));
+		worldMin = glm::min(worldMin, point);
+		worldMax = glm::max(worldMax, point);
+	}
+	//the same direction the shading uses
+	glm::vec3 towardsLight = lightDir;
+	WindowDimensions dimensions = myWindow.getWindowDimensions();
+	shadowCascades.Update(view, glm::radians(45.0f), (float)dimensions.width / (float)dimensions.height, 0.1f, SHADOW_DISTANCE,
+		towardsLight, worldMin, worldMax);
+	//the depth shader reads the cascade matrices from the block, so they go out before any layer is drawn
+	if (shadowCascades.TakeUniformsChanged())
+		uniformBuffers.UpdateShadows(shadowCascades.GetUniforms(true));
+
+	//levels of detail as the camera sees them, culled against each cascade, drawn right away
+	gps::RenderView shadowView = renderView;
+	shadowView.occlusion = nullptr;
+	shadowView.occlusionQueries = nullptr;
+	shadowView.queue = nullptr;
+	shadowView.alphaTestedShader = nullptr;
+	for (int cascade = 0; cascade < gps::ShadowCascades::CASCADE_COUNT; cascade++) {
+		if (!shadowCascades.IsStaticDirty(cascade))
+			continue;
+		shadowCascades.BeginStatic(cascade, myDepthMapShader);
+		shadowView.frustum = shadowCascades.GetFrustum(cascade);
+		renderStaticCasters(myDepthMapShader, shadowView);
+	}
+	for (int cascade = 0; cascade < gps::ShadowCascades::CASCADE_COUNT; cascade++) {
+		shadowCascades.BeginOverlay(cascade, myDepthMapShader);
+		shadowView.frustum = shadowCascades.GetFrustum(cascade);
+		renderDynamicCasters(myDepthMapShader, shadowView);
+	}
+	shadowCascades.End(dimensions.width, dimensions.height);
+	shadowCascades.BindTextures();
+}
+
+//every static cascade re-rendered with the overlays, the depth pass the position streams are for
+void benchmarkDepthPass()
+{
+	gps::RunDepthPassBenchmark([]() {
+		updatePinWheels();
+		shadowCascades.Invalidate();
+		renderShadows();
+	});
+}
+
 void renderScene() 
 {
+	// finish texture uploads that decoded since the last frame, within a small time budget
+	gps::TextureLoader::Instance().Update(2.0);
+	gps::RenderStats::Instance().BeginFrame();
+
+	renderView.cameraPosition = myCamera.cameraPosition;
+	renderView.frustum = myCamera.getFrustum(projection);
+	renderView.projectionScale = projection[1][1] * 0.5f * (float)myWindow.getWindowDimensions().height;
+
 	lightRotation = glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f)); 
-	myBasicShader.useShaderProgram();
-	glUniform3fv(lightDirLoc, 1, glm::value_ptr(glm::inverseTranspose(glm::mat3(view * lightRotation)) * lightDir));
+
+	//everything the shaders share for this frame, sent once
+	gps::FrameUniforms frameUniforms;
+	frameUniforms.view = view;
+	frameUniforms.projection = projection;
+	frameUniforms.lightSpaceTrMatrix = glm::mat4(1.0f);
+	//unrotated, as the park used to send it before everything else was drawn with it
+	frameUniforms.lightDir = glm::inverseTranspose(glm::mat3(view)) * lightDir;
+	frameUniforms.fogDensity = fogDensityValue;
+	frameUniforms.lightColor = lightColor;
+	frameUniforms.padding = 0.0f;
+	uniformBuffers.UpdateFrame(frameUniforms);
+
+	updatePinWheels();
+	if (shadowsEnabled)
+		renderShadows();
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	//draw the skybox
-	mySkyBox.Draw(mySkyBoxShader, view, projection);
+	mySkyBox.Draw(mySkyBoxShader);
+
+	//rasterize the occluders before any draw is submitted
+	renderView.occlusion = nullptr;
+	if (occlusionEnabled) {
+		occlusionCuller.BeginFrame(projection * view);
+		parkScene.AddOccluders(occlusionCuller, model);
+		house.AddOccluders(occlusionCuller, model);
+		occlusionCuller.Rasterize();
+		gps::RenderStats::Instance().AddOcclusionTime(occlusionCuller.GetBuildMilliseconds());
+		renderView.occlusion = &occlusionCuller;
+	}
+	renderView.occlusionQueries = nullptr;
+	if (occlusionQueriesEnabled) {
+		occlusionQueries.BeginFrame(projection * view);
+		renderView.occlusionQueries = &occlusionQueries;
+	}
 
-	//render all the objects needed for the scene
+	//the instanced props go first, outside the queue
+	renderScatteredObjects();
+
+	//render all the objects needed for the scene; the queue puts the opaque meshes front to back and the
+	//blended windows last, back to front
+	renderQueue.BeginFrame(myCamera.cameraPosition, 100.0f);
+	renderView.queue = &renderQueue;
 	renderAllObjects(myBasicShader); 
+	renderQueue.Flush(uniformBuffers);
+}
+
+//whole frames with the pre-pass off and on
+void benchmarkDepthPrepass()
+{
+	gps::RunDepthPrepassBenchmark(renderQueue, myDepthPrepassShader, []() {
+		renderScene();
+	});
 }
 
 void cleanup() {
-	glDeleteTextures(1, &depthMapTexture);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glDeleteFramebuffers(1, &shadowMapFBO);
+	// by now every texture is uploaded, so the byte counts are complete
+	gps::AssetRegistry::Instance().PrintReport();
+	gps::TextureLoader::Instance().PrintReport();
+	gps::GeometryArena::Instance().PrintReport();
+	gps::InstanceStream::Instance().PrintReport();
+	shadowCascades.PrintReport();
+	occlusionQueries.Delete();
+	//the globals would only be destroyed after the context and the singletons they release into
+	teapot.Release();
+	parkScene.Release();
+	felinare.Release();
+	house.Release();
+	windows.Release();
+	pinwheel_stick.Release();
+	pinwheel_petals.Release();
+	gps::GeometryArena::Instance().Delete();
+	gps::InstanceStream::Instance().Delete();
+	uniformBuffers.Delete();
+	shadowCascades.Delete();
 	//close GL context and any other GLFW resources
 	glfwTerminate();
 	myWindow.Delete();
@@ -737,6 +1015,7 @@ void presentation() {
 
 	//fogs.push_back(0.0f); //last and ignored
 
+	gps::RenderStats::Instance().BeginCapture();
 	while (positions.size() > 1) {
 
 		for (float i = 0.0f; i < 1.0f; i += 0.004) {
@@ -757,8 +1036,6 @@ void presentation() {
 			myCamera.cameraTarget = cameraTar;
 
 			view = myCamera.getViewMatrix();
-			myBasicShader.useShaderProgram();
-			glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 
 			renderScene();
 			glCheckError();
@@ -769,10 +1046,25 @@ void presentation() {
 		targets.erase(targets.begin());
 		fogs.erase(fogs.begin());
 	}
+	gps::RenderStats::Instance().EndCapture("Presentation");
 }
 
 int main(int argc, const char * argv[]) {
 
+	// offline benchmarks that do not need a window
+	if (argc > 1 && std::string(argv[1]) == "--bench-obj") {
+		gps::RunObjParserBenchmark();
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--bench-image") {
+		gps::RunImagePipelineBenchmark();
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--bench-occlusion") {
+		gps::RunOcclusionBenchmark();
+		return EXIT_SUCCESS;
+	}
+
     try {
         initOpenGLWindow();
     } catch (const std::exception& e) {
@@ -782,11 +1074,30 @@ int main(int argc, const char * argv[]) {
 
     initOpenGLState(); 
 	initModels(); 
+	//the skybox is loaded, the pooled pixel buffers have nothing left to serve
+	gps::ImageBufferPool::Shared().Trim();
 	initShaders(); 
 	initUniforms();  
+	initShadowMaps();
     setWindowCallbacks();  
 
 	glCheckError();
+	if (argc > 1 && std::string(argv[1]) == "--bench-depth") {
+		benchmarkDepthPass();
+		cleanup();
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--bench-prepass") {
+		benchmarkDepthPrepass();
+		cleanup();
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--bench-instancing") {
+		gps::RunInstancingBenchmark(pinwheel_petals, myBasicShader, myInstancedShader, uniformBuffers, view);
+		cleanup();
+		return EXIT_SUCCESS;
+	}
+
 	// application loop
 	while (!glfwWindowShouldClose(myWindow.getWindow())) {
         processMovement(); 
@@ -7,19 +7,40 @@ in vec4 fPosEye;
 
 out vec4 fColor;
 
-//matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat3 normalMatrix; //used to transform the normal for diffuse lighting
+//camera, light and fog, written once per frame (UniformBuffers)
+layout(std140) uniform FrameUniforms
+{
+	mat4 view;
+	mat4 projection;
+	mat4 lightSpaceTrMatrix;
+	vec3 lightDir; //towards the light, eye space
+	float fogDensity;
+	vec3 lightColor;
+};
+
+//per-object block, one ring slot per draw call group
+layout(std140) uniform ObjectUniforms
+{
+	mat4 model;
+	mat3 normalMatrix; //used to transform the normal for diffuse lighting
+	float transparency;
+};
 
-//lighting
-uniform vec3 lightDir;
-uniform vec3 lightColor;
+//cascades of the directional light's shadow maps, rewritten only when they move (ShadowCascades)
+layout(std140) uniform ShadowUniforms
+{
+	mat4 cascadeMatrices[4];
+	vec4 cascadeEnds; //eye-space distance each cascade reaches
+	vec4 cascadeBias;
+	int cascadeCount; //0 with shadows off
+};
 
 // textures
 uniform sampler2D diffuseTexture;
 uniform sampler2D specularTexture;
+//static casters, cached, and the moving ones, rendered every frame over the same cascades
+uniform sampler2DArrayShadow staticShadowMap;
+uniform sampler2DArrayShadow overlayShadowMap;
 
 //components used for lights
 //ambient light
@@ -33,10 +54,6 @@ float specularStrength = 0.5f;
 
 float shininess = 32.0f;
 
-//fog uniforms
-uniform float fogDensity;
-uniform float transparency;
-
 //use this function to compute how dense the fog should be according to the viewer's position
 float computeFog()
 {
@@ -45,6 +62,22 @@ float computeFog()
 	return clamp(fogFactor, 0.0f, 1.0f);
 }
 
+//1 where the light reaches the fragment, 0 in shadow; the filtered lookups soften the edges
+float computeShadow()
+{
+	float depth = -fPosEye.z;
+	for (int c = 0; c < cascadeCount; c++)
+	{
+		if (depth > cascadeEnds[c])
+			continue;
+		vec4 lightSpace = cascadeMatrices[c] * model * vec4(fPosition, 1.0f);
+		vec3 coords = lightSpace.xyz * 0.5f + 0.5f;
+		vec4 lookup = vec4(coords.xy, float(c), coords.z - cascadeBias[c]);
+		return min(texture(staticShadowMap, lookup), texture(overlayShadowMap, lookup));
+	}
+	return 1.0f;
+}
+
 void computeDirLight()
 {
     //compute ambient light
@@ -72,8 +105,19 @@ void computeDirLight()
 
 void main() 
 {
+#ifdef ALPHA_TEST
+    //cutouts are dropped before any lighting is paid for; the opaque permutation never discards, so it keeps early-Z
+    if (texture(diffuseTexture, fTexCoords).a < 0.1f)
+        discard;
+#endif
+
     computeDirLight();
 
+    //only the ambient part reaches shadowed fragments
+    float shadow = computeShadow();
+    diffuse *= shadow;
+    specular *= shadow;
+
     // //compute final vertex color
     // vec3 color = min((ambient + diffuse) * texture(diffuseTexture, fTexCoords).rgb + specular * texture(specularTexture, fTexCoords).rgb, 1.0f);
     ambient *= texture(diffuseTexture, fTexCoords).rgb;
@@ -88,12 +132,7 @@ void main()
     {
         float fogFactor = computeFog();
 	    vec4 fogColor = vec4(0.5f, 0.5f, 0.5f, 1.0f);
-        vec4 colorFromTexture = texture(diffuseTexture, fTexCoords);
-		if(colorFromTexture.a < 0.1)
-            discard;
-        fColor = colorFromTexture;
-		fColor = vec4(color, 1.0f);
-		fColor = vec4(vec3(fogColor * (1 - fogFactor) + vec4(color, colorFromTexture.a) * fogFactor), 1.0f);
+		fColor = vec4(fogColor.rgb * (1 - fogFactor) + color * fogFactor, 1.0f);
     }
     else
     {
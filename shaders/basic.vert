@@ -8,16 +8,53 @@ out vec3 fPosition;
 out vec3 fNormal;
 out vec2 fTexCoords;
 out vec4 fPosEye;
+//the depth pre-pass (depthPrepass.vert) has to land on the very same depths for the GL_EQUAL test
+invariant gl_Position;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+//camera, light and fog, written once per frame (UniformBuffers)
+layout(std140) uniform FrameUniforms
+{
+	mat4 view;
+	mat4 projection;
+	mat4 lightSpaceTrMatrix;
+	vec3 lightDir; //towards the light, eye space
+	float fogDensity;
+	vec3 lightColor;
+};
+
+//per-object block, one ring slot per draw call group
+layout(std140) uniform ObjectUniforms
+{
+	mat4 model;
+	mat3 normalMatrix; //used to transform the normal for diffuse lighting
+	float transparency;
+};
+
+//vertex decode, constant per mesh or fetched per draw through the base instance of a multi-draw (identity for float vertices)
+layout(location=3) in vec3 positionScale;
+layout(location=4) in vec3 positionOffset;
+layout(location=5) in float normalScale; //0 for float normals, otherwise vNormal.xy is an octahedral normal
+//copy of a repeated shape the importer folded into one mesh (identity for meshes drawn once)
+layout(location=6) in mat4 instanceModel;
+
+vec3 decodeNormal()
+{
+	if (normalScale == 0.0f)
+		return vNormal;
+	vec2 e = clamp(vNormal.xy * normalScale, -1.0f, 1.0f);
+	vec3 n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+	if (n.z < 0.0f)
+		n.xy = (1.0f - abs(n.yx)) * vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+	return normalize(n);
+}
 
 void main() 
 {
-	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
-	fPosition = vPosition;
-	fNormal = vNormal;
+	//instances only rotate and scale uniformly, so their upper 3x3 turns the normal as well
+	vec3 position = vec3(instanceModel * vec4(vPosition * positionScale + positionOffset, 1.0f));
+	gl_Position = projection * view * model * vec4(position, 1.0f);
+	fPosition = position;
+	fNormal = mat3(instanceModel) * decodeNormal();
 	fTexCoords = vTexCoords;
-	fPosEye = view * model * vec4(vPosition, 1.0f);
+	fPosEye = view * model * vec4(position, 1.0f);
 }
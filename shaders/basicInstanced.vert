@@ -0,0 +1,59 @@
+#version 410 core
+
+layout(location=0) in vec3 vPosition;
+layout(location=1) in vec3 vNormal;
+layout(location=2) in vec2 vTexCoords;
+
+out vec3 fPosition;
+out vec3 fNormal;
+out vec2 fTexCoords;
+out vec4 fPosEye;
+
+//camera, light and fog, written once per frame (UniformBuffers)
+layout(std140) uniform FrameUniforms
+{
+	mat4 view;
+	mat4 projection;
+	mat4 lightSpaceTrMatrix;
+	vec3 lightDir; //towards the light, eye space
+	float fogDensity;
+	vec3 lightColor;
+};
+
+//per-object block, one ring slot per draw call group
+layout(std140) uniform ObjectUniforms
+{
+	mat4 model;
+	mat3 normalMatrix; //used to transform the normal for diffuse lighting
+	float transparency;
+};
+
+//vertex decode, constant per mesh or fetched per draw through the base instance of a multi-draw (identity for float vertices)
+layout(location=3) in vec3 positionScale;
+layout(location=4) in vec3 positionOffset;
+layout(location=5) in float normalScale; //0 for float normals, otherwise vNormal.xy is an octahedral normal
+//per-instance transforms streamed by Model3D::DrawInstanced, applied before the model in ObjectUniforms
+layout(location=6) in mat4 instanceModel;
+layout(location=10) in mat3 instanceNormalMatrix; //inverse transpose of mat3(instanceModel), computed on the CPU
+
+vec3 decodeNormal()
+{
+	if (normalScale == 0.0f)
+		return vNormal;
+	vec2 e = clamp(vNormal.xy * normalScale, -1.0f, 1.0f);
+	vec3 n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+	if (n.z < 0.0f)
+		n.xy = (1.0f - abs(n.yx)) * vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+	return normalize(n);
+}
+
+void main() 
+{
+	//world-space position and normal; basic.frag takes the normal on to eye space with normalMatrix
+	vec3 position = vec3(instanceModel * vec4(vPosition * positionScale + positionOffset, 1.0f));
+	gl_Position = projection * view * model * vec4(position, 1.0f);
+	fPosition = position;
+	fNormal = instanceNormalMatrix * decodeNormal();
+	fTexCoords = vTexCoords;
+	fPosEye = view * model * vec4(position, 1.0f);
+}
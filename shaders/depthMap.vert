@@ -2,10 +2,33 @@
 
 layout(location=0) in vec3 vPosition;
 
-uniform mat4 lightSpaceTrMatrix;
-uniform mat4 model;
+//cascades of the directional light's shadow maps, rewritten only when they move (ShadowCascades)
+layout(std140) uniform ShadowUniforms
+{
+	mat4 cascadeMatrices[4];
+	vec4 cascadeEnds; //eye-space distance each cascade reaches
+	vec4 cascadeBias;
+	int cascadeCount; //0 with shadows off
+};
+
+//layer of the shadow map being rendered
+uniform int cascade;
+
+//per-object block, one ring slot per draw call group
+layout(std140) uniform ObjectUniforms
+{
+	mat4 model;
+	mat3 normalMatrix; //used to transform the normal for diffuse lighting
+	float transparency;
+};
+
+//vertex decode, constant per mesh or fetched per draw through the base instance of a multi-draw (identity for float vertices)
+layout(location=3) in vec3 positionScale;
+layout(location=4) in vec3 positionOffset;
+//copy of a repeated shape the importer folded into one mesh (identity for meshes drawn once)
+layout(location=6) in mat4 instanceModel;
 
 void main()
 {
-	gl_Position = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
+	gl_Position = cascadeMatrices[cascade] * model * instanceModel * vec4(vPosition * positionScale + positionOffset, 1.0f);
 }
\ No newline at end of file
@@ -0,0 +1,37 @@
+#version 410 core
+
+layout(location=0) in vec3 vPosition;
+
+//the same depths as basic.vert, to the bit, so the shading pass can test against them with GL_EQUAL
+invariant gl_Position;
+
+//camera, light and fog, written once per frame (UniformBuffers)
+layout(std140) uniform FrameUniforms
+{
+	mat4 view;
+	mat4 projection;
+	mat4 lightSpaceTrMatrix;
+	vec3 lightDir; //towards the light, eye space
+	float fogDensity;
+	vec3 lightColor;
+};
+
+//per-object block, one ring slot per draw call group
+layout(std140) uniform ObjectUniforms
+{
+	mat4 model;
+	mat3 normalMatrix; //used to transform the normal for diffuse lighting
+	float transparency;
+};
+
+//vertex decode, constant per mesh or fetched per draw through the base instance of a multi-draw (identity for float vertices)
+layout(location=3) in vec3 positionScale;
+layout(location=4) in vec3 positionOffset;
+//copy of a repeated shape the importer folded into one mesh (identity for meshes drawn once)
+layout(location=6) in mat4 instanceModel;
+
+void main()
+{
+	vec3 position = vec3(instanceModel * vec4(vPosition * positionScale + positionOffset, 1.0f));
+	gl_Position = projection * view * model * vec4(position, 1.0f);
+}
\ No newline at end of file
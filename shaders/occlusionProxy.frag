@@ -0,0 +1,9 @@
+#version 410 core
+
+out vec4 fColor;
+
+void main() 
+{    
+    // color writes are masked off, only the samples passing the depth test count
+    fColor = vec4(1.0f);
+}
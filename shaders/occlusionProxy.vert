@@ -0,0 +1,11 @@
+#version 410 core
+
+layout(location=0) in vec3 vPosition;
+
+// projection * view * model * box placement, for a unit cube
+uniform mat4 proxyMatrix;
+
+void main() 
+{
+	gl_Position = proxyMatrix * vec4(vPosition, 1.0f);
+}
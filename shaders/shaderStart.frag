@@ -10,8 +10,16 @@ out vec4 fColor;
 uniform sampler2D diffuseTexture;
 uniform sampler2D specularTexture;
 
-//lighting
-uniform	vec3 lightColor;
+//camera, light and fog, written once per frame (UniformBuffers)
+layout(std140) uniform FrameUniforms
+{
+	mat4 view;
+	mat4 projection;
+	mat4 lightSpaceTrMatrix;
+	vec3 lightDir; //towards the light, eye space
+	float fogDensity;
+	vec3 lightColor;
+};
 
 vec3 ambient;
 float ambientStrength = 0.2f;
@@ -11,11 +11,24 @@ out vec2 fragTexCoords;
 
 uniform vec4 lightPos;
 
-uniform mat4 lightSpaceTrMatrix;
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform	mat3 normalMatrix;
+//camera, light and fog, written once per frame (UniformBuffers)
+layout(std140) uniform FrameUniforms
+{
+	mat4 view;
+	mat4 projection;
+	mat4 lightSpaceTrMatrix;
+	vec3 lightDir; //towards the light, eye space
+	float fogDensity;
+	vec3 lightColor;
+};
+
+//per-object block, one ring slot per draw call group
+layout(std140) uniform ObjectUniforms
+{
+	mat4 model;
+	mat3 normalMatrix; //used to transform the normal for diffuse lighting
+	float transparency;
+};
 
 void main()
 {